@@ -4,6 +4,10 @@
  *
  * Build with: gcc -o counter counter.c
  * Be sure hbaserver is running and listening on port 8870
+ * The led writes are put in hba_basicio's async mode so each hbaset
+ * returns once its write is queued, without waiting for the ACK.  Use
+ * 'hbaset serial_fpga window 4' to keep several of them in flight on
+ * the serial link at once.  Async mode is turned off again at the end.
  */
 
 
@@ -50,6 +54,9 @@ int main()
     // XXX sndcmd(cmdfd, "hbaset serial_fpga port /dev/ttyUSB1\n");
     // XXX sleep(1);
 
+    // Queue the led writes without waiting for each ACK
+    sndcmd(cmdfd, "hbaset hba_basicio async 1\n");
+
     counter = 0;   // leds are already showing zero
 
     // Start the timer
@@ -63,12 +70,13 @@ int main()
         counter = (counter+1) % 256;
     }
 
-    // close the socket
-    close(cmdfd);
-
     // Stop the timer
     gettimeofday(&tv2, NULL);
 
+    // Have leds sets wait for the ACK again and close the socket
+    sndcmd(cmdfd, "hbaset hba_basicio async 0\n");
+    close(cmdfd);
+
     total_time = (double) (tv2.tv_usec - tv1.tv_usec) / 1000000 +
         (double) (tv2.tv_sec - tv1.tv_sec);
     printf ("Count to 1024. Time = %f seconds \n", total_time);
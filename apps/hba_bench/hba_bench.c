@@ -0,0 +1,537 @@
+/* hba_bench.c  :  End-to-end benchmarks of hbaserver and the FPGA.
+ * The tests are run over TCP the way any client would so the numbers
+ * include the daemon, the plug-ins, and the serial link.
+ *
+ *   write  : hbaset hba_basicio leds writes per second
+ *   burst  : reads per second of -b registers in one burst, by
+ *            default the first 8 registers of hba_quad.  It uses the
+ *            regs resource of serial_fpga.  More than 8 registers go
+ *            out as one extended read.
+ *   get    : latency percentiles of hbaget hba_basicio buttons
+ *   intr   : time from an hbaset of a GPIO output to the hbacat line
+ *            of the interrupt it causes.  Needs hba_gpio pin 2 wired to
+ *            pin 0.  utils/hba_emu has this loopback built in.
+ *   mixed  : writes and reads on one connection with -k subscribers
+ *            streaming 'hbacat serial_fpga rawin' at the same time
+ *
+ * Results are printed as one JSON object.  Use -c to put the link in
+ * the mode under test and -l to label the run so results of different
+ * transport modes can be compared.  The leds writes wait for each
+ * ACK unless hba_basicio is in async mode.  For example:
+ *
+ *   hba_bench -l window4 -c "hbaset serial_fpga window 4" \
+ *             -c "hbaset hba_basicio async 1" > w4.json
+ *
+ * Build with: gcc -O2 -o hba_bench hba_bench.c -lpthread
+ * Be sure hbaserver is running and listening on port 8870
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>    /* for memset */
+#include <arpa/inet.h> /* for inet_addr() */
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+
+#define MXCMD      (16)     // max number of -c setup commands
+#define MXSUB      (64)     // max number of subscribers
+#define MXRSP      (4096)   // max response length
+#define INTR_TMO   (1000)   // ms to wait for an interrupt's hbacat line
+
+typedef struct {
+    double   rate;          // operations per second
+    double   mean;          // mean latency in us
+    double   p50, p90, p99, p999, max;  // latency percentiles in us
+    int      nok;           // operations that succeeded
+    int      nerr;          // operations that got an error or no reply
+} RESULT;
+
+typedef struct {
+    pthread_t thread;
+    int      fd;            // connection streaming rawin
+    long     nbytes;        // bytes received
+    long     nlines;        // lines received
+} SUBSCRIBER;
+
+static char    *host = "127.0.0.1";
+static int      port = 8870;
+static int      niter = 1000;
+static int      nsub = 4;
+static char    *label = "";
+static char    *burst = "5:1:8";   // core:reg:count for the burst test
+static char    *setup[MXCMD];
+static int      nsetup;
+static volatile int substop;
+
+static int    hbaconnect(void);
+static int    sndcmd(int fd, char *cmd, char *rsp, int len);
+static double now_us(void);
+static void   stats(double *lat, int n, double elapsed, RESULT *pr);
+static void   json_result(char *name, RESULT *pr, int first, long subbytes);
+static void   json_str(char *str);
+static void   test_write(RESULT *pr);
+static void   test_burst(RESULT *pr);
+static void   test_get(RESULT *pr);
+static void   test_intr(RESULT *pr);
+static void   test_mixed(RESULT *pr, SUBSCRIBER *psub);
+static void  *subscriber(void *arg);
+
+int main(int argc, char *argv[])
+{
+    char    *tests = "write,burst,get,intr,mixed";
+    RESULT   res;
+    SUBSCRIBER sub[MXSUB];
+    char     rsp[MXRSP];
+    char     cmd[MXRSP];
+    int      cmdfd;
+    int      first;
+    long     subbytes;
+    int      opt;
+    int      i;
+
+    while ((opt = getopt(argc, argv, "H:p:n:k:l:c:t:b:")) != -1) {
+        switch (opt) {
+        case 'H': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'n': niter = atoi(optarg); break;
+        case 'k': nsub = atoi(optarg); break;
+        case 'l': label = optarg; break;
+        case 'c':
+            if (nsetup < MXCMD)
+                setup[nsetup++] = optarg;
+            break;
+        case 't': tests = optarg; break;
+        case 'b': burst = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [-H host] [-p port] [-n iterations] "
+                    "[-k subscribers] [-l label] [-c setup_cmd]... "
+                    "[-t write,burst,get,intr,mixed] [-b core:reg:count]\n",
+                    argv[0]);
+            exit(1);
+        }
+    }
+    if ((niter < 1) || (nsub < 0) || (nsub > MXSUB)) {
+        fprintf(stderr, "Bad iteration or subscriber count\n");
+        exit(1);
+    }
+
+    // Put the link in the mode under test
+    cmdfd = hbaconnect();
+    for (i = 0; i < nsetup; i++) {
+        snprintf(cmd, sizeof(cmd), "%s\n", setup[i]);
+        if (sndcmd(cmdfd, cmd, rsp, sizeof(rsp)) < 0) {
+            fprintf(stderr, "Setup command failed: %s", rsp);
+            exit(1);
+        }
+    }
+    close(cmdfd);
+
+    printf("{\n  \"label\": ");
+    json_str(label);
+    printf(",\n  \"iterations\": %d,\n  \"subscribers\": %d,\n"
+           "  \"burst\": ", niter, nsub);
+    json_str(burst);
+    printf(",\n  \"setup\": [");
+    for (i = 0; i < nsetup; i++) {
+        printf("%s", (i ? ", " : ""));
+        json_str(setup[i]);
+    }
+    printf("],\n  \"tests\": {");
+    first = 1;
+    if (strstr(tests, "write")) {
+        test_write(&res);
+        json_result("write", &res, first, -1);
+        first = 0;
+    }
+    if (strstr(tests, "burst")) {
+        test_burst(&res);
+        json_result("burst", &res, first, -1);
+        first = 0;
+    }
+    if (strstr(tests, "get")) {
+        test_get(&res);
+        json_result("get", &res, first, -1);
+        first = 0;
+    }
+    if (strstr(tests, "intr")) {
+        test_intr(&res);
+        json_result("intr", &res, first, -1);
+        first = 0;
+    }
+    if (strstr(tests, "mixed")) {
+        test_mixed(&res, sub);
+        subbytes = 0;
+        for (i = 0; i < nsub; i++)
+            subbytes += sub[i].nbytes;
+        json_result("mixed", &res, first, subbytes);
+        first = 0;
+    }
+    printf("\n  }\n}\n");
+    return(0);
+}
+
+
+/* test_write(): Time back to back LED writes. */
+static void test_write(RESULT *pr)
+{
+    char    cmd[99];
+    char    rsp[MXRSP];
+    double *lat;
+    double  t0, t1;
+    int     fd;
+    int     i;
+
+    fd = hbaconnect();
+    lat = malloc(niter * sizeof(double));
+    memset(pr, 0, sizeof(RESULT));
+    t0 = now_us();
+    for (i = 0; i < niter; i++) {
+        sprintf(cmd, "hbaset hba_basicio leds %02x\n", (i & 0xff));
+        t1 = now_us();
+        if (sndcmd(fd, cmd, rsp, sizeof(rsp)) < 0)
+            pr->nerr++;
+        else
+            lat[pr->nok++] = now_us() - t1;
+    }
+    stats(lat, pr->nok, now_us() - t0, pr);
+    free(lat);
+    close(fd);
+}
+
+
+/* test_burst(): Time back to back reads of the -b registers.  Each
+ * is one burst read on the serial link. */
+static void test_burst(RESULT *pr)
+{
+    char    cmd[99];
+    char    rsp[MXRSP];
+    double *lat;
+    double  t0, t1;
+    int     core, reg, count;
+    int     fd;
+    int     i;
+
+    memset(pr, 0, sizeof(RESULT));
+    if (sscanf(burst, "%d:%d:%d", &core, &reg, &count) != 3) {
+        fprintf(stderr, "Bad burst %s, skipping the burst test\n", burst);
+        pr->nerr = niter;
+        return;
+    }
+    fd = hbaconnect();
+    snprintf(cmd, sizeof(cmd), "hbaset serial_fpga regs %d %d %d\n",
+             core, reg, count);
+    if (sndcmd(fd, cmd, rsp, sizeof(rsp)) < 0) {
+        fprintf(stderr, "Unable to set the burst, skipping the burst "
+                "test: %s", rsp);
+        pr->nerr = niter;
+        close(fd);
+        return;
+    }
+    lat = malloc(niter * sizeof(double));
+    t0 = now_us();
+    for (i = 0; i < niter; i++) {
+        t1 = now_us();
+        if (sndcmd(fd, "hbaget serial_fpga regs\n", rsp, sizeof(rsp)) < 0)
+            pr->nerr++;
+        else
+            lat[pr->nok++] = now_us() - t1;
+    }
+    stats(lat, pr->nok, now_us() - t0, pr);
+    free(lat);
+    close(fd);
+}
+
+
+/* test_get(): Time single register reads.  Same as the burst test
+ * but the point here is the spread of the latency. */
+static void test_get(RESULT *pr)
+{
+    char    rsp[MXRSP];
+    double *lat;
+    double  t0, t1;
+    int     fd;
+    int     i;
+
+    fd = hbaconnect();
+    lat = malloc(niter * sizeof(double));
+    memset(pr, 0, sizeof(RESULT));
+    t0 = now_us();
+    for (i = 0; i < niter; i++) {
+        t1 = now_us();
+        if (sndcmd(fd, "hbaget hba_basicio buttons\n", rsp, sizeof(rsp)) < 0)
+            pr->nerr++;
+        else
+            lat[pr->nok++] = now_us() - t1;
+    }
+    stats(lat, pr->nok, now_us() - t0, pr);
+    free(lat);
+    close(fd);
+}
+
+
+/* test_intr(): Toggle GPIO output pin 2, which is looped back to
+ * input pin 0, and time the arrival of the hbacat line that the
+ * resulting interrupt broadcasts.  A toggle with no line within
+ * INTR_TMO ms counts as an error. */
+static void test_intr(RESULT *pr)
+{
+    char    cmd[99];
+    char    rsp[MXRSP];
+    char    c;
+    double *lat;
+    double  t0, t1;
+    struct pollfd pfd;
+    int     cmdfd;
+    int     catfd;
+    int     ret;
+    int     i;
+
+    cmdfd = hbaconnect();
+    lat = malloc(niter * sizeof(double));
+    memset(pr, 0, sizeof(RESULT));
+    if ((sndcmd(cmdfd, "hbaset hba_gpio dir c\n", rsp, sizeof(rsp)) < 0) ||
+        (sndcmd(cmdfd, "hbaset hba_gpio val 0\n", rsp, sizeof(rsp)) < 0) ||
+        (sndcmd(cmdfd, "hbaset hba_gpio intr 1\n", rsp, sizeof(rsp)) < 0)) {
+        fprintf(stderr, "No hba_gpio, skipping the intr test: %s", rsp);
+        pr->nerr = niter;
+        free(lat);
+        close(cmdfd);
+        return;
+    }
+    catfd = hbaconnect();
+    write(catfd, "hbacat hba_gpio val\n", 20);
+    usleep(100000);             // let the subscription take
+
+    t0 = now_us();
+    for (i = 0; i < niter; i++) {
+        sprintf(cmd, "hbaset hba_gpio val %x\n", ((i & 1) ? 0 : 4));
+        t1 = now_us();
+        if (sndcmd(cmdfd, cmd, rsp, sizeof(rsp)) < 0) {
+            pr->nerr++;
+            continue;
+        }
+        // Wait for the end of the broadcast line
+        pfd.fd = catfd;
+        pfd.events = POLLIN;
+        while (1) {
+            ret = poll(&pfd, 1, INTR_TMO);
+            if ((ret <= 0) || (read(catfd, &c, 1) != 1)) {
+                pr->nerr++;
+                break;
+            }
+            if (c == '\n') {
+                lat[pr->nok++] = now_us() - t1;
+                break;
+            }
+        }
+    }
+    stats(lat, pr->nok, now_us() - t0, pr);
+    (void) sndcmd(cmdfd, "hbaset hba_gpio intr 0\n", rsp, sizeof(rsp));
+    free(lat);
+    close(catfd);
+    close(cmdfd);
+}
+
+
+/* test_mixed(): Alternate LED writes and button reads while nsub
+ * other connections stream every byte the FPGA sends. */
+static void test_mixed(RESULT *pr, SUBSCRIBER *psub)
+{
+    char    cmd[99];
+    char    rsp[MXRSP];
+    double *lat;
+    double  t0, t1;
+    int     fd;
+    int     i;
+
+    substop = 0;
+    for (i = 0; i < nsub; i++) {
+        psub[i].fd = hbaconnect();
+        psub[i].nbytes = 0;
+        psub[i].nlines = 0;
+        write(psub[i].fd, "hbacat serial_fpga rawin\n", 25);
+        pthread_create(&(psub[i].thread), NULL, subscriber, &(psub[i]));
+    }
+    usleep(100000);             // let the subscriptions take
+
+    fd = hbaconnect();
+    lat = malloc(niter * sizeof(double));
+    memset(pr, 0, sizeof(RESULT));
+    t0 = now_us();
+    for (i = 0; i < niter; i++) {
+        if (i & 1)
+            sprintf(cmd, "hbaget hba_basicio buttons\n");
+        else
+            sprintf(cmd, "hbaset hba_basicio leds %02x\n", (i & 0xff));
+        t1 = now_us();
+        if (sndcmd(fd, cmd, rsp, sizeof(rsp)) < 0)
+            pr->nerr++;
+        else
+            lat[pr->nok++] = now_us() - t1;
+    }
+    stats(lat, pr->nok, now_us() - t0, pr);
+    free(lat);
+    close(fd);
+
+    substop = 1;
+    for (i = 0; i < nsub; i++) {
+        shutdown(psub[i].fd, SHUT_RDWR);
+        pthread_join(psub[i].thread, NULL);
+        close(psub[i].fd);
+    }
+}
+
+
+/* subscriber(): Count what arrives on a hbacat connection. */
+static void *subscriber(void *arg)
+{
+    SUBSCRIBER *psub = (SUBSCRIBER *) arg;
+    char    buf[MXRSP];
+    int     nrd;
+    int     i;
+
+    while (!substop) {
+        nrd = read(psub->fd, buf, sizeof(buf));
+        if (nrd <= 0)
+            break;
+        psub->nbytes += nrd;
+        for (i = 0; i < nrd; i++)
+            if (buf[i] == '\n')
+                psub->nlines++;
+    }
+    return(NULL);
+}
+
+
+/* stats(): Fill in the rate and latency percentiles of a test. */
+static int cmpdbl(const void *a, const void *b)
+{
+    double da = *(const double *) a;
+    double db = *(const double *) b;
+
+    return((da > db) - (da < db));
+}
+
+static void stats(double *lat, int n, double elapsed, RESULT *pr)
+{
+    double  sum = 0;
+    int     i;
+
+    if (n == 0)
+        return;
+    qsort(lat, n, sizeof(double), cmpdbl);
+    for (i = 0; i < n; i++)
+        sum += lat[i];
+    pr->rate = (n * 1000000.0) / elapsed;
+    pr->mean = sum / n;
+    pr->p50 = lat[(n * 50) / 100];
+    pr->p90 = lat[(n * 90) / 100];
+    pr->p99 = lat[(n * 99) / 100];
+    pr->p999 = lat[(n * 999) / 1000];
+    pr->max = lat[n - 1];
+}
+
+
+/* json_result(): Print one test's results as a JSON member.  The
+ * bytes the subscribers got are included if subbytes is not -1. */
+static void json_result(char *name, RESULT *pr, int first, long subbytes)
+{
+    printf("%s\n    \"%s\": {\"ok\": %d, \"errors\": %d, \"ops_per_sec\": %.1f, "
+           "\"mean_us\": %.1f, \"p50_us\": %.1f, \"p90_us\": %.1f, "
+           "\"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f",
+           (first ? "" : ","), name, pr->nok, pr->nerr, pr->rate, pr->mean,
+           pr->p50, pr->p90, pr->p99, pr->p999, pr->max);
+    if (subbytes >= 0)
+        printf(", \"subscriber_bytes\": %ld", subbytes);
+    printf("}");
+}
+
+
+/* json_str(): Print a string as a JSON string with the quotes,
+ * backslashes, and control characters escaped. */
+static void json_str(char *str)
+{
+    putchar('"');
+    for ( ; *str; str++) {
+        if ((*str == '"') || (*str == '\\'))
+            printf("\\%c", *str);
+        else if ((unsigned char) *str < 0x20)
+            printf("\\u%04x", (unsigned char) *str);
+        else
+            putchar(*str);
+    }
+    putchar('"');
+}
+
+
+/* hbaconnect(): Open a connection to hbaserver.  Exits on error. */
+static int hbaconnect(void)
+{
+    struct sockaddr_in skt; // network address for hbaserver
+    int  adrlen;
+    int  fd;
+    int  one = 1;
+
+    adrlen = sizeof(struct sockaddr_in);
+    (void) memset((void *) &skt, 0, (size_t) adrlen);
+    skt.sin_family = AF_INET;
+    skt.sin_port = htons(port);
+    if ((inet_aton(host, &(skt.sin_addr)) == 0) ||
+        ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) ||
+        (connect(fd, (struct sockaddr *) &skt, adrlen) < 0)) {
+        fprintf(stderr, "Error: unable to connect to hbaserver.\n");
+        exit(-1);
+    }
+    // Commands are short.  Do not let Nagle hold them.
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return(fd);
+}
+
+
+/* sndcmd():  Send a command to hbaserver and wait for the prompt
+ *     character that ends the response.  The response less the prompt
+ *     is put in rsp.  Returns the response length, or -1 if the
+ *     response is an error message or the connection went down. */
+static int sndcmd(int fd, char *cmd, char *rsp, int len)
+{
+    int    count = 0;      // number of chars in rsp
+    int    retval;         // return value of read()
+
+    if (write(fd, cmd, strlen(cmd)) != (ssize_t) strlen(cmd))
+        return(-1);
+
+    // Read until the response ends with a prompt character '\'
+    rsp[0] = 0;
+    while (1) {
+        retval = read(fd, &rsp[count], (len - 1 - count));
+        if (0 >= retval)
+            return(-1);    // did TCP conn go down?
+        count += retval;
+        if ((rsp[count - 1] == '\\') || (count == len - 1))
+            break;
+    }
+    rsp[--count] = 0;
+    if (strncmp(rsp, "ERROR", 5) == 0)
+        return(-1);
+    return(count);
+}
+
+
+/* now_us(): Return CLOCK_MONOTONIC time in microseconds. */
+static double now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((ts.tv_sec * 1000000.0) + (ts.tv_nsec / 1000.0));
+}
@@ -335,9 +335,7 @@ try:
     buttons = old_buttons = 0
 
     # Initialize Motors to Forward and Stopped...
-    hba_set( sock_motor, 'hbaset hba_motor mode cc\n' )
-    hba_set( sock_motor, 'hbaset hba_motor motor0 0\n' )
-    hba_set( sock_motor, 'hbaset hba_motor motor1 0\n' )
+    hba_set( sock_motor, 'hbaset hba_motor drive cc 0 0\n' )
     hba_set( sock_motor, 'hbaset hba_motor mode ff\n' )
 
     motor_speed_l = old_motor_speed_l = 0
@@ -463,20 +461,18 @@ try:
             hba_set( sock_motor, 'hbaset hba_motor mode cc\n' )
             old_motor_mode = 'cc'
 
-        # Update Motor Speeds...
-        if motor_speed_l != old_motor_speed_l:
-            hba_set( sock_motor, 'hbaset hba_motor motor0 %i\n' % abs(motor_speed_l) )
+        # Update Motor direction Mode and both Speeds in one step...
+        # Speeds go out as decimal digits, which hba_motor reads as hex,
+        # just as the old motor0/motor1 commands did.  Keeps the scaling.
+        if motor_mode != old_motor_mode \
+          or motor_speed_l != old_motor_speed_l \
+          or motor_speed_r != old_motor_speed_r:
+            hba_set( sock_motor, 'hbaset hba_motor drive %s %i %i\n' % (
+                motor_mode, abs(motor_speed_l), abs(motor_speed_r) ) )
+            old_motor_mode    = motor_mode
             old_motor_speed_l = motor_speed_l
-
-        if motor_speed_r != old_motor_speed_r:
-            hba_set( sock_motor, 'hbaset hba_motor motor1 %i\n' % abs(motor_speed_r) )
             old_motor_speed_r = motor_speed_r
 
-        # Update Motor direction Mode...
-        if motor_mode != old_motor_mode:
-            hba_set( sock_motor, 'hbaset hba_motor mode %s\n' % motor_mode )
-            old_motor_mode = motor_mode
-
         # Exit?...
         if buttons & GAMEPAD_HOME:
             raise KeyboardInterrupt
@@ -486,9 +482,7 @@ except KeyboardInterrupt:
     print "Stopping..."
 
     # Disable Motors...
-    hba_set( sock_motor, 'hbaset hba_motor mode cc\n' )
-    hba_set( sock_motor, 'hbaset hba_motor motor0 0\n' )
-    hba_set( sock_motor, 'hbaset hba_motor motor1 0\n' )
+    hba_set( sock_motor, 'hbaset hba_motor drive cc 0 0\n' )
 
     # Disable Leds...
     hba_set( sock_basicio, 'hbaset hba_basicio leds 0\n' )
@@ -9,48 +9,36 @@
 `hbaset hba_quad ctrl 3`
 `hbaset hba_quad reset 1`
 
-# Setup the motor
-`hbaset hba_motor mode bb`
-`hbaset hba_motor motor0 0a`    #10
-`hbaset hba_motor motor1 0a`
-`hbaset hba_motor mode ff`
+# Start the motors.  drive sets the mode and both powers in one burst.
+`hbaset hba_motor drive ff 0a 0a`    #10
 
 # Ramp up the speed
 sleep 0.2
-`hbaset hba_motor motor0 14`   #20
-`hbaset hba_motor motor1 14`
+`hbaset hba_motor drive ff 14 14`   #20
 
 sleep 0.2
-`hbaset hba_motor motor0 1e`   #30
-`hbaset hba_motor motor1 1e`
+`hbaset hba_motor drive ff 1e 1e`   #30
 
 #sleep 0.2
-#`hbaset hba_motor motor0 28`   #40
-#`hbaset hba_motor motor1 28`
+#`hbaset hba_motor drive ff 28 28`   #40
 
 #sleep 0.2
-#`hbaset hba_motor motor0 32`   #50
-#`hbaset hba_motor motor1 32`
+#`hbaset hba_motor drive ff 32 32`   #50
 
 #sleep 0.2
-#`hbaset hba_motor motor0 3c`   #60
-#`hbaset hba_motor motor1 3c`
+#`hbaset hba_motor drive ff 3c 3c`   #60
 
 #sleep 0.2
-#`hbaset hba_motor motor0 46`   #70
-#`hbaset hba_motor motor1 46`
+#`hbaset hba_motor drive ff 46 46`   #70
 
 #sleep 0.2
-#`hbaset hba_motor motor0 50`   #80
-#`hbaset hba_motor motor1 50`
+#`hbaset hba_motor drive ff 50 50`   #80
 
 #sleep 0.2
-#`hbaset hba_motor motor0 5a`   #90
-#`hbaset hba_motor motor1 5a`
+#`hbaset hba_motor drive ff 5a 5a`   #90
 
 #sleep 0.2
-#`hbaset hba_motor motor0 64`   #100
-#`hbaset hba_motor motor1 64`
+#`hbaset hba_motor drive ff 64 64`   #100
 
 # Reset the encoder
 `hbaset hba_quad reset 1`
@@ -62,5 +50,5 @@ sleep 1.0
 echo `hbaget hba_quad enc`
 
 # Stop the motors
-`hbaset hba_motor mode bb`
+`hbaset hba_motor drive bb 00 00`
 
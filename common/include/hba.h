@@ -21,6 +21,7 @@
 #ifndef HBA_H_
 #define HBA_H_
 
+#include <dlfcn.h>
 
 /***************************************************************************
  *  - Defines
@@ -49,7 +50,60 @@
 #define HBA_READ_CMD      (0x80)
 #define HBA_WRITE_CMD     (0x00)
 #define HBA_MXPKT         (16)
+#define HBA_MXBURST       (8)
+        // Extended command.  cmd[6:0] == 0x7F is followed by a core
+        // byte, the reg byte, and a length byte with 0 to 255 data bytes.
+        // Reads echo all four header bytes.  The escape is the short
+        // command for 8 bytes at core 15, so core 15 is reserved.
+#define HBA_EXT_CMD       (0x7F)
+#define HBA_IS_EXT(c)     (((c) & 0x7F) == HBA_EXT_CMD)
+#define HBA_MXBURST_EXT   (255)
+#define HBA_MXPKT_EXT     (8 + HBA_MXBURST_EXT)
 #define HBA_ACK           (0xAC)
+        // Version of the HBA_OPS table.  Bump it when the table changes.
+#define HBA_OPS_VERSION   (1)
+
+/***************************************************************************
+ *  - Data structures
+ ***************************************************************************/
+    // One packet in the vector given to sendrecv_batch().  The buffer
+    // holds the packet to send and, on return, the response.
+typedef struct
+{
+    uint8_t *buff;       // packet to send / response received
+    int      count;      // number of bytes to send
+    int      ret;        // response count or HBAERROR_xxx on return
+} HBA_PKT;
+
+    // Counters of the parent returned by the stats operation
+typedef struct
+{
+    int      baud;       // baud rate of the link
+    int      nqueued;    // transactions queued or outstanding
+    uint32_t nintr;      // interrupts for the core
+    uint32_t nunhandled; // interrupts for the core with no handler
+    uint32_t shhits;     // reads answered from the register shadow
+    uint32_t shmisses;   // reads of non-volatile registers sent to the FPGA
+    uint32_t shskips;    // writes dropped since they matched the shadow
+} HBA_STATS;
+
+    // The bus operations of the parent.  Children get the table once
+    // with hba_ops() and pass ctx as the first argument of each call.
+    // The calls work like the parent's exported routines of the same
+    // name but skip the check of the parent's slot on every packet.
+typedef struct
+{
+    int      version;    // HBA_OPS_VERSION
+    void    *ctx;        // the parent's instance
+    int    (*send)(void *ctx, int count, uint8_t *buff);
+    int    (*send_async)(void *ctx, int count, uint8_t *buff,
+                         void (*done_cb)(), void *trans);
+    int    (*send_batch)(void *ctx, int npkt, HBA_PKT *pkts);
+    void   (*reg_intr)(void *ctx, int coreid, void (*handler)(), void *trans);
+    void   (*reg_telemetry)(void *ctx, int coreid, void (*handler)(), void *trans);
+    void   (*reg_nonvolatile)(void *ctx, int coreid, int reg, int count);
+    int    (*stats)(void *ctx, int coreid, HBA_STATS *pstats);
+} HBA_OPS;
 
 /***************************************************************************
  *  - Functions
@@ -72,5 +126,29 @@ int hba_parent(){
     return 0;
 }
 
+// Bind to the bus operations of the parent.  Call once from Initialize().
+// Returns 0 if the parent is not loaded or has a different HBA_OPS_VERSION.
+HBA_OPS *hba_ops(){
+
+    extern SLOT Slots[];
+    HBA_OPS *(*getops)(int);
+    HBA_OPS *pops;
+    int      parent;
+
+    parent = hba_parent();
+    if ((Slots[parent].name == 0) || strcmp(Slots[parent].name, HBA_PARENT_NAME)) {
+        return 0;
+    }
+
+    *(void **) (&getops) = dlsym(Slots[parent].handle, "hba_get_ops");
+    pops = (getops == 0) ? (HBA_OPS *) 0 : getops(parent);
+    if ((pops == (HBA_OPS *) 0) || (pops->version != HBA_OPS_VERSION)) {
+        edlog("ERROR: %s does not have version %d bus operations.",
+              HBA_PARENT_NAME, HBA_OPS_VERSION);
+        return 0;
+    }
+    return pops;
+}
+
 #endif /*HBA_H*/
 
@@ -0,0 +1,75 @@
+/*
+ * Name: hba_shm.h
+ *
+ * Description: This file has the layout of the shared memory mirror of
+ *              the FPGA registers kept by serial_fpga.  Local programs
+ *              can map it read-only and read registers without a
+ *              request to the daemon.
+ *
+ * Copyright:   Copyright (C) 2019 by Demand Peripherals, Inc.
+ *              All rights reserved.
+ *
+ * License:     This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the Version 2 of the GNU General
+ *              Public License as published by the Free Software Foundation.
+ *              GPL2.txt in the top level directory is a copy of this license.
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *              GNU General Public License for more details.
+ *
+ */
+
+#ifndef HBA_SHM_H_
+#define HBA_SHM_H_
+
+#include <stdint.h>
+
+
+/***************************************************************************
+ *  - Defines
+ ***************************************************************************/
+        // Name given to shm_open()
+#define HBA_SHM_NAME       "/hba_regs"
+        // Set in the mirror once it is ready
+#define HBA_SHM_MAGIC      (0x48424152)
+        // Number of cores and registers per core in the mirror
+#define HBA_SHM_NCORE      16
+#define HBA_SHM_NREG       256
+
+/***************************************************************************
+ *  - Data structures
+ ***************************************************************************/
+    // The register mirror.  It has the last value read of each register.
+    // The sequence count of a core is odd while serial_fpga is updating
+    // the core's registers.
+typedef struct
+{
+    uint32_t magic;                          // HBA_SHM_MAGIC once set up
+    uint32_t seq[HBA_SHM_NCORE];             // per core sequence count
+    uint8_t  reg[HBA_SHM_NCORE][HBA_SHM_NREG]; // last value of each register
+} HBA_SHM;
+
+/***************************************************************************
+ *  - Functions
+ ***************************************************************************/
+
+// Copy count registers of core starting at reg from the mirror.  Retries
+// until it gets a copy that was not torn by an update.
+static inline void hba_shm_read(const HBA_SHM *pshm, int core, int reg,
+                                int count, uint8_t *buff)
+{
+    uint32_t seq;
+    int      i;
+
+    do {
+        while ((seq = __atomic_load_n(&(pshm->seq[core]), __ATOMIC_ACQUIRE)) & 1)
+            ;
+        for (i = 0; i < count; i++)
+            buff[i] = __atomic_load_n(&(pshm->reg[core][(reg + i) % HBA_SHM_NREG]),
+                                      __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&(pshm->seq[core]), __ATOMIC_RELAXED) != seq);
+}
+
+#endif /*HBA_SHM_H_*/
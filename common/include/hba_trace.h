@@ -0,0 +1,76 @@
+/*
+ * Name: hba_trace.h
+ *
+ * Description: This file has the layout of the packet trace capture
+ *              files written by serial_fpga.  A capture file is an
+ *              HBA_TRHDR followed by nrec HBA_TRREC records, oldest
+ *              first, in the host's byte order.
+ *
+ * Copyright:   Copyright (C) 2019 by Demand Peripherals, Inc.
+ *              All rights reserved.
+ *
+ * License:     This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the Version 2 of the GNU General
+ *              Public License as published by the Free Software Foundation.
+ *              GPL2.txt in the top level directory is a copy of this license.
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *              GNU General Public License for more details.
+ *
+ */
+
+#ifndef HBA_TRACE_H_
+#define HBA_TRACE_H_
+
+#include <stdint.h>
+
+
+/***************************************************************************
+ *  - Defines
+ ***************************************************************************/
+        // First word of a capture file
+#define HBA_TR_MAGIC       (0x54414248)
+#define HBA_TR_VERSION     (1)
+        // Number of packet bytes kept in a record.  Longer packets are
+        // cut short but len has their full length.
+#define HBA_TR_DATA        (50)
+        // Record types
+#define HBA_TR_TX          (1)      // packet put on the wire
+#define HBA_TR_RX          (2)      // response, or error, of a transaction
+#define HBA_TR_FRAME       (3)      // telemetry or snapshot frame
+#define HBA_TR_BREAK       (4)      // break sent to resync the link
+        // Record flags
+#define HBA_TR_CACHED      (0x01)   // answered from the register shadow
+#define HBA_TR_UNSENT      (0x02)   // failed before it was sent
+#define HBA_TR_RAW         (0x04)   // bytes written to the rawout resource
+        // Core of records that are not for one core
+#define HBA_TR_NOCORE      (0xff)
+
+/***************************************************************************
+ *  - Data structures
+ ***************************************************************************/
+    // Capture file header
+typedef struct
+{
+    uint32_t magic;             // HBA_TR_MAGIC
+    uint16_t version;           // HBA_TR_VERSION
+    uint16_t recsize;           // sizeof(HBA_TRREC)
+    uint32_t nrec;              // number of records in the file
+    uint32_t baud;              // baud rate of the link at the dump
+    uint64_t total;             // records made since the ring was set up
+} HBA_TRHDR;
+
+    // One trace record.  64 bytes.
+typedef struct
+{
+    uint64_t ts;                // CLOCK_MONOTONIC time in ns
+    uint16_t len;               // number of bytes in the packet or frame
+    uint8_t  type;              // HBA_TR_TX, _RX, _FRAME, or _BREAK
+    uint8_t  core;              // core of the transaction, or HBA_TR_NOCORE
+    uint8_t  flags;             // HBA_TR_CACHED, _UNSENT, or _RAW
+    int8_t   err;               // HBAERROR_xxx of a failed transaction, or 0
+    uint8_t  data[HBA_TR_DATA]; // first bytes of the packet or frame
+} HBA_TRREC;
+
+#endif /*HBA_TRACE_H_*/
@@ -7,6 +7,7 @@
  *    leds    -  value displayed on the leds (read/write)
  *    buttons -  value from the buttons (read only)
  *    intr    -  0=no button interrupts, 1=enable button interrupts (read/write)
+ *    async   -  1=leds sets return without waiting for the ACK (read/write)
  */
 
 /*
@@ -63,9 +64,11 @@
 #define FN_LEDS            "leds"
 #define FN_BUTTONS         "buttons"
 #define FN_INTR            "intr"
+#define FN_ASYNC           "async"
 #define RSC_LEDS           0
 #define RSC_BUTTONS        1
 #define RSC_INTR           2
+#define RSC_ASYNC          3
         // What we are is a ...
 #define PLUGIN_NAME        "hba_basicio"
         // Default led value is zero, all leds off
@@ -82,13 +85,13 @@
     // All state info for an instance of a BASICIO port
 typedef struct
 {
-    int      parent;   // Slot number of parent peripheral.
+    HBA_OPS *ops;      // bus operations of the parent peripheral
     int      coreid;   // FPGA core ID with this BASICIO
     void    *pslot;    // handle to plug-in's's slot info
     int      leds;     // most recent value to display on leds
     int      buttons;  // most recent button state
     int      intr;     // Change at input generates an interrupt
-    int      (*sendrecv_pkt)();  // routine to send data to the FPGA
+    int      async;    // ==1 if a leds set returns once it is queued
 } HBA_BASICIO;
 
 
@@ -98,6 +101,8 @@ typedef struct
 static void usercmd(int, int, char*, SLOT*, int, int*, char*);
 extern SLOT Slots[];
 static void core_interrupt();
+static void leds_done(void *, int, uint8_t *);
+static void buttons_done(void *, int, uint8_t *);
 
 
 /**************************************************************
@@ -108,8 +113,6 @@ int Initialize(
     SLOT *pslot)         // points to the SLOT for this plug-in
 {
     HBA_BASICIO *pctx;   // our local context
-    const char  *errmsg; // error message from dlsym
-    void        *reg_intr;  // use this to register and interrupt handler
 
     // Allocate memory for this plug-in
     pctx = (HBA_BASICIO *) malloc(sizeof(HBA_BASICIO));
@@ -120,13 +123,13 @@ int Initialize(
     }
 
     // Init our HBA_BASICIO structure
-    pctx->parent = hba_parent();       // Slot number of parent peripheral.
     pctx->coreid = HBA_BASICIO_COREID; // Immutable.
     pctx->pslot = pslot;               // this instance of a basicio
 
     pctx->leds = HBA_DEFLEDS;          // most recent from to/from port
     pctx->buttons = 0xff;              // default no buttons pussed
     pctx->intr = HBA_DEFINTR;          // default interrupt enable
+    pctx->async = 0;                   // leds sets wait for the ACK
 
     // Register name and private data
     pslot->name = PLUGIN_NAME;
@@ -153,16 +156,18 @@ int Initialize(
     pslot->rsc[RSC_INTR].pgscb = usercmd;
     pslot->rsc[RSC_INTR].uilock = -1;
     pslot->rsc[RSC_INTR].slot = pslot;
-
-    // The serial_fpga plug-in has a routine to send packets to the FPGA
-    // and to return with packet data from the FPGA.  We need to look up
-    // this, 'sendrecv_pkt', address from within serial_fpga.so.
-    // We cache the routine address so we don't need to look it up every
-    // time we want to send a packet.
-    dlerror();                  /* Clear any existing error */
-    *(void **) (&(pctx->sendrecv_pkt)) = dlsym(Slots[pctx->parent].handle, "sendrecv_pkt");
-    errmsg = dlerror();         /* check for errors */
-    if (errmsg != NULL) {
+    pslot->rsc[RSC_ASYNC].name = FN_ASYNC;
+    pslot->rsc[RSC_ASYNC].flags = IS_READABLE | IS_WRITABLE;
+    pslot->rsc[RSC_ASYNC].bkey = 0;
+    pslot->rsc[RSC_ASYNC].pgscb = usercmd;
+    pslot->rsc[RSC_ASYNC].uilock = -1;
+    pslot->rsc[RSC_ASYNC].slot = pslot;
+
+    // The serial_fpga plug-in has the routines to send packets to the
+    // FPGA and to register our handlers.  Get its table of them once
+    // here so each packet goes straight to serial_fpga.
+    pctx->ops = hba_ops();
+    if (pctx->ops == (HBA_OPS *) 0) {
         return(-1);
     }
 
@@ -172,15 +177,8 @@ int Initialize(
     // core's interrupt handler and invokes it.
     // The code below registers this core's interrupt handler with
     // serial_fpga.
-    dlerror();                  /* Clear any existing error */
-    reg_intr = dlsym(Slots[pctx->parent].handle, "register_interrupt_handler");
-    if (errmsg != NULL) {
-        return(-1);
-    }
     // Pass in the core ID of this plug-in...
-    if (reg_intr != (void *) 0) {
-        ((void (*)())reg_intr) (pctx->parent, pctx->coreid, &core_interrupt, (void *) pctx);
-    }
+    pctx->ops->reg_intr(pctx->ops->ctx, pctx->coreid, &core_interrupt, (void *) pctx);
 
 
     return (0);
@@ -204,6 +202,7 @@ void usercmd(
     // Does not make sense to set the button value
     // XXX int       nbuttons=0;   // new buttons value: for BASICIO pins
     int       nintr=0;  // new interrupt enable setting for pins
+    int       nasync=0; // new leds set mode
     int       nsd;      // number of bytes sent to FPGA
     int       ret;      // generic call return value
     uint8_t   pkt[HBA_MXPKT];  
@@ -219,7 +218,7 @@ void usercmd(
         pkt[2] = 0;                     // (cmd)
         pkt[3] = 0;                     // (reg)
         pkt[4] = 0;                     // (buttons)
-        nsd = pctx->sendrecv_pkt(pctx->parent, 5, pkt);
+        nsd = pctx->ops->send(pctx->ops->ctx, 5, pkt);
         // We sent header + one byte so the sendrecv return value should be 3
         if (nsd != 3) {
             // error reading buttons from BASICIO port
@@ -241,6 +240,19 @@ void usercmd(
         ret = snprintf(buf, *plen, "%x\n", pctx->intr);
         *plen = ret;  // (errors are handled in calling routine)
     }
+    else if ((cmd == EDGET) && (rscid == RSC_ASYNC)) {
+        ret = snprintf(buf, *plen, "%d\n", pctx->async);
+        *plen = ret;  // (errors are handled in calling routine)
+    }
+    else if ((cmd == EDSET) && (rscid == RSC_ASYNC)) {
+        ret = sscanf(val, "%d", &nasync);
+        if ((ret != 1) || (nasync < 0) || (nasync > 1)) {
+            ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
+            *plen = ret;
+            return;
+        }
+        pctx->async = nasync;
+    }
     else if ((cmd == EDSET) && (rscid == RSC_LEDS)) {
         ret = sscanf(val, "%x", &nleds);
         if ((ret != 1) || (nleds < 0) || (nleds > 0xff)) {
@@ -251,12 +263,21 @@ void usercmd(
         // record the new data value 
         pctx->leds = nleds;
 
-        // Send new value to FPGA BASICIO leds register
+        // Send new value to FPGA BASICIO leds register.  In async
+        // mode queue it without waiting for the ACK so that back to
+        // back updates can be in flight together.  The set succeeds
+        // once the write is queued and leds_done() logs a NACK or a
+        // lost reply.
         pkt[0] = HBA_WRITE_CMD | ((1 -1) << 4) | pctx->coreid;
         pkt[1] = HBA_BASICIO_REG_LEDS;
         pkt[2] = pctx->leds;                     // new value
         pkt[3] = 0;                             // dummy for the ack
-        nsd = pctx->sendrecv_pkt(pctx->parent, 4, pkt);
+        if ((pctx->async == 1) &&
+            (pctx->ops->send_async(pctx->ops->ctx, 4, pkt, leds_done, (void *) pctx) == 0)) {
+            return;
+        }
+        // Not async or could not queue it.  Send it and wait for the ACK.
+        nsd = pctx->ops->send(pctx->ops->ctx, 4, pkt);
         // We did a write so the sendrecv return value should be 1
         // and the returned byte should be an ACK
         if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
@@ -281,7 +302,7 @@ void usercmd(
         pkt[1] = HBA_BASICIO_REG_INTR;
         pkt[2] = pctx->intr;                    // new interrupt enable
         pkt[3] = 0;                             // dummy for the ack
-        nsd = pctx->sendrecv_pkt(pctx->parent, 4, pkt);
+        nsd = pctx->ops->send(pctx->ops->ctx, 4, pkt);
         // We did a write so the sendrecv return value should be 1
         // and the returned byte should be an ACK
         if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
@@ -298,17 +319,31 @@ void usercmd(
 
 
 /**************************************************************
- * core_interrupt():  - interrupt handler for this peripheral
+ * leds_done():  - completion callback for a led write queued in
+ * async mode.  The hbaset has already returned so a failure can
+ * only be logged.
+ **************************************************************/
+static void leds_done(
+    void        *trans,      // our context
+    int          nsd,        // number of bytes received
+    uint8_t     *pkt)        // the response
+{
+    // We did a write so the sendrecv return value should be 1
+    // and the returned byte should be an ACK
+    if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
+        edlog("Error writing value to basicio leds");
+    }
+}
+
+
+/**************************************************************
+ * core_interrupt():  - interrupt handler for this peripheral.
+ * Queue the read of the buttons.  buttons_done() gets the value.
  **************************************************************/
 void core_interrupt(void *trans)
 {
     HBA_BASICIO *pctx;       // this hba_gpio private info
-    SLOT        *pslot;      // This instance of the serial plug-in
-    RSC         *prsc;       // pointer to this slot's counts resource
-    int          nsd;        // number of bytes sent to FPGA
     uint8_t      pkt[HBA_MXPKT];  
-    char         msg[MX_MSGLEN * 3 +1]; // text to send.  +1 for newline
-    int          slen;       // length of text to output
 
     // get pointers to this instance of the plug-in and its slot
     pctx = (HBA_BASICIO *) trans; // transparent data is our context
@@ -321,7 +356,29 @@ void core_interrupt(void *trans)
     pkt[3] = 0;                     // dummy byte
     pkt[4] = 0;                     // dummy byte
 
-    nsd = pctx->sendrecv_pkt(pctx->parent, 5, pkt);
+    if (pctx->ops->send_async(pctx->ops->ctx, 5, pkt, buttons_done, (void *) pctx) != 0) {
+        edlog("Error reading button value from basicio");
+    }
+}
+
+
+/**************************************************************
+ * buttons_done():  - completion callback for the interrupt's
+ * read of the buttons.  Broadcast the new value.
+ **************************************************************/
+static void buttons_done(
+    void        *trans,      // our context
+    int          nsd,        // number of bytes received
+    uint8_t     *pkt)        // echoed header and the buttons
+{
+    HBA_BASICIO *pctx;       // this hba_gpio private info
+    SLOT        *pslot;      // This instance of the serial plug-in
+    RSC         *prsc;       // pointer to this slot's counts resource
+    char         msg[MX_MSGLEN * 3 +1]; // text to send.  +1 for newline
+    int          slen;       // length of text to output
+
+    pctx = (HBA_BASICIO *) trans; // transparent data is our context
+
     // We sent header + one byte so the sendrecv return value should be 3
     if (nsd != 3) {
         // error reading value from GPIO port
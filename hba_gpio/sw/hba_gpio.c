@@ -79,13 +79,12 @@
     // All state info for an instance of a GPIO port
 typedef struct
 {
-    int      parent;   // Slot number of parent peripheral.
+    HBA_OPS *ops;      // bus operations of the parent peripheral
     int      coreid;   // FPGA core ID with this GPIO
     void    *pslot;    // handle to plug-in's's slot info
     int      val;      // most recent value on gpio pins
     int      dir;      // GPIO data direction. 1==output
     int      intr;     // Change at input generates an interrupt
-    int      (*sendrecv_pkt)();  // routine to send data to the FPGA
 } HBA_GPIO;
 
 
@@ -95,6 +94,7 @@ typedef struct
 static void usercmd(int, int, char*, SLOT*, int, int*, char*);
 extern SLOT Slots[];
 static void core_interrupt();
+static void val_done(void *, int, uint8_t *);
 
 
 /**************************************************************
@@ -105,8 +105,6 @@ int Initialize(
     SLOT *pslot)            // points to the SLOT for this plug-in
 {
     HBA_GPIO *pctx;         // our local context
-    const char *errmsg;     // error message from dlsym
-    void        *reg_intr;  // use this to register and interrupt handler
 
     // Allocate memory for this plug-in
     pctx = (HBA_GPIO *) malloc(sizeof(HBA_GPIO));
@@ -117,7 +115,6 @@ int Initialize(
     }
 
     // Init our HBA_GPIO structure
-    pctx->parent = hba_parent();    // Slot number of parent peripheral.
     pctx->coreid = HBA_GPIO_COREID; // Immutable.
     pctx->pslot = pslot;            // this instance of a gpio
 
@@ -151,15 +148,11 @@ int Initialize(
     pslot->rsc[RSC_INTR].uilock = -1;
     pslot->rsc[RSC_INTR].slot = pslot;
 
-    // The serial_fpga plug-in has a routine to send packets to the FPGA
-    // and to return with packet data from the FPGA.  We need to look up
-    // this, 'sendrecv_pkt', address from within serial_fpga.so.
-    // We cache the routine address so we don't need to look it up every
-    // time we want to send a packet.
-    dlerror();                  /* Clear any existing error */
-    *(void **) (&(pctx->sendrecv_pkt)) = dlsym(Slots[pctx->parent].handle, "sendrecv_pkt");
-    errmsg = dlerror();         /* check for errors */
-    if (errmsg != NULL) {
+    // The serial_fpga plug-in has the routines to send packets to the
+    // FPGA and to register our handlers.  Get its table of them once
+    // here so each packet goes straight to serial_fpga.
+    pctx->ops = hba_ops();
+    if (pctx->ops == (HBA_OPS *) 0) {
         return(-1);
     }
 
@@ -169,15 +162,8 @@ int Initialize(
     // core's interrupt handler and invokes it.
     // The code below registers this core's interrupt handler with
     // serial_fpga.
-    dlerror();                  /* Clear any existing error */
-    reg_intr = dlsym(Slots[pctx->parent].handle, "register_interrupt_handler");
-    if (errmsg != NULL) {
-        return(-1);
-    }
     // Pass in the core ID of this plug-in...
-    if (reg_intr != (void *) 0) {
-        ((void (*)())reg_intr) (pctx->parent, pctx->coreid, &core_interrupt, (void *) pctx);
-    }
+    pctx->ops->reg_intr(pctx->ops->ctx, pctx->coreid, &core_interrupt, (void *) pctx);
 
     return (0);
 }
@@ -214,7 +200,7 @@ void usercmd(
         pkt[2] = 0;                     // (cmd)
         pkt[3] = 0;                     // (reg)
         pkt[4] = 0;                     // (gpio)
-        nsd = pctx->sendrecv_pkt(pctx->parent, 5, pkt);
+        nsd = pctx->ops->send(pctx->ops->ctx, 5, pkt);
         // We sent header + one byte so the sendrecv return value should be 3
         if (nsd != 3) {
             // error reading value from GPIO port
@@ -251,7 +237,7 @@ void usercmd(
         pkt[1] = HBA_GPIO_REG_VAL;
         pkt[2] = pctx->val;                     // new value
         pkt[3] = 0;                             // dummy for the ack
-        nsd = pctx->sendrecv_pkt(pctx->parent, 4, pkt);
+        nsd = pctx->ops->send(pctx->ops->ctx, 4, pkt);
         // We did a write so the sendrecv return value should be 1
         // and the returned byte should be an ACK
         if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
@@ -275,7 +261,7 @@ void usercmd(
         pkt[1] = HBA_GPIO_REG_DIR;
         pkt[2] = pctx->dir;                     // new direction
         pkt[3] = 0;                             // dummy for the ack
-        nsd = pctx->sendrecv_pkt(pctx->parent, 4, pkt);
+        nsd = pctx->ops->send(pctx->ops->ctx, 4, pkt);
         // We did a write so the sendrecv return value should be 1
         // and the returned byte should be an ACK
         if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
@@ -299,7 +285,7 @@ void usercmd(
         pkt[1] = HBA_GPIO_REG_INTR;
         pkt[2] = pctx->intr;                    // new interrupt enable
         pkt[3] = 0;                             // dummy for the ack
-        nsd = pctx->sendrecv_pkt(pctx->parent, 4, pkt);
+        nsd = pctx->ops->send(pctx->ops->ctx, 4, pkt);
         // We did a write so the sendrecv return value should be 1
         // and the returned byte should be an ACK
         if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
@@ -315,17 +301,13 @@ void usercmd(
 
 
 /**************************************************************
- * core_interrupt():  - interrupt handler for this peripheral
+ * core_interrupt():  - interrupt handler for this peripheral.
+ * Queue the read of the pins.  val_done() gets the value.
  **************************************************************/
 void core_interrupt(void *trans)
 {
     HBA_GPIO    *pctx;       // this peripheral's private info
-    SLOT        *pslot;      // This instance of the serial plug-in
-    RSC         *prsc;       // pointer to this slot's counts resource
-    int          nsd;        // number of bytes sent to FPGA
     uint8_t      pkt[HBA_MXPKT];  
-    char         msg[MX_MSGLEN * 3 +1]; // text to send.  +1 for newline
-    int          slen;       // length of text to output
 
     // get pointers to this instance of the plug-in and its slot
     pctx = (HBA_GPIO *) trans; // transparent data is our context
@@ -338,7 +320,29 @@ void core_interrupt(void *trans)
     pkt[3] = 0;                     // dummy byte
     pkt[4] = 0;                     // dummy byte
 
-    nsd = pctx->sendrecv_pkt(pctx->parent, 5, pkt);
+    if (pctx->ops->send_async(pctx->ops->ctx, 5, pkt, val_done, (void *) pctx) != 0) {
+        edlog("Error reading button value from gpio");
+    }
+}
+
+
+/**************************************************************
+ * val_done():  - completion callback for the interrupt's read
+ * of the pins.  Broadcast the new value.
+ **************************************************************/
+static void val_done(
+    void        *trans,      // our context
+    int          nsd,        // number of bytes received
+    uint8_t     *pkt)        // echoed header and the value
+{
+    HBA_GPIO    *pctx;       // this peripheral's private info
+    SLOT        *pslot;      // This instance of the serial plug-in
+    RSC         *prsc;       // pointer to this slot's counts resource
+    char         msg[MX_MSGLEN * 3 +1]; // text to send.  +1 for newline
+    int          slen;       // length of text to output
+
+    pctx = (HBA_GPIO *) trans; // transparent data is our context
+
     // We sent header + one byte so the sendrecv return value should be 3
     if (nsd != 3) {
         // error reading value from GPIO port
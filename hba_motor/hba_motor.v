@@ -92,6 +92,10 @@ localparam DIR_LEFT     = 2;
 localparam DIR_RIGHT    = 3;
 localparam COAST_LEFT   = 4;
 localparam COAST_RIGHT  = 5;
+localparam HOLD         = 7;
+
+localparam REG_MODE        = 0;
+localparam REG_POWER_RIGHT = 2;
 
 /*
 *****************************
@@ -104,6 +108,21 @@ wire [DBUS_WIDTH-1:0] reg_mode;         // reg0: Control register
 wire [DBUS_WIDTH-1:0] reg_power_left;   // reg1: Left Power register
 wire [DBUS_WIDTH-1:0] reg_power_right;  // reg2: Right Power register
 
+// The copies of the registers that drive the motors.  They follow
+// the register bank except while a write to reg0 with the HOLD bit
+// set is waiting for the write to reg2.  A burst of reg0 to reg2
+// then changes the mode and both powers on the same clock edge.
+reg [DBUS_WIDTH-1:0] act_mode;
+reg [DBUS_WIDTH-1:0] act_power_left;
+reg [DBUS_WIDTH-1:0] act_power_right;
+reg hold;
+
+// The reg bank raises its ack on the edge that stores a write
+wire reg_write = hba_xferack_slave & ~hba_rnw;
+wire [REG_ADDR_WIDTH-1:0] reg_addr = hba_abus[REG_ADDR_WIDTH-1:0];
+wire hold_next = (reg_write && (reg_addr == REG_MODE)) ? reg_mode[HOLD] :
+                 (reg_write && (reg_addr == REG_POWER_RIGHT)) ? 1'b0 : hold;
+
 // No interrupts
 assign slave_interrupt = 0;
 
@@ -160,10 +179,10 @@ pmw_dir #
 (
     .clk(hba_clk),
     .reset(hba_reset),
-    .en(reg_mode[EN_LEFT]),
-    .float(reg_mode[COAST_LEFT]),
-    .duty_cycle(reg_power_left[6:0]),   // [6:0]
-    .dir_in(reg_mode[DIR_LEFT]),
+    .en(act_mode[EN_LEFT]),
+    .float(act_mode[COAST_LEFT]),
+    .duty_cycle(act_power_left[6:0]),   // [6:0]
+    .dir_in(act_mode[DIR_LEFT]),
     .estop(estop_posedge),
 
     .pwm(motor_pwm[LEFT]),
@@ -179,10 +198,10 @@ pmw_dir #
 (
     .clk(hba_clk),
     .reset(hba_reset),
-    .en(reg_mode[EN_RIGHT]),
-    .float(reg_mode[COAST_RIGHT]),
-    .duty_cycle(reg_power_right[6:0]),   // [6:0]
-    .dir_in(reg_mode[DIR_RIGHT]),
+    .en(act_mode[EN_RIGHT]),
+    .float(act_mode[COAST_RIGHT]),
+    .duty_cycle(act_power_right[6:0]),   // [6:0]
+    .dir_in(act_mode[DIR_RIGHT]),
     .estop(estop_posedge),
 
     .pwm(motor_pwm[RIGHT]),
@@ -190,6 +209,24 @@ pmw_dir #
     .float_n(motor_float_n[RIGHT])
 );
 
+// Load the active registers unless a held update is in progress
+always @ (posedge hba_clk)
+begin
+    if (hba_reset) begin
+        hold <= 0;
+        act_mode <= 0;
+        act_power_left <= 0;
+        act_power_right <= 0;
+    end else begin
+        hold <= hold_next;
+        if (~hold_next) begin
+            act_mode <= reg_mode;
+            act_power_left <= reg_power_left;
+            act_power_right <= reg_power_right;
+        end
+    end
+end
+
 // Generate the estop pulses
 reg estop_reg;
 always @ (posedge hba_clk)
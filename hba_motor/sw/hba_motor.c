@@ -7,6 +7,8 @@
  *    mode    -  Set the motors modes.
  *    motor0  -  Power for motor0
  *    motor1  -  Power for motor1
+ *    drive   -  Mode and both powers in one update
+ *    async   -  1=sets return without waiting for the ACK
  */
 
 /*
@@ -37,6 +39,7 @@
  *    reg0[3] : Direction motor 1. 0=Forward, 1=Reverse
  *    reg0[4] : Coast/Float motor 0. 0=Not Coast, 1=Coast
  *    reg0[5] : Coast/Float motor 1. 0=Not Coast, 1=Coast
+ *    reg0[7] : Hold.  1=Apply reg0 to reg2 together when reg2 is written
  * reg2 : Motor 0 power and direction
  *    reg2[7:0] : Motor 0 duty cycle.  0 (stop) ... 100 (full power)
  *              Values greater than 100 are ignored.
@@ -76,14 +79,19 @@
 #define MR_REV                (8)
 #define ML_COAST              (16)
 #define MR_COAST              (32)
+#define M_HOLD                (128)
         // resource names and numbers
 #define FN_MODE           "mode"
 #define FN_MOTOR0         "motor0"
 #define FN_MOTOR1         "motor1"
+#define FN_DRIVE          "drive"
+#define FN_ASYNC          "async"
 
 #define RSC_MODE          0
 #define RSC_MOTOR0        2
 #define RSC_MOTOR1        3
+#define RSC_DRIVE         4
+#define RSC_ASYNC         5
         // What we are is a ...
 #define PLUGIN_NAME        "hba_motor"
         // Default values
@@ -101,7 +109,7 @@
     // All state info for an instance of a MOTOR port
 typedef struct
 {
-    int      parent;   // Slot number of parent peripheral.
+    HBA_OPS *ops;      // bus operations of the parent peripheral
     int      coreid;   // FPGA core ID with this MOTOR
     void    *pslot;    // handle to plug-in's's slot info
     int      mode;     // most recent value to display on mode
@@ -109,7 +117,7 @@ typedef struct
     char     r_mode;   // Right mode char
     int      motor0;   // most recent motor0 value
     int      motor1;   // most recent motor. value
-    int      (*sendrecv_pkt)();  // routine to send data to the FPGA
+    int      async;    // ==1 if a set returns once its write is queued
 } HBA_MOTOR;
 
 
@@ -118,6 +126,9 @@ typedef struct
  **************************************************************/
 static void usercmd(int, int, char*, SLOT*, int, int*, char*);
 extern SLOT Slots[];
+static int  write_regs(HBA_MOTOR *, int, int, uint8_t *);
+static int  parse_mode(char, char, int *);
+static void write_done(void *, int, uint8_t *);
 
 
 /**************************************************************
@@ -128,7 +139,6 @@ int Initialize(
     SLOT *pslot)       // points to the SLOT for this plug-in
 {
     HBA_MOTOR *pctx;  // our local context
-    const char *errmsg; // error message from dlsym
 
     // Allocate memory for this plug-in
     pctx = (HBA_MOTOR *) malloc(sizeof(HBA_MOTOR));
@@ -139,7 +149,6 @@ int Initialize(
     }
 
     // Init our HBA_MOTOR structure
-    pctx->parent = hba_parent();      // Slot number of parent peripheral.
     pctx->coreid = HBA_MOTOR_COREID;  // Immutable.
     pctx->pslot = pslot;              // this instance of a motor controller
 
@@ -148,6 +157,7 @@ int Initialize(
     pctx->r_mode =  HBA_DEFMODE_CHAR; // default mode right char
     pctx->motor0 = HBA_DEFMOTOR0;     // default motor0 value.
     pctx->motor1 = HBA_DEFMOTOR1;     // default motor1 value.
+    pctx->async = 0;                  // sets wait for the ACK
 
     // Register name and private data
     pslot->name = PLUGIN_NAME;
@@ -174,19 +184,31 @@ int Initialize(
     pslot->rsc[RSC_MOTOR1].pgscb = usercmd;
     pslot->rsc[RSC_MOTOR1].uilock = -1;
     pslot->rsc[RSC_MOTOR1].slot = pslot;
-
-    // The serial_fpga plug-in has a routine to send packets to the FPGA
-    // and to return with packet data from the FPGA.  We need to look up
-    // this, 'sendrecv_pkt', address from within serial_fpga.so.
-    // We cache the routine address so we don't need to look it up every
-    // time we want to send a packet.
-    dlerror();                  /* Clear any existing error */
-    *(void **) (&(pctx->sendrecv_pkt)) = dlsym(Slots[pctx->parent].handle, "sendrecv_pkt");
-    errmsg = dlerror();         /* check for errors */
-    if (errmsg != NULL) {
+    pslot->rsc[RSC_DRIVE].name = FN_DRIVE;
+    pslot->rsc[RSC_DRIVE].flags = IS_READABLE | IS_WRITABLE;
+    pslot->rsc[RSC_DRIVE].bkey = 0;
+    pslot->rsc[RSC_DRIVE].pgscb = usercmd;
+    pslot->rsc[RSC_DRIVE].uilock = -1;
+    pslot->rsc[RSC_DRIVE].slot = pslot;
+    pslot->rsc[RSC_ASYNC].name = FN_ASYNC;
+    pslot->rsc[RSC_ASYNC].flags = IS_READABLE | IS_WRITABLE;
+    pslot->rsc[RSC_ASYNC].bkey = 0;
+    pslot->rsc[RSC_ASYNC].pgscb = usercmd;
+    pslot->rsc[RSC_ASYNC].uilock = -1;
+    pslot->rsc[RSC_ASYNC].slot = pslot;
+
+    // The serial_fpga plug-in has the routines to send packets to the
+    // FPGA and to register our handlers.  Get its table of them once
+    // here so each packet goes straight to serial_fpga.
+    pctx->ops = hba_ops();
+    if (pctx->ops == (HBA_OPS *) 0) {
         return(-1);
     }
 
+    // Only the host changes the mode and power registers so serial_fpga
+    // can skip writes of the values they already hold.
+    pctx->ops->reg_nonvolatile(pctx->ops->ctx, pctx->coreid, HBA_MOTOR_REG_MODE, 3);
+
     return (0);
 }
 
@@ -207,9 +229,9 @@ void usercmd(
     int       nval=0;    // new value to write to reg
     char      lch;       // new left mode char
     char      rch;       // new right mode char
-    int       nsd;       // number of bytes sent to FPGA
+    int       m0, m1;    // new motor0 and motor1 values
+    uint8_t   regs[3];   // new mode, motor0, and motor1 registers
     int       ret;       // generic call return value
-    uint8_t   pkt[HBA_MXPKT];
 
     // Get this instance of the plug-in
     pctx = (HBA_MOTOR *) pslot->priv;
@@ -221,56 +243,10 @@ void usercmd(
             *plen = ret;     // errors are handled in calling routine
             return;
         }
-        nval = 0;       // next mode value, Clear all bits
-
-        // Process left mode char
-        switch (lch)
-        {
-            case 'b' : // left brake (bit0 = 0)
-                // nval =0, already brake by default
-                break;
-            case 'f' : // left forward (bit2 = 0)
-                // forward by default, just turn off brake.
-                nval = ML_EN;
-                break;
-            case 'r' : // left reverse (bit2 = 1)
-                // Reverse and Brake off
-                nval = ML_REV | ML_EN;
-                break;
-            case 'c' : // left coast (bit4 = 1)
-                // Coast and Brake off
-                nval = ML_COAST | ML_EN;
-                break;
-            default :
-                // Invalid character
-                ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
-                *plen = ret;     // errors are handled in calling routine
-                return;
-        }
-
-        // Process right mode char
-        switch (rch)
-        {
-            case 'b' : // right brake (bit1 = 0)
-                // nval =0, already brake by default
-                break;
-            case 'f' : // right forward (bit3 = 0)
-                // forward by default, just turn off brake.
-                nval = nval | MR_EN;
-                break;
-            case 'r' : // right reverse (bit3 = 1)
-                // Reverse and Brake off
-                nval = nval | MR_REV | MR_EN;
-                break;
-            case 'c' : // right coast (bit5 = 1)
-                // Coast and Brake off
-                nval = nval | MR_COAST | MR_EN;
-                break;
-            default :
-                // Invalid character
-                ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
-                *plen = ret;     // errors are handled in calling routine
-                return;
+        if (parse_mode(lch, rch, &nval) != 0) {
+            ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
+            *plen = ret;     // errors are handled in calling routine
+            return;
         }
 
         // record the new data value 
@@ -279,14 +255,8 @@ void usercmd(
         pctx->mode = nval;
 
         // Send new value to FPGA MOTOR mode register
-        pkt[0] = HBA_WRITE_CMD | ((1 -1) << 4) | pctx->coreid;
-        pkt[1] = HBA_MOTOR_REG_MODE;
-        pkt[2] = pctx->mode;                     // new value
-        pkt[3] = 0;                             // dummy for the ack
-        nsd = pctx->sendrecv_pkt(pctx->parent, 4, pkt);
-        // We did a write so the sendrecv return value should be 1
-        // and the returned byte should be an ACK
-        if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
+        regs[0] = pctx->mode;
+        if (write_regs(pctx, HBA_MOTOR_REG_MODE, 1, regs) != 0) {
             // error writing value from MOTOR port
             ret = snprintf(buf, *plen, E_NORSP, pslot->rsc[rscid].name);
             *plen = ret;     // errors are handled in calling routine
@@ -310,14 +280,8 @@ void usercmd(
         pctx->motor0 = nval;
 
         // Send new value to FPGA MOTOR motor0 register
-        pkt[0] = HBA_WRITE_CMD | ((1 -1) << 4) | pctx->coreid;
-        pkt[1] = HBA_MOTOR_REG_MOTOR0;
-        pkt[2] = pctx->motor0;                     // new value
-        pkt[3] = 0;                             // dummy for the ack
-        nsd = pctx->sendrecv_pkt(pctx->parent, 4, pkt);
-        // We did a write so the sendrecv return value should be 1
-        // and the returned byte should be an ACK
-        if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
+        regs[0] = pctx->motor0;
+        if (write_regs(pctx, HBA_MOTOR_REG_MOTOR0, 1, regs) != 0) {
             // error writing value from MOTOR port
             ret = snprintf(buf, *plen, E_NORSP, pslot->rsc[rscid].name);
             *plen = ret;     // errors are handled in calling routine
@@ -341,14 +305,8 @@ void usercmd(
         pctx->motor1 = nval;
 
         // Send new value to FPGA MOTOR motor1 register
-        pkt[0] = HBA_WRITE_CMD | ((1 -1) << 4) | pctx->coreid;
-        pkt[1] = HBA_MOTOR_REG_MOTOR1;
-        pkt[2] = pctx->motor1;                     // new value
-        pkt[3] = 0;                             // dummy for the ack
-        nsd = pctx->sendrecv_pkt(pctx->parent, 4, pkt);
-        // We did a write so the sendrecv return value should be 1
-        // and the returned byte should be an ACK
-        if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
+        regs[0] = pctx->motor1;
+        if (write_regs(pctx, HBA_MOTOR_REG_MOTOR1, 1, regs) != 0) {
             // error writing value from MOTOR port
             ret = snprintf(buf, *plen, E_NORSP, pslot->rsc[rscid].name);
             *plen = ret;     // errors are handled in calling routine
@@ -356,6 +314,46 @@ void usercmd(
     } else if ((cmd == EDGET) && (rscid == RSC_MOTOR0)) {
         ret = snprintf(buf, *plen, "%x\n", pctx->motor1);
         *plen = ret;  // (errors are handled in calling routine)
+    } else if ((cmd == EDSET) && (rscid == RSC_DRIVE)) {
+        ret = sscanf(val, " %c%c %x %x", &lch, &rch, &m0, &m1);
+        if ((ret != 4) || (parse_mode(lch, rch, &nval) != 0) ||
+            (m0 < 0) || (m0 > 0xff) || (m1 < 0) || (m1 > 0xff)) {
+            ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
+            *plen = ret;     // errors are handled in calling routine
+            return;
+        }
+        // record the new data values
+        pctx->l_mode = lch;
+        pctx->r_mode = rch;
+        pctx->mode = nval;
+        pctx->motor0 = m0;
+        pctx->motor1 = m1;
+
+        // Send all three registers as one burst.  The hold bit has the
+        // FPGA apply them together when motor1 arrives.
+        regs[0] = pctx->mode | M_HOLD;
+        regs[1] = pctx->motor0;
+        regs[2] = pctx->motor1;
+        if (write_regs(pctx, HBA_MOTOR_REG_MODE, 3, regs) != 0) {
+            // error writing value from MOTOR port
+            ret = snprintf(buf, *plen, E_NORSP, pslot->rsc[rscid].name);
+            *plen = ret;     // errors are handled in calling routine
+        }
+    } else if ((cmd == EDGET) && (rscid == RSC_DRIVE)) {
+        ret = snprintf(buf, *plen, "%c%c %x %x\n", pctx->l_mode, pctx->r_mode,
+                       pctx->motor0, pctx->motor1);
+        *plen = ret;  // (errors are handled in calling routine)
+    } else if ((cmd == EDSET) && (rscid == RSC_ASYNC)) {
+        ret = sscanf(val, "%d", &nval);
+        if ((ret != 1) || (nval < 0) || (nval > 1)) {
+            ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
+            *plen = ret;     // errors are handled in calling routine
+            return;
+        }
+        pctx->async = nval;
+    } else if ((cmd == EDGET) && (rscid == RSC_ASYNC)) {
+        ret = snprintf(buf, *plen, "%d\n", pctx->async);
+        *plen = ret;  // (errors are handled in calling routine)
     }
 
     // Nothing to do here if edcat.  That is handled in the UI code
@@ -364,4 +362,123 @@ void usercmd(
 }
 
 
+/**************************************************************
+ * parse_mode():  - Convert the left and right mode characters
+ * to a mode register value.  Returns 0 on success and -1 if
+ * either character is not one of b, f, r, or c.
+ **************************************************************/
+static int parse_mode(
+    char      lch,       // left mode char
+    char      rch,       // right mode char
+    int      *pmode)     // the mode register value on return
+{
+    int       nval;      // next mode value
+
+    nval = 0;       // next mode value, Clear all bits
+
+    // Process left mode char
+    switch (lch)
+    {
+        case 'b' : // left brake (bit0 = 0)
+            // nval =0, already brake by default
+            break;
+        case 'f' : // left forward (bit2 = 0)
+            // forward by default, just turn off brake.
+            nval = ML_EN;
+            break;
+        case 'r' : // left reverse (bit2 = 1)
+            // Reverse and Brake off
+            nval = ML_REV | ML_EN;
+            break;
+        case 'c' : // left coast (bit4 = 1)
+            // Coast and Brake off
+            nval = ML_COAST | ML_EN;
+            break;
+        default :
+            // Invalid character
+            return(-1);
+    }
+
+    // Process right mode char
+    switch (rch)
+    {
+        case 'b' : // right brake (bit1 = 0)
+            // nval =0, already brake by default
+            break;
+        case 'f' : // right forward (bit3 = 0)
+            // forward by default, just turn off brake.
+            nval = nval | MR_EN;
+            break;
+        case 'r' : // right reverse (bit3 = 1)
+            // Reverse and Brake off
+            nval = nval | MR_REV | MR_EN;
+            break;
+        case 'c' : // right coast (bit5 = 1)
+            // Coast and Brake off
+            nval = nval | MR_COAST | MR_EN;
+            break;
+        default :
+            // Invalid character
+            return(-1);
+    }
+
+    *pmode = nval;
+    return(0);
+}
+
+
+/**************************************************************
+ * write_regs():  - Write count registers starting at reg in one
+ * packet and wait for the ACK.  In async mode the write is posted
+ * so serial_fpga can merge it with writes to the neighboring motor
+ * registers.  Success then means only that it was queued and
+ * write_done() logs a NACK or a lost reply.  If it can not be
+ * queued it is sent and we wait for the ACK.
+ * Returns 0 on success and -1 on error.
+ **************************************************************/
+static int write_regs(
+    HBA_MOTOR *pctx,     // hba_motor private info
+    int       reg,       // first register to write
+    int       count,     // number of registers, 1 to 3
+    uint8_t  *vals)      // new values
+{
+    int       nsd;       // number of bytes sent to FPGA
+    uint8_t   pkt[HBA_MXPKT];
+
+    pkt[0] = HBA_WRITE_CMD | ((count -1) << 4) | pctx->coreid;
+    pkt[1] = reg;
+    (void) memcpy(&(pkt[2]), vals, count);  // new values
+    pkt[2 + count] = 0;                     // dummy for the ack
+    if ((pctx->async == 1) &&
+        (pctx->ops->send_async(pctx->ops->ctx, (3 + count), pkt, write_done, (void *) pctx) == 0)) {
+        return(0);
+    }
+    nsd = pctx->ops->send(pctx->ops->ctx, (3 + count), pkt);
+    // We did a write so the sendrecv return value should be 1
+    // and the returned byte should be an ACK
+    if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
+        return(-1);
+    }
+    return(0);
+}
+
+
+/**************************************************************
+ * write_done():  - completion callback for a write posted in async
+ * mode.  The hbaset has already returned so a failure can only be
+ * logged.
+ **************************************************************/
+static void write_done(
+    void        *trans,      // our context
+    int          nsd,        // number of bytes received
+    uint8_t     *pkt)        // the response
+{
+    // We did a write so the sendrecv return value should be 1
+    // and the returned byte should be an ACK
+    if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
+        edlog("Error writing value to motor");
+    }
+}
+
+
 // end of hba_motor.c
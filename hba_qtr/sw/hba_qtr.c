@@ -98,7 +98,7 @@
     // All state info for an instance of a QTR port
 typedef struct
 {
-    int      parent;    // Slot number of parent peripheral.
+    HBA_OPS *ops;       // bus operations of the parent peripheral
     int      coreid;    // FPGA core ID with this QTR
     void    *pslot;     // handle to plug-in's's slot info
     int      ctrl;      // most recent value to display on ctrl
@@ -106,7 +106,6 @@ typedef struct
     int      qtr1;      // most recent qtr1 value
     int      period;    // the trigger period, resolution 50ms.
     int      thresh;    // Interrupt threshold
-    int      (*sendrecv_pkt)();  // routine to send data to the FPGA
 } HBA_QTR;
 
 
@@ -116,6 +115,9 @@ typedef struct
 static void usercmd(int, int, char*, SLOT*, int, int*, char*);
 extern SLOT Slots[];
 static void core_interrupt();
+static void core_telemetry();
+static void core_update(HBA_QTR *, uint8_t *);
+static void qtr_done(void *, int, uint8_t *);
 
 
 /**************************************************************
@@ -126,8 +128,6 @@ int Initialize(
     SLOT *pslot)       // points to the SLOT for this plug-in
 {
     HBA_QTR *pctx;  // our local context
-    const char *errmsg; // error message from dlsym
-    void        *reg_intr;  // use this to register and interrupt handler
 
     // Allocate memory for this plug-in
     pctx = (HBA_QTR *) malloc(sizeof(HBA_QTR));
@@ -138,7 +138,6 @@ int Initialize(
     }
 
     // Init our HBA_QTR structure
-    pctx->parent = hba_parent();   // Slot number of parent peripheral.
     pctx->coreid = HBA_QTR_COREID; // Immutable.
     pctx->pslot = pslot;           // this instance of the qtr sensor
 
@@ -183,15 +182,11 @@ int Initialize(
     pslot->rsc[RSC_THRESH].pgscb = usercmd;
     pslot->rsc[RSC_THRESH].uilock = -1;
 
-    // The serial_fpga plug-in has a routine to send packets to the FPGA
-    // and to return with packet data from the FPGA.  We need to look up
-    // this, 'sendrecv_pkt', address from within serial_fpga.so.
-    // We cache the routine address so we don't need to look it up every
-    // time we want to send a packet.
-    dlerror();                  /* Clear any existing error */
-    *(void **) (&(pctx->sendrecv_pkt)) = dlsym(Slots[pctx->parent].handle, "sendrecv_pkt");
-    errmsg = dlerror();         /* check for errors */
-    if (errmsg != NULL) {
+    // The serial_fpga plug-in has the routines to send packets to the
+    // FPGA and to register our handlers.  Get its table of them once
+    // here so each packet goes straight to serial_fpga.
+    pctx->ops = hba_ops();
+    if (pctx->ops == (HBA_OPS *) 0) {
         return(-1);
     }
 
@@ -201,15 +196,12 @@ int Initialize(
     // core's interrupt handler and invokes it.
     // The code below registers this core's interrupt handler with
     // serial_fpga.
-    dlerror();                  /* Clear any existing error */
-    reg_intr = dlsym(Slots[pctx->parent].handle, "register_interrupt_handler");
-    if (errmsg != NULL) {
-        return(-1);
-    }
     // Pass in the core ID of this plug-in...
-    if (reg_intr != (void *) 0) {
-        ((void (*)())reg_intr) (pctx->parent, pctx->coreid, &core_interrupt, (void *) pctx);
-    }
+    pctx->ops->reg_intr(pctx->ops->ctx, pctx->coreid, &core_interrupt, (void *) pctx);
+
+    // serial_fpga can also send our registers in telemetry frames.
+    // Register the routine that takes them.
+    pctx->ops->reg_telemetry(pctx->ops->ctx, pctx->coreid, &core_telemetry, (void *) pctx);
 
     return (0);
 }
@@ -256,7 +248,7 @@ void usercmd(
         pkt[1] = HBA_QTR_REG_CTRL;
         pkt[2] = pctx->ctrl;                     // new value
         pkt[3] = 0;                             // dummy for the ack
-        nsd = pctx->sendrecv_pkt(pctx->parent, 4, pkt);
+        nsd = pctx->ops->send(pctx->ops->ctx, 4, pkt);
         // We did a write so the sendrecv return value should be 1
         // and the returned byte should be an ACK
         if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
@@ -275,7 +267,7 @@ void usercmd(
         pkt[3] = 0;                     // (reg)
         pkt[4] = 0;                     // (qtr0)
         pkt[5] = 0;                     // (qtr1)
-        nsd = pctx->sendrecv_pkt(pctx->parent, 6, pkt);
+        nsd = pctx->ops->send(pctx->ops->ctx, 6, pkt);
         // We sent header + two bytes so the sendrecv return value should be 4
         if (nsd != 4) {
             // error reading qtr0 from QTR port
@@ -310,7 +302,7 @@ void usercmd(
         pkt[1] = HBA_QTR_REG_PERIOD;
         pkt[2] = pctx->period;                     // new value
         pkt[3] = 0;                             // dummy for the ack
-        nsd = pctx->sendrecv_pkt(pctx->parent, 4, pkt);
+        nsd = pctx->ops->send(pctx->ops->ctx, 4, pkt);
         // We did a write so the sendrecv return value should be 1
         // and the returned byte should be an ACK
         if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
@@ -341,7 +333,7 @@ void usercmd(
         pkt[1] = HBA_QTR_REG_THRESH;
         pkt[2] = pctx->thresh;                     // new value
         pkt[3] = 0;                                // dummy for the ack
-        nsd = pctx->sendrecv_pkt(pctx->parent, 4, pkt);
+        nsd = pctx->ops->send(pctx->ops->ctx, 4, pkt);
         // We did a write so the sendrecv return value should be 1
         // and the returned byte should be an ACK
         if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
@@ -361,19 +353,13 @@ void usercmd(
 
 
 /**************************************************************
- * core_interrupt():  - interrupt handler for this peripheral
+ * core_interrupt():  - interrupt handler for this peripheral.
+ * Queue the read of the qtr registers.  qtr_done() gets the values.
  **************************************************************/
 void core_interrupt(void *trans)
 {
     HBA_QTR     *pctx;       // this peripheral's private info
-    SLOT        *pslot;      // This instance of the serial plug-in
-    RSC         *prsc;       // pointer to this slot's counts resource
-    int          nsd;        // number of bytes sent to FPGA
     uint8_t      pkt[HBA_MXPKT];  
-    char         msg[MX_MSGLEN * 3 +1]; // text to send.  +1 for newline
-    int          slen;       // length of text to output
-    int          newqtr0;
-    int          newqtr1;
 
     // get pointers to this instance of the plug-in and its slot
     pctx = (HBA_QTR *) trans; // transparent data is our context
@@ -387,15 +373,64 @@ void core_interrupt(void *trans)
     pkt[4] = 0;                     // dummy byte (qtr0)
     pkt[5] = 0;                     // dummy byte (qtr1)
 
-    nsd = pctx->sendrecv_pkt(pctx->parent, 6, pkt);
-    // We sent header + four bytes so the sendrecv return value should be 4
+    if (pctx->ops->send_async(pctx->ops->ctx, 6, pkt, qtr_done, (void *) pctx) != 0) {
+        edlog("Error reading values from QTR");
+    }
+}
+
+
+/**************************************************************
+ * qtr_done():  - completion callback for the interrupt's read
+ * of the qtr registers.
+ **************************************************************/
+static void qtr_done(
+    void        *trans,      // our context
+    int          nsd,        // number of bytes received
+    uint8_t     *pkt)        // echoed header and the registers
+{
+    // We sent header + two bytes so the sendrecv return value should be 4
     if (nsd != 4) {
-        // error reading value from QTR port
         edlog("Error reading values from QTR");
         return;
     }
-    newqtr0 = pkt[2];   // first two bytes are echo of header
-    newqtr1 = pkt[3];   // first two bytes are echo of header
+    core_update((HBA_QTR *) trans, &(pkt[2]));     // first two bytes are echo of header
+}
+
+
+/**************************************************************
+ * core_telemetry():  - telemetry handler for this peripheral.
+ * Takes the two qtr registers from a telemetry frame if the
+ * frame has both of them.
+ **************************************************************/
+void core_telemetry(
+    void        *trans,      // our context
+    int          reg,        // first register in data
+    int          count,      // number of registers in data
+    uint8_t     *data)       // the register values
+{
+    if ((reg == HBA_QTR_REG_QTR0) && (count >= 2)) {
+        core_update((HBA_QTR *) trans, data);
+    }
+}
+
+
+/**************************************************************
+ * core_update():  - Record new qtr values and broadcast them
+ * if they changed.  The data is the qtr0 and qtr1 registers.
+ **************************************************************/
+static void core_update(
+    HBA_QTR     *pctx,       // this peripheral's private info
+    uint8_t     *data)       // registers qtr0 and qtr1
+{
+    SLOT        *pslot;      // This instance of the serial plug-in
+    RSC         *prsc;       // pointer to this slot's counts resource
+    char         msg[MX_MSGLEN * 3 +1]; // text to send.  +1 for newline
+    int          slen;       // length of text to output
+    int          newqtr0;
+    int          newqtr1;
+
+    newqtr0 = data[0];
+    newqtr1 = data[1];
 
     // Broadcast qtr if it's changed and if any UI is monitoring it
     pslot = pctx->pslot;
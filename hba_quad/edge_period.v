@@ -0,0 +1,114 @@
+/*
+*****************************
+* MODULE : edge_period.v
+*
+* This module times the clocks between encoder edges.
+* The period is the time between the last two edges
+* or, if longer, the time since the last edge so it
+* grows while the wheel slows to a stop.  It holds at
+* all ones when the wheel is stopped or has just
+* changed direction.  rev is set if the last edge
+* was not in the FWD direction.
+*
+* Status: Not yet simulated or run in hardware.  The
+*         emulator in utils/hba_emu.c models it.
+*
+* Create Date: 10/17/2026
+*
+*****************************
+*/
+
+/*
+*****************************
+*
+* Copyright (C) 2026 by Brandon Blodget <brandon.blodget@gmail.com>
+* All rights reserved.
+*
+* License:
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+*****************************
+*/
+
+// Force error when implicit net has no type.
+`default_nettype none
+
+module edge_period #
+(
+    parameter integer FWD = 1,
+    parameter integer WIDTH = 24
+)
+(
+    input wire clk,
+    input wire reset,
+
+    input wire pulse_in,
+    input wire dir_in,
+
+    output wire [WIDTH-1:0] period,  // clocks per edge
+    output reg rev                   // last edge was backwards
+);
+
+/*
+********************************************
+* Signals
+********************************************
+*/
+
+localparam [WIDTH-1:0] PERIOD_MAX = {WIDTH{1'b1}};
+
+// Register the pulse_in to find edges
+reg pulse_in_reg;
+
+wire pulse_edge;
+assign pulse_edge = pulse_in != pulse_in_reg;
+
+reg [WIDTH-1:0] since;      // clocks since the last edge
+reg [WIDTH-1:0] last;       // clocks between the last two edges
+
+assign period = (since > last) ? since : last;
+
+/*
+********************************************
+* Main
+********************************************
+*/
+
+always @ (posedge clk)
+begin
+    if (reset) begin
+        pulse_in_reg <= 0;
+    end else begin
+        pulse_in_reg <= pulse_in;
+    end
+end
+
+always @ (posedge clk)
+begin
+    if (reset) begin
+        since <= PERIOD_MAX;
+        last <= PERIOD_MAX;
+        rev <= 0;
+    end else begin
+        if (pulse_edge) begin
+            // There is no period across a change of direction
+            last <= (rev == (dir_in != FWD)) ? since : PERIOD_MAX;
+            rev <= (dir_in != FWD);
+            since <= 1;
+        end else if (since != PERIOD_MAX) begin
+            since <= since + 1;
+        end
+    end
+end
+
+endmodule
+
@@ -7,11 +7,17 @@
 * quatrature encoders.  This module senses the direction
 * and increments or decrements the encoder count as appropriate.
 * Each encoder count is a 16-bit value, stored in two
-* 8-bit registers.  It is recommended to disable the encoder
-* updates before reading the encoder values.  Then re-enable
-* encoder updates after the values are read.  The encoder
-* counts will still be updated internally only the updating
-* to the register bank is disabled.
+* 8-bit registers.  A read of reg1 latches both encoder
+* counts and both speeds into the register bank at once.
+* Reads of reg2 to reg6 return the latched values so a
+* burst read starting at reg1 is consistent.  The encoder
+* counts are always updated internally.
+* Each encoder also has a 24-bit period, the hba_clk
+* cycles between its last two edges.  A read of reg8
+* latches both periods and their directions the same way.
+* A block RAM FIFO takes a sample of a ms timestamp and
+* both counts every reg15 ms.  Reads of reg32 and up
+* drain it.  It can interrupt when it has reg17 samples.
 *
 * See the README.md for information about the register interface.
 *
@@ -91,6 +97,11 @@ module hba_quad #
 localparam LEFT     = 0;
 localparam RIGHT    = 1;
 
+// A read of this register latches the counts and speeds
+localparam REG_LATCH = 1;
+// A read of this register latches the periods
+localparam REG_PERIOD_LATCH = 8;
+
 // Define the bank of registers
 wire [DBUS_WIDTH-1:0] reg_ctrl;  // reg0: Control register
 
@@ -100,9 +111,16 @@ wire [DBUS_WIDTH-1:0] reg_quad0_hi_in;  // reg2: Upper 8-bit of quad0
 wire [DBUS_WIDTH-1:0] reg_quad1_low_in; // reg3: Lower 8-bits of quad1
 wire [DBUS_WIDTH-1:0] reg_quad1_hi_in;  // reg4: Upper 8-bit of quad1
 
+wire [23:0] left_period;    // reg8-10: hba_clk cycles per left edge
+wire [23:0] right_period;   // reg11-13: hba_clk cycles per right edge
+wire left_rev;              // reg14[0]: last left edge was backwards
+wire right_rev;             // reg14[1]: last right edge was backwards
+wire [7:0] reg_sample_ms;   // reg15: ms between FIFO samples, 0=off
+
 
 // Enables writing to slave registers.
 wire slv_wr_en;
+wire period_wr_en;
 
 // Indicates new quadrature data
 wire [1:0] quad_valid;
@@ -110,8 +128,25 @@ wire [1:0] quad_valid;
 // Enable interrupt bit
 wire intr_en = reg_ctrl[2];
 
-assign slave_interrupt = (|quad_valid) & intr_en;
-assign slv_wr_en = |quad_valid;
+// Sample FIFO reached its watermark
+wire fifo_intr;
+
+assign slave_interrupt = ((|quad_valid) & intr_en) | fifo_intr;
+
+// Latch on the first clock of a read of REG_LATCH.  The register
+// bank has the new values before it answers the read.
+wire [PERIPH_ADDR_WIDTH-1:0] periph_addr =
+    hba_abus[ADDR_WIDTH-1:ADDR_WIDTH-PERIPH_ADDR_WIDTH];
+wire [REG_ADDR_WIDTH-1:0] reg_addr = hba_abus[REG_ADDR_WIDTH-1:0];
+wire latch_hit = hba_select & hba_rnw & (periph_addr == PERIPH_ADDR) &
+                 (reg_addr == REG_LATCH);
+reg latch_hit2;
+assign slv_wr_en = latch_hit & ~latch_hit2;
+
+wire period_hit = hba_select & hba_rnw & (periph_addr == PERIPH_ADDR) &
+                  (reg_addr == REG_PERIOD_LATCH);
+reg period_hit2;
+assign period_wr_en = period_hit & ~period_hit2;
 
 wire quad0_en;
 assign quad0_en = reg_ctrl[0];
@@ -137,15 +172,34 @@ wire right_dir;
 wire [DBUS_WIDTH-1:0] hba_dbus_slave1;
 wire hba_xferack_slave1;
 
-// Combine the two address banks.
-assign hba_dbus_slave = hba_dbus_slave0 | hba_dbus_slave1;
-assign hba_xferack_slave = hba_xferack_slave0 | hba_xferack_slave1;
+// Periods
+wire [DBUS_WIDTH-1:0] hba_dbus_slave2;
+wire hba_xferack_slave2;
+wire [DBUS_WIDTH-1:0] hba_dbus_slave3;
+wire hba_xferack_slave3;
+
+// Sample FIFO
+wire [DBUS_WIDTH-1:0] hba_dbus_slave4;
+wire hba_xferack_slave4;
+
+// Combine the four address banks and the FIFO.
+assign hba_dbus_slave = hba_dbus_slave0 | hba_dbus_slave1 |
+                        hba_dbus_slave2 | hba_dbus_slave3 |
+                        hba_dbus_slave4;
+assign hba_xferack_slave = hba_xferack_slave0 | hba_xferack_slave1 |
+                           hba_xferack_slave2 | hba_xferack_slave3 |
+                           hba_xferack_slave4;
 
 wire enc_reset = hba_reset | reg_reset_pos_edge;
 
 // Timer pulse
 wire [7:0] reg_rate_ms;
 
+// Sample timing
+wire ms_pulse;
+wire sample_pulse;
+reg [15:0] timestamp;       // ms, wraps
+
 /*
 *****************************
 * Instantiation
@@ -185,7 +239,8 @@ hba_reg_bank #
     .slv_reg3_in(reg_quad1_low_in),
 
     .slv_wr_en(slv_wr_en),   // Assert to set slv_reg? <= slv_reg?_in
-    .slv_wr_mask(4'b1110),    // reg 1,2,3 writable by this module
+    // reg 1,2,3 writable by this module if their encoder is enabled
+    .slv_wr_mask({quad1_en, quad0_en, quad0_en, 1'b0}),
     .slv_autoclr_mask(4'b0000)    // No autoclear
 );
 
@@ -224,7 +279,79 @@ hba_reg_bank #
     //.slv_reg3_in(),
 
     .slv_wr_en(slv_wr_en),   // Assert to set slv_reg? <= slv_reg?_in
-    .slv_wr_mask(4'b0111),    // reg0,1,2 writable by this module
+    // reg0 writable by this module if its encoder is enabled, reg1,2 always
+    .slv_wr_mask({1'b0, 1'b1, 1'b1, quad1_en}),
+    .slv_autoclr_mask(4'b0000)    // no autoclear
+);
+
+hba_reg_bank #
+(
+    .DBUS_WIDTH(DBUS_WIDTH),
+    .PERIPH_ADDR_WIDTH(PERIPH_ADDR_WIDTH),
+    .REG_ADDR_WIDTH(REG_ADDR_WIDTH),
+    .PERIPH_ADDR(PERIPH_ADDR),
+    .REG_OFFSET(8)
+) hba_reg_bank_inst2
+(
+    // HBA Bus Slave Interface
+    .hba_clk(hba_clk),
+    .hba_reset(hba_reset),
+    .hba_rnw(hba_rnw),         // 1=Read from register. 0=Write to register.
+    .hba_select(hba_select),      // Transfer in progress.
+    .hba_abus(hba_abus), // The input address bus.
+    .hba_dbus(hba_dbus),  // The input data bus.
+
+    .hba_dbus_slave(hba_dbus_slave2),   // The output data bus.
+    .hba_xferack_slave(hba_xferack_slave2),     // Acknowledge transfer requested. 
+                                    // Asserted when request has been completed. 
+                                    // Must be zero when inactive.
+
+    // writeable registers
+    .slv_reg0_in(left_period[7:0]),     // reg8
+    .slv_reg1_in(left_period[15:8]),    // reg9
+    .slv_reg2_in(left_period[23:16]),   // reg10
+    .slv_reg3_in(right_period[7:0]),    // reg11
+
+    .slv_wr_en(period_wr_en),   // Assert to set slv_reg? <= slv_reg?_in
+    // writable by this module if their encoder is enabled
+    .slv_wr_mask({quad1_en, quad0_en, quad0_en, quad0_en}),
+    .slv_autoclr_mask(4'b0000)    // no autoclear
+);
+
+hba_reg_bank #
+(
+    .DBUS_WIDTH(DBUS_WIDTH),
+    .PERIPH_ADDR_WIDTH(PERIPH_ADDR_WIDTH),
+    .REG_ADDR_WIDTH(REG_ADDR_WIDTH),
+    .PERIPH_ADDR(PERIPH_ADDR),
+    .REG_OFFSET(12)
+) hba_reg_bank_inst3
+(
+    // HBA Bus Slave Interface
+    .hba_clk(hba_clk),
+    .hba_reset(hba_reset),
+    .hba_rnw(hba_rnw),         // 1=Read from register. 0=Write to register.
+    .hba_select(hba_select),      // Transfer in progress.
+    .hba_abus(hba_abus), // The input address bus.
+    .hba_dbus(hba_dbus),  // The input data bus.
+
+    .hba_dbus_slave(hba_dbus_slave3),   // The output data bus.
+    .hba_xferack_slave(hba_xferack_slave3),     // Acknowledge transfer requested. 
+                                    // Asserted when request has been completed. 
+                                    // Must be zero when inactive.
+
+    // Access to registgers
+    .slv_reg3(reg_sample_ms), // reg15
+
+    // writeable registers
+    .slv_reg0_in(right_period[15:8]),   // reg12
+    .slv_reg1_in(right_period[23:16]),  // reg13
+    .slv_reg2_in({6'b0, right_rev, left_rev}), // reg14
+    //.slv_reg3_in(),
+
+    .slv_wr_en(period_wr_en),   // Assert to set slv_reg? <= slv_reg?_in
+    // reg0,1 writable by this module if its encoder is enabled, reg2 always
+    .slv_wr_mask({1'b0, 1'b1, quad1_en, quad1_en}),
     .slv_autoclr_mask(4'b0000)    // no autoclear
 );
 
@@ -261,6 +388,22 @@ pulse_counter #
     .valid(quad_valid[LEFT])
 );
 
+edge_period #
+(
+    .FWD(1),
+    .WIDTH(24)
+) left_period_inst
+(
+    .clk(hba_clk),
+    .reset(enc_reset),
+
+    .pulse_in(left_pulse),
+    .dir_in(left_dir),
+
+    .period(left_period),   // [23:0]
+    .rev(left_rev)
+);
+
 quadrature right_quad_inst
 (
     .clk(hba_clk),
@@ -294,6 +437,22 @@ pulse_counter #
     .valid(quad_valid[RIGHT])
 );
 
+edge_period #
+(
+    .FWD(1),
+    .WIDTH(24)
+) right_period_inst
+(
+    .clk(hba_clk),
+    .reset(enc_reset),
+
+    .pulse_in(right_pulse),
+    .dir_in(right_dir),
+
+    .period(right_period),   // [23:0]
+    .rev(right_rev)
+);
+
 timer_pulse #
 (
     .CLK_FREQUENCY(CLK_FREQUENCY)
@@ -306,6 +465,62 @@ timer_pulse #
     .pulse(quad_speed_pulse)
 );
 
+timer_pulse #
+(
+    .CLK_FREQUENCY(CLK_FREQUENCY)
+) ms_pulse_inst
+(
+    .clk(hba_clk),
+    .reset(hba_reset),
+    .rate_ms(8'd1),
+
+    .pulse(ms_pulse)
+);
+
+timer_pulse #
+(
+    .CLK_FREQUENCY(CLK_FREQUENCY)
+) sample_pulse_inst
+(
+    .clk(hba_clk),
+    .reset(hba_reset),
+    .rate_ms(reg_sample_ms),    // [7:0]
+
+    .pulse(sample_pulse)
+);
+
+sample_fifo #
+(
+    .DBUS_WIDTH(DBUS_WIDTH),
+    .PERIPH_ADDR_WIDTH(PERIPH_ADDR_WIDTH),
+    .REG_ADDR_WIDTH(REG_ADDR_WIDTH),
+    .PERIPH_ADDR(PERIPH_ADDR),
+    .REG_COUNT(16),
+    .REG_DATA(32),
+    .FIFO_ADDR_WIDTH(7)
+) sample_fifo_inst
+(
+    // HBA Bus Slave Interface
+    .hba_clk(hba_clk),
+    .hba_reset(hba_reset),
+    .hba_rnw(hba_rnw),         // 1=Read from register. 0=Write to register.
+    .hba_select(hba_select),      // Transfer in progress.
+    .hba_abus(hba_abus), // The input address bus.
+    .hba_dbus(hba_dbus),  // The input data bus.
+
+    .hba_dbus_slave(hba_dbus_slave4),   // The output data bus.
+    .hba_xferack_slave(hba_xferack_slave4),     // Acknowledge transfer requested. 
+                                    // Asserted when request has been completed. 
+                                    // Must be zero when inactive.
+
+    .sample_pulse(sample_pulse),
+    .timestamp(timestamp),
+    .enc0({reg_quad0_hi_in[7:0], reg_quad0_low_in[7:0]}),
+    .enc1({reg_quad1_hi_in[7:0], reg_quad1_low_in[7:0]}),
+
+    .intr(fifo_intr)
+);
+
 /*
 *****************************
 * Main
@@ -325,6 +540,28 @@ begin
     end
 end
 
+// ms timestamp of the FIFO samples
+always @ (posedge hba_clk)
+begin
+    if (hba_reset) begin
+        timestamp <= 0;
+    end else if (ms_pulse) begin
+        timestamp <= timestamp + 1;
+    end
+end
+
+// One latch per read of REG_LATCH or REG_PERIOD_LATCH
+always @ (posedge hba_clk)
+begin
+    if (hba_reset) begin
+        latch_hit2 <= 0;
+        period_hit2 <= 0;
+    end else begin
+        latch_hit2 <= latch_hit;
+        period_hit2 <= period_hit;
+    end
+end
+
 endmodule
 
 
@@ -0,0 +1,296 @@
+/*
+*****************************
+* MODULE : sample_fifo.v
+*
+* This module is a HBA (HomeBrew Automation) bus peripheral.
+* It keeps a block RAM FIFO of encoder samples.  Each
+* sample_pulse pushes a six byte sample of the timestamp
+* and the two encoder counts.  It shares its peripheral
+* address with hba_quad and answers only these registers.
+*
+* REG_COUNT   : Number of whole samples in the FIFO.
+* REG_COUNT+1 : Watermark.  intr pulses when the count
+*               reaches it.  0 for no interrupt.
+* REG_COUNT+2 : Samples dropped because the FIFO was
+*               full.  Stops at 255.  Write to clear.
+* REG_DATA up : Each read returns the next byte of the
+*               oldest sample.  The sample is removed
+*               after its sixth byte.  Reads of an empty
+*               FIFO return 0.  Since the bus increments
+*               the register address, one long read that
+*               starts at REG_DATA drains many samples.
+*
+* The bytes of a sample are the timestamp, enc0, and
+* enc1, each least significant byte first.
+*
+* Any read of REG_DATA and up removes data, so telemetry
+* and snapshot pairs of this core must end below it.
+*
+* Status: Not yet simulated or run in hardware.  The
+*         emulator in utils/hba_emu.c models it.
+*
+* Create Date: 10/17/2026
+*
+*****************************
+*/
+
+/*
+*****************************
+*
+* Copyright (C) 2026 by Brandon Blodget <brandon.blodget@gmail.com>
+* All rights reserved.
+*
+* License:
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+*****************************
+*/
+
+// Force error when implicit net has no type.
+`default_nettype none
+
+module sample_fifo #
+(
+    parameter integer DBUS_WIDTH = 8,
+    parameter integer PERIPH_ADDR_WIDTH = 4,
+    parameter integer REG_ADDR_WIDTH = 8,
+    parameter integer ADDR_WIDTH = PERIPH_ADDR_WIDTH + REG_ADDR_WIDTH,
+    parameter integer PERIPH_ADDR = 0,
+    parameter integer REG_COUNT = 16,
+    parameter integer REG_DATA = 32,
+    // 2**FIFO_ADDR_WIDTH samples.  At most 7 so the count fits a register.
+    parameter integer FIFO_ADDR_WIDTH = 7
+)
+(
+    // HBA Bus Slave Interface
+    input wire hba_clk,
+    input wire hba_reset,
+    input wire hba_rnw,         // 1=Read from register. 0=Write to register.
+    input wire hba_select,      // Transfer in progress.
+    input wire [ADDR_WIDTH-1:0] hba_abus, // The input address bus.
+    input wire [DBUS_WIDTH-1:0] hba_dbus,  // The input data bus.
+
+    output reg [DBUS_WIDTH-1:0] hba_dbus_slave,   // The output data bus.
+    output reg hba_xferack_slave,     // Acknowledge transfer requested.
+                                    // Asserted when request has been completed.
+                                    // Must be zero when inactive.
+
+    input wire sample_pulse,        // push a sample
+    input wire [15:0] timestamp,
+    input wire [15:0] enc0,
+    input wire [15:0] enc1,
+
+    output reg intr                 // count reached the watermark
+);
+
+/*
+*****************************
+* Signals and Assignments
+*****************************
+*/
+
+localparam DEPTH = 1 << FIFO_ADDR_WIDTH;
+localparam SAMPLE_LAST = 5;     // last byte of a sample
+
+wire [REG_ADDR_WIDTH-1:0] reg_addr = hba_abus[REG_ADDR_WIDTH-1:0];
+
+wire [PERIPH_ADDR_WIDTH-1:0] periph_addr =
+    hba_abus[ADDR_WIDTH-1:ADDR_WIDTH-PERIPH_ADDR_WIDTH];
+
+// logic to decode addresses
+// Decode only the three registers and the data window, the same
+// way hba_reg_bank decodes only its own four registers.
+wire addr_decode_hit = (periph_addr == PERIPH_ADDR) &&
+    ((reg_addr == REG_COUNT) || (reg_addr == REG_COUNT+1) ||
+     (reg_addr == REG_COUNT+2) || (reg_addr >= REG_DATA));
+
+wire addr_hit_clear = ~hba_select | hba_xferack_slave;
+
+reg addr_hit;
+
+// The FIFO
+reg [47:0] mem [0:DEPTH-1];
+reg [47:0] rd_word;             // mem[rd_ptr] from the clock before
+reg [FIFO_ADDR_WIDTH-1:0] wr_ptr;
+reg [FIFO_ADDR_WIDTH-1:0] rd_ptr;
+reg [FIFO_ADDR_WIDTH:0] count;
+reg [2:0] rd_byte;              // next byte of the oldest sample
+reg [7:0] watermark;
+reg [7:0] dropped;
+
+// The count goes up the clock after the write so a read never
+// sees a sample before rd_word has it.
+wire push = sample_pulse & (count != DEPTH);
+reg push2;
+
+wire is_data = (reg_addr >= REG_DATA);
+wire pop;
+
+wire at_mark = (watermark != 0) && (count >= watermark);
+reg at_mark2;
+
+// state machine
+reg [7:0] fifo_state;
+
+// Define states
+localparam IDLE   = 0;
+localparam READ   = 1;
+localparam WRITE  = 2;
+localparam WAIT   = 3;
+
+assign pop = (fifo_state == READ) & is_data & (count != 0) &
+             (rd_byte == SAMPLE_LAST);
+
+/*
+*****************************
+* Main
+*****************************
+*/
+
+// Generate addr_hit
+always @ (posedge hba_clk)
+begin
+    if (hba_reset) begin
+        addr_hit <= 0;
+    end else begin
+        if (addr_hit_clear)
+            addr_hit <= 0;
+        else
+            addr_hit <= addr_decode_hit;
+    end
+end
+
+// Block RAM.  No reset.
+always @ (posedge hba_clk)
+begin
+    if (push) begin
+        mem[wr_ptr] <= {enc1, enc0, timestamp};
+    end
+    rd_word <= mem[rd_ptr];
+end
+
+// Pointers and count
+always @ (posedge hba_clk)
+begin
+    if (hba_reset) begin
+        wr_ptr <= 0;
+        rd_ptr <= 0;
+        count <= 0;
+        push2 <= 0;
+        dropped <= 0;
+    end else begin
+        push2 <= push;
+        if (push) begin
+            wr_ptr <= wr_ptr + 1;
+        end
+        if (pop) begin
+            rd_ptr <= rd_ptr + 1;
+        end
+        if (push2 & ~pop) begin
+            count <= count + 1;
+        end else if (pop & ~push2) begin
+            count <= count - 1;
+        end
+        if (sample_pulse & ~push & (dropped != 8'hff)) begin
+            dropped <= dropped + 1;
+        end
+        if ((fifo_state == WRITE) && (reg_addr == REG_COUNT+2)) begin
+            dropped <= 0;
+        end
+    end
+end
+
+// Interrupt on reaching the watermark
+always @ (posedge hba_clk)
+begin
+    if (hba_reset) begin
+        at_mark2 <= 0;
+        intr <= 0;
+    end else begin
+        at_mark2 <= at_mark;
+        intr <= at_mark & ~at_mark2;
+    end
+end
+
+// Bus state machine
+always @ (posedge hba_clk)
+begin
+    if (hba_reset) begin
+        fifo_state <= IDLE;
+        hba_xferack_slave <= 0;
+        hba_dbus_slave <= 0;
+        rd_byte <= 0;
+        watermark <= 0;
+    end else begin
+        case (fifo_state)
+            IDLE : begin
+                hba_xferack_slave <= 0;
+                hba_dbus_slave <= 0;
+
+                if (addr_hit)
+                begin
+                    if (hba_rnw)
+                        fifo_state <= READ;
+                    else
+                        fifo_state <= WRITE;
+                end
+            end
+            READ : begin
+                hba_xferack_slave <= 1;
+                fifo_state <= WAIT;
+                if (is_data) begin
+                    if (count != 0) begin
+                        hba_dbus_slave <= rd_word[(rd_byte * 8) +: 8];
+                        rd_byte <= (rd_byte == SAMPLE_LAST) ? 3'd0 : rd_byte + 1;
+                    end else begin
+                        hba_dbus_slave <= 0;
+                    end
+                end else begin
+                    case(reg_addr)
+                        REG_COUNT : begin
+                            hba_dbus_slave <= count;
+                        end
+                        REG_COUNT+1 : begin
+                            hba_dbus_slave <= watermark;
+                        end
+                        REG_COUNT+2 : begin
+                            hba_dbus_slave <= dropped;
+                        end
+                        default : begin
+                            hba_dbus_slave <= 0;
+                        end
+                    endcase
+                end
+            end
+            WRITE : begin
+                hba_xferack_slave <= 1;
+                fifo_state <= WAIT;
+                if (reg_addr == REG_COUNT+1) begin
+                    watermark <= hba_dbus;
+                end
+            end
+            WAIT : begin
+                fifo_state <= IDLE;
+                hba_xferack_slave <= 0;
+                hba_dbus_slave <= 0;
+            end
+            default begin
+                fifo_state <= IDLE;
+                hba_xferack_slave <= 0;
+                hba_dbus_slave <= 0;
+            end
+        endcase
+    end
+end
+
+endmodule
+
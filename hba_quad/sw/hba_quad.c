@@ -8,6 +8,13 @@
  *    enc0      -  Reads 16-bit left encoder value
  *    enc1      -  Reads 16-bit right encoder value
  *    enc       -  Reads left and right encoder values
+ *    pos64     -  Reads left and right counts extended to 64 bits
+ *    pose      -  Reads or sets the x, y, and heading from odometry
+ *    reset     -  Resets both encoder counts to zero
+ *    geometry  -  Sets the wheel sizes and track used for the pose
+ *    rate      -  Reads left and right ticks per second from the periods
+ *    sampler   -  Sets the FIFO sample period and watermark
+ *    samples   -  Drains timestamped encoder samples from the FIFO
  */
 
 /*
@@ -29,24 +36,46 @@
 
 /*
  * FPGA Register Interface
- * There are three 8-bit registers.
+ * There are nineteen 8-bit registers and a FIFO data window.
  *
  * reg0 : Control register. Enables quad enc updates and interrupts.
  *  - reg0[0] : Enable left encoder register updates
  *  - reg0[1] : Enable right encoder register updates
  *  - reg0[2] : Enable interrupt.
+ *  - reg0[3] : A 0 to 1 change resets both encoders.  Not auto
+ *              cleared, so the reset resource writes a 1 then a 0.
  * reg1 : Left encoder count, least significant byte
  * reg2 : Left encoder count, most significant byte
  * reg3 : Right encoder count, least significant byte
  * reg4 : Right encoder count, most significant byte
- * reg5 : Reset both encoders by writing 1.  Auto cleared.
+ * reg5 : Left ticks in the last speed period
+ * reg6 : Right ticks in the last speed period
+ * reg7 : Speed period in ms
+ * reg8 : Left period, hba_clk cycles per tick, bits 0-7
+ * reg9 : Left period bits 8-15
+ * reg10: Left period bits 16-23
+ * reg11: Right period bits 0-7
+ * reg12: Right period bits 8-15
+ * reg13: Right period bits 16-23
+ * reg14: bit 0 is set if the left wheel is going backwards, bit 1 right
+ * reg15: ms between FIFO samples, 0 is off
+ * reg16: number of samples in the FIFO
+ * reg17: FIFO watermark.  Interrupt when it has this many samples.
+ * reg18: number of samples dropped because the FIFO was full
+ * reg32 and up : Each read is the next byte of the oldest FIFO sample.
+ *        A sample is a ms timestamp, enc0, and enc1, LSB first.
+ *        Registers 19 to 31 are not decoded.
  *
+ * A read of reg1 latches the encoder counts and the speeds.  All
+ * reads start at reg1 so the values read together are consistent.
+ * A read of reg8 latches the periods and directions the same way.
  */
 
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <math.h>
 #include <syslog.h>
 #include <errno.h>
 #include <string.h>
@@ -73,6 +102,24 @@
 #define HBA_QUAD_REG_SPEED_LEFT (5)
 #define HBA_QUAD_REG_SPEED_RIGHT (6)
 #define HBA_QUAD_REG_SPEED_PERIOD (7)
+#define HBA_QUAD_REG_PERIOD     (8)
+        // registers from reg8 to the direction register
+#define HBA_QUAD_NPERIOD        (7)
+        // a period of all ones is a stopped wheel
+#define HBA_QUAD_PERIOD_MAX     (0xffffff)
+        // default hba_clk, that of the romi boards.  The periods count it.
+#define HBA_QUAD_CLK_HZ         (50000000)
+#define HBA_QUAD_REG_SAMPLE_MS  (15)
+#define HBA_QUAD_REG_FIFO_COUNT (16)
+#define HBA_QUAD_REG_FIFO_MARK  (17)
+#define HBA_QUAD_REG_FIFO_DROP  (18)
+#define HBA_QUAD_REG_FIFO_DATA  (32)
+#define HBA_QUAD_FIFO_DEPTH     (128)
+        // bytes in a FIFO sample and the most samples in one read
+#define HBA_QUAD_SAMPLE_LEN     (6)
+#define HBA_QUAD_MXDRAIN        ((256 - HBA_QUAD_REG_FIFO_DATA) / HBA_QUAD_SAMPLE_LEN)
+        // most characters in the text of one sample
+#define HBA_QUAD_SAMPLE_TXT     (40)
         // resource names and numbers
 #define FN_CTRL         "ctrl"
 #define FN_ENC0         "enc0"
@@ -81,6 +128,13 @@
 #define FN_RESET        "reset"
 #define FN_SPEED_PERIOD "speed_period"
 #define FN_SPEED        "speed"
+#define FN_POS64        "pos64"
+#define FN_POSE         "pose"
+#define FN_GEOMETRY     "geometry"
+#define FN_RATE         "rate"
+#define FN_SAMPLER      "sampler"
+#define FN_SAMPLES      "samples"
+#define FN_CLOCK        "clock"
 
 #define RSC_CTRL        0
 #define RSC_ENC0        1
@@ -89,6 +143,13 @@
 #define RSC_RESET       4
 #define RSC_SPEED_PERIOD 5
 #define RSC_SPEED       6
+#define RSC_POS64       7
+#define RSC_POSE        8
+#define RSC_GEOMETRY    9
+#define RSC_RATE        10
+#define RSC_SAMPLER     11
+#define RSC_SAMPLES     12
+#define RSC_CLOCK       13
 
         // What we are is a ...
 #define PLUGIN_NAME        "hba_quad"
@@ -104,7 +165,7 @@
     // All state info for an instance of a QUAD port
 typedef struct
 {
-    int      parent;    // Slot number of parent peripheral.
+    HBA_OPS *ops;       // bus operations of the parent peripheral
     int      coreid;    // FPGA core ID with this QUAD
     void    *pslot;     // handle to plug-in's's slot info
     int      ctrl;      // most recent value to display on ctrl
@@ -113,7 +174,24 @@ typedef struct
     int      speed_period; // period in ms
     int      speed_left;   // most recent speed_left value
     int      speed_right;  // most recent speed_right value
-    int      (*sendrecv_pkt)();  // routine to send data to the FPGA
+    int64_t  pos0;      // enc0 extended past its 16 bit wrap
+    int64_t  pos1;      // enc1 extended past its 16 bit wrap
+    int      havecount; // ==1 once the counts have been read
+    double   mmpt0;     // mm of travel per tick of the left wheel
+    double   mmpt1;     // mm of travel per tick of the right wheel
+    double   track;     // mm between the wheels.  0 = no odometry
+    double   x;         // position in mm
+    double   y;
+    double   heading;   // heading in radians, -pi to pi
+    double   rate0;     // left ticks per second from its period
+    double   rate1;     // right ticks per second from its period
+    int      clkhz;     // hba_clk in Hz.  The periods count it.
+    int      sample_ms;    // ms between FIFO samples, 0=off
+    int      sample_mark;  // FIFO watermark
+    int      ts16;      // most recent 16 bit FIFO timestamp
+    int64_t  ts;        // FIFO timestamp extended past its wrap
+    int      draining;  // ==1 while an interrupt drains the FIFO
+    int      ndrained;  // samples read by that drain
 } HBA_QUAD;
 
 
@@ -123,6 +201,20 @@ typedef struct
 static void usercmd(int, int, char*, SLOT*, int, int*, char*);
 extern SLOT Slots[];
 static void core_interrupt();
+static void core_telemetry();
+static void core_update(HBA_QUAD *, uint8_t *);
+static int  read_regs(HBA_QUAD *, int, int, uint8_t *);
+static int  read_async(HBA_QUAD *, int, int, void (*)());
+static void enc_done(void *, int, uint8_t *);
+static void period_done(void *, int, uint8_t *);
+static void fifo_stat_done(void *, int, uint8_t *);
+static void fifo_data_done(void *, int, uint8_t *);
+static void write_done(void *, int, uint8_t *);
+static int  odom_update(HBA_QUAD *, int, int);
+static void rate_update(HBA_QUAD *, uint8_t *);
+static int  write_reg(HBA_QUAD *, int, int);
+static int  drain_samples(HBA_QUAD *, int, char *, int);
+static int  put_samples(HBA_QUAD *, uint8_t *, int, char *, int, int *, int *);
 
 
 /**************************************************************
@@ -133,8 +225,6 @@ int Initialize(
     SLOT *pslot)           // points to the SLOT for this plug-in
 {
     HBA_QUAD   *pctx;      // our local context
-    const char *errmsg;    // error message from dlsym
-    void       *reg_intr;  // use this to register and interrupt handler
 
     // Allocate memory for this plug-in
     pctx = (HBA_QUAD *) malloc(sizeof(HBA_QUAD));
@@ -145,7 +235,6 @@ int Initialize(
     }
 
     // Init our HBA_QUAD structure
-    pctx->parent = hba_parent();     // Slot number of parent peripheral.
     pctx->coreid = HBA_QUAD_COREID;  // Immutable.
     pctx->pslot = pslot;             // this instance of a quadrature decoder
 
@@ -155,6 +244,24 @@ int Initialize(
     pctx->speed_period = HBA_DEFVAL; // default speed_period value.
     pctx->speed_left = HBA_DEFVAL;   // default speed_left value.
     pctx->speed_right = HBA_DEFVAL;  // default speed_right value.
+    pctx->pos0 = 0;
+    pctx->pos1 = 0;
+    pctx->havecount = 0;
+    pctx->mmpt0 = 0.0;               // no pose until geometry is set
+    pctx->mmpt1 = 0.0;
+    pctx->track = 0.0;
+    pctx->x = 0.0;
+    pctx->y = 0.0;
+    pctx->heading = 0.0;
+    pctx->rate0 = 0.0;
+    pctx->rate1 = 0.0;
+    pctx->sample_ms = HBA_DEFVAL;
+    pctx->sample_mark = HBA_DEFVAL;
+    pctx->ts16 = 0;
+    pctx->ts = 0;
+    pctx->clkhz = HBA_QUAD_CLK_HZ;
+    pctx->draining = 0;
+    pctx->ndrained = 0;
 
     // Register name and private data
     pslot->name = PLUGIN_NAME;
@@ -205,16 +312,54 @@ int Initialize(
     pslot->rsc[RSC_SPEED].pgscb = usercmd;
     pslot->rsc[RSC_SPEED].uilock = -1;
     pslot->rsc[RSC_SPEED].slot = pslot;
+    pslot->rsc[RSC_POS64].name = FN_POS64;
+    pslot->rsc[RSC_POS64].flags = IS_READABLE | CAN_BROADCAST;
+    pslot->rsc[RSC_POS64].bkey = 0;
+    pslot->rsc[RSC_POS64].pgscb = usercmd;
+    pslot->rsc[RSC_POS64].uilock = -1;
+    pslot->rsc[RSC_POS64].slot = pslot;
+    pslot->rsc[RSC_POSE].name = FN_POSE;
+    pslot->rsc[RSC_POSE].flags = IS_READABLE | IS_WRITABLE | CAN_BROADCAST;
+    pslot->rsc[RSC_POSE].bkey = 0;
+    pslot->rsc[RSC_POSE].pgscb = usercmd;
+    pslot->rsc[RSC_POSE].uilock = -1;
+    pslot->rsc[RSC_POSE].slot = pslot;
+    pslot->rsc[RSC_GEOMETRY].name = FN_GEOMETRY;
+    pslot->rsc[RSC_GEOMETRY].flags = IS_READABLE | IS_WRITABLE;
+    pslot->rsc[RSC_GEOMETRY].bkey = 0;
+    pslot->rsc[RSC_GEOMETRY].pgscb = usercmd;
+    pslot->rsc[RSC_GEOMETRY].uilock = -1;
+    pslot->rsc[RSC_GEOMETRY].slot = pslot;
+    pslot->rsc[RSC_RATE].name = FN_RATE;
+    pslot->rsc[RSC_RATE].flags = IS_READABLE | CAN_BROADCAST;
+    pslot->rsc[RSC_RATE].bkey = 0;
+    pslot->rsc[RSC_RATE].pgscb = usercmd;
+    pslot->rsc[RSC_RATE].uilock = -1;
+    pslot->rsc[RSC_RATE].slot = pslot;
+    pslot->rsc[RSC_SAMPLER].name = FN_SAMPLER;
+    pslot->rsc[RSC_SAMPLER].flags = IS_READABLE | IS_WRITABLE;
+    pslot->rsc[RSC_SAMPLER].bkey = 0;
+    pslot->rsc[RSC_SAMPLER].pgscb = usercmd;
+    pslot->rsc[RSC_SAMPLER].uilock = -1;
+    pslot->rsc[RSC_SAMPLER].slot = pslot;
+    pslot->rsc[RSC_SAMPLES].name = FN_SAMPLES;
+    pslot->rsc[RSC_SAMPLES].flags = IS_READABLE | CAN_BROADCAST;
+    pslot->rsc[RSC_SAMPLES].bkey = 0;
+    pslot->rsc[RSC_SAMPLES].pgscb = usercmd;
+    pslot->rsc[RSC_SAMPLES].uilock = -1;
+    pslot->rsc[RSC_SAMPLES].slot = pslot;
+    pslot->rsc[RSC_CLOCK].name = FN_CLOCK;
+    pslot->rsc[RSC_CLOCK].flags = IS_READABLE | IS_WRITABLE;
+    pslot->rsc[RSC_CLOCK].bkey = 0;
+    pslot->rsc[RSC_CLOCK].pgscb = usercmd;
+    pslot->rsc[RSC_CLOCK].uilock = -1;
+    pslot->rsc[RSC_CLOCK].slot = pslot;
 
-    // The serial_fpga plug-in has a routine to send packets to the FPGA
-    // and to return with packet data from the FPGA.  We need to look up
-    // this, 'sendrecv_pkt', address from within serial_fpga.so.
-    // We cache the routine address so we don't need to look it up every
-    // time we want to send a packet.
-    dlerror();                  /* Clear any existing error */
-    *(void **) (&(pctx->sendrecv_pkt)) = dlsym(Slots[pctx->parent].handle, "sendrecv_pkt");
-    errmsg = dlerror();         /* check for errors */
-    if (errmsg != NULL) {
+    // The serial_fpga plug-in has the routines to send packets to the
+    // FPGA and to register our handlers.  Get its table of them once
+    // here so each packet goes straight to serial_fpga.
+    pctx->ops = hba_ops();
+    if (pctx->ops == (HBA_OPS *) 0) {
         return(-1);
     }
 
@@ -224,15 +369,19 @@ int Initialize(
     // core's interrupt handler and invokes it.
     // The code below registers this core's interrupt handler with
     // serial_fpga.
-    dlerror();                  /* Clear any existing error */
-    reg_intr = dlsym(Slots[pctx->parent].handle, "register_interrupt_handler");
-    if (errmsg != NULL) {
-        return(-1);
-    }
     // Pass in the core ID of this plug-in...
-    if (reg_intr != (void *) 0) {
-        ((void (*)())reg_intr) (pctx->parent, pctx->coreid, &core_interrupt, (void *) pctx);
-    }
+    pctx->ops->reg_intr(pctx->ops->ctx, pctx->coreid, &core_interrupt, (void *) pctx);
+
+    // serial_fpga can also send our registers in telemetry frames.
+    // Register the routine that takes them.
+    pctx->ops->reg_telemetry(pctx->ops->ctx, pctx->coreid, &core_telemetry, (void *) pctx);
+
+    // Only the host changes the control and speed period registers so
+    // serial_fpga can skip writes of the values they already hold.
+    pctx->ops->reg_nonvolatile(pctx->ops->ctx, pctx->coreid, HBA_QUAD_REG_CTRL, 1);
+    pctx->ops->reg_nonvolatile(pctx->ops->ctx, pctx->coreid, HBA_QUAD_REG_SPEED_PERIOD, 1);
+    pctx->ops->reg_nonvolatile(pctx->ops->ctx, pctx->coreid, HBA_QUAD_REG_SAMPLE_MS, 1);
+    pctx->ops->reg_nonvolatile(pctx->ops->ctx, pctx->coreid, HBA_QUAD_REG_FIFO_MARK, 1);
 
     return (0);
 }
@@ -255,10 +404,9 @@ void usercmd(
     int       nsd;      // number of bytes sent to FPGA
     int       ret;      // generic call return value
     uint8_t   pkt[HBA_MXPKT];
-    int       newenc0;
-    int       newenc1;
-    int       new_speed_left;
-    int       new_speed_right;
+    uint8_t   data[HBA_MXPKT];  // register values from read_regs()
+    double    dval[3];  // new pose or geometry
+    int       mark;     // new FIFO watermark
 
     // Get this instance of the plug-in
     pctx = (HBA_QUAD *) pslot->priv;
@@ -284,7 +432,7 @@ void usercmd(
         pkt[1] = HBA_QUAD_REG_CTRL;
         pkt[2] = pctx->ctrl;                     // new value
         pkt[3] = 0;                             // dummy for the ack
-        nsd = pctx->sendrecv_pkt(pctx->parent, 4, pkt);
+        nsd = pctx->ops->send(pctx->ops->ctx, 4, pkt);
         // We did a write so the sendrecv return value should be 1
         // and the returned byte should be an ACK
         if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
@@ -296,188 +444,40 @@ void usercmd(
         // XXX ret = snprintf(buf, *plen, "%x\n", pctx->ctrl);
         ret = snprintf(buf, *plen, "%d\n", pctx->ctrl);
         *plen = ret;  // (errors are handled in calling routine)
-    } else if ((cmd == EDGET) && (rscid == RSC_ENC0)) {
-
-        // Disable left encoder updates
-        pkt[0] = HBA_WRITE_CMD | ((1 -1) << 4) | pctx->coreid;
-        pkt[1] = HBA_QUAD_REG_CTRL;
-        pkt[2] = pctx->ctrl & 0xfe;     // bit0 (en left enc) set to 0.
-        pkt[3] = 0;                     // dummy for the ack
-        nsd = pctx->sendrecv_pkt(pctx->parent, 4, pkt);
-        // We did a write so the sendrecv return value should be 1
-        // and the returned byte should be an ACK
-        if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
-            // error writing value from QUAD port
-            ret = snprintf(buf, *plen, E_NORSP, pslot->rsc[rscid].name);
-            *plen = ret;
-        }
-
-        // Read value in FPGA ENC0 value register
-        pkt[0] = HBA_READ_CMD | ((2 -1) << 4) | pctx->coreid;
-        pkt[1] = HBA_QUAD_REG_ENC0_LSB;
-        pkt[2] = 0;                     // (cmd)
-        pkt[3] = 0;                     // (reg)
-        pkt[4] = 0;                     // (quadrature low)
-        pkt[5] = 0;                     // (quadrature high)
-        nsd = pctx->sendrecv_pkt(pctx->parent, 6, pkt);
-        // We sent header + two bytes so the sendrecv return value should be 4
-        if (nsd != 4) {
-            // error reading enc0 from QUAD port
+    } else if ((cmd == EDGET) && ((rscid == RSC_ENC0) || (rscid == RSC_ENC1) ||
+               (rscid == RSC_ENC) || (rscid == RSC_SPEED) ||
+               (rscid == RSC_POS64) || (rscid == RSC_POSE))) {
+        // Read the counts and speeds.  Every read goes through
+        // core_update() so the 64 bit counts and the pose see it.
+        if (read_regs(pctx, HBA_QUAD_REG_ENC0_LSB, 6, data) != 0) {
+            // error reading encoders from QUAD port
             ret = snprintf(buf, *plen, E_NORSP, pslot->rsc[rscid].name);
             *plen = ret;
+            return;
         }
-        else {
-            // Got the values.  Print and send to user
-            // First two bytes are echoed header.
-            // XXX pctx->enc0 = (pkt[3]<<8) | pkt[2];   // Reconstruct 16-bit value.
-            newenc0 = (pkt[3]<<8) | pkt[2];   // Reconstruct 16-bit value.
-            if (newenc0 >= 0x8000) {
-                newenc0 = newenc0 - 0x10000;
-            }
-            pctx->enc0 = newenc0;   // Reconstruct 16-bit value.
+        core_update(pctx, data);
 
-            // XXX ret = snprintf(buf, *plen, "%04x\n", pctx->enc0);
+        if (rscid == RSC_ENC0) {
             ret = snprintf(buf, *plen, "%d\n", pctx->enc0);
-            *plen = ret;  // (errors are handled in calling routine)
-        }
-
-        // Put the control back the way it was.
-        pkt[0] = HBA_WRITE_CMD | ((1 -1) << 4) | pctx->coreid;
-        pkt[1] = HBA_QUAD_REG_CTRL;
-        pkt[2] = pctx->ctrl;
-        pkt[3] = 0;                     // dummy for the ack
-        nsd = pctx->sendrecv_pkt(pctx->parent, 4, pkt);
-        // We did a write so the sendrecv return value should be 1
-        // and the returned byte should be an ACK
-        if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
-            // error writing value from QUAD port
-            ret = snprintf(buf, *plen, E_NORSP, pslot->rsc[rscid].name);
-            *plen = ret;
-        }
-    } else if ((cmd == EDGET) && (rscid == RSC_ENC1)) {
-        // Disable right encoder updates
-        pkt[0] = HBA_WRITE_CMD | ((1 -1) << 4) | pctx->coreid;
-        pkt[1] = HBA_QUAD_REG_CTRL;
-        pkt[2] = pctx->ctrl & 0xfd;     // bit1 (en right enc) set to 0.
-        pkt[3] = 0;                     // dummy for the ack
-        nsd = pctx->sendrecv_pkt(pctx->parent, 4, pkt);
-        // We did a write so the sendrecv return value should be 1
-        // and the returned byte should be an ACK
-        if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
-            // error writing value from QUAD port
-            ret = snprintf(buf, *plen, E_NORSP, pslot->rsc[rscid].name);
-            *plen = ret;
-        }
-
-        // Read value in FPGA ENC1 value register
-        pkt[0] = HBA_READ_CMD | ((2 -1) << 4) | pctx->coreid;
-        pkt[1] = HBA_QUAD_REG_ENC1_LSB;
-        pkt[2] = 0;                     // (cmd)
-        pkt[3] = 0;                     // (reg)
-        pkt[4] = 0;                     // (quadrature low)
-        pkt[5] = 0;                     // (quadrature high)
-        nsd = pctx->sendrecv_pkt(pctx->parent, 6, pkt);
-        // We sent header + two bytes so the sendrecv return value should be 4
-        if (nsd != 4) {
-            // error reading enc1 from QUAD port
-            ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
-            *plen = ret;
         }
-        else {
-            // Got the values.  Print and send to user
-            // First two bytes are echoed header.
-            // XXX pctx->enc1 = (pkt[3]<<8) | pkt[2];   // Reconstruct 16-bit value.
-            newenc1 = (pkt[3]<<8) | pkt[2];   // Reconstruct 16-bit value.
-            if (newenc1 >= 0x8000) {
-                newenc1 = newenc1 - 0x10000;
-            }
-            pctx->enc1 = newenc1;   // Reconstruct 16-bit value.
-
-
-            // XXX ret = snprintf(buf, *plen, "%04x\n", pctx->enc1);
+        else if (rscid == RSC_ENC1) {
             ret = snprintf(buf, *plen, "%d\n", pctx->enc1);
-            *plen = ret;  // (errors are handled in calling routine)
         }
-
-        // Put the control back the way it was.
-        pkt[0] = HBA_WRITE_CMD | ((1 -1) << 4) | pctx->coreid;
-        pkt[1] = HBA_QUAD_REG_CTRL;
-        pkt[2] = pctx->ctrl;
-        pkt[3] = 0;                     // dummy for the ack
-        nsd = pctx->sendrecv_pkt(pctx->parent, 4, pkt);
-        // We did a write so the sendrecv return value should be 1
-        // and the returned byte should be an ACK
-        if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
-            // error writing value from QUAD port
-            ret = snprintf(buf, *plen, E_NORSP, pslot->rsc[rscid].name);
-            *plen = ret;
+        else if (rscid == RSC_ENC) {
+            ret = snprintf(buf, *plen, "%d %d\n", pctx->enc0, pctx->enc1);
         }
-    } else if ((cmd == EDGET) && (rscid == RSC_ENC)) {
-
-        // Disable both encoder updates
-        pkt[0] = HBA_WRITE_CMD | ((1 -1) << 4) | pctx->coreid;
-        pkt[1] = HBA_QUAD_REG_CTRL;
-        pkt[2] = pctx->ctrl & 0xfc;     // Both encoders updates disabled
-        pkt[3] = 0;                     // dummy for the ack
-        nsd = pctx->sendrecv_pkt(pctx->parent, 4, pkt);
-        // We did a write so the sendrecv return value should be 1
-        // and the returned byte should be an ACK
-        if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
-            // error writing value from QUAD port
-            ret = snprintf(buf, *plen, E_NORSP, pslot->rsc[rscid].name);
-            *plen = ret;
+        else if (rscid == RSC_SPEED) {
+            ret = snprintf(buf, *plen, "%d %d\n", pctx->speed_left, pctx->speed_right);
         }
-
-        // Read both enc0 and enc1 values.  4 registers in all
-        pkt[0] = HBA_READ_CMD | ((4 -1) << 4) | pctx->coreid;
-        pkt[1] = HBA_QUAD_REG_ENC0_LSB;
-        pkt[2] = 0;                     // (cmd)
-        pkt[3] = 0;                     // (reg)
-        pkt[4] = 0;                     // (quadrature low)
-        pkt[5] = 0;                     // (quadrature high)
-        pkt[6] = 0;                     // (quadrature low)
-        pkt[7] = 0;                     // (quadrature high)
-        nsd = pctx->sendrecv_pkt(pctx->parent, 8, pkt);
-        // We sent 2 byte header + siz bytes so the sendrecv return value should be 6
-        if (nsd != 6) {
-            // error reading enc1 from QUAD port
-            ret = snprintf(buf, *plen, E_NORSP, pslot->rsc[rscid].name);
-            *plen = ret;
+        else if (rscid == RSC_POS64) {
+            ret = snprintf(buf, *plen, "%lld %lld\n", (long long) pctx->pos0,
+                     (long long) pctx->pos1);
         }
         else {
-            // Got the values.  Print and send to user
-            // First two bytes are echoed header.
-            //XXX pctx->enc0 = (pkt[3]<<8) | pkt[2];   // Reconstruct enc0 16-bit value.
-            //XXX pctx->enc1 = (pkt[5]<<8) | pkt[4];   // Reconstruct enc1 16-bit value.
-            newenc0= (pkt[3]<<8) | pkt[2];   // Reconstruct enc0 16-bit value.
-            newenc1 = (pkt[5]<<8) | pkt[4];   // Reconstruct enc1 16-bit value.
-            if (newenc0 >= 0x8000) {
-                newenc0 = newenc0 - 0x10000;
-            }
-            if (newenc1 >= 0x8000) {
-                newenc1 = newenc1 - 0x10000;
-            }
-            pctx->enc0 = newenc0;   // Reconstruct enc0 16-bit value.
-            pctx->enc1 = newenc1;   // Reconstruct enc1 16-bit value.
-
-            // XXX ret = snprintf(buf, *plen, "%04x %04x\n", pctx->enc0, pctx->enc1);
-            ret = snprintf(buf, *plen, "%d %d\n", pctx->enc0, pctx->enc1);
-            *plen = ret;  // (errors are handled in calling routine)
-        }
-
-        // Put the control back the way it was.
-        pkt[0] = HBA_WRITE_CMD | ((1 -1) << 4) | pctx->coreid;
-        pkt[1] = HBA_QUAD_REG_CTRL;
-        pkt[2] = pctx->ctrl;
-        pkt[3] = 0;                     // dummy for the ack
-        nsd = pctx->sendrecv_pkt(pctx->parent, 4, pkt);
-        // We did a write so the sendrecv return value should be 1
-        // and the returned byte should be an ACK
-        if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
-            // error writing value from QUAD port
-            ret = snprintf(buf, *plen, E_NORSP, pslot->rsc[rscid].name);
-            *plen = ret;
+            ret = snprintf(buf, *plen, "%.1f %.1f %.2f\n", pctx->x, pctx->y,
+                     (pctx->heading * 180.0 / M_PI));
         }
+        *plen = ret;  // (errors are handled in calling routine)
     } else if ((cmd == EDSET) && (rscid == RSC_RESET)) {
         // Set bit 3 for encoder reset
         pctx->ctrl = pctx->ctrl | 0x08;
@@ -487,7 +487,7 @@ void usercmd(
         pkt[1] = HBA_QUAD_REG_CTRL;
         pkt[2] = pctx->ctrl;                             // new value
         pkt[3] = 0;                             // dummy for the ack
-        nsd = pctx->sendrecv_pkt(pctx->parent, 4, pkt);
+        nsd = pctx->ops->send(pctx->ops->ctx, 4, pkt);
         // We did a write so the sendrecv return value should be 1
         // and the returned byte should be an ACK
         if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
@@ -499,12 +499,19 @@ void usercmd(
         // Clear bit 3 for encoder reset
         pctx->ctrl = pctx->ctrl & 0xF7;
 
+        // The counts start again from zero.  The robot did not move so
+        // the pose is kept.
+        pctx->enc0 = 0;
+        pctx->enc1 = 0;
+        pctx->pos0 = 0;
+        pctx->pos1 = 0;
+
         // Write a 0 to reg_ctrl[3]
         pkt[0] = HBA_WRITE_CMD | ((1 -1) << 4) | pctx->coreid;
         pkt[1] = HBA_QUAD_REG_CTRL;
         pkt[2] = pctx->ctrl;                             // new value
         pkt[3] = 0;                             // dummy for the ack
-        nsd = pctx->sendrecv_pkt(pctx->parent, 4, pkt);
+        nsd = pctx->ops->send(pctx->ops->ctx, 4, pkt);
         // We did a write so the sendrecv return value should be 1
         // and the returned byte should be an ACK
         if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
@@ -532,7 +539,7 @@ void usercmd(
         pkt[1] = HBA_QUAD_REG_SPEED_PERIOD;
         pkt[2] = pctx->speed_period;                     // new value
         pkt[3] = 0;                             // dummy for the ack
-        nsd = pctx->sendrecv_pkt(pctx->parent, 4, pkt);
+        nsd = pctx->ops->send(pctx->ops->ctx, 4, pkt);
         // We did a write so the sendrecv return value should be 1
         // and the returned byte should be an ACK
         if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
@@ -543,70 +550,88 @@ void usercmd(
     } else if ((cmd == EDGET) && (rscid == RSC_SPEED_PERIOD)) {
         ret = snprintf(buf, *plen, "%d\n", pctx->speed_period);
         *plen = ret;  // (errors are handled in calling routine)
-    } else if ((cmd == EDGET) && (rscid == RSC_SPEED)) {
-
-        // Disable both encoder updates
-        pkt[0] = HBA_WRITE_CMD | ((1 -1) << 4) | pctx->coreid;
-        pkt[1] = HBA_QUAD_REG_CTRL;
-        pkt[2] = pctx->ctrl & 0xfc;     // Both encoders updates disabled
-        pkt[3] = 0;                     // dummy for the ack
-        nsd = pctx->sendrecv_pkt(pctx->parent, 4, pkt);
-        // We did a write so the sendrecv return value should be 1
-        // and the returned byte should be an ACK
-        if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
-            // error writing value from QUAD port
+    } else if ((cmd == EDGET) && (rscid == RSC_RATE)) {
+        // Read both periods and the directions
+        if (read_regs(pctx, HBA_QUAD_REG_PERIOD, HBA_QUAD_NPERIOD, data) != 0) {
+            // error reading periods from QUAD port
             ret = snprintf(buf, *plen, E_NORSP, pslot->rsc[rscid].name);
             *plen = ret;
+            return;
         }
-
-        // Read both speed_left and speed_right values.  2 registers in all
-        pkt[0] = HBA_READ_CMD | ((2 -1) << 4) | pctx->coreid;
-        pkt[1] = HBA_QUAD_REG_SPEED_LEFT;
-        pkt[2] = 0;                     // (cmd)
-        pkt[3] = 0;                     // (reg)
-        pkt[4] = 0;                     // (speed left)
-        pkt[5] = 0;                     // (speed right)
-        nsd = pctx->sendrecv_pkt(pctx->parent, 6, pkt);
-        // We sent 2 byte header + siz bytes so the sendrecv return value should be 4
-        if (nsd != 4) {
-            // error reading speed_left from QUAD port
+        rate_update(pctx, data);
+        ret = snprintf(buf, *plen, "%.2f %.2f\n", pctx->rate0, pctx->rate1);
+        *plen = ret;  // (errors are handled in calling routine)
+    } else if ((cmd == EDSET) && (rscid == RSC_SAMPLER)) {
+        // The ms between samples and the watermark
+        ret = sscanf(val, "%d %d", &nval, &mark);
+        if ((ret != 2) || (nval < 0) || (nval > 0xff) ||
+            (mark < 0) || (mark > HBA_QUAD_FIFO_DEPTH)) {
+            ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
+            *plen = ret;
+            return;
+        }
+        pctx->sample_ms = nval;
+        pctx->sample_mark = mark;
+        if ((write_reg(pctx, HBA_QUAD_REG_FIFO_MARK, pctx->sample_mark) != 0) ||
+            (write_reg(pctx, HBA_QUAD_REG_SAMPLE_MS, pctx->sample_ms) != 0)) {
+            // error writing value from QUAD port
             ret = snprintf(buf, *plen, E_NORSP, pslot->rsc[rscid].name);
             *plen = ret;
         }
-        else {
-            // Got the values.  Print and send to user
-            // First two bytes are echoed header.
-            // XXX pctx->speed_left  = pkt[2];   // speed_left value
-            // XXX pctx->speed_right = pkt[3];   // speed_right value
-            new_speed_left  = pkt[2];   // speed_left value
-            new_speed_right = pkt[3];   // speed_right value
-            if (new_speed_left >= 0x80) {
-                new_speed_left = new_speed_left - 0x100;
-            }
-            if (new_speed_right >= 0x80) {
-                new_speed_right = new_speed_right - 0x100;
-            }
-            pctx->speed_left  = new_speed_left;   // speed_left value
-            pctx->speed_right = new_speed_right;   // speed_right value
-
-            // XXX ret = snprintf(buf, *plen, "%04x %04x\n", pctx->enc0, pctx->enc1);
-            ret = snprintf(buf, *plen, "%d %d\n", pctx->speed_left, pctx->speed_right);
-            *plen = ret;  // (errors are handled in calling routine)
+    } else if ((cmd == EDGET) && (rscid == RSC_SAMPLER)) {
+        ret = snprintf(buf, *plen, "%d %d\n", pctx->sample_ms, pctx->sample_mark);
+        *plen = ret;  // (errors are handled in calling routine)
+    } else if ((cmd == EDSET) && (rscid == RSC_CLOCK)) {
+        // The hba_clk frequency that the periods count
+        ret = sscanf(val, "%d", &nval);
+        if ((ret != 1) || (nval <= 0)) {
+            ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
+            *plen = ret;
+            return;
         }
-
-        // Put the control back the way it was.
-        pkt[0] = HBA_WRITE_CMD | ((1 -1) << 4) | pctx->coreid;
-        pkt[1] = HBA_QUAD_REG_CTRL;
-        pkt[2] = pctx->ctrl;
-        pkt[3] = 0;                     // dummy for the ack
-        nsd = pctx->sendrecv_pkt(pctx->parent, 4, pkt);
-        // We did a write so the sendrecv return value should be 1
-        // and the returned byte should be an ACK
-        if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
-            // error writing value from QUAD port
+        pctx->clkhz = nval;
+    } else if ((cmd == EDGET) && (rscid == RSC_CLOCK)) {
+        ret = snprintf(buf, *plen, "%d\n", pctx->clkhz);
+        *plen = ret;  // (errors are handled in calling routine)
+    } else if ((cmd == EDGET) && (rscid == RSC_SAMPLES)) {
+        // A drain started by the interrupt gives the samples to hbacat
+        if (pctx->draining) {
+            *plen = 0;
+            return;
+        }
+        // Drain as many samples as fit in the reply
+        ret = drain_samples(pctx, ((*plen - 1) / HBA_QUAD_SAMPLE_TXT), buf, *plen);
+        if (ret < 0) {
             ret = snprintf(buf, *plen, E_NORSP, pslot->rsc[rscid].name);
+        }
+        *plen = ret;  // (errors are handled in calling routine)
+    } else if ((cmd == EDSET) && (rscid == RSC_POSE)) {
+        // Set the x, y, and heading in degrees.  Usually "0 0 0".
+        ret = sscanf(val, "%lf %lf %lf", &dval[0], &dval[1], &dval[2]);
+        if (ret != 3) {
+            ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
             *plen = ret;
+            return;
+        }
+        pctx->x = dval[0];
+        pctx->y = dval[1];
+        pctx->heading = remainder((dval[2] * M_PI / 180.0), (2.0 * M_PI));
+    } else if ((cmd == EDSET) && (rscid == RSC_GEOMETRY)) {
+        // mm per tick of the left and right wheels and the track in mm.
+        // A negative mm per tick is for a wheel that counts backwards.
+        ret = sscanf(val, "%lf %lf %lf", &dval[0], &dval[1], &dval[2]);
+        if ((ret != 3) || (dval[2] <= 0.0)) {
+            ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
+            *plen = ret;
+            return;
         }
+        pctx->mmpt0 = dval[0];
+        pctx->mmpt1 = dval[1];
+        pctx->track = dval[2];
+    } else if ((cmd == EDGET) && (rscid == RSC_GEOMETRY)) {
+        ret = snprintf(buf, *plen, "%g %g %g\n", pctx->mmpt0, pctx->mmpt1,
+                 pctx->track);
+        *plen = ret;  // (errors are handled in calling routine)
     } 
 
     // Nothing to do here if edcat.  That is handled in the UI code
@@ -616,15 +641,292 @@ void usercmd(
 
 
 /**************************************************************
- * core_interrupt():  - interrupt handler for this peripheral
+ * read_regs():  - Read nreg registers starting at reg in one
+ * packet.  The FPGA latches the counts and speeds when a read
+ * of enc0 lsb starts, and the periods when a read of the left
+ * period starts, so the values are from the same time.
+ * Returns 0 with the register values in data, or -1 on error.
+ **************************************************************/
+static int read_regs(
+    HBA_QUAD *pctx,      // hba_quad private info
+    int       reg,       // first register to read
+    int       nreg,      // number of registers to read
+    uint8_t  *data)      // register values on return
+{
+    int       nsd;       // number of bytes received
+    uint8_t   pkt[HBA_MXPKT];
+
+    pkt[0] = HBA_READ_CMD | ((nreg -1) << 4) | pctx->coreid;
+    pkt[1] = reg;
+    (void) memset(&(pkt[2]), 0, (nreg + 2));  // dummies for echo and data
+
+    nsd = pctx->ops->send(pctx->ops->ctx, (nreg + 4), pkt);
+
+    // The read returns the echoed header and then the register values
+    if (nsd != (nreg + 2)) {
+        return(-1);
+    }
+    (void) memcpy(data, &(pkt[2]), nreg);
+    return(0);
+}
+
+
+/**************************************************************
+ * read_async():  - Queue a read of nreg registers starting at
+ * reg.  More than HBA_MXBURST, and any read of the FIFO data, go
+ * in one extended read.  done_cb gets the echoed header and then
+ * the register values.  The
+ * interrupt handler uses this so the event loop does not wait on
+ * the serial link.  Returns 0 if queued and -1 if not.
+ **************************************************************/
+static int read_async(
+    HBA_QUAD *pctx,      // hba_quad private info
+    int       reg,       // first register to read
+    int       nreg,      // number of registers to read
+    void    (*done_cb)()) // invoked with the response
+{
+    uint8_t   pkt[HBA_MXPKT_EXT];
+    int       count;     // number of bytes to send
+
+    (void) memset(pkt, 0, sizeof(pkt));     // dummies for echo and data
+    if ((nreg <= HBA_MXBURST) && (reg < HBA_QUAD_REG_FIFO_DATA)) {
+        pkt[0] = HBA_READ_CMD | ((nreg -1) << 4) | pctx->coreid;
+        pkt[1] = reg;
+        count = nreg + 4;
+    }
+    else {
+        pkt[0] = HBA_READ_CMD | HBA_EXT_CMD;
+        pkt[1] = pctx->coreid;
+        pkt[2] = reg;
+        pkt[3] = nreg;
+        count = nreg + 8;
+    }
+
+    if (pctx->ops->send_async(pctx->ops->ctx, count, pkt, done_cb, (void *) pctx) != 0) {
+        return(-1);
+    }
+    return(0);
+}
+
+
+/**************************************************************
+ * core_interrupt():  - interrupt handler for this peripheral.
+ * The reads are queued and the callbacks below finish the work.
  **************************************************************/
 void core_interrupt(void *trans)
 {
     HBA_QUAD    *pctx;       // this peripheral's private info
+    SLOT        *pslot;      // This instance of the quad plug-in
+
+    // get pointers to this instance of the plug-in and its slot
+    pctx = (HBA_QUAD *) trans; // transparent data is our context
+    pslot = pctx->pslot;
+
+    // The watermark interrupt is an edge so the FIFO has to go back
+    // below the watermark for the next one.  Drain it every time and
+    // broadcast the samples to any UI monitoring them.  With no UI
+    // they are dropped.  A drain already running reads the count
+    // again after each read so it gets the new samples too.
+    if ((pctx->sample_mark != 0) && (pctx->draining == 0)) {
+        pctx->draining = 1;
+        pctx->ndrained = 0;
+        if (read_async(pctx, HBA_QUAD_REG_FIFO_COUNT, 3, fifo_stat_done) != 0) {
+            pctx->draining = 0;
+            edlog("Error reading samples from quadrature");
+        }
+    }
+
+    // With the FIFO on the counts only interrupt if enabled in ctrl
+    if ((pctx->sample_ms != 0) && ((pctx->ctrl & 0x04) == 0)) {
+        return;
+    }
+
+    // Read the encoder and speed registers
+    if (read_async(pctx, HBA_QUAD_REG_ENC0_LSB, 6, enc_done) != 0) {
+        // error reading value from QUAD port
+        edlog("Error reading value from quadrature");
+        return;
+    }
+
+    // Read the periods too if any UI is monitoring the rate
+    if (pslot->rsc[RSC_RATE].bkey != 0) {
+        if (read_async(pctx, HBA_QUAD_REG_PERIOD, HBA_QUAD_NPERIOD, period_done) != 0) {
+            edlog("Error reading period from quadrature");
+        }
+    }
+}
+
+
+/**************************************************************
+ * enc_done():  - completion callback for the interrupt's read
+ * of the encoder and speed registers.
+ **************************************************************/
+static void enc_done(
+    void        *trans,      // our context
+    int          nsd,        // number of bytes received
+    uint8_t     *pkt)        // echoed header and the registers
+{
+    // We sent header + six bytes so the return value should be 8
+    if (nsd != 8) {
+        edlog("Error reading value from quadrature");
+        return;
+    }
+    core_update((HBA_QUAD *) trans, &(pkt[2]));
+}
+
+
+/**************************************************************
+ * period_done():  - completion callback for the interrupt's read
+ * of the period registers.
+ **************************************************************/
+static void period_done(
+    void        *trans,      // our context
+    int          nsd,        // number of bytes received
+    uint8_t     *pkt)        // echoed header and the registers
+{
+    if (nsd != (HBA_QUAD_NPERIOD + 2)) {
+        edlog("Error reading period from quadrature");
+        return;
+    }
+    rate_update((HBA_QUAD *) trans, &(pkt[2]));
+}
+
+
+/**************************************************************
+ * fifo_stat_done():  - completion callback for a read of the FIFO
+ * count, watermark, and dropped registers during an interrupt
+ * drain.  Queue the read of the samples, up to the FIFO depth in
+ * all, or end the drain if there are none.
+ **************************************************************/
+static void fifo_stat_done(
+    void        *trans,      // our context
+    int          nsd,        // number of bytes received
+    uint8_t     *pkt)        // echoed header and the registers
+{
+    HBA_QUAD    *pctx;       // this peripheral's private info
+    uint8_t      wpkt[HBA_MXPKT];  // write to clear the dropped count
+    int          nsmp;       // number of samples to read
+
+    pctx = (HBA_QUAD *) trans;
+
+    if (nsd != 5) {
+        pctx->draining = 0;
+        edlog("Error reading samples from quadrature");
+        return;
+    }
+    if (pkt[4] != 0) {
+        edlog("%s: %d samples dropped", PLUGIN_NAME, pkt[4]);
+        wpkt[0] = HBA_WRITE_CMD | ((1 -1) << 4) | pctx->coreid;
+        wpkt[1] = HBA_QUAD_REG_FIFO_DROP;
+        wpkt[2] = 0;                        // new value
+        wpkt[3] = 0;                        // dummy for the ack
+        (void) pctx->ops->send_async(pctx->ops->ctx, 4, wpkt, write_done, (void *) pctx);
+    }
+    nsmp = (pkt[2] < (HBA_QUAD_FIFO_DEPTH - pctx->ndrained)) ? pkt[2] :
+           (HBA_QUAD_FIFO_DEPTH - pctx->ndrained);
+    nsmp = (nsmp < HBA_QUAD_MXDRAIN) ? nsmp : HBA_QUAD_MXDRAIN;
+    if (nsmp == 0) {
+        pctx->draining = 0;
+        return;
+    }
+    if (read_async(pctx, HBA_QUAD_REG_FIFO_DATA, (nsmp * HBA_QUAD_SAMPLE_LEN),
+                   fifo_data_done) != 0) {
+        pctx->draining = 0;
+        edlog("Error reading samples from quadrature");
+    }
+}
+
+
+/**************************************************************
+ * fifo_data_done():  - completion callback for a read of samples
+ * during an interrupt drain.  Broadcast them to any UI monitoring
+ * the samples and read the count again.
+ **************************************************************/
+static void fifo_data_done(
+    void        *trans,      // our context
+    int          nsd,        // number of bytes received
+    uint8_t     *pkt)        // echoed header and the samples
+{
+    HBA_QUAD    *pctx;       // this peripheral's private info
+    SLOT        *pslot;      // This instance of the quad plug-in
+    RSC         *prsc;       // pointer to the samples resource
+    char         msg[MX_MSGLEN * 3 +1]; // text to send.  +1 for newline
+    int          tlen = 0;   // characters in msg
+    int          nsmp;       // number of samples in the response
+
+    pctx = (HBA_QUAD *) trans;
+    pslot = pctx->pslot;
+    prsc = &(pslot->rsc[RSC_SAMPLES]);
+
+    // The read returns the echoed header and then the samples
+    nsmp = (nsd - 4) / HBA_QUAD_SAMPLE_LEN;
+    if ((nsmp <= 0) || (nsd != ((nsmp * HBA_QUAD_SAMPLE_LEN) + 4))) {
+        pctx->draining = 0;
+        edlog("Error reading samples from quadrature");
+        return;
+    }
+    (void) put_samples(pctx, &(pkt[4]), nsmp, msg, sizeof(msg), &tlen,
+                       &(prsc->bkey));
+    if ((tlen > 0) && (prsc->bkey != 0)) {
+        bcst_ui(msg, tlen, &(prsc->bkey));
+    }
+    pctx->ndrained += nsmp;
+
+    if (read_async(pctx, HBA_QUAD_REG_FIFO_COUNT, 3, fifo_stat_done) != 0) {
+        pctx->draining = 0;
+        edlog("Error reading samples from quadrature");
+    }
+}
+
+
+/**************************************************************
+ * write_done():  - completion callback for a queued write.
+ * Nothing waits on it so a failure can only be logged.
+ **************************************************************/
+static void write_done(
+    void        *trans,      // our context
+    int          nsd,        // number of bytes received
+    uint8_t     *pkt)        // the response
+{
+    // We did a write so the sendrecv return value should be 1
+    // and the returned byte should be an ACK
+    if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
+        edlog("Error writing value to quadrature");
+    }
+}
+
+
+/**************************************************************
+ * core_telemetry():  - telemetry handler for this peripheral.
+ * Takes the encoder and speed registers, or the period registers,
+ * from a telemetry frame if the frame has all of them.
+ **************************************************************/
+void core_telemetry(
+    void        *trans,      // our context
+    int          reg,        // first register in data
+    int          count,      // number of registers in data
+    uint8_t     *data)       // the register values
+{
+    if ((reg == HBA_QUAD_REG_ENC0_LSB) && (count >= 6)) {
+        core_update((HBA_QUAD *) trans, data);
+    }
+    else if ((reg == HBA_QUAD_REG_PERIOD) && (count >= HBA_QUAD_NPERIOD)) {
+        rate_update((HBA_QUAD *) trans, data);
+    }
+}
+
+
+/**************************************************************
+ * core_update():  - Record new encoder and speed values and
+ * broadcast the ones that changed.  The data is the six registers
+ * starting at enc0 lsb.
+ **************************************************************/
+static void core_update(
+    HBA_QUAD    *pctx,       // this peripheral's private info
+    uint8_t     *data)       // registers enc0 lsb to speed right
+{
     SLOT        *pslot;      // This instance of the serial plug-in
     RSC         *prsc;       // pointer to this slot's counts resource
-    int          nsd;        // number of bytes sent to FPGA
-    uint8_t      pkt[HBA_MXPKT];
     char         msg[MX_MSGLEN * 3 +1]; // text to send.  +1 for newline
     int          slen;       // length of text to output
     int          newenc0;
@@ -632,35 +934,11 @@ void core_interrupt(void *trans)
     int          new_speed_left;
     int          new_speed_right;
 
-    // get pointers to this instance of the plug-in and its slot
-    pctx = (HBA_QUAD *) trans; // transparent data is our context
+    newenc0 = (data[1]<<8) | data[0];   // Reconstruct 16-bit value.
+    newenc1 = (data[3]<<8) | data[2];   // Reconstruct 16-bit value.
 
-    // Read value in quadrature registers
-    // Read four bytes offset by -1 (4 -1)
-    pkt[0] = HBA_READ_CMD | ((6 -1) << 4) | pctx->coreid;
-    pkt[1] = HBA_QUAD_REG_ENC0_LSB;
-    pkt[2] = 0;                     // dummy byte (cmd)
-    pkt[3] = 0;                     // dummy byte (reg)
-    pkt[4] = 0;                     // dummy byte (q0 low)
-    pkt[5] = 0;                     // dummy byte (q0 high)
-    pkt[6] = 0;                     // dummy byte (q1 low)
-    pkt[7] = 0;                     // dummy byte (q1 high)
-    pkt[8] = 0;                     // dummy byte (q0 speed)
-    pkt[9] = 0;                     // dummy byte (q1 speed)
-
-    nsd = pctx->sendrecv_pkt(pctx->parent, 10, pkt);
-
-    // We sent header + eight bytes so the sendrecv return value should be 8
-    if (nsd != 8) {
-        // error reading value from QUAD port
-        edlog("Error reading value from quadrature");
-        return;
-    }
-    newenc0 = (pkt[3]<<8) | pkt[2];   // Reconstruct 16-bit value.
-    newenc1 = (pkt[5]<<8) | pkt[4];   // Reconstruct 16-bit value.
-
-    new_speed_left = pkt[6];
-    new_speed_right = pkt[7];
+    new_speed_left = data[4];
+    new_speed_right = data[5];
 
     // Check for negative values
     if (newenc0 >= 0x8000) {
@@ -676,8 +954,26 @@ void core_interrupt(void *trans)
         new_speed_right = new_speed_right - 0x100;
     }
 
-    // Broadcast encoder 0 if it's changed and any UI is monitoring it
     pslot = pctx->pslot;
+
+    // Extend the counts and move the pose.  Broadcast both if they
+    // changed and any UI is monitoring them.
+    if (odom_update(pctx, newenc0, newenc1)) {
+        prsc = &(pslot->rsc[RSC_POS64]);
+        if (prsc->bkey != 0) {
+            slen = snprintf(msg, (MX_MSGLEN -1), "%lld %lld\n",
+                     (long long) pctx->pos0, (long long) pctx->pos1);
+            bcst_ui(msg, slen, &(prsc->bkey));
+        }
+        prsc = &(pslot->rsc[RSC_POSE]);
+        if ((prsc->bkey != 0) && (pctx->track != 0.0)) {
+            slen = snprintf(msg, (MX_MSGLEN -1), "%.1f %.1f %.2f\n", pctx->x,
+                     pctx->y, (pctx->heading * 180.0 / M_PI));
+            bcst_ui(msg, slen, &(prsc->bkey));
+        }
+    }
+
+    // Broadcast encoder 0 if it's changed and any UI is monitoring it
     if (newenc0 != pctx->enc0) {
         prsc = &(pslot->rsc[RSC_ENC0]);
         if (prsc->bkey != 0) {
@@ -719,5 +1015,230 @@ void core_interrupt(void *trans)
 }
 
 
+/**************************************************************
+ * odom_update():  - Add the change in the counts since the last
+ * update to the 64 bit counts and, if the geometry is set, move
+ * the pose.  The 16 bit counts wrap so the change is taken as a
+ * 16 bit signed value.  This is right as long as each wheel moves
+ * less than 32767 ticks between updates.  Turn on interrupts or
+ * telemetry if a slow poll rate could miss that.  Returns 1 if
+ * either count changed and 0 if not.  Call before pctx->enc0 and
+ * pctx->enc1 are set to the new counts.
+ **************************************************************/
+static int odom_update(
+    HBA_QUAD    *pctx,       // this peripheral's private info
+    int          newenc0,    // new left count
+    int          newenc1)    // new right count
+{
+    int          d0;         // left ticks since the last update
+    int          d1;         // right ticks since the last update
+    double       dl;         // mm the left wheel moved
+    double       dr;         // mm the right wheel moved
+    double       dc;         // mm the center moved
+    double       dth;        // change in heading in radians
+
+    d0 = (int16_t) (uint16_t) (newenc0 - pctx->enc0);
+    d1 = (int16_t) (uint16_t) (newenc1 - pctx->enc1);
+
+    // The first counts read may be from before we started.  They are
+    // where the 64 bit counts start, not a move.
+    if (pctx->havecount == 0) {
+        pctx->havecount = 1;
+        return((d0 != 0) || (d1 != 0));
+    }
+    if ((d0 == 0) && (d1 == 0)) {
+        return(0);
+    }
+    pctx->pos0 += d0;
+    pctx->pos1 += d1;
+    if (pctx->track == 0.0) {
+        return(1);
+    }
+
+    // Differential drive.  The center moves the average of the two
+    // wheels along the heading halfway through the turn.
+    dl = d0 * pctx->mmpt0;
+    dr = d1 * pctx->mmpt1;
+    dc = (dl + dr) / 2.0;
+    dth = (dr - dl) / pctx->track;
+    pctx->x += dc * cos(pctx->heading + (dth / 2.0));
+    pctx->y += dc * sin(pctx->heading + (dth / 2.0));
+    pctx->heading = remainder((pctx->heading + dth), (2.0 * M_PI));
+
+    return(1);
+}
+
+
+/**************************************************************
+ * rate_update():  - Turn the periods into ticks per second and
+ * broadcast them if they changed.  The data is the registers from
+ * the left period to the direction register.
+ **************************************************************/
+static void rate_update(
+    HBA_QUAD    *pctx,       // this peripheral's private info
+    uint8_t     *data)       // registers left period lsb to direction
+{
+    SLOT        *pslot;      // This instance of the quad plug-in
+    RSC         *prsc;       // pointer to this slot's rate resource
+    char         msg[MX_MSGLEN];  // text to send
+    int          slen;       // length of text to output
+    double       rate[2];    // new ticks per second, left and right
+    uint32_t     period;     // hba_clk cycles per tick
+    int          i;
+
+    for (i = 0; i < 2; i++) {
+        period = data[(3 * i)] | (data[(3 * i) + 1] << 8) |
+                 (data[(3 * i) + 2] << 16);
+        if ((period == 0) || (period == HBA_QUAD_PERIOD_MAX)) {
+            rate[i] = 0.0;           // stopped
+        }
+        else {
+            rate[i] = (double) pctx->clkhz / period;
+            if (data[6] & (1 << i)) {
+                rate[i] = -rate[i];
+            }
+        }
+    }
+
+    // Broadcast the rates if they changed and any UI is monitoring them
+    if ((rate[0] != pctx->rate0) || (rate[1] != pctx->rate1)) {
+        pslot = pctx->pslot;
+        prsc = &(pslot->rsc[RSC_RATE]);
+        if (prsc->bkey != 0) {
+            slen = snprintf(msg, (MX_MSGLEN -1), "%.2f %.2f\n", rate[0], rate[1]);
+            bcst_ui(msg, slen, &(prsc->bkey));
+        }
+    }
+    pctx->rate0 = rate[0];
+    pctx->rate1 = rate[1];
+}
+
+
+/**************************************************************
+ * write_reg():  - Write one register.  Returns 0 on success and
+ * -1 if the FPGA did not ACK the write.
+ **************************************************************/
+static int write_reg(
+    HBA_QUAD *pctx,      // hba_quad private info
+    int       reg,       // register to write
+    int       val)       // its new value
+{
+    int       nsd;       // number of bytes received
+    uint8_t   pkt[HBA_MXPKT];
+
+    pkt[0] = HBA_WRITE_CMD | ((1 -1) << 4) | pctx->coreid;
+    pkt[1] = reg;
+    pkt[2] = val;                           // new value
+    pkt[3] = 0;                             // dummy for the ack
+    nsd = pctx->ops->send(pctx->ops->ctx, 4, pkt);
+    // We did a write so the sendrecv return value should be 1
+    // and the returned byte should be an ACK
+    if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
+        return(-1);
+    }
+    return(0);
+}
+
+
+/**************************************************************
+ * drain_samples():  - Read up to nmax samples from the FIFO and
+ * put them in text as "timestamp enc0 enc1" lines.  Each extended
+ * read from the FIFO data registers takes up to HBA_QUAD_MXDRAIN
+ * samples.  len must have room for nmax lines.  Returns the number
+ * of characters in text or -1 on error.
+ **************************************************************/
+static int drain_samples(
+    HBA_QUAD *pctx,      // hba_quad private info
+    int       nmax,      // most samples to read
+    char     *text,      // where to put the samples
+    int       len)       // size of text
+{
+    uint8_t   stat[HBA_MXPKT];      // count, watermark, and dropped
+    uint8_t   pkt[HBA_MXPKT_EXT];
+    int       nsmp;      // number of samples in this read
+    int       nsd;       // number of bytes received
+    int       tlen = 0;  // characters in text
+
+    text[0] = (char) 0;
+    while (nmax > 0) {
+        if (read_regs(pctx, HBA_QUAD_REG_FIFO_COUNT, 3, stat) != 0) {
+            return(-1);
+        }
+        if (stat[2] != 0) {
+            edlog("%s: %d samples dropped", PLUGIN_NAME, stat[2]);
+            (void) write_reg(pctx, HBA_QUAD_REG_FIFO_DROP, 0);
+        }
+        nsmp = (stat[0] < nmax) ? stat[0] : nmax;
+        nsmp = (nsmp < HBA_QUAD_MXDRAIN) ? nsmp : HBA_QUAD_MXDRAIN;
+        if (nsmp == 0) {
+            break;
+        }
+
+        pkt[0] = HBA_READ_CMD | HBA_EXT_CMD;
+        pkt[1] = pctx->coreid;
+        pkt[2] = HBA_QUAD_REG_FIFO_DATA;
+        pkt[3] = nsmp * HBA_QUAD_SAMPLE_LEN;
+        (void) memset(&(pkt[4]), 0, (pkt[3] + 4));  // dummies for echo and data
+        nsd = pctx->ops->send(pctx->ops->ctx, (pkt[3] + 8), pkt);
+
+        // The read returns the echoed header and then the samples
+        if (nsd != ((nsmp * HBA_QUAD_SAMPLE_LEN) + 4)) {
+            return(-1);
+        }
+        if (put_samples(pctx, &(pkt[4]), nsmp, text, len, &tlen, (int *) 0) != 0) {
+            return(tlen);       // no room.  Keep whole lines only.
+        }
+        nmax -= nsmp;
+    }
+    return(tlen);
+}
+
+
+/**************************************************************
+ * put_samples():  - Add nsmp samples read from the FIFO to text
+ * as "timestamp enc0 enc1" lines starting at *ptlen.  The
+ * timestamp is in ms and is extended past its 16 bit wrap.  With
+ * pbkey the text is broadcast each time it fills and then starts
+ * over, so text need only hold a few lines.  Returns 0, or -1 if
+ * text filled with no pbkey.
+ **************************************************************/
+static int put_samples(
+    HBA_QUAD *pctx,      // hba_quad private info
+    uint8_t  *data,      // the samples
+    int       nsmp,      // number of samples in data
+    char     *text,      // where to put the samples
+    int       len,       // size of text
+    int      *ptlen,     // characters in text
+    int      *pbkey)     // broadcast key, or 0 to keep the text
+{
+    uint8_t  *smp;       // one sample in data
+    int       ts16;      // 16 bit timestamp of a sample
+    int       ret;       // characters in one line
+    int       i;
+
+    for (i = 0; i < nsmp; i++) {
+        smp = &(data[i * HBA_QUAD_SAMPLE_LEN]);
+        ts16 = (smp[1] << 8) | smp[0];
+        pctx->ts += (uint16_t) (ts16 - pctx->ts16);
+        pctx->ts16 = ts16;
+        if ((pbkey != (int *) 0) && ((len - *ptlen) <= HBA_QUAD_SAMPLE_TXT)) {
+            if (*pbkey != 0) {
+                bcst_ui(text, *ptlen, pbkey);
+            }
+            *ptlen = 0;
+        }
+        ret = snprintf(&(text[*ptlen]), (len - *ptlen), "%lld %d %d\n",
+                  (long long) pctx->ts, (int16_t) ((smp[3] << 8) | smp[2]),
+                  (int16_t) ((smp[5] << 8) | smp[4]));
+        if ((ret < 0) || (ret >= (len - *ptlen))) {
+            text[*ptlen] = (char) 0;  // no room.  Keep whole lines only.
+            return(-1);
+        }
+        *ptlen += ret;
+    }
+    return(0);
+}
+
+
 // end of hba_enc.c
 
@@ -82,13 +82,12 @@
     // All state info for an instance of a SONAR port
 typedef struct
 {
-    int      parent;   // Slot number of parent peripheral.
+    HBA_OPS *ops;      // bus operations of the parent peripheral
     int      coreid;   // FPGA core ID with this SONAR
     void    *pslot;    // handle to plug-in's's slot info
     int      ctrl;     // most recent value to display on ctrl
     int      sonar0;   // most recent sonar0 value
     int      sonar1;   // most recent sonar1 value
-    int      (*sendrecv_pkt)();  // routine to send data to the FPGA
 } HBA_SONAR;
 
 
@@ -98,6 +97,9 @@ typedef struct
 static void usercmd(int, int, char*, SLOT*, int, int*, char*);
 extern SLOT Slots[];
 static void core_interrupt();
+static void core_telemetry();
+static void core_update(HBA_SONAR *, uint8_t *);
+static void sonar_done(void *, int, uint8_t *);
 
 
 /**************************************************************
@@ -108,8 +110,6 @@ int Initialize(
     SLOT *pslot)       // points to the SLOT for this plug-in
 {
     HBA_SONAR *pctx;  // our local context
-    const char *errmsg; // error message from dlsym
-    void        *reg_intr;  // use this to register and interrupt handler
 
     // Allocate memory for this plug-in
     pctx = (HBA_SONAR *) malloc(sizeof(HBA_SONAR));
@@ -120,7 +120,6 @@ int Initialize(
     }
 
     // Init our HBA_SONAR structure
-    pctx->parent = hba_parent();     // Slot number of parent peripheral.
     pctx->coreid = HBA_SONAR_COREID; // Immutable.
     pctx->pslot = pslot;             // this instance of a dual sonar receiver
 
@@ -154,15 +153,11 @@ int Initialize(
     pslot->rsc[RSC_SONAR1].uilock = -1;
     pslot->rsc[RSC_SONAR1].slot = pslot;
 
-    // The serial_fpga plug-in has a routine to send packets to the FPGA
-    // and to return with packet data from the FPGA.  We need to look up
-    // this, 'sendrecv_pkt', address from within serial_fpga.so.
-    // We cache the routine address so we don't need to look it up every
-    // time we want to send a packet.
-    dlerror();                  /* Clear any existing error */
-    *(void **) (&(pctx->sendrecv_pkt)) = dlsym(Slots[pctx->parent].handle, "sendrecv_pkt");
-    errmsg = dlerror();         /* check for errors */
-    if (errmsg != NULL) {
+    // The serial_fpga plug-in has the routines to send packets to the
+    // FPGA and to register our handlers.  Get its table of them once
+    // here so each packet goes straight to serial_fpga.
+    pctx->ops = hba_ops();
+    if (pctx->ops == (HBA_OPS *) 0) {
         return(-1);
     }
 
@@ -172,15 +167,12 @@ int Initialize(
     // core's interrupt handler and invokes it.
     // The code below registers this core's interrupt handler with
     // serial_fpga.
-    dlerror();                  /* Clear any existing error */
-    reg_intr = dlsym(Slots[pctx->parent].handle, "register_interrupt_handler");
-    if (errmsg != NULL) {
-        return(-1);
-    }
     // Pass in the core ID of this plug-in...
-    if (reg_intr != (void *) 0) {
-        ((void (*)())reg_intr) (pctx->parent, pctx->coreid, &core_interrupt, (void *) pctx);
-    }
+    pctx->ops->reg_intr(pctx->ops->ctx, pctx->coreid, &core_interrupt, (void *) pctx);
+
+    // serial_fpga can also send our registers in telemetry frames.
+    // Register the routine that takes them.
+    pctx->ops->reg_telemetry(pctx->ops->ctx, pctx->coreid, &core_telemetry, (void *) pctx);
 
     return (0);
 }
@@ -222,7 +214,7 @@ void usercmd(
         pkt[1] = HBA_SONAR_REG_CTRL;
         pkt[2] = pctx->ctrl;                     // new value
         pkt[3] = 0;                             // dummy for the ack
-        nsd = pctx->sendrecv_pkt(pctx->parent, 4, pkt);
+        nsd = pctx->ops->send(pctx->ops->ctx, 4, pkt);
         // We did a write so the sendrecv return value should be 1
         // and the returned byte should be an ACK
         if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
@@ -240,7 +232,7 @@ void usercmd(
         pkt[2] = 0;                     // (cmd)
         pkt[3] = 0;                     // (reg)
         pkt[4] = 0;                     // (sonar0)
-        nsd = pctx->sendrecv_pkt(pctx->parent, 5, pkt);
+        nsd = pctx->ops->send(pctx->ops->ctx, 5, pkt);
         // We sent header + one byte so the sendrecv return value should be 3
         if (nsd != 3) {
             // error reading sonar0 from SONAR port
@@ -260,7 +252,7 @@ void usercmd(
         pkt[2] = 0;                     // (cmd)
         pkt[3] = 0;                     // (reg)
         pkt[4] = 0;                     // (sonar1)
-        nsd = pctx->sendrecv_pkt(pctx->parent, 5, pkt);
+        nsd = pctx->ops->send(pctx->ops->ctx, 5, pkt);
         // We sent header + one byte so the sendrecv return value should be 3
         if (nsd != 3) {
             // error reading sonar1 from SONAR port
@@ -282,19 +274,13 @@ void usercmd(
 
 
 /**************************************************************
- * core_interrupt():  - interrupt handler for this peripheral
+ * core_interrupt():  - interrupt handler for this peripheral.
+ * Queue the read of the sonar registers.  sonar_done() gets the values.
  **************************************************************/
 void core_interrupt(void *trans)
 {
     HBA_SONAR   *pctx;       // this peripheral's private info
-    SLOT        *pslot;      // This instance of the serial plug-in
-    RSC         *prsc;       // pointer to this slot's counts resource
-    int          nsd;        // number of bytes sent to FPGA
     uint8_t      pkt[HBA_MXPKT];  
-    char         msg[MX_MSGLEN * 3 +1]; // text to send.  +1 for newline
-    int          slen;       // length of text to output
-    int          new0;
-    int          new1;
 
     // get pointers to this instance of the plug-in and its slot
     pctx = (HBA_SONAR *) trans; // transparent data is our context
@@ -308,15 +294,64 @@ void core_interrupt(void *trans)
     pkt[4] = 0;                     // dummy byte (echo0)
     pkt[5] = 0;                     // dummy byte (echo1)
 
-    nsd = pctx->sendrecv_pkt(pctx->parent, 6, pkt);
-    // We sent header + four bytes so the sendrecv return value should be 4
+    if (pctx->ops->send_async(pctx->ops->ctx, 6, pkt, sonar_done, (void *) pctx) != 0) {
+        edlog("Error reading value from SONAR");
+    }
+}
+
+
+/**************************************************************
+ * sonar_done():  - completion callback for the interrupt's read
+ * of the sonar registers.
+ **************************************************************/
+static void sonar_done(
+    void        *trans,      // our context
+    int          nsd,        // number of bytes received
+    uint8_t     *pkt)        // echoed header and the registers
+{
+    // We sent header + two bytes so the sendrecv return value should be 4
     if (nsd != 4) {
-        // error reading value from SONAR port
         edlog("Error reading value from SONAR");
         return;
     }
-    new0 = pkt[2];   // first two bytes are echo of header
-    new1 = pkt[3];
+    core_update((HBA_SONAR *) trans, &(pkt[2]));     // first two bytes are echo of header
+}
+
+
+/**************************************************************
+ * core_telemetry():  - telemetry handler for this peripheral.
+ * Takes the two sonar registers from a telemetry frame if the
+ * frame has both of them.
+ **************************************************************/
+void core_telemetry(
+    void        *trans,      // our context
+    int          reg,        // first register in data
+    int          count,      // number of registers in data
+    uint8_t     *data)       // the register values
+{
+    if ((reg == HBA_SONAR_REG_SONAR0) && (count >= 2)) {
+        core_update((HBA_SONAR *) trans, data);
+    }
+}
+
+
+/**************************************************************
+ * core_update():  - Record new sonar values and broadcast the
+ * ones that changed.  The data is the sonar0 and sonar1 registers.
+ **************************************************************/
+static void core_update(
+    HBA_SONAR   *pctx,       // this peripheral's private info
+    uint8_t     *data)       // registers sonar0 and sonar1
+{
+    SLOT        *pslot;      // This instance of the serial plug-in
+    RSC         *prsc;       // pointer to this slot's counts resource
+    char         msg[MX_MSGLEN * 3 +1]; // text to send.  +1 for newline
+    int          slen;       // length of text to output
+    int          new0;
+    int          new1;
+
+    new0 = data[0];
+    new1 = data[1];
 
     // Broadcast sonar0 if it's changed and any UI is monitoring it
     pslot = pctx->pslot;
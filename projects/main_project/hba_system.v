@@ -14,6 +14,7 @@
 *   3  |    hba_motor
 *   4  |    hba_sonar
 *   5  |    hba_quad
+*  15  |    reserved for the extended command
 *
 *
 * Author: Brandon Blodget
@@ -0,0 +1,102 @@
+/*
+********************************************
+* MODULE hba_system_sim.v
+*
+* This is the top level of the Verilator
+* co-simulation of hba_system.  It has the
+* pins of hba_system and brings out the HBA
+* bus and serial_fpga state that sim_main.cpp
+* needs for its cycle counts.
+*
+* Create Date: 10/17/2026
+*
+********************************************
+*/
+
+`timescale 1 ns / 1 ns
+
+// Force error when implicit net has no type.
+`default_nettype none
+
+module hba_system_sim #
+(
+    // Parameters
+    parameter integer CLK_FREQUENCY = 16_000_000,
+    parameter integer BAUD = 32'd115_200
+)
+(
+    input wire  clk,
+    input wire  reset,
+
+    // SLOT(0) : serial_fpga pins
+    input wire  rxd,
+    output wire txd,
+    output wire intr,
+
+    // SLOT(1) : hba_basicio pins
+    output wire [7:0] basicio_led,
+    input wire [7:0] basicio_button,
+
+    // SLOT(2) : hba_qtr pins
+    output wire [1:0] qtr_out_en,
+    output wire [1:0] qtr_out_sig,
+    input wire [1:0] qtr_in_sig,
+    output wire [1:0] qtr_ctrl,
+
+    // SLOT(3) : hba_motor pins
+    output wire [1:0] motor_pwm,
+    output wire [1:0] motor_dir,
+    output wire [1:0] motor_float_n,
+
+    // SLOT(4) : hba_sonar pins
+    output wire [1:0] sonar_trig,
+    input wire [1:0] sonar_echo,
+
+    // SLOT(5) : hba_quad pins
+    input wire [1:0] quad_enc_a,
+    input wire [1:0] quad_enc_b,
+
+    // Probes for the cycle counts
+    output wire sim_hba_select,     // a bus transfer is in progress
+    output wire sim_hba_xferack,    // a bus transfer is done
+    output wire [4:0] sim_serial_state  // serial_fpga state machine
+);
+
+hba_system #
+(
+    .CLK_FREQUENCY(CLK_FREQUENCY),
+    .BAUD(BAUD)
+) hba_system_inst
+(
+    .clk(clk),
+    .reset(reset),
+
+    .rxd(rxd),
+    .txd(txd),
+    .intr(intr),
+
+    .basicio_led(basicio_led),
+    .basicio_button(basicio_button),
+
+    .qtr_out_en(qtr_out_en),
+    .qtr_out_sig(qtr_out_sig),
+    .qtr_in_sig(qtr_in_sig),
+    .qtr_ctrl(qtr_ctrl),
+
+    .motor_pwm(motor_pwm),
+    .motor_dir(motor_dir),
+    .motor_float_n(motor_float_n),
+
+    .sonar_trig(sonar_trig),
+    .sonar_echo(sonar_echo),
+
+    .quad_enc_a(quad_enc_a),
+    .quad_enc_b(quad_enc_b)
+);
+
+assign sim_hba_select = hba_system_inst.hba_select;
+assign sim_hba_xferack = hba_system_inst.hba_xferack;
+assign sim_serial_state = hba_system_inst.serial_fpga_inst.serial_state;
+
+endmodule
+
@@ -0,0 +1,544 @@
+/* sim_main.cpp  :  Verilator co-simulation of hba_system.
+ * The uart pins of the RTL are bridged to a pseudo-terminal so that
+ * serial_fpga, hbaserver, and the apps run against the real RTL one
+ * clock at a time.  io_intr drives a FIFO that serial_fpga reads in
+ * place of a GPIO pin.  Point serial_fpga at the simulation with:
+ *   hbaset serial_fpga port /tmp/hba_fpga
+ *   hbaset serial_fpga intrr_pin /tmp/hba_intr
+ *
+ * Host chars are shifted onto rxd, and txd is sampled, at the baud
+ * rate the host has set on the pty.  A rate the RTL is not at garbles
+ * chars the way it would on the wire.  A pty has no break so the
+ * host's flush of its input at the end of a break is turned into a
+ * break on rxd.
+ *
+ * The sensors are simple models.  The QTR pins decay QTR_US after
+ * they are released, each sonar echoes SONAR_US after its trigger,
+ * and each motor's pwm turns its encoder.  The buttons are not
+ * pressed.
+ *
+ * The simulated clock is held to real time so the host's timeouts
+ * work.  If the simulation can not keep up the report says so.
+ * Lower CLK_HZ in the Makefile to catch up.
+ *
+ * The report has:
+ *   cycles per command : from the cycle serial_fpga has a command
+ *                        byte to the cycle it is idle again
+ *   bus busy           : share of the cycles with hba_select high
+ *   link busy          : share of the cycles a char is on rxd or txd
+ * It is printed every -s seconds of simulated time, at the end of
+ * a -t run, and on ^C.
+ *
+ * Usage: Vhba_system_sim [-l link] [-i fifo] [-s sec] [-t sec] [-f]
+ *   -l : symlink to make to the pty (/tmp/hba_fpga)
+ *   -i : path of the interrupt FIFO (/tmp/hba_intr)
+ *   -s : seconds of simulated time between reports (0=none)
+ *   -t : seconds of simulated time to run (0=until ^C)
+ *   -f : run as fast as possible, not in real time
+ *
+ * Build with: make compile
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <asm/termbits.h>        // termios2 for any baud rate
+#include "Vhba_system_sim.h"
+#include "verilated.h"
+
+        // These come from the Makefile
+#ifndef CLK_HZ
+#define CLK_HZ        (16000000)
+#endif
+#ifndef BAUD
+#define BAUD          (115200)
+#endif
+        // serial_fpga states.  See the localparams in serial_fpga.v
+#define ST_IDLE       (0)
+#define ST_REG_ADDR   (1)
+#define ST_EXT_CORE   (10)
+#define ST_TM_CANCEL  (14)
+        // Length of the break made of the host's flush in bit times.
+        // It must be longer than serial_fpga's BREAK_BITS.
+#define BREAK_BITS    (40)
+        // Queue entry for a break
+#define RXQ_BREAK     (0x100)
+#define RXQ_SZ        (8192)
+        // Cycles between reads of the pty and between real-time checks
+#define POLL_CYCLES   (256)
+#define RT_CYCLES     (CLK_HZ / 1000)
+#define RESET_CYCLES  (16)
+        // Sensor models
+#define QTR_US        (400)     // QTR decay time
+#define SONAR_US      (5800)    // echo time of a target 100 cm away
+#define SONAR_DLY_US  (100)     // time from trigger to echo
+#define ENC_RATE      (1000)    // encoder edges per second at full duty
+        // Defaults
+#define DEF_LINK      "/tmp/hba_fpga"
+#define DEF_FIFO      "/tmp/hba_intr"
+
+static Vhba_system_sim *Top;
+static uint64_t Cycle;          // clock cycles since the start
+static int      Mfd = -1;       // pty master
+static int      Irfd = -1;      // io_intr FIFO
+static uint32_t Hostbaud = BAUD;  // rate set on the host's side
+static volatile sig_atomic_t Stop = 0;
+
+    // Host to FPGA: chars and breaks waiting for rxd
+static uint16_t Rxq[RXQ_SZ];
+static int      Rxhead, Rxn;
+static int      Rxbusy;         // ==1 while a char or break is on rxd
+static uint64_t Rxstart;        // cycle the start bit went out
+static uint32_t Rxbaud;         // rate of the char on rxd
+static uint64_t Rxframe;        // the bits, LSB first
+static int      Rxnbit;         // number of bits in Rxframe
+
+    // FPGA to host: the char being sampled on txd
+static int      Txbusy;         // ==1 while receiving a char
+static uint64_t Txstart;        // cycle of the falling edge of start
+static uint32_t Txbaud;         // rate of the char
+static int      Txbit;          // next bit to sample.  0 is start.
+static uint8_t  Txchar;
+static int      Txprev = 1;     // txd on the last cycle
+
+    // Sensor state
+static uint64_t Qtrrel[2];      // cycle each QTR pin was released
+static uint64_t Sontrig[2];     // cycle of each sonar's trigger
+static int      Sonprev[2];
+static uint64_t Encacc[2];      // pwm high cycles toward the next edge
+static int      Encphase[2];    // quadrature phase, 0 to 3
+
+    // Counts for the report
+typedef struct
+{
+    uint64_t cycles;
+    uint64_t ncmd;              // commands carried out
+    uint64_t nframe;            // telemetry and snapshot frames sent
+    uint64_t cmdcycles;         // cycles in commands
+    uint64_t cmdmin, cmdmax;
+    uint64_t selcycles;         // cycles with hba_select high
+    uint64_t nxfer;             // bus transfers
+    uint64_t rxcycles;          // cycles a char was on rxd
+    uint64_t txcycles;          // cycles a char was on txd
+    uint64_t nrx, ntx;          // chars each way
+    uint64_t nbreak;            // breaks sent on rxd
+    uint64_t nferr;             // chars from txd with a framing error
+    uint64_t ndrop;             // host chars lost to a full queue
+    double   wall;              // real seconds
+} STATS;
+static STATS    St;
+static STATS    Last;           // counts at the last report
+static int      State;          // serial_fpga state on the last cycle
+static uint64_t Cmdstart;       // cycle the command started
+static int      Xferprev;
+
+
+/* now_s() : Return the CLOCK_MONOTONIC time in seconds */
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(ts.tv_sec + (ts.tv_nsec / 1e9));
+}
+
+
+/* us2cyc() : Convert us to clock cycles */
+static uint64_t us2cyc(uint64_t us)
+{
+    return((us * CLK_HZ) / 1000000);
+}
+
+
+/* pty_open() : Open the pty in packet mode so the host's flushes
+ * show up and keep the slave open so the master never sees a hangup.
+ * Return the name of the slave.
+ */
+static char *pty_open(void)
+{
+    struct termios2 t;
+    char    *pts;
+    int      sfd;
+    int      one = 1;
+
+    Mfd = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((Mfd < 0) || (grantpt(Mfd) < 0) || (unlockpt(Mfd) < 0) ||
+        (ioctl(Mfd, TIOCPKT, &one) < 0)) {
+        perror("pty");
+        exit(1);
+    }
+    pts = ptsname(Mfd);
+    sfd = open(pts, O_RDWR | O_NOCTTY);
+    if ((sfd < 0) || (ioctl(sfd, TCGETS2, &t) < 0)) {
+        perror(pts);
+        exit(1);
+    }
+    t.c_iflag = 0;
+    t.c_oflag = 0;
+    t.c_lflag = 0;
+    t.c_cflag = CS8 | CREAD | CLOCAL | BOTHER;
+    t.c_ispeed = BAUD;
+    t.c_ospeed = BAUD;
+    t.c_cc[VMIN] = 1;
+    t.c_cc[VTIME] = 0;
+    (void) ioctl(sfd, TCSETS2, &t);
+    (void) fcntl(Mfd, F_SETFL, O_NONBLOCK);
+    return(pts);
+}
+
+
+/* pty_poll() : Queue the chars from the host and a break for each
+ * flush of the host's input.  Get the host's baud rate.
+ */
+static void pty_poll(void)
+{
+    struct termios2 t;
+    uint8_t  buf[1024];
+    int      ret;
+    int      i;
+
+    if (ioctl(Mfd, TCGETS2, &t) == 0)
+        Hostbaud = t.c_ospeed;
+
+    ret = read(Mfd, buf, sizeof(buf));
+    if (ret <= 0)
+        return;
+    // In packet mode the first byte is 0 for data or has the flags
+    // of a flush of the host side
+    if (buf[0] != TIOCPKT_DATA) {
+        if ((buf[0] & TIOCPKT_FLUSHREAD) && (Rxn < RXQ_SZ)) {
+            Rxq[(Rxhead + Rxn++) % RXQ_SZ] = RXQ_BREAK;
+        }
+        return;
+    }
+    for (i = 1; i < ret; i++) {
+        if (Rxn == RXQ_SZ) {
+            St.ndrop += ret - i;
+            break;
+        }
+        Rxq[(Rxhead + Rxn++) % RXQ_SZ] = buf[i];
+    }
+}
+
+
+/* drive_rxd() : Shift the queued chars and breaks onto rxd */
+static int drive_rxd(void)
+{
+    uint64_t bit;
+
+    if (!Rxbusy && (Rxn > 0)) {
+        uint16_t c = Rxq[Rxhead];
+
+        Rxhead = (Rxhead + 1) % RXQ_SZ;
+        Rxn--;
+        Rxbusy = 1;
+        Rxstart = Cycle;
+        Rxbaud = Hostbaud;
+        if (c == RXQ_BREAK) {
+            Rxframe = 0;
+            Rxnbit = BREAK_BITS;
+            St.nbreak++;
+        }
+        else {
+            // start bit, 8 data bits LSB first, stop bit
+            Rxframe = (1 << 9) | (c << 1);
+            Rxnbit = 10;
+            St.nrx++;
+        }
+    }
+    if (!Rxbusy)
+        return(1);
+    St.rxcycles++;
+    bit = ((Cycle - Rxstart) * Rxbaud) / CLK_HZ;
+    if (bit >= (uint64_t) Rxnbit) {
+        Rxbusy = 0;
+        return(1);
+    }
+    return((Rxframe >> bit) & 1);
+}
+
+
+/* sample_txd() : Receive the chars on txd in the middle of each bit
+ * and send them to the host.  A char without a stop bit is sent as
+ * a 0 the way a uart does.
+ */
+static void sample_txd(int txd)
+{
+    uint64_t at;
+
+    if (!Txbusy) {
+        if (Txprev && !txd) {
+            Txbusy = 1;
+            Txstart = Cycle;
+            Txbaud = Hostbaud;
+            Txbit = 0;
+            Txchar = 0;
+        }
+        Txprev = txd;
+        return;
+    }
+    Txprev = txd;
+    St.txcycles++;
+    at = Txstart + (((2 * Txbit + 1) * (uint64_t) CLK_HZ) / (2 * Txbaud));
+    if (Cycle < at)
+        return;
+    if (Txbit == 0) {
+        if (txd)
+            Txbusy = 0;          // a glitch, not a start bit
+    }
+    else if (Txbit <= 8) {
+        Txchar |= (txd << (Txbit - 1));
+    }
+    else {
+        if (!txd) {
+            St.nferr++;
+            Txchar = 0;
+        }
+        (void) write(Mfd, &Txchar, 1);
+        St.ntx++;
+        Txbusy = 0;
+        return;
+    }
+    Txbit++;
+}
+
+
+/* sensors() : Drive the sensor inputs from the outputs of the RTL */
+static void sensors(void)
+{
+    static const uint8_t quad[4] = { 0x0, 0x1, 0x3, 0x2 }; // B:A
+    uint8_t  qtr = 0;
+    uint8_t  echo = 0;
+    uint8_t  enca = 0, encb = 0;
+    int      i;
+
+    for (i = 0; i < 2; i++) {
+        // QTR: the pin follows the RTL while it drives it and stays
+        // high QTR_US once released
+        if ((Top->qtr_out_en >> i) & 1) {
+            qtr |= ((Top->qtr_out_sig >> i) & 1) << i;
+            Qtrrel[i] = Cycle;
+        }
+        else if ((Cycle - Qtrrel[i]) < us2cyc(QTR_US)) {
+            qtr |= (1 << i);
+        }
+
+        // Sonar: echo on the falling edge of the trigger
+        if (Sonprev[i] && !((Top->sonar_trig >> i) & 1))
+            Sontrig[i] = Cycle;
+        Sonprev[i] = (Top->sonar_trig >> i) & 1;
+        if ((Sontrig[i] != 0) &&
+            ((Cycle - Sontrig[i]) >= us2cyc(SONAR_DLY_US)) &&
+            ((Cycle - Sontrig[i]) < us2cyc(SONAR_DLY_US + SONAR_US)))
+            echo |= (1 << i);
+
+        // Encoder: ENC_RATE edges a second at full duty
+        if ((Top->motor_pwm >> i) & 1) {
+            Encacc[i] += ENC_RATE;
+            if (Encacc[i] >= CLK_HZ) {
+                Encacc[i] -= CLK_HZ;
+                Encphase[i] = (Encphase[i] + (((Top->motor_dir >> i) & 1) ? 3 : 1)) & 3;
+            }
+        }
+        enca |= (quad[Encphase[i]] & 1) << i;
+        encb |= ((quad[Encphase[i]] >> 1) & 1) << i;
+    }
+    Top->qtr_in_sig = qtr;
+    Top->sonar_echo = echo;
+    Top->quad_enc_a = enca;
+    Top->quad_enc_b = encb;
+}
+
+
+/* count() : Update the counts from the probes after a clock */
+static void count(void)
+{
+    int      state = Top->sim_serial_state;
+
+    St.cycles++;
+    if (Top->sim_hba_select)
+        St.selcycles++;
+    if (Top->sim_hba_xferack && !Xferprev)
+        St.nxfer++;
+    Xferprev = Top->sim_hba_xferack;
+
+    if ((State == ST_IDLE) && ((state == ST_REG_ADDR) || (state == ST_EXT_CORE))) {
+        Cmdstart = Cycle;
+    }
+    else if ((State == ST_IDLE) && (state == ST_TM_CANCEL)) {
+        St.nframe++;
+    }
+    else if ((State != ST_IDLE) && (state == ST_IDLE) && (Cmdstart != 0)) {
+        uint64_t n = Cycle - Cmdstart;
+
+        St.ncmd++;
+        St.cmdcycles += n;
+        if ((St.cmdmin == 0) || (n < St.cmdmin))
+            St.cmdmin = n;
+        if (n > St.cmdmax)
+            St.cmdmax = n;
+        Cmdstart = 0;
+    }
+    State = state;
+}
+
+
+/* report() : Print the counts since the last report and in total */
+static void report(void)
+{
+    STATS    d;
+    double   simsec;
+
+    d.cycles = St.cycles - Last.cycles;
+    d.ncmd = St.ncmd - Last.ncmd;
+    d.cmdcycles = St.cmdcycles - Last.cmdcycles;
+    d.selcycles = St.selcycles - Last.selcycles;
+    d.nxfer = St.nxfer - Last.nxfer;
+    d.wall = St.wall - Last.wall;
+    if (d.cycles == 0)
+        return;
+    simsec = (double) d.cycles / CLK_HZ;
+
+    printf("%.3f s: %.3f s simulated at %.2f x real time\n",
+           (double) St.cycles / CLK_HZ, simsec,
+           (d.wall > 0) ? (simsec / d.wall) : 0.0);
+    printf("  commands %llu (%.0f/s)  cycles per command %.1f",
+           (unsigned long long) d.ncmd, d.ncmd / simsec,
+           d.ncmd ? ((double) d.cmdcycles / d.ncmd) : 0.0);
+    printf("  min %llu max %llu\n", (unsigned long long) St.cmdmin,
+           (unsigned long long) St.cmdmax);
+    printf("  bus transfers %llu  bus busy %.3f%%  cycles per transfer %.1f\n",
+           (unsigned long long) d.nxfer, (100.0 * d.selcycles) / d.cycles,
+           d.nxfer ? ((double) d.selcycles / d.nxfer) : 0.0);
+    printf("  link rx %llu chars %.1f%% busy  tx %llu chars %.1f%% busy\n",
+           (unsigned long long) (St.nrx - Last.nrx),
+           (100.0 * (St.rxcycles - Last.rxcycles)) / d.cycles,
+           (unsigned long long) (St.ntx - Last.ntx),
+           (100.0 * (St.txcycles - Last.txcycles)) / d.cycles);
+    printf("  frames %llu  breaks %llu  framing errors %llu  dropped %llu\n",
+           (unsigned long long) St.nframe, (unsigned long long) St.nbreak,
+           (unsigned long long) St.nferr, (unsigned long long) St.ndrop);
+    fflush(stdout);
+    Last = St;
+}
+
+
+static void on_signal(int sig)
+{
+    (void) sig;
+    Stop = 1;
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *link = DEF_LINK;
+    const char *fifo = DEF_FIFO;
+    double   repsec = 10.0;      // seconds between reports
+    double   runsec = 0.0;       // seconds to run
+    int      realtime = 1;
+    uint64_t repcyc, runcyc;
+    double   start;
+    double   ahead;
+    int      intr = 0;
+    char    *pts;
+    int      opt;
+
+    Verilated::commandArgs(argc, argv);
+    while ((opt = getopt(argc, argv, "l:i:s:t:f")) != -1) {
+        switch (opt) {
+            case 'l':
+                link = optarg;
+                break;
+            case 'i':
+                fifo = optarg;
+                break;
+            case 's':
+                repsec = atof(optarg);
+                break;
+            case 't':
+                runsec = atof(optarg);
+                break;
+            case 'f':
+                realtime = 0;
+                break;
+            default:
+                printf("Usage: %s [-l link] [-i fifo] [-s sec] [-t sec] [-f]\n",
+                       argv[0]);
+                exit(1);
+        }
+    }
+    repcyc = (uint64_t) (repsec * CLK_HZ);
+    runcyc = (uint64_t) (runsec * CLK_HZ);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    pts = pty_open();
+    (void) unlink(link);
+    if (symlink(pts, link) < 0)
+        perror(link);
+    if ((mkfifo(fifo, 0666) < 0) && (errno != EEXIST))
+        perror(fifo);
+    // Opened read-write so the open does not wait for a reader
+    Irfd = open(fifo, O_RDWR | O_NONBLOCK);
+    if (Irfd < 0)
+        perror(fifo);
+    printf("hba_system at %d Hz on %s (%s) at %d baud, io_intr on %s\n",
+           CLK_HZ, link, pts, BAUD, fifo);
+
+    Top = new Vhba_system_sim;
+    Top->rxd = 1;
+    Top->basicio_button = 0;
+    Top->reset = 1;
+    start = now_s();
+
+    while (!Stop && ((runcyc == 0) || (Cycle < runcyc))) {
+        if (Cycle == RESET_CYCLES)
+            Top->reset = 0;
+        if ((Cycle % POLL_CYCLES) == 0)
+            pty_poll();
+
+        // Inputs change before the rising edge
+        Top->rxd = drive_rxd();
+        sensors();
+        Top->clk = 0;
+        Top->eval();
+        Top->clk = 1;
+        Top->eval();
+        Cycle++;
+
+        sample_txd(Top->txd);
+        count();
+        if (Top->intr != intr) {
+            intr = Top->intr;
+            if (Irfd >= 0)
+                (void) write(Irfd, intr ? "1" : "0", 1);
+        }
+
+        // Hold the simulated time to real time
+        if ((Cycle % RT_CYCLES) == 0) {
+            St.wall = now_s() - start;
+            ahead = ((double) Cycle / CLK_HZ) - St.wall;
+            if (realtime && (ahead > 0))
+                usleep((useconds_t) (ahead * 1e6));
+        }
+        if ((repcyc != 0) && ((Cycle % repcyc) == 0))
+            report();
+    }
+
+    St.wall = now_s() - start;
+    report();
+    Top->final();
+    delete Top;
+    return(0);
+}
@@ -20,7 +20,7 @@ module serial_test_tb;
 // Parameters
 parameter integer CLK_FREQUENCY     = 50_000_000;
 parameter integer BAUD              = 115_200;
-parameter integer NUM_OF_BYTES      = 15;  // (serial_test.dat)
+parameter integer NUM_OF_BYTES      = 36;  // (serial_test.dat)
 
 // Inputs (Registers)
 reg clk;
@@ -38,6 +38,7 @@ wire [7:0] rx_data;
 
 // Internal
 integer i;
+integer k;
 
 wire rxd;
 wire txd;
@@ -50,6 +51,9 @@ reg [7:0] echo_regaddr;
 reg [7:0] read_ack;
 reg [7:0] read_data;
 
+// Number of mismatches in the self-checking tests
+integer errors;
+
 // TestBench memory
 reg [7:0] tv_mem [0:NUM_OF_BYTES-1];
 
@@ -113,6 +117,7 @@ begin
     echo_regaddr = 0;
     read_ack = 0;
     read_data = 0;
+    errors = 0;
 
     // 5 clock signals
     @(posedge clk);
@@ -126,12 +131,19 @@ begin
 
     write_test;
     read_test;
+    ext_write_test;
+    ext_read_test;
 
     @(posedge clk);
     @(posedge clk);
     @(posedge clk);
     @(posedge clk);
 
+    if (errors == 0) begin
+        $display("\nPASS");
+    end else begin
+        $display("\nFAIL: %0d errors", errors);
+    end
     $finish;
 
 end
@@ -218,6 +230,18 @@ begin
 end
 endtask
 
+// Compare a received byte to what was expected
+task check;
+    input [7:0] got;
+    input [7:0] expected;
+begin
+    if (got !== expected) begin
+        $display("%t: ERROR got %x, expected %x",$time,got,expected);
+        errors = errors + 1;
+    end
+end
+endtask
+
 // Write test
 task write_test;
 begin
@@ -244,6 +268,7 @@ begin
     send_char(tv_mem[6]);
     read_char(read_ack);
     $display("%t:   recv read_ack=%x",$time,read_ack);
+    check(read_ack, 8'hAC);
 
     $display("\n%t: END write_test",$time);
 end
@@ -267,37 +292,97 @@ begin
     send_char(tv_mem[9]);
     read_char(echo_cmd);
     $display("%t:   recv echo_cmd=%x",$time,echo_cmd);
+    check(echo_cmd, tv_mem[7]);
 
     // Read echo_regaddr
     $display("%t: send dummy=%x",$time,tv_mem[10]);
     send_char(tv_mem[10]);
     read_char(echo_regaddr);
     $display("%t:   recv echo_regaddr=%x",$time,echo_regaddr);
+    check(echo_regaddr, tv_mem[8]);
 
     // read the data
     $display("%t: send dummy0=%x",$time,tv_mem[11]);
     send_char(tv_mem[11]);
     read_char(read_data);
     $display("%t:   recv read_data=%x",$time,read_data);
+    check(read_data, tv_mem[2]);
 
     $display("%t: send dummy1=%x",$time,tv_mem[12]);
     send_char(tv_mem[12]);
     read_char(read_data);
     $display("%t:   recv read_data=%x",$time,read_data);
+    check(read_data, tv_mem[3]);
 
     $display("%t: send dummy2=%x",$time,tv_mem[13]);
     send_char(tv_mem[13]);
     read_char(read_data);
     $display("%t:   recv read_data=%x",$time,read_data);
+    check(read_data, tv_mem[4]);
 
     $display("%t: send dummy3=%x",$time,tv_mem[14]);
     send_char(tv_mem[14]);
     read_char(read_data);
     $display("%t:   recv read_data=%x",$time,read_data);
+    check(read_data, tv_mem[5]);
 
     $display("\n%t: END read_test",$time);
 end
 endtask
 
 
+// Extended write test.  Header is cmd, core, reg_addr, length.
+task ext_write_test;
+begin
+    $display("\n%t: BEGIN ext_write_test",$time);
+
+    // Send the 4 header bytes and the 4 data bytes
+    for (k=15; k<23; k=k+1)
+    begin
+        $display("%t: send %x",$time,tv_mem[k]);
+        send_char(tv_mem[k]);
+    end
+
+    // Read ACK
+    send_char(tv_mem[23]);
+    read_char(read_ack);
+    $display("%t:   recv read_ack=%x",$time,read_ack);
+    check(read_ack, 8'hAC);
+
+    $display("\n%t: END ext_write_test",$time);
+end
+endtask
+
+// Extended read test.  The 4 header bytes are echoed.
+task ext_read_test;
+begin
+    $display("\n%t: BEGIN ext_read_test",$time);
+
+    // Send the 4 header bytes
+    for (k=24; k<28; k=k+1)
+    begin
+        $display("%t: send %x",$time,tv_mem[k]);
+        send_char(tv_mem[k]);
+    end
+
+    // Read the echoed header then the data
+    for (k=28; k<36; k=k+1)
+    begin
+        $display("%t: send dummy=%x",$time,tv_mem[k]);
+        send_char(tv_mem[k]);
+        read_char(read_data);
+        $display("%t:   recv %x",$time,read_data);
+        if (k < 32) begin
+            // The header sent, tv_mem[24..27]
+            check(read_data, tv_mem[k-4]);
+        end else begin
+            // The data written by ext_write_test, tv_mem[19..22]
+            check(read_data, tv_mem[k-13]);
+        end
+    end
+
+    $display("\n%t: END ext_read_test",$time);
+end
+endtask
+
 endmodule
@@ -4,7 +4,20 @@
 *
 * This module send 1 character to the uart
 * a waits to receive a character before 
-* asserting done.
+* asserting done.  If serial_txonly is set
+* a write asserts done once the character is
+* handed to the uart without waiting to receive.
+*
+* Received characters are buffered in a small
+* FIFO so the host may keep sending while the
+* requester is busy transmitting.  A pending
+* read is abandoned with serial_cancel so the
+* requester can send unsolicited characters.
+* serial_flush drops the buffered characters and
+* any read or write in progress.  A character is
+* not taken from the uart while rx_hold is set so
+* the zero the uart makes of a break waits for
+* the flush that drops it.
 *
 * Status: In development
 *
@@ -17,7 +30,11 @@
 // Force error when implicit net has no type.
 // `default_nettype none
 
-module send_recv
+module send_recv #
+(
+    // log2 of the depth of the receive FIFO
+    parameter integer RX_FIFO_BITS = 6
+)
 (
     input wire clk,
     input wire reset,
@@ -26,6 +43,12 @@ module send_recv
     input wire [7:0] serial_tx_data,
     input wire serial_wr,
     input wire serial_rd,
+    input wire serial_txonly,   // writes do not wait for a received char
+    input wire serial_cancel,   // abandon a pending read
+    input wire serial_flush,    // drop buffered chars and go idle
+    input wire rx_hold,         // leave the received char in the uart
+    output wire serial_idle,    // no read or write in progress
+    output wire serial_rx_ready, // a received char is buffered
     output reg serial_valid,
     output reg [7:0] serial_rx_data,
 
@@ -43,35 +66,76 @@ module send_recv
 reg [7:0] serial_tx_data_reg;
 reg [2:0] send_recv_state;
 
+// Receive FIFO.  The pointers have an extra bit to tell full from empty.
+reg [7:0] rx_fifo [0:(1<<RX_FIFO_BITS)-1];
+reg [RX_FIFO_BITS:0] rx_wr_ptr;
+reg [RX_FIFO_BITS:0] rx_rd_ptr;
+wire rx_empty;
+wire rx_full;
+
+assign rx_empty = (rx_wr_ptr == rx_rd_ptr);
+assign rx_full = (rx_wr_ptr == {~rx_rd_ptr[RX_FIFO_BITS], rx_rd_ptr[RX_FIFO_BITS-1:0]});
+
 // States
 localparam IDLE         = 0;
 localparam WRITE_CHAR   = 1;
 localparam READ_CHAR    = 2;
+localparam TX_DONE      = 3;
+
+assign serial_idle = (send_recv_state == IDLE);
+assign serial_rx_ready = !rx_empty;
+
+// Move each char from the uart into the FIFO.  The uart clears
+// rx_valid the cycle after rx_rd_strobe.  Chars received when
+// the FIFO is full, or held until a flush, are dropped.
+always @ (posedge clk)
+begin
+    if (reset) begin
+        rx_wr_ptr <= 0;
+        rx_rd_strobe <= 0;
+    end else begin
+        rx_rd_strobe <= 0;
+        if (rx_valid && !rx_rd_strobe && (serial_flush || !rx_hold)) begin
+            rx_rd_strobe <= 1;
+            if (!rx_full && !serial_flush) begin
+                rx_fifo[rx_wr_ptr[RX_FIFO_BITS-1:0]] <= rx_data;
+                rx_wr_ptr <= rx_wr_ptr + 1;
+            end
+        end
+    end
+end
 
 always @ (posedge clk)
 begin
     if (reset) begin
         send_recv_state <= 0;
         tx_wr_strobe <= 0;
-        rx_rd_strobe <= 0;
+        rx_rd_ptr <= 0;
         serial_valid <= 0;
         serial_tx_data_reg <= 0;
         tx_data <= 0;
         serial_rx_data <= 0;
+    end else if (serial_flush) begin
+        send_recv_state <= IDLE;
+        tx_wr_strobe <= 0;
+        serial_valid <= 0;
+        rx_rd_ptr <= rx_wr_ptr;
     end else begin
         case (send_recv_state)
             IDLE : begin
                 tx_wr_strobe <= 0;
-                rx_rd_strobe <= 0;
                 serial_valid <= 0;
 
-                if (serial_wr) begin
+                // The requester drops serial_wr/serial_rd the cycle
+                // after serial_valid.  Skip that stale request since
+                // it would take a buffered char nobody asked for.
+                if (serial_wr && !serial_valid) begin
                     // Write then read
                     serial_tx_data_reg <= serial_tx_data;
                     send_recv_state <= WRITE_CHAR;
                 end
 
-                if (serial_rd) begin
+                if (serial_rd && !serial_valid) begin
                     // Read only
                     send_recv_state <= READ_CHAR;
                 end
@@ -81,17 +145,30 @@ begin
                 if (!tx_busy) begin
                     tx_data <= serial_tx_data_reg;
                     tx_wr_strobe <= 1;
-                    send_recv_state <= READ_CHAR;
+                    if (serial_txonly) begin
+                        send_recv_state <= TX_DONE;
+                    end else begin
+                        send_recv_state <= READ_CHAR;
+                    end
                 end
             end
+            TX_DONE : begin
+                // Write only.  The uart has the char.
+                tx_wr_strobe <= 0;
+                serial_valid <= 1;
+                send_recv_state <= IDLE;
+            end
             READ_CHAR : begin
                 tx_wr_strobe <= 0;
-                // Wait for reception of char to proceed
-                if (rx_valid) begin
+                // Wait for reception of char to proceed.  On a
+                // cancel any buffered char is left for the next read.
+                if (serial_cancel) begin
+                    send_recv_state <= IDLE;
+                end else if (!rx_empty) begin
                     // Received a byte
-                    rx_rd_strobe <= 1;
                     serial_valid <= 1;
-                    serial_rx_data <= rx_data;
+                    serial_rx_data <= rx_fifo[rx_rd_ptr[RX_FIFO_BITS-1:0]];
+                    rx_rd_ptr <= rx_rd_ptr + 1;
                     send_recv_state <= IDLE;
                 end
             end
@@ -8,6 +8,27 @@
 * external processor like a Raspberry Pi
 * control the FPGA peripherals on the HBA Bus.
 *
+* It can also stream telemetry frames to the
+* host.  Every tm_rate_ms it reads the configured
+* (core, register range) pairs and sends them
+* unsolicited between commands.  In snapshot
+* mode an interrupt sends the pending flags and
+* the pairs of the interrupting cores the same
+* way in place of asserting io_intr.
+*
+* The link starts at BAUD.  The host can move
+* it to another rate by writing reg16-19.  The
+* new rate is kept only if the host reads reg19
+* at that rate within BAUD_TRIAL_MS.  Otherwise
+* the old rate is restored and whatever was
+* received at the new rate is dropped.
+*
+* A break on io_rxd of BREAK_BITS bit times or
+* more drops the command in progress and the
+* received chars, and holds the bridge idle until
+* the break ends, so the host can resync without
+* waiting out the rest of a misframed packet.
+*
 * Status: In development
 *
 * Author : Brandon Blodget
@@ -44,6 +65,10 @@ module serial_fpga #
 (
     parameter integer CLK_FREQUENCY = 50_000_000,
     parameter integer BAUD = 32'd115_200,
+    // ms to wait at a new baud rate for the host to confirm it
+    parameter integer BAUD_TRIAL_MS = 100,
+    // bit times io_rxd must be low to be a break
+    parameter integer BREAK_BITS = 20,
 
     parameter integer DBUS_WIDTH = 8,
     parameter integer PERIPH_ADDR_WIDTH = 4,
@@ -114,6 +139,9 @@ wire app_valid_out;    // read or write transfer complete. Assert one clock cycl
 reg [7:0] serial_tx_data;
 reg serial_wr;
 reg serial_rd;
+wire serial_cancel;
+wire serial_idle;
+wire serial_rx_ready;
 wire serial_valid;
 wire [7:0] serial_rx_data;
 
@@ -130,6 +158,103 @@ reg [DBUS_WIDTH-1:0] reg_intr1_in;
 
 wire [DBUS_WIDTH-1:0] reg_rate_ms;
 
+// reg_ctrl[0] : nodummy.  Send responses without waiting for dummy bytes
+wire [DBUS_WIDTH-1:0] reg_ctrl;
+
+// nodummy mode latched from reg_ctrl[0] at the start of each command.
+// The host sends no dummy bytes and the echo, read data, and ACK
+// are sent as soon as they are ready.
+reg nodummy;
+
+// Telemetry configuration.  reg4 is the frame period in ms (0=off)
+// and reg5 the number of pairs in use.  Each pair is two registers
+// starting at reg8: {count[3:0], core[3:0]} and the first register.
+wire [DBUS_WIDTH-1:0] reg_tm_rate_ms;
+wire [DBUS_WIDTH-1:0] reg_tm_npairs;
+wire [DBUS_WIDTH-1:0] reg_tm_cc0;
+wire [DBUS_WIDTH-1:0] reg_tm_reg0;
+wire [DBUS_WIDTH-1:0] reg_tm_cc1;
+wire [DBUS_WIDTH-1:0] reg_tm_reg1;
+wire [DBUS_WIDTH-1:0] reg_tm_cc2;
+wire [DBUS_WIDTH-1:0] reg_tm_reg2;
+wire [DBUS_WIDTH-1:0] reg_tm_cc3;
+wire [DBUS_WIDTH-1:0] reg_tm_reg3;
+
+// reg_snap[0] : send an interrupt snapshot frame in place of io_intr.
+// The frame has the pending registers and the telemetry pairs of the
+// cores with an interrupt pending.
+wire [DBUS_WIDTH-1:0] reg_snap;
+
+// reg16-19 : Baud rate to switch to, LSB first.  The switch happens
+// after the ACK of a write to reg19 is sent.
+wire [DBUS_WIDTH-1:0] reg_baud0;
+wire [DBUS_WIDTH-1:0] reg_baud1;
+wire [DBUS_WIDTH-1:0] reg_baud2;
+wire [DBUS_WIDTH-1:0] reg_baud3;
+
+// The uart's baud rate and the rate to go back to if the host does
+// not confirm a new one.  baud_wr and baud_rd pulse when the bridge
+// writes or reads reg19.
+reg [31:0] uart_baud;
+reg [31:0] uart_baud_prev;
+reg baud_wr;
+reg baud_rd;
+reg baud_pending;
+reg baud_trial;
+reg [7:0] baud_trial_ms;
+// Pulses when the old rate is restored.  Drops the command in
+// progress and the received chars.
+reg baud_revert;
+
+// Break detection.  rxd_sync is io_rxd in our clock domain and
+// brk_seen is set from when it has been low for BREAK_BITS until it
+// goes high again.
+reg [1:0] rxd_sync;
+reg [31:0] brk_acc;
+reg [7:0] brk_bits;
+reg brk_seen;
+
+// Drop the command in progress and the received chars
+wire serial_resync;
+assign serial_resync = baud_revert | brk_seen;
+
+// Combine the register banks.
+wire [DBUS_WIDTH-1:0] hba_dbus_slave0;
+wire hba_xferack_slave0;
+wire [DBUS_WIDTH-1:0] hba_dbus_slave1;
+wire hba_xferack_slave1;
+wire [DBUS_WIDTH-1:0] hba_dbus_slave2;
+wire hba_xferack_slave2;
+wire [DBUS_WIDTH-1:0] hba_dbus_slave3;
+wire hba_xferack_slave3;
+wire [DBUS_WIDTH-1:0] hba_dbus_slave4;
+wire hba_xferack_slave4;
+
+assign hba_dbus_slave = hba_dbus_slave0 | hba_dbus_slave1 |
+                        hba_dbus_slave2 | hba_dbus_slave3 |
+                        hba_dbus_slave4;
+assign hba_xferack_slave = hba_xferack_slave0 | hba_xferack_slave1 |
+                           hba_xferack_slave2 | hba_xferack_slave3 |
+                           hba_xferack_slave4;
+
+// A telemetry frame is due.  Set by the timer, cleared by tm_start.
+reg tm_due;
+reg tm_start;
+// Sending a telemetry frame.  The frame is sent without waiting for
+// dummy bytes.
+reg tm_active;
+
+// An interrupt snapshot is due.  Set when an interrupt would be
+// raised, cleared by snap_start.
+reg snap_due;
+reg snap_start;
+// The frame being sent is a snapshot.  snap_mask is the pending
+// interrupts when it started and snap_pend is set while the pending
+// registers are sent.
+reg snap_active;
+reg [15:0] snap_mask;
+reg snap_pend;
+
 /*
 ****************************
 * Instantiations
@@ -142,7 +267,7 @@ buart # (
     // inputs
    .clk(hba_clk),
    .resetq(~hba_reset),
-   .baud(BAUD),    // [31:0] max = 32'd921600
+   .baud(uart_baud),    // [31:0] up to about CLK_FREQUENCY/16
    .rx(io_rxd),            // recv wire
    .rd(uart0_rd),    // read strobe
    .wr(uart0_wr),   // write strobe
@@ -164,6 +289,12 @@ send_recv send_recv_inst
     .serial_tx_data(serial_tx_data), // [7:0]
     .serial_wr(serial_wr),
     .serial_rd(serial_rd),
+    .serial_txonly(nodummy | tm_active),
+    .serial_cancel(serial_cancel),
+    .serial_flush(serial_resync),
+    .rx_hold(!rxd_sync[1]),
+    .serial_idle(serial_idle),
+    .serial_rx_ready(serial_rx_ready),
     .serial_valid(serial_valid),
     .serial_rx_data(serial_rx_data),
 
@@ -213,7 +344,7 @@ hba_reg_bank #
     .PERIPH_ADDR_WIDTH(PERIPH_ADDR_WIDTH),
     .REG_ADDR_WIDTH(REG_ADDR_WIDTH),
     .PERIPH_ADDR(PERIPH_ADDR)
-) hba_reg_bank_inst
+) hba_reg_bank_inst0
 (
     // HBA Bus Slave Interface
     .hba_clk(hba_clk),
@@ -223,8 +354,8 @@ hba_reg_bank #
     .hba_abus(hba_abus), // The input address bus.
     .hba_dbus(hba_dbus),  // The input data bus.
 
-    .hba_dbus_slave(hba_dbus_slave),   // The output data bus.
-    .hba_xferack_slave(hba_xferack_slave),     // Acknowledge transfer requested. 
+    .hba_dbus_slave(hba_dbus_slave0),   // The output data bus.
+    .hba_xferack_slave(hba_xferack_slave0),     // Acknowledge transfer requested. 
                                     // Asserted when request has been completed. 
                                     // Must be zero when inactive.
 
@@ -237,11 +368,145 @@ hba_reg_bank #
 
     .slv_reg2(reg_rate_ms),        // Max interrupt rate.
 
+    .slv_reg3(reg_ctrl),           // Control.  bit0=nodummy
+
     .slv_wr_en(slv_wr_en),     // No write.
     .slv_wr_mask(4'b011),   // 0011, Enable writes to slv_reg0, and slv_reg1.
     .slv_autoclr_mask(4'b011)   // 0011, Enable clearing when read
 );
 
+hba_reg_bank #
+(
+    .DBUS_WIDTH(DBUS_WIDTH),
+    .PERIPH_ADDR_WIDTH(PERIPH_ADDR_WIDTH),
+    .REG_ADDR_WIDTH(REG_ADDR_WIDTH),
+    .PERIPH_ADDR(PERIPH_ADDR),
+    .REG_OFFSET(4)
+) hba_reg_bank_inst1
+(
+    // HBA Bus Slave Interface
+    .hba_clk(hba_clk),
+    .hba_reset(hba_reset),
+    .hba_rnw(hba_rnw),         // 1=Read from register. 0=Write to register.
+    .hba_select(hba_select),      // Transfer in progress.
+    .hba_abus(hba_abus), // The input address bus.
+    .hba_dbus(hba_dbus),  // The input data bus.
+
+    .hba_dbus_slave(hba_dbus_slave1),   // The output data bus.
+    .hba_xferack_slave(hba_xferack_slave1),     // Acknowledge transfer requested. 
+                                    // Asserted when request has been completed. 
+                                    // Must be zero when inactive.
+
+    // Access to registgers
+    .slv_reg0(reg_tm_rate_ms),     // reg4, telemetry period in ms
+    .slv_reg1(reg_tm_npairs),      // reg5, number of telemetry pairs
+    .slv_reg2(reg_snap),           // reg6, bit0=interrupt snapshot
+    //.slv_reg3(),                 // reg7
+
+    .slv_wr_en(1'b0),          // No write.
+    .slv_wr_mask(4'b0000),
+    .slv_autoclr_mask(4'b0000)  // No autoclear
+);
+
+hba_reg_bank #
+(
+    .DBUS_WIDTH(DBUS_WIDTH),
+    .PERIPH_ADDR_WIDTH(PERIPH_ADDR_WIDTH),
+    .REG_ADDR_WIDTH(REG_ADDR_WIDTH),
+    .PERIPH_ADDR(PERIPH_ADDR),
+    .REG_OFFSET(8)
+) hba_reg_bank_inst2
+(
+    // HBA Bus Slave Interface
+    .hba_clk(hba_clk),
+    .hba_reset(hba_reset),
+    .hba_rnw(hba_rnw),         // 1=Read from register. 0=Write to register.
+    .hba_select(hba_select),      // Transfer in progress.
+    .hba_abus(hba_abus), // The input address bus.
+    .hba_dbus(hba_dbus),  // The input data bus.
+
+    .hba_dbus_slave(hba_dbus_slave2),   // The output data bus.
+    .hba_xferack_slave(hba_xferack_slave2),     // Acknowledge transfer requested. 
+                                    // Asserted when request has been completed. 
+                                    // Must be zero when inactive.
+
+    // Access to registgers
+    .slv_reg0(reg_tm_cc0),         // reg8, pair0 {count, core}
+    .slv_reg1(reg_tm_reg0),        // reg9, pair0 first register
+    .slv_reg2(reg_tm_cc1),         // reg10, pair1 {count, core}
+    .slv_reg3(reg_tm_reg1),        // reg11, pair1 first register
+
+    .slv_wr_en(1'b0),          // No write.
+    .slv_wr_mask(4'b0000),
+    .slv_autoclr_mask(4'b0000)  // No autoclear
+);
+
+hba_reg_bank #
+(
+    .DBUS_WIDTH(DBUS_WIDTH),
+    .PERIPH_ADDR_WIDTH(PERIPH_ADDR_WIDTH),
+    .REG_ADDR_WIDTH(REG_ADDR_WIDTH),
+    .PERIPH_ADDR(PERIPH_ADDR),
+    .REG_OFFSET(12)
+) hba_reg_bank_inst3
+(
+    // HBA Bus Slave Interface
+    .hba_clk(hba_clk),
+    .hba_reset(hba_reset),
+    .hba_rnw(hba_rnw),         // 1=Read from register. 0=Write to register.
+    .hba_select(hba_select),      // Transfer in progress.
+    .hba_abus(hba_abus), // The input address bus.
+    .hba_dbus(hba_dbus),  // The input data bus.
+
+    .hba_dbus_slave(hba_dbus_slave3),   // The output data bus.
+    .hba_xferack_slave(hba_xferack_slave3),     // Acknowledge transfer requested. 
+                                    // Asserted when request has been completed. 
+                                    // Must be zero when inactive.
+
+    // Access to registgers
+    .slv_reg0(reg_tm_cc2),         // reg12, pair2 {count, core}
+    .slv_reg1(reg_tm_reg2),        // reg13, pair2 first register
+    .slv_reg2(reg_tm_cc3),         // reg14, pair3 {count, core}
+    .slv_reg3(reg_tm_reg3),        // reg15, pair3 first register
+
+    .slv_wr_en(1'b0),          // No write.
+    .slv_wr_mask(4'b0000),
+    .slv_autoclr_mask(4'b0000)  // No autoclear
+);
+
+hba_reg_bank #
+(
+    .DBUS_WIDTH(DBUS_WIDTH),
+    .PERIPH_ADDR_WIDTH(PERIPH_ADDR_WIDTH),
+    .REG_ADDR_WIDTH(REG_ADDR_WIDTH),
+    .PERIPH_ADDR(PERIPH_ADDR),
+    .REG_OFFSET(16)
+) hba_reg_bank_inst4
+(
+    // HBA Bus Slave Interface
+    .hba_clk(hba_clk),
+    .hba_reset(hba_reset),
+    .hba_rnw(hba_rnw),         // 1=Read from register. 0=Write to register.
+    .hba_select(hba_select),      // Transfer in progress.
+    .hba_abus(hba_abus), // The input address bus.
+    .hba_dbus(hba_dbus),  // The input data bus.
+
+    .hba_dbus_slave(hba_dbus_slave4),   // The output data bus.
+    .hba_xferack_slave(hba_xferack_slave4),     // Acknowledge transfer requested. 
+                                    // Asserted when request has been completed. 
+                                    // Must be zero when inactive.
+
+    // Access to registgers
+    .slv_reg0(reg_baud0),          // reg16, baud rate [7:0]
+    .slv_reg1(reg_baud1),          // reg17, baud rate [15:8]
+    .slv_reg2(reg_baud2),          // reg18, baud rate [23:16]
+    .slv_reg3(reg_baud3),          // reg19, baud rate [31:24]
+
+    .slv_wr_en(1'b0),          // No write.
+    .slv_wr_mask(4'b0000),
+    .slv_autoclr_mask(4'b0000)  // No autoclear
+);
+
 
 /*
 ****************************
@@ -250,11 +515,19 @@ hba_reg_bank #
 */
 
 // Serial Interface State Machine.
-reg [3:0] serial_state;
+reg [4:0] serial_state;
 
 reg [7:0] cmd_byte;
 reg [7:0] regaddr_byte;
-reg [3:0] transfer_num;
+reg [7:0] transfer_num;
+
+// Extended command.  cmd_byte[6:0] == 7'h7F is followed by a core
+// byte, the reg byte, and a length byte for up to 255 data bytes.
+// Every command byte is a legal short command, so core 15 is
+// reserved for the escape.  No peripheral may be at core 15.
+reg ext_mode;
+reg [7:0] extcore_byte;
+reg [7:0] extlen_byte;
 
 wire rnw_bit;
 wire [2:0] num_bytes_bits;
@@ -262,7 +535,7 @@ wire [3:0] core_addr_bits;
 
 assign rnw_bit = cmd_byte[7];
 assign num_bytes_bits = cmd_byte[6:4];
-assign core_addr_bits = cmd_byte[3:0];
+assign core_addr_bits = ext_mode ? extcore_byte[3:0] : cmd_byte[3:0];
 
 // States
 localparam IDLE                     = 0;
@@ -275,6 +548,22 @@ localparam HBA_WAIT                 = 6;
 localparam HBA_WAIT2                = 7;
 localparam ACK                      = 8;
 localparam DONE                     = 9;
+localparam EXT_CORE                 = 10;
+localparam EXT_LEN                  = 11;
+localparam ECHO_CORE                = 12;
+localparam ECHO_LEN                 = 13;
+localparam TM_CANCEL                = 14;
+localparam TM_SYNC                  = 15;
+localparam TM_LEN                   = 16;
+localparam TM_PAIR                  = 17;
+localparam TM_HDR_CC                = 18;
+localparam TM_HDR_REG               = 19;
+localparam TM_READ                  = 20;
+localparam TM_WAIT                  = 21;
+localparam TM_SEND                  = 22;
+
+// Extended command escape, cmd_byte[6:0]
+localparam EXT_CMD              = 7'h7F;
 
 // rnw values
 localparam RPI_WRITE            = 0;
@@ -284,6 +573,87 @@ localparam RPI_READ             = 1;
 localparam ACK_CHAR         =8'hAC;
 localparam NACK_CHAR        =8'h56;
 
+// First byte of a telemetry frame.  Responses never start with it.
+localparam TM_SYNC_CHAR     =8'h5A;
+
+// Header of the pending pair that starts a snapshot frame.  Two
+// registers starting at reg0 of core 0.
+localparam SNAP_PEND_CC     =8'h20;
+localparam SNAP_PEND_REG    =8'h00;
+
+// Writing this register switches the baud rate.  Reading it confirms
+// the new rate.
+localparam BAUD_REG3        =8'd19;
+
+// Telemetry pairs.  Counts are limited to 8 and pairs to 4.
+reg [2:0] tm_pair;
+reg [7:0] tm_pair_cc;
+reg [7:0] tm_pair_reg;
+wire [3:0] tm_count0;
+wire [3:0] tm_count1;
+wire [3:0] tm_count2;
+wire [3:0] tm_count3;
+wire [2:0] tm_npairs;
+wire [7:0] tm_len;
+wire [7:0] snap_len;
+wire [7:0] tm_hdr_cc;
+wire [7:0] tm_hdr_reg;
+
+assign tm_count0 = (reg_tm_cc0[7:4] > 8) ? 4'd8 : reg_tm_cc0[7:4];
+assign tm_count1 = (reg_tm_cc1[7:4] > 8) ? 4'd8 : reg_tm_cc1[7:4];
+assign tm_count2 = (reg_tm_cc2[7:4] > 8) ? 4'd8 : reg_tm_cc2[7:4];
+assign tm_count3 = (reg_tm_cc3[7:4] > 8) ? 4'd8 : reg_tm_cc3[7:4];
+assign tm_npairs = (reg_tm_npairs > 4) ? 3'd4 : reg_tm_npairs[2:0];
+
+// Number of frame bytes after the length byte.  Two header
+// bytes and the data for each pair.
+assign tm_len = ((tm_npairs > 0) ? (8'd2 + tm_count0) : 8'd0) +
+                ((tm_npairs > 1) ? (8'd2 + tm_count1) : 8'd0) +
+                ((tm_npairs > 2) ? (8'd2 + tm_count2) : 8'd0) +
+                ((tm_npairs > 3) ? (8'd2 + tm_count3) : 8'd0);
+
+// A snapshot has the pending pair and only the pairs of cores
+// with an interrupt pending.
+assign snap_len = 8'd4 +
+        (((tm_npairs > 0) && snap_mask[reg_tm_cc0[3:0]]) ? (8'd2 + tm_count0) : 8'd0) +
+        (((tm_npairs > 1) && snap_mask[reg_tm_cc1[3:0]]) ? (8'd2 + tm_count1) : 8'd0) +
+        (((tm_npairs > 2) && snap_mask[reg_tm_cc2[3:0]]) ? (8'd2 + tm_count2) : 8'd0) +
+        (((tm_npairs > 3) && snap_mask[reg_tm_cc3[3:0]]) ? (8'd2 + tm_count3) : 8'd0);
+
+always @ (*)
+begin
+    case (tm_pair[1:0])
+        0 : begin
+            tm_pair_cc = {tm_count0, reg_tm_cc0[3:0]};
+            tm_pair_reg = reg_tm_reg0;
+        end
+        1 : begin
+            tm_pair_cc = {tm_count1, reg_tm_cc1[3:0]};
+            tm_pair_reg = reg_tm_reg1;
+        end
+        2 : begin
+            tm_pair_cc = {tm_count2, reg_tm_cc2[3:0]};
+            tm_pair_reg = reg_tm_reg2;
+        end
+        default : begin
+            tm_pair_cc = {tm_count3, reg_tm_cc3[3:0]};
+            tm_pair_reg = reg_tm_reg3;
+        end
+    endcase
+end
+
+// The pair being sent
+assign tm_hdr_cc = (snap_pend) ? SNAP_PEND_CC : tm_pair_cc;
+assign tm_hdr_reg = (snap_pend) ? SNAP_PEND_REG : tm_pair_reg;
+
+// Abandon the read for the next command in the same cycle the
+// frame starts so send_recv can not hand us a command byte.  No
+// frames are started while the baud rate is changing.
+assign serial_cancel = ((serial_state == IDLE) && (tm_due || snap_due) &&
+                        !baud_pending && !baud_trial &&
+                        !serial_valid && !serial_rx_ready) ||
+                       (serial_state == TM_CANCEL);
+
 always @ (posedge hba_clk)
 begin
     if (hba_reset) begin
@@ -291,6 +661,17 @@ begin
         cmd_byte <= 0;
         regaddr_byte <= 0;
         transfer_num <= 0;
+        ext_mode <= 0;
+        nodummy <= 0;
+        tm_start <= 0;
+        tm_active <= 0;
+        tm_pair <= 0;
+        snap_start <= 0;
+        snap_active <= 0;
+        snap_mask <= 0;
+        snap_pend <= 0;
+        extcore_byte <= 0;
+        extlen_byte <= 0;
 
         app_core_addr <= 0;
         app_reg_addr <= 0;
@@ -301,19 +682,63 @@ begin
         serial_tx_data <= 0;
         serial_wr <= 0;
         serial_rd <= 0;
+        baud_wr <= 0;
+        baud_rd <= 0;
 
+    end else if (serial_resync) begin
+        // Anything received at a failed rate or before a break
+        // is garbage
+        serial_state <= IDLE;
+        serial_wr <= 0;
+        serial_rd <= 0;
+        app_en_strobe <= 0;
+        tm_active <= 0;
+        snap_active <= 0;
+        baud_wr <= 0;
+        baud_rd <= 0;
     end else begin
+        baud_wr <= 0;
+        baud_rd <= 0;
         case (serial_state)
             IDLE : begin
                 serial_wr <= 0;
                 transfer_num <= 0;
                 app_en_strobe <= 0;
+                tm_active <= 0;
+                snap_active <= 0;
 
                 // Read the cmd_byte
                 serial_rd <= 1;
                 if (serial_valid) begin
                     serial_rd <= 0;
                     cmd_byte <= serial_rx_data;
+                    nodummy <= reg_ctrl[0];
+                    if (serial_rx_data[6:0] == EXT_CMD) begin
+                        ext_mode <= 1;
+                        serial_state <= EXT_CORE;
+                    end else begin
+                        ext_mode <= 0;
+                        serial_state <= REG_ADDR;
+                    end
+                end else if (serial_cancel) begin
+                    // A frame is due and no command is waiting.
+                    // Snapshots go first.
+                    serial_rd <= 0;
+                    snap_active <= snap_due;
+                    if (snap_due) begin
+                        snap_start <= 1;
+                    end else begin
+                        tm_start <= 1;
+                    end
+                    serial_state <= TM_CANCEL;
+                end
+            end
+            EXT_CORE : begin
+                // Read the core byte of an extended command
+                serial_rd <= 1;
+                if (serial_valid) begin
+                    serial_rd <= 0;
+                    extcore_byte <= serial_rx_data;
                     serial_state <= REG_ADDR;
                 end
             end
@@ -324,6 +749,22 @@ begin
                     serial_rd <= 0;
                     transfer_num <= num_bytes_bits + 1;
                     regaddr_byte <= serial_rx_data;
+                    if (ext_mode) begin
+                        serial_state <= EXT_LEN;
+                    end else if (rnw_bit == RPI_READ) begin
+                        serial_state <= ECHO_CMD;
+                    end else begin
+                        serial_state <= HBA_SETUP;
+                    end
+                end
+            end
+            EXT_LEN : begin
+                // Read the length byte of an extended command
+                serial_rd <= 1;
+                if (serial_valid) begin
+                    serial_rd <= 0;
+                    transfer_num <= serial_rx_data;
+                    extlen_byte <= serial_rx_data;
                     if (rnw_bit == RPI_READ) begin
                         serial_state <= ECHO_CMD;
                     end else begin
@@ -335,6 +776,19 @@ begin
                 // Echo back the command
                 serial_tx_data <= cmd_byte;
                 serial_wr <= 1;
+                if (serial_valid) begin
+                    serial_wr <= 0;
+                    if (ext_mode) begin
+                        serial_state <= ECHO_CORE;
+                    end else begin
+                        serial_state <= ECHO_RAD;
+                    end
+                end
+            end
+            ECHO_CORE : begin
+                // Echo back the core byte of an extended command
+                serial_tx_data <= extcore_byte;
+                serial_wr <= 1;
                 if (serial_valid) begin
                     serial_wr <= 0;
                     serial_state <= ECHO_RAD;
@@ -344,6 +798,19 @@ begin
                 // Echo back the Reg ADdr
                 serial_tx_data <= regaddr_byte;
                 serial_wr <= 1;
+                if (serial_valid) begin
+                    serial_wr <= 0;
+                    if (ext_mode) begin
+                        serial_state <= ECHO_LEN;
+                    end else begin
+                        serial_state <= HBA_SETUP;
+                    end
+                end
+            end
+            ECHO_LEN : begin
+                // Echo back the length byte of an extended command
+                serial_tx_data <= extlen_byte;
+                serial_wr <= 1;
                 if (serial_valid) begin
                     serial_wr <= 0;
                     serial_state <= HBA_SETUP;
@@ -399,6 +866,11 @@ begin
                 app_en_strobe <= 0;
                 // Wait for hba bus to finish
                 if (app_valid_out) begin
+                    if ((app_core_addr == PERIPH_ADDR) &&
+                        (app_reg_addr == BAUD_REG3)) begin
+                        baud_wr <= (rnw_bit == RPI_WRITE);
+                        baud_rd <= (rnw_bit == RPI_READ);
+                    end
                     if (rnw_bit == RPI_WRITE) begin
                         serial_state <= HBA_SETUP;
                     end else begin
@@ -428,6 +900,104 @@ begin
                     serial_state <= IDLE;
                 end
             end
+            TM_CANCEL : begin
+                // Wait for send_recv to drop the pending read
+                tm_start <= 0;
+                snap_start <= 0;
+                if (serial_idle) begin
+                    tm_active <= 1;
+                    tm_pair <= 0;
+                    snap_mask <= {reg_intr1, reg_intr0};
+                    snap_pend <= snap_active;
+                    serial_state <= TM_SYNC;
+                end
+            end
+            TM_SYNC : begin
+                // Send the frame sync byte
+                serial_tx_data <= TM_SYNC_CHAR;
+                serial_wr <= 1;
+                if (serial_valid) begin
+                    serial_wr <= 0;
+                    serial_state <= TM_LEN;
+                end
+            end
+            TM_LEN : begin
+                // Send the number of bytes in the rest of the frame
+                serial_tx_data <= (snap_active) ? snap_len : tm_len;
+                serial_wr <= 1;
+                if (serial_valid) begin
+                    serial_wr <= 0;
+                    serial_state <= TM_PAIR;
+                end
+            end
+            TM_PAIR : begin
+                app_en_strobe <= 0;
+                if (!snap_pend && (tm_pair == tm_npairs)) begin
+                    // Frame done
+                    serial_state <= IDLE;
+                end else if (!snap_pend && snap_active &&
+                             !snap_mask[tm_pair_cc[3:0]]) begin
+                    // No interrupt pending for this pair's core
+                    tm_pair <= tm_pair + 1;
+                end else begin
+                    transfer_num <= tm_hdr_cc[7:4];
+                    regaddr_byte <= tm_hdr_reg;
+                    serial_state <= TM_HDR_CC;
+                end
+            end
+            TM_HDR_CC : begin
+                // Send the pair's count and core
+                serial_tx_data <= tm_hdr_cc;
+                serial_wr <= 1;
+                if (serial_valid) begin
+                    serial_wr <= 0;
+                    serial_state <= TM_HDR_REG;
+                end
+            end
+            TM_HDR_REG : begin
+                // Send the pair's first register
+                serial_tx_data <= tm_hdr_reg;
+                serial_wr <= 1;
+                if (serial_valid) begin
+                    serial_wr <= 0;
+                    serial_state <= TM_READ;
+                end
+            end
+            TM_READ : begin
+                if (transfer_num == 0) begin
+                    // On to the next pair
+                    if (snap_pend) begin
+                        snap_pend <= 0;
+                    end else begin
+                        tm_pair <= tm_pair + 1;
+                    end
+                    serial_state <= TM_PAIR;
+                end else begin
+                    transfer_num <= transfer_num - 1;
+
+                    // Read the register from the hba bus
+                    app_core_addr <= tm_hdr_cc[3:0];
+                    app_reg_addr <= regaddr_byte;
+                    app_rnw <= RPI_READ;
+                    app_en_strobe <= 1;
+                    regaddr_byte <= regaddr_byte + 1;
+                    serial_state <= TM_WAIT;
+                end
+            end
+            TM_WAIT : begin
+                app_en_strobe <= 0;
+                if (app_valid_out) begin
+                    serial_tx_data <= app_data_out;
+                    serial_wr <= 1;
+                    serial_state <= TM_SEND;
+                end
+            end
+            TM_SEND : begin
+                if (serial_valid) begin
+                    serial_wr <= 0;
+                    serial_state <= TM_READ;
+                end
+            end
             default : begin
                 serial_state <= IDLE;
             end
@@ -461,6 +1031,100 @@ begin
     end
 end
 
+// Telemetry frame timer.  A frame is due every reg_tm_rate_ms
+// while there are pairs to send.
+reg [7:0] tm_count_ms;
+always @ (posedge hba_clk)
+begin
+    if (hba_reset) begin
+        tm_count_ms <= 0;
+        tm_due <= 0;
+    end else begin
+        if (tm_start || (reg_tm_rate_ms == 0) || (tm_npairs == 0)) begin
+            tm_due <= 0;
+        end
+        if (count_to_1ms == (ONE_MS_COUNT-1)) begin
+            tm_count_ms <= tm_count_ms + 1;
+            if ((tm_count_ms + 1) >= reg_tm_rate_ms) begin
+                tm_count_ms <= 0;
+                if ((reg_tm_rate_ms != 0) && (tm_npairs != 0)) begin
+                    tm_due <= 1;
+                end
+            end
+        end
+    end
+end
+
+// Baud rate changes.  A write of reg19 switches the uart to the rate
+// in reg16-19 once the ACK is sent and nothing else is in progress.
+// The host then has BAUD_TRIAL_MS to read reg19 at the new rate or the
+// uart goes back to the old rate.
+always @ (posedge hba_clk)
+begin
+    if (hba_reset) begin
+        uart_baud <= BAUD;
+        uart_baud_prev <= BAUD;
+        baud_pending <= 0;
+        baud_trial <= 0;
+        baud_trial_ms <= 0;
+        baud_revert <= 0;
+    end else begin
+        baud_revert <= 0;
+        if (baud_wr) begin
+            baud_pending <= 1;
+        end
+        if (baud_pending && (serial_state == IDLE) && serial_rd &&
+            !tx_busy && !uart0_wr) begin
+            baud_pending <= 0;
+            uart_baud_prev <= uart_baud;
+            uart_baud <= {reg_baud3, reg_baud2, reg_baud1, reg_baud0};
+            baud_trial <= 1;
+            baud_trial_ms <= 0;
+        end else if (baud_trial) begin
+            if (baud_rd) begin
+                baud_trial <= 0;
+            end else if (count_to_1ms == (ONE_MS_COUNT-1)) begin
+                baud_trial_ms <= baud_trial_ms + 1;
+                if ((baud_trial_ms + 1) >= BAUD_TRIAL_MS) begin
+                    uart_baud <= uart_baud_prev;
+                    baud_trial <= 0;
+                    baud_revert <= 1;
+                end
+            end
+        end
+    end
+end
+
+// Break detection.  brk_acc counts bit times at the uart's rate
+// while io_rxd is low.  A low of BREAK_BITS or more is longer than
+// any char so the bridge is held idle, with nothing sent and the char
+// the uart made of the break dropped, until io_rxd goes high again.
+always @ (posedge hba_clk)
+begin
+    if (hba_reset) begin
+        rxd_sync <= 2'b11;
+        brk_acc <= 0;
+        brk_bits <= 0;
+        brk_seen <= 0;
+    end else begin
+        rxd_sync <= {rxd_sync[0], io_rxd};
+        if (rxd_sync[1]) begin
+            brk_acc <= 0;
+            brk_bits <= 0;
+            brk_seen <= 0;
+        end else if ((brk_acc + uart_baud) >= CLK_FREQUENCY) begin
+            brk_acc <= brk_acc + uart_baud - CLK_FREQUENCY;
+            if (brk_bits >= (BREAK_BITS - 1)) begin
+                brk_seen <= 1;
+            end else begin
+                brk_bits <= brk_bits + 1;
+            end
+        end else begin
+            brk_acc <= brk_acc + uart_baud;
+        end
+    end
+end
+
 // Set the HBA interrupt registers
 integer i;
 always @ (posedge hba_clk)
@@ -470,9 +1134,16 @@ begin
         reg_intr0_in <= 0;
         reg_intr1_in <= 0;
         io_intr <= 0;
+        snap_due <= 0;
     end else begin
-        // Generate interrupt to CPU if any interrupt bits are set
-        if (io_intr == 0) begin
+        // Generate interrupt to CPU if any interrupt bits are set.
+        // In snapshot mode send a snapshot frame instead.
+        if (reg_snap[0]) begin
+            io_intr <= 0;
+            if (io_intr_en && !snap_active) begin
+                snap_due <= (|reg_intr0) | (|reg_intr1);
+            end
+        end else if (io_intr == 0) begin
             if (io_intr_en) begin
                 io_intr <= (|reg_intr0) | (|reg_intr1);
             end
@@ -480,6 +1151,9 @@ begin
             // if io_intr is 1 then let the clear happen.
             io_intr <= (|reg_intr0) | (|reg_intr1);
         end
+        if (snap_start || !reg_snap[0]) begin
+            snap_due <= 0;
+        end
 
         // default
         slv_wr_en <= 0;
@@ -5,10 +5,23 @@
  *
  *  Resources:
  *    port   -  full path to serial port (/dev/serial0)
- *    config -  baudrate in range of 1200 to 921000
+ *    config -  baudrate in range of 1200 to 12000000
  *    intrr_pin -  which pin to monitor as an interrupt
  *    rawin  -  Received characters displayed in hex
  *    rawout -  Characters to send to serial port
+ *    window -  max number of transactions in flight to the FPGA
+ *    nodummy - FPGA replies without dummy bytes from the host
+ *    telemetry - rate and register ranges the FPGA streams unsolicited
+ *    intrr_snapshot - FPGA sends pending interrupts with the core's registers
+ *    intr_stats - per core interrupt counts and latency histograms
+ *    cache  -  register shadow hits, misses, and skipped writes
+ *    maxbaud - step the link up to the highest rate that works
+ *    rtio   -  run the serial port on its own pinned real-time thread
+ *    trace  -  record packets, responses, and breaks in a ring
+ *    regs   -  read a range of any core's registers in one burst
+ *
+ *  The last value read of each register is kept in the shared memory
+ *  mirror described in hba_shm.h for local programs to map.
  */
 
 /*
@@ -25,6 +38,7 @@
  *              GNU General Public License for more details. 
  */
 
+#define _GNU_SOURCE              // for CPU_SET and pthread affinity
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -35,12 +49,24 @@
 #include <sys/fcntl.h>
 #include <sys/types.h>
 #include <limits.h>              // for PATH_MAX
-#include <termios.h>
 #include <unistd.h>
 #include <sys/ioctl.h> 
+#include <asm/termbits.h>        // termios2 for any baud rate
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <glob.h>
 #include <linux/serial.h>
+#include <linux/gpio.h>
 #include "eedd.h"
 #include "hba.h"
+#include "hba_shm.h"
+#include "hba_trace.h"
 #include "readme.h"
 
 
@@ -52,6 +78,33 @@
 #define HBA_SF_REG_INTR0       (0)
 #define HBA_SF_REG_INTR1       (1)
 #define HBA_SF_REG_RATE        (2)
+#define HBA_SF_REG_CTRL        (3)
+#define HBA_SF_REG_TM_RATE     (4)
+#define HBA_SF_REG_TM_NPAIRS   (5)
+#define HBA_SF_REG_SNAP        (6)
+#define HBA_SF_REG_TM_PAIR0    (8)
+#define HBA_SF_REG_BAUD        (16)
+        // ctrl register bits
+#define HBA_SF_CTRL_NODUMMY    (0x01)
+        // snapshot register bits
+#define HBA_SF_SNAP_ENABLE     (0x01)
+        // Telemetry frames start with this byte.  Responses never do.
+#define HBA_SF_TM_SYNC         (0x5A)
+        // Max number of (core, register range) pairs in a frame
+#define HBA_SF_TM_MXPAIR       (4)
+        // Max number of registers in a pair
+#define HBA_SF_TM_MXCOUNT      (8)
+        // A snapshot frame starts with this {count, core} for the two
+        // interrupt pending registers
+#define HBA_SF_SNAP_PENDCC     (0x20)
+        // Max length of a frame after the sync and length bytes.  A
+        // snapshot frame has the pending registers in front of the pairs.
+#define HBA_SF_TM_MXLEN        (4 + (HBA_SF_TM_MXPAIR * (2 + HBA_SF_TM_MXCOUNT)))
+        // Size of the FPGA receive FIFO
+#define HBA_SF_RXFIFO          (64)
+        // Time in ms the FPGA waits at a new baud rate for the host
+        // to confirm it
+#define HBA_SF_BAUD_TRIAL_MS   (100)
         // resource names and numbers
 #define FN_PORT            "port"
 #define FN_CONFIG          "config"
@@ -59,20 +112,100 @@
 #define FN_RAWIN           "rawin"
 #define FN_RAWOUT          "rawout"
 #define FN_INTRRT          "intrr_rate"
+#define FN_WINDOW          "window"
+#define FN_NODUMMY         "nodummy"
+#define FN_TELEMETRY       "telemetry"
+#define FN_SNAPSHOT        "intrr_snapshot"
+#define FN_INTRSTATS       "intr_stats"
+#define FN_CACHE           "cache"
+#define FN_MAXBAUD         "maxbaud"
+#define FN_RTIO            "rtio"
+#define FN_TRACE           "trace"
+#define FN_REGS            "regs"
 #define RSC_PORT           0
 #define RSC_CONFIG         1
 #define RSC_INTRRP         2
 #define RSC_RAWIN          3
 #define RSC_RAWOUT         4
 #define RSC_INTRRT         5
+#define RSC_WINDOW         6
+#define RSC_NODUMMY        7
+#define RSC_TELEMETRY      8
+#define RSC_SNAPSHOT       9
+#define RSC_INTRSTATS      10
+#define RSC_CACHE          11
+#define RSC_MAXBAUD        12
+#define RSC_RTIO           13
+#define RSC_TRACE          14
+#define RSC_REGS           15
         // What we are is a ...
 #define PLUGIN_NAME        "serial_fpga"
         // Default serial port
 #define DEFDEV             "/dev/serial0"
         // Default baudrate
 #define DEFBAUD            115200
+        // Range of baud rates
+#define HBA_MNBAUD        (1200)
+#define HBA_MXBAUD        (12000000)
+        // Number of reads to check the link at a new baud rate
+#define HBA_BAUD_NCHECK   (4)
+        // baud_switch() return when a failed rate is finished by a timer
+#define HBA_BAUD_PENDING  (2)
         // Default interrupt GPIO pin
 #define HBA_DEF_INTR      (25)
+        // GPIO character device with the interrupt pin.  intrr_pin
+        // is a line offset on this chip for every backend.
+#define HBA_GPIOCHIP      "/dev/gpiochip0"
+        // Largest interrupt line offset accepted
+#define HBA_MXINTRPIN     (1000)
+        // sysfs base file of the chip, the global number of line 0.
+        // Its node is under the chip or, on older kernels, its parent.
+#define HBA_GPIOBASE      "/sys/bus/gpio/devices/gpiochip0/gpio/gpiochip*/base"
+#define HBA_GPIOPBASE     "/sys/bus/gpio/devices/gpiochip0/../gpio/gpiochip*/base"
+        // Max number of interrupt pin edges read at once
+#define HBA_MXEDGE        (16)
+        // Number of buckets in the interrupt time histograms.  Bucket n
+        // counts times of 2^n to 2^(n+1)-1 us and the last bucket counts
+        // everything longer.
+#define HBA_NSTATBKT      (12)
+        // Register shadow flags
+#define HBA_SH_NONVOL     (0x01)    // changes only when the host writes it
+#define HBA_SH_VALID      (0x02)    // shadow has the register's value
+        // Max number of queued and outstanding transactions
+#define HBA_MXXFER        (32)
+        // Time in ms added to the wire time of a transaction before it
+        // times out.  Covers the FPGA and the kernel's serial latency.
+#define HBA_XFER_SLACK_MS (3)
+        // Length in bit times of the break that resyncs the FPGA
+#define HBA_BREAK_BITS    (40)
+        // Max number of transactions in flight at the FPGA
+#define HBA_MXWINDOW      (8)
+        // Max number of packets in one sendrecv_batch()
+#define HBA_MXBATCH       (16)
+        // Delay in ms of the timer that sends posted writes.  Zero
+        // runs it once the event loop has handled the fds ready this
+        // turn, so the writes of one turn merge and none is held longer.
+#define HBA_COALESCE_MS   (0)
+        // Number of submit rings to the I/O thread.  Ring 0 is for the
+        // event loop and the others go to the first threads to submit.
+#define HBA_RT_NSUBMIT    (4)
+        // Slots in each submit ring and in the completion ring.  Powers
+        // of two so the free running ring counters can wrap.
+#define HBA_RT_NMSG       (64)
+#define HBA_RT_NDONE      (256)
+        // Max number of interrupt edges waiting on the read of the
+        // pending registers.  Covers the queue and the done ring.
+#define HBA_MXIRQ         (HBA_MXXFER + HBA_RT_NDONE)
+        // Max number of records in the packet trace ring
+#define HBA_TR_MXREC      (1 << 18)
+        // Message types on the rings
+#define RT_SUBMIT         (1)       // a packet for xfer_submit()
+#define RT_POST           (2)       // a write for xfer_post()
+#define RT_BATCH          (3)       // a packet of a sendrecv_batch()
+#define RT_DONE           (4)       // a completion callback to invoke
+#define RT_FRAME          (5)       // a telemetry frame for the handlers
+#define RT_RAWIN          (6)       // received bytes for rawin
+#define RT_CALL           (7)       // a function to run on the I/O thread
 
 
 
@@ -84,13 +217,135 @@ typedef struct
 {
     void    (*intr_hndlr) ();    // interrupt handler
     void     *trans;             // data to pass transparently to handler 
+    void    (*tm_hndlr) ();      // telemetry handler
+    void     *tm_trans;          // data to pass transparently to tm_hndlr
+    uint32_t  nintr;             // number of interrupts
+    uint32_t  nunhandled;        // number of interrupts with no handler
+    uint32_t  lathist[HBA_NSTATBKT];  // GPIO edge to handler times
+    uint32_t  exechist[HBA_NSTATBKT]; // handler execution times
 } COREINFO;
 
+    // An interrupt edge.  It is the trans of the read of the pending
+    // registers so the edge time goes to intr_pending() with the
+    // response, whichever thread did the read.
+typedef struct
+{
+    void     *pctx;             // the SERPORT of the pin
+    uint64_t  ts;               // kernel time of the edge in ns, 0 if none
+    atomic_int busy;            // ==1 until intr_pending() is done with it
+} IRQEDGE;
+
+    // A copy of the counters.  Readers format or return this instead
+    // of the live counts.  The link and shadow counts are copied on the
+    // I/O thread and the interrupt counts in the event loop, the
+    // threads that update them.
+typedef struct
+{
+    int      baud;              // baud rate
+    int      nqueued;           // transactions in the queue
+    uint32_t nintr[NCORE];      // number of interrupts of each core
+    uint32_t nunhandled[NCORE]; // number with no handler
+    uint32_t lathist[NCORE][HBA_NSTATBKT];  // GPIO edge to handler times
+    uint32_t exechist[NCORE][HBA_NSTATBKT]; // handler execution times
+    uint32_t shhits;            // reads answered from the shadow
+    uint32_t shmisses;          // reads of non-volatile registers sent
+    uint32_t shskips;           // writes dropped since they matched
+    unsigned int trsize;        // number of records in the trace ring
+    uint64_t trcount;           // number of trace records made
+} SFSTATS;
+
+    // A transaction queued for, or outstanding at, the FPGA
+typedef struct
+{
+    uint8_t  pkt[HBA_MXPKT_EXT]; // packet to send, response on completion
+    int      count;             // number of bytes to send
+    int      expectrd;          // number of bytes expected in response
+    int      rdsofar;           // number of response bytes received
+    int      txbytes;           // number of bytes put on the wire
+    int      nbatch;            // # transactions sent with this one in one write()
+    int      canmerge;          // ==1 if later posted writes may merge into this
+    int      ncb;               // number of callbacks (merged writes)
+    int      setmode;           // nodummy mode after this is sent, or -1
+    int      newbaud;           // baud rate after this is ACKed, or 0
+    int      cached;            // ==1 if answered from the register shadow
+    int      core;              // core the packet is for
+    uint8_t  cmd;               // command byte sent, kept past the response
+    void    (*done_cb[HBA_MXBURST]) (); // completion callbacks
+    void     *trans[HBA_MXBURST];   // data to pass transparently to callbacks
+} XFER;
+
+    // A request to, or an event from, the real-time I/O thread
+typedef struct
+{
+    int      op;                // RT_xxx
+    int      count;             // bytes in pkt, or the response count
+    int      nbatch;            // packets in the batch this one starts
+    void    (*done_cb) ();      // completion callback
+    void     *trans;            // data to pass transparently to done_cb
+    uint8_t  pkt[HBA_MXPKT_EXT]; // packet, response, frame, or raw bytes
+} RTMSG;
+
+    // A lock-free single producer, single consumer ring.  Only the
+    // producer stores head and only the consumer stores tail.  Both
+    // count up forever and are used modulo nmsg.
+typedef struct
+{
+    atomic_uint head;           // number of messages pushed
+    atomic_uint tail;           // number of messages popped
+    unsigned int nmsg;          // number of slots, a power of two
+    RTMSG   *msg;               // the slots
+} RTRING;
+
+    // The real-time I/O thread.  While it runs it owns the serial
+    // port, the interrupt pin, and the transaction queue.  The event
+    // loop and other threads reach the queue through the submit rings
+    // and callbacks come back to the event loop on the done ring.
+typedef struct
+{
+    pthread_t thread;           // the I/O thread
+    int      cpu;               // CPU the thread is pinned to (-1=any)
+    int      prio;              // SCHED_FIFO priority (0=SCHED_OTHER)
+    int      wakefd;            // eventfd to wake the I/O thread
+    int      donefd;            // eventfd to wake the event loop
+    int      nwake;             // messages pushed since donefd was written
+    atomic_int stop;            // ==1 to have the thread exit
+    atomic_int used[HBA_RT_NSUBMIT];  // ==1 once a ring has its thread
+    RTRING   submit[HBA_RT_NSUBMIT];  // requests to the I/O thread
+    RTRING   done;              // completions, frames, and rawin bytes
+    pthread_mutex_t dlock;      // held to wait for room on the done ring
+    pthread_cond_t dcond;       // signaled when there is room or on stop
+    atomic_int dfull;           // ==1 while the thread waits for room
+    RTMSG   *spill;             // messages posted while stopping a full ring
+    int      nspill;            // number of messages in spill
+    int      mxspill;           // number of slots in spill
+} RTIO;
+
+    // An interrupt pin backend.  The GPIO character device is tried
+    // first and the sysfs GPIO interface is the fallback.  A FIFO
+    // stands in for the pin of an emulated FPGA.
+typedef struct
+{
+    char    *name;              // backend name for the log
+    int      fdflag;            // ED_READ or ED_EXCEPT for add_fd()
+    int    (*open) (int pin);   // configure the pin, returns an fd or -1
+    int    (*edges) (int fd, uint64_t *ts, int maxts); // read the edges
+} GPIOBE;
+
     // All state info for an instance of an hba_serial_fpga peripheral
 typedef struct
 {
     void    *pslot;    // handle to plug-in's's slot info
     int      baud;     // baudrate
+    int      maxbaud;  // highest baud rate to step up to (0=do not)
+    int      rgcore;   // core read by the regs resource
+    int      rgreg;    // first register read by regs
+    int      rgcount;  // number of registers read by regs
+    int      baudwait; // ==1 while waiting for the ACK of a rate change
+    int      bnmax;    // maxbaud being negotiated (0=none)
+    int      bnold;    // rate to go back to after a failed trial
+    int      bnnew;    // the failed rate
+    int      bnrtio;   // ==1 to start the I/O thread when negotiation ends
+    void    *btimer;   // waits out the FPGA's trial of a failed rate
     void    *ptimer;   // timer with callback to bcast state
     char     port[PATH_MAX]; // full path to serial port node
     int      spfd;     // serial port File Descriptor (=-1 if closed)
@@ -99,9 +354,45 @@ typedef struct
     uint8_t  rawoutc[MX_MSGLEN];  // data from host to fpga
     int      outidx;   // index into rawoutc
     int      intrrp;   // interrupt input gpio
+    char     irpath[PATH_MAX]; // FIFO used in place of the pin ("" if none)
     int      irfd;     // interrupt pin file descriptor (-1 if closed)
+    GPIOBE  *irbe;     // interrupt pin backend used for irfd
+    IRQEDGE  irq[HBA_MXIRQ]; // edges waiting on a pending register read
+    int      irnext;   // next slot in irq to use
+    IRQEDGE  irnone;   // an edge with no time, used when irq is full
     int      intrrt;   // interrupt rate in hz
     COREINFO coreinfo[NCORE];
+    XFER     xfer[HBA_MXXFER]; // circular queue of transactions
+    int      xhead;    // index of oldest transaction in xfer
+    int      nxfer;    // number of transactions in the queue
+    int      nsent;    // number of queued transactions sent to FPGA
+    int      window;   // max number of transactions in flight
+    void    *xtimer;   // timeout for the oldest sent transaction
+    void    *ftimer;   // flushes posted writes at the end of a loop turn
+    int      nodummy;  // ==1 if the FPGA replies without dummy bytes
+    int      txnodummy; // ==1 if the next packet is sent in nodummy format
+    int      nsentb;   // number of bytes sent for the nsent transactions
+    int      tmrate;   // telemetry frame period in ms (0=off)
+    int      tmnpair;  // number of telemetry pairs
+    uint8_t  tmcore[HBA_SF_TM_MXPAIR];  // core of each pair
+    uint8_t  tmreg[HBA_SF_TM_MXPAIR];   // first register of each pair
+    uint8_t  tmcount[HBA_SF_TM_MXPAIR]; // number of registers in each pair
+    int      snapshot; // ==1 if the FPGA sends interrupt snapshot frames
+    HBA_SHM *pshm;     // shared memory register mirror (0 if none)
+    uint8_t  shadow[NCORE][HBA_SHM_NREG];  // last value of each register
+    uint8_t  shflags[NCORE][HBA_SHM_NREG]; // HBA_SH_xxx flags of each register
+    uint8_t  shpend[NCORE][HBA_SHM_NREG];  // writes queued and not yet answered
+    uint32_t shhits;   // reads answered from the shadow
+    uint32_t shmisses; // reads of non-volatile registers sent to the FPGA
+    uint32_t shskips;  // writes dropped since they matched the shadow
+    pthread_t mainthr; // the thread that runs the event loop
+    RTIO    *prt;      // the real-time I/O thread (0 until first started)
+    int      rtio;     // ==1 while the I/O thread owns the queue
+    uint64_t xdue;     // I/O thread's timeout of the oldest sent transaction
+    HBA_TRREC *trace;  // packet trace ring (0 if off)
+    unsigned int trsize; // number of records in the ring, a power of two
+    uint64_t trcount;  // number of records made since the ring was set up
+    HBA_OPS  ops;      // bus operations handed to the child plug-ins
 } SERPORT;
 
 
@@ -109,16 +400,109 @@ typedef struct
  *  - Function prototypes and external references
  **************************************************************/
 int sendrecv_pkt(int parent, int count, uint8_t *buff);
+int sendrecv_async(int parent, int count, uint8_t *buff, void (*)(), void *);
+int sendrecv_batch(int parent, int npkt, HBA_PKT *pkts);
+HBA_OPS *hba_get_ops(int parent);
+static SERPORT *parent_ctx(int parent);
+static int  bus_send(void *pctx, int count, uint8_t *buff);
+static int  bus_async(void *pctx, int count, uint8_t *buff, void (*)(), void *);
+static int  bus_batch(void *pctx, int npkt, HBA_PKT *pkts);
+static void bus_intr(void *pctx, int coreid, void (*)(), void *);
+static void bus_telemetry(void *pctx, int coreid, void (*)(), void *);
+static void bus_nonvolatile(void *pctx, int coreid, int reg, int count);
+static int  bus_stats(void *pctx, int coreid, HBA_STATS *pstats);
 static void getevents(int, void *);
 static void usercmd(int, int, char*, SLOT*, int, int*, char*);
 static int  portconfig(SERPORT *pctx);
-static int  gpioconfig(int pin);
+static int  port_setbaud(int fd, int baud);
+static int  baud_switch(SERPORT *pctx, int nbaud);
+static int  baud_check(SERPORT *pctx, int rate, int nreg);
+static int  baud_negotiate(SERPORT *pctx, int maxbaud);
+static void baud_trialend(void *timer, void *pctx);
+static void baud_done(SERPORT *pctx, int ret);
+static int  gpioconfig(SERPORT *pctx);
+static int  gpiocdev_open(int pin);
+static int  gpiocdev_edges(int fd, uint64_t *ts, int maxts);
+static int  gpiosysfs_open(int pin);
+static int  gpiosysfs_base(void);
+static int  gpiosysfs_edges(int fd, uint64_t *ts, int maxts);
+static int  gpiofifo_open(char *path);
+static int  gpiofifo_edges(int fd, uint64_t *ts, int maxts);
 static void do_interrupt(int fd, void *pctx);
+static void intr_pending(void *pctx, int nrc, uint8_t *pkt);
+static void intr_dispatch(SERPORT *pctx, int intpending, int handled, uint64_t edgets);
+static void intr_stat(COREINFO *pci, uint64_t edgets, uint64_t start, uint64_t end);
+static int  intr_stats(SFSTATS *pst, char *buf, int len);
+static uint64_t now_ns(void);
+static int  xfer_submit(SERPORT *pctx, int count, uint8_t *buff, void (*)(), void *);
+static int  xfer_queue(SERPORT *pctx, int count, uint8_t *buff, void (*)(), void *);
+static int  xfer_post(SERPORT *pctx, int count, uint8_t *buff, void (*)(), void *);
+static void xfer_flush(void *timer, void *pctx);
+static void xfer_wait(SERPORT *pctx, atomic_int *pdone);
+static void xfer_send(SERPORT *pctx);
+static int  xfer_txcount(int nodummy, XFER *px);
+static int  set_nodummy(SERPORT *pctx, int nodummy);
+static void xfer_rxbytes(SERPORT *pctx);
+static int  tm_rxframe(SERPORT *pctx, uint8_t *buff, int count);
+static void tm_dispatch(SERPORT *pctx, uint8_t *frame, int flen);
+static void rawin_bcst(SERPORT *pctx, uint8_t *bytes, int nrd);
+static int  set_telemetry(SERPORT *pctx, char *val);
+static int  set_snapshot(SERPORT *pctx, int snapshot);
+static void xfer_fail(SERPORT *pctx, int err);
+static void xfer_timeout(void *timer, void *pctx);
+static int  xfer_tmo(SERPORT *pctx);
+static void link_resync(SERPORT *pctx);
+static int  write_pkt(SERPORT *pctx, uint8_t *buff, int count);
+static HBA_SHM *shm_setup(void);
+static void shm_update(SERPORT *pctx, int core, int reg, int count, uint8_t *data);
+static void shadow_check(SERPORT *pctx, XFER *px);
+static int  shadow_same(SERPORT *pctx, int core, int reg, int count, uint8_t *data);
+static void shadow_pend(SERPORT *pctx, int core, int reg, int count);
+static void shadow_done(SERPORT *pctx, XFER *px, int ack);
+static void shadow_fill(SERPORT *pctx, int core, int reg, int count, uint8_t *data);
+static void shadow_invalidate(SERPORT *pctx, int core);
+static void xfer_cached(SERPORT *pctx);
+static int  rtio_start(SERPORT *pctx, int cpu, int prio);
+static void rtio_stop(SERPORT *pctx);
+static void rtio_fds(SERPORT *pctx);
+static void *rtio_run(void *pctx);
+static void rtio_take(SERPORT *pctx);
+static RTRING *rtio_ring(SERPORT *pctx);
+static int  rtio_submit(SERPORT *pctx, int op, int npkt, HBA_PKT *pkts, void (*)(), void **);
+static void rtio_wait(SERPORT *pctx, atomic_int *pdone, int efd);
+static int  rtio_call(SERPORT *pctx, void (*fn)(SERPORT *, void *), void *arg);
+static int  rtio_set(SERPORT *pctx, int *pvar, int val);
+static void stats_snap(SERPORT *pctx, void *arg);
+static void intr_snap(SERPORT *pctx, SFSTATS *pst);
+static void intr_reset(SERPORT *pctx);
+static void cache_reset(SERPORT *pctx, void *arg);
+static int  rtio_waitfd(SERPORT *pctx);
+static void rtio_done(SERPORT *pctx, void (*)(), void *, int ret, uint8_t *rsp);
+static void rtio_post(SERPORT *pctx, int op, int count, uint8_t *data, void (*)(), void *);
+static void rtio_events(int fd, void *pctx);
+static void rtio_drain(SERPORT *pctx);
+static void rtio_msg(SERPORT *pctx, RTMSG *pm);
+static void rtio_room(RTIO *prt);
+static void trace_add(SERPORT *pctx, int type, int core, int flags, uint8_t *data, int len);
+static int  trace_size(SERPORT *pctx, int nrec);
+static int  trace_dump(SERPORT *pctx, char *path);
 void        register_interupt_handler(int parent, int, void (*)());
+void        register_telemetry_handler(int parent, int, void (*)(), void *);
+void        register_nonvolatile(int parent, int, int, int);
 extern SLOT Slots[];
 extern int  DebugMode;
 extern int  ForegroundMode;
 
+    // Interrupt pin backends in the order they are tried
+static GPIOBE gpiobe[] = {
+#ifdef GPIO_V2_GET_LINE_IOCTL
+    { "chardev", ED_READ, gpiocdev_open, gpiocdev_edges },
+#endif
+    { "sysfs", ED_EXCEPT, gpiosysfs_open, gpiosysfs_edges },
+};
+    // The io_intr FIFO of hba_emu.  It is opened by path, not pin.
+static GPIOBE gpiofifo = { "fifo", ED_READ, (int (*) (int)) 0, gpiofifo_edges };
+
 
 /**************************************************************
  * Initialize():  - Allocate our permanent storage and set up
@@ -128,6 +512,7 @@ int Initialize(
     SLOT *pslot)       // points to the SLOT for this plug-in
 {
     SERPORT *pctx;     // our local port context
+    int      i;        // to walk the interrupt edges
 
     // Allocate memory for this plug-in
     pctx = (SERPORT *) malloc(sizeof(SERPORT));
@@ -140,14 +525,68 @@ int Initialize(
     // Init our SERPORT structure
     pctx->pslot = pslot;       // this instance of serial_fpga
     pctx->baud = DEFBAUD;      // default baud rate
+    pctx->maxbaud = 0;         // stay at baud
+    pctx->rgcore = 0;          // no registers for regs to read
+    pctx->rgreg = 0;
+    pctx->rgcount = 0;
+    pctx->baudwait = 0;
+    pctx->bnmax = 0;
+    pctx->bnrtio = 0;
+    pctx->btimer = (void *) 0;
     pctx->inidx = 0;           // no bytes in input buffer
     pctx->outidx = 0;          // no bytes in output buffer
     pctx->spfd = -1;           // port is not yet open
     (void) strncpy(pctx->port, DEFDEV, PATH_MAX);
     // no default for the interrupt pin. 
     pctx->intrrp = HBA_DEF_INTR;  // interrupt gpio
+    pctx->irpath[0] = (char) 0;   // a pin, not a FIFO
     pctx->intrrt = 0;             // 0 rate indicates no delay.
     pctx->irfd = -1;           // interrupt pin file descriptor (-1 if closed)
+    pctx->irbe = (GPIOBE *) 0;
+    for (i = 0; i < HBA_MXIRQ; i++) {
+        pctx->irq[i].pctx = (void *) pctx;
+        pctx->irq[i].ts = 0;
+        atomic_init(&(pctx->irq[i].busy), 0);
+    }
+    pctx->irnext = 0;
+    pctx->irnone.pctx = (void *) pctx;
+    pctx->irnone.ts = 0;
+    atomic_init(&(pctx->irnone.busy), 0);
+    pctx->xhead = 0;           // transaction queue is empty
+    pctx->nxfer = 0;
+    pctx->nsent = 0;
+    pctx->window = 1;          // wait for each response by default
+    pctx->xtimer = (void *) 0;
+    pctx->ftimer = (void *) 0;
+    pctx->nodummy = 0;         // FPGA resets to dummy byte clocking
+    pctx->txnodummy = 0;
+    pctx->nsentb = 0;
+    pctx->tmrate = 0;          // FPGA resets with telemetry off
+    pctx->tmnpair = 0;
+    pctx->snapshot = 0;        // FPGA resets with snapshots off
+    pctx->pshm = shm_setup();  // register mirror for local programs
+    (void) memset(pctx->shflags, 0, sizeof(pctx->shflags)); // all volatile
+    (void) memset(pctx->shpend, 0, sizeof(pctx->shpend));
+    pctx->shhits = 0;
+    pctx->shmisses = 0;
+    pctx->shskips = 0;
+    pctx->mainthr = pthread_self();
+    pctx->prt = (RTIO *) 0;    // serial I/O runs in the event loop
+    pctx->rtio = 0;
+    pctx->xdue = 0;
+    pctx->trace = (HBA_TRREC *) 0;  // no packet trace
+    pctx->trsize = 0;
+    pctx->trcount = 0;
+    (void) memset(pctx->coreinfo, 0, sizeof(pctx->coreinfo));
+    pctx->ops.version = HBA_OPS_VERSION;
+    pctx->ops.ctx = (void *) pctx;
+    pctx->ops.send = bus_send;
+    pctx->ops.send_async = bus_async;
+    pctx->ops.send_batch = bus_batch;
+    pctx->ops.reg_intr = bus_intr;
+    pctx->ops.reg_telemetry = bus_telemetry;
+    pctx->ops.reg_nonvolatile = bus_nonvolatile;
+    pctx->ops.stats = bus_stats;
 
     // Register name and private data
     pslot->name = PLUGIN_NAME;
@@ -192,6 +631,66 @@ int Initialize(
     pslot->rsc[RSC_INTRRT].pgscb = usercmd;
     pslot->rsc[RSC_INTRRT].uilock = -1;
     pslot->rsc[RSC_INTRRT].slot = pslot;
+    pslot->rsc[RSC_WINDOW].name = FN_WINDOW;
+    pslot->rsc[RSC_WINDOW].flags = IS_READABLE | IS_WRITABLE;
+    pslot->rsc[RSC_WINDOW].bkey = 0;
+    pslot->rsc[RSC_WINDOW].pgscb = usercmd;
+    pslot->rsc[RSC_WINDOW].uilock = -1;
+    pslot->rsc[RSC_WINDOW].slot = pslot;
+    pslot->rsc[RSC_NODUMMY].name = FN_NODUMMY;
+    pslot->rsc[RSC_NODUMMY].flags = IS_READABLE | IS_WRITABLE;
+    pslot->rsc[RSC_NODUMMY].bkey = 0;
+    pslot->rsc[RSC_NODUMMY].pgscb = usercmd;
+    pslot->rsc[RSC_NODUMMY].uilock = -1;
+    pslot->rsc[RSC_NODUMMY].slot = pslot;
+    pslot->rsc[RSC_TELEMETRY].name = FN_TELEMETRY;
+    pslot->rsc[RSC_TELEMETRY].flags = IS_READABLE | IS_WRITABLE;
+    pslot->rsc[RSC_TELEMETRY].bkey = 0;
+    pslot->rsc[RSC_TELEMETRY].pgscb = usercmd;
+    pslot->rsc[RSC_TELEMETRY].uilock = -1;
+    pslot->rsc[RSC_TELEMETRY].slot = pslot;
+    pslot->rsc[RSC_SNAPSHOT].name = FN_SNAPSHOT;
+    pslot->rsc[RSC_SNAPSHOT].flags = IS_READABLE | IS_WRITABLE;
+    pslot->rsc[RSC_SNAPSHOT].bkey = 0;
+    pslot->rsc[RSC_SNAPSHOT].pgscb = usercmd;
+    pslot->rsc[RSC_SNAPSHOT].uilock = -1;
+    pslot->rsc[RSC_SNAPSHOT].slot = pslot;
+    pslot->rsc[RSC_INTRSTATS].name = FN_INTRSTATS;
+    pslot->rsc[RSC_INTRSTATS].flags = IS_READABLE | IS_WRITABLE;
+    pslot->rsc[RSC_INTRSTATS].bkey = 0;
+    pslot->rsc[RSC_INTRSTATS].pgscb = usercmd;
+    pslot->rsc[RSC_INTRSTATS].uilock = -1;
+    pslot->rsc[RSC_INTRSTATS].slot = pslot;
+    pslot->rsc[RSC_CACHE].name = FN_CACHE;
+    pslot->rsc[RSC_CACHE].flags = IS_READABLE | IS_WRITABLE;
+    pslot->rsc[RSC_CACHE].bkey = 0;
+    pslot->rsc[RSC_CACHE].pgscb = usercmd;
+    pslot->rsc[RSC_CACHE].uilock = -1;
+    pslot->rsc[RSC_CACHE].slot = pslot;
+    pslot->rsc[RSC_MAXBAUD].name = FN_MAXBAUD;
+    pslot->rsc[RSC_MAXBAUD].flags = IS_READABLE | IS_WRITABLE;
+    pslot->rsc[RSC_MAXBAUD].bkey = 0;
+    pslot->rsc[RSC_MAXBAUD].pgscb = usercmd;
+    pslot->rsc[RSC_MAXBAUD].uilock = -1;
+    pslot->rsc[RSC_MAXBAUD].slot = pslot;
+    pslot->rsc[RSC_RTIO].name = FN_RTIO;
+    pslot->rsc[RSC_RTIO].flags = IS_READABLE | IS_WRITABLE;
+    pslot->rsc[RSC_RTIO].bkey = 0;
+    pslot->rsc[RSC_RTIO].pgscb = usercmd;
+    pslot->rsc[RSC_RTIO].uilock = -1;
+    pslot->rsc[RSC_RTIO].slot = pslot;
+    pslot->rsc[RSC_TRACE].name = FN_TRACE;
+    pslot->rsc[RSC_TRACE].flags = IS_READABLE | IS_WRITABLE;
+    pslot->rsc[RSC_TRACE].bkey = 0;
+    pslot->rsc[RSC_TRACE].pgscb = usercmd;
+    pslot->rsc[RSC_TRACE].uilock = -1;
+    pslot->rsc[RSC_TRACE].slot = pslot;
+    pslot->rsc[RSC_REGS].name = FN_REGS;
+    pslot->rsc[RSC_REGS].flags = IS_READABLE | IS_WRITABLE;
+    pslot->rsc[RSC_REGS].bkey = 0;
+    pslot->rsc[RSC_REGS].pgscb = usercmd;
+    pslot->rsc[RSC_REGS].uilock = -1;
+    pslot->rsc[RSC_REGS].slot = pslot;
 
     pctx->ptimer = (void *) 0;
 
@@ -199,11 +698,7 @@ int Initialize(
     (void) portconfig(pctx);  // void since there is no ui
 
     // try to allocate the default interrupt gpio pin
-    pctx->irfd = gpioconfig(pctx->intrrp);
-    if (pctx->irfd >= 0) {       // config succeeded?
-        // Add fd to exception list for select()
-        add_fd(pctx->irfd, ED_EXCEPT, do_interrupt, (void *) pctx);
-    }
+    (void) gpioconfig(pctx);
 
     return (0);
 }
@@ -229,12 +724,53 @@ static void usercmd(
     int      intrpin;  // new interrupt GPIO pin
     int      intrrate; // new interrupt rate in hz
     int      intrrt_ms; // new interrupt rate in ms
+    int      nwindow;  // new max number of transactions in flight
+    int      nnodummy; // new nodummy mode
+    int      nsnapshot; // new snapshot mode
     int      nsd;      // number of bytes sent to FPGA
+    int      rtcpu;    // CPU for the I/O thread
+    int      rtprio;   // priority of the I/O thread
+    int      ntrace;   // new number of trace records
+    int      ncore;    // new core for regs
+    int      nreg;     // new first register for regs
+    int      ncount;   // new number of registers for regs
+    uint8_t *pdata;    // register values in xpkt
+    int      i;        // to walk the telemetry pairs
+    SFSTATS  st;       // snapshot of the counters
     uint8_t  pkt[HBA_MXPKT];
+    uint8_t  xpkt[HBA_MXPKT_EXT]; // burst read for regs
 
     // Get this instance of the plug-in
     pctx = (SERPORT *) pslot->priv;
 
+    // Nothing changes while the FPGA tries a failed baud rate.  The
+    // trial is over in about 2*HBA_SF_BAUD_TRIAL_MS.
+    if ((cmd == EDSET) && (pctx->btimer != (void *) 0)) {
+        ret = snprintf(buf, *plen, E_NORSP, pslot->rsc[rscid].name);
+        *plen = ret;
+        return;
+    }
+
+    // The I/O thread owns the port, the pin, and the transaction
+    // queue.  Stop it while a resource changes the link or its fds and
+    // start it again after.  Other changes are made on the thread by
+    // rtio_call().
+    if ((cmd == EDSET) && (pctx->rtio != 0) &&
+        ((rscid == RSC_PORT) || (rscid == RSC_CONFIG) ||
+         (rscid == RSC_MAXBAUD) || (rscid == RSC_NODUMMY) ||
+         (rscid == RSC_INTRRP) || (rscid == RSC_INTRRT) ||
+         (rscid == RSC_RAWOUT) || (rscid == RSC_TRACE))) {
+        rtio_stop(pctx);
+        usercmd(cmd, rscid, val, pslot, cn, plen, buf);
+        if (pctx->btimer != (void *) 0) {
+            pctx->bnrtio = 1;          // baud_done() starts it
+            return;
+        }
+        if (rtio_start(pctx, pctx->prt->cpu, pctx->prt->prio) != 0) {
+            edlog("%s: unable to restart the I/O thread", PLUGIN_NAME);
+        }
+        return;
+    }
 
     if ((cmd == EDGET) && (rscid == RSC_PORT)) {
         ret = snprintf(buf, *plen, "%s\n", pctx->port);
@@ -244,6 +780,10 @@ static void usercmd(
         ret = snprintf(buf, *plen, "%d\n", pctx->baud);
         *plen = ret;  // (errors are handled in calling routine)
     }
+    else if ((cmd == EDGET) && (rscid == RSC_INTRRP) && pctx->irpath[0]) {
+        ret = snprintf(buf, *plen, "%s\n", pctx->irpath);
+        *plen = ret;  // (errors are handled in calling routine)
+    }
     else if ((cmd == EDGET) && (rscid == RSC_INTRRP)) {
         ret = snprintf(buf, *plen, "%d\n", pctx->intrrp);
         *plen = ret;  // (errors are handled in calling routine)
@@ -252,6 +792,252 @@ static void usercmd(
         ret = snprintf(buf, *plen, "%d\n", pctx->intrrt);
         *plen = ret;  // (errors are handled in calling routine)
     }
+    else if ((cmd == EDGET) && (rscid == RSC_WINDOW)) {
+        ret = snprintf(buf, *plen, "%d\n", pctx->window);
+        *plen = ret;  // (errors are handled in calling routine)
+    }
+    else if ((cmd == EDSET) && (rscid == RSC_WINDOW)) {
+        ret = sscanf(val, "%d", &nwindow);
+        if ((ret != 1) || (nwindow < 1) || (nwindow > HBA_MXWINDOW)) {
+            ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
+            *plen = ret;
+            return;
+        }
+        // A smaller window takes effect as transactions complete
+        if (rtio_set(pctx, &(pctx->window), nwindow) != 0) {
+            ret = snprintf(buf, *plen, E_NORSP, pslot->rsc[rscid].name);
+            *plen = ret;
+            return;
+        }
+    }
+    else if ((cmd == EDGET) && (rscid == RSC_NODUMMY)) {
+        ret = snprintf(buf, *plen, "%d\n", pctx->nodummy);
+        *plen = ret;  // (errors are handled in calling routine)
+    }
+    else if ((cmd == EDSET) && (rscid == RSC_NODUMMY)) {
+        ret = sscanf(val, "%d", &nnodummy);
+        if ((ret != 1) || (nnodummy < 0) || (nnodummy > 1)) {
+            ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
+            *plen = ret;
+            return;
+        }
+        if (set_nodummy(pctx, nnodummy) != 0) {
+            ret = snprintf(buf, *plen, E_NORSP, pslot->rsc[rscid].name);
+            *plen = ret;
+            return;
+        }
+    }
+    else if ((cmd == EDGET) && (rscid == RSC_TELEMETRY)) {
+        ret = snprintf(buf, *plen, "%d", pctx->tmrate);
+        for (i = 0; i < pctx->tmnpair; i++) {
+            ret += snprintf(&(buf[ret]), (*plen - ret), " %d:%d:%d",
+                            pctx->tmcore[i], pctx->tmreg[i], pctx->tmcount[i]);
+        }
+        ret += snprintf(&(buf[ret]), (*plen - ret), "\n");
+        *plen = ret;  // (errors are handled in calling routine)
+    }
+    else if ((cmd == EDSET) && (rscid == RSC_TELEMETRY)) {
+        ret = set_telemetry(pctx, val);
+        if (ret == HBAERROR_NOSEND) {
+            ret = snprintf(buf, *plen, E_NORSP, pslot->rsc[rscid].name);
+            *plen = ret;
+            return;
+        }
+        else if (ret != 0) {
+            ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
+            *plen = ret;
+            return;
+        }
+    }
+    else if ((cmd == EDGET) && (rscid == RSC_SNAPSHOT)) {
+        ret = snprintf(buf, *plen, "%d\n", pctx->snapshot);
+        *plen = ret;  // (errors are handled in calling routine)
+    }
+    else if ((cmd == EDSET) && (rscid == RSC_SNAPSHOT)) {
+        ret = sscanf(val, "%d", &nsnapshot);
+        if ((ret != 1) || (nsnapshot < 0) || (nsnapshot > 1)) {
+            ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
+            *plen = ret;
+            return;
+        }
+        if (set_snapshot(pctx, nsnapshot) != 0) {
+            ret = snprintf(buf, *plen, E_NORSP, pslot->rsc[rscid].name);
+            *plen = ret;
+            return;
+        }
+    }
+    else if ((cmd == EDGET) && (rscid == RSC_INTRSTATS)) {
+        // The handlers, and so the counts, run in the event loop
+        intr_snap(pctx, &st);
+        ret = intr_stats(&st, buf, *plen);
+        if (ret < 0) {
+            ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
+        }
+        *plen = ret;
+    }
+    else if ((cmd == EDSET) && (rscid == RSC_INTRSTATS)) {
+        // Any value resets the statistics
+        intr_reset(pctx);
+    }
+    else if ((cmd == EDGET) && (rscid == RSC_CACHE)) {
+        if (rtio_call(pctx, stats_snap, (void *) &st) != 0) {
+            ret = snprintf(buf, *plen, E_NORSP, pslot->rsc[rscid].name);
+            *plen = ret;
+            return;
+        }
+        ret = snprintf(buf, *plen, "%u %u %u\n", st.shhits, st.shmisses,
+                       st.shskips);
+        *plen = ret;  // (errors are handled in calling routine)
+    }
+    else if ((cmd == EDGET) && (rscid == RSC_MAXBAUD)) {
+        ret = snprintf(buf, *plen, "%d\n", pctx->maxbaud);
+        *plen = ret;  // (errors are handled in calling routine)
+    }
+    else if ((cmd == EDSET) && (rscid == RSC_MAXBAUD)) {
+        ret = sscanf(val, "%d", &nbaud);
+        if ((ret != 1) || ((nbaud != 0) &&
+            ((nbaud < HBA_MNBAUD) || (nbaud > HBA_MXBAUD)))) {
+            ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
+            *plen = ret;
+            return;
+        }
+        if (nbaud == 0) {
+            pctx->maxbaud = 0;
+            return;
+        }
+        pctx->bnmax = nbaud;
+        ret = baud_negotiate(pctx, nbaud);
+        if (ret == HBA_BAUD_PENDING) {
+            // baud_done() answers once the FPGA gives up the failed rate
+            pslot->rsc[rscid].uilock = cn;
+            *plen = 0;
+            return;
+        }
+        pctx->bnmax = 0;
+        if (ret < 0) {
+            ret = snprintf(buf, *plen, E_NORSP, pslot->rsc[rscid].name);
+            *plen = ret;
+            return;
+        }
+        pctx->maxbaud = nbaud;
+    }
+    else if ((cmd == EDGET) && (rscid == RSC_RTIO)) {
+        if (pctx->rtio == 0) {
+            ret = snprintf(buf, *plen, "off\n");
+        }
+        else {
+            ret = snprintf(buf, *plen, "%d %d\n", pctx->prt->cpu,
+                           pctx->prt->prio);
+        }
+        *plen = ret;  // (errors are handled in calling routine)
+    }
+    else if ((cmd == EDSET) && (rscid == RSC_RTIO)) {
+        if (strncmp(val, "off", 3) == 0) {
+            rtio_stop(pctx);
+            return;
+        }
+        ret = sscanf(val, "%d %d", &rtcpu, &rtprio);
+        if ((ret != 2) || (rtcpu < -1) || (rtcpu >= CPU_SETSIZE) ||
+            (rtprio < 0) || (rtprio > sched_get_priority_max(SCHED_FIFO))) {
+            ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
+            *plen = ret;
+            return;
+        }
+        rtio_stop(pctx);
+        if (rtio_start(pctx, rtcpu, rtprio) != 0) {
+            ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
+            *plen = ret;
+            return;
+        }
+    }
+    else if ((cmd == EDGET) && (rscid == RSC_TRACE)) {
+        if (rtio_call(pctx, stats_snap, (void *) &st) != 0) {
+            ret = snprintf(buf, *plen, E_NORSP, pslot->rsc[rscid].name);
+            *plen = ret;
+            return;
+        }
+        ret = snprintf(buf, *plen, "%u %llu\n", st.trsize,
+                       (unsigned long long) st.trcount);
+        *plen = ret;  // (errors are handled in calling routine)
+    }
+    else if ((cmd == EDSET) && (rscid == RSC_TRACE)) {
+        // A path dumps the ring.  A number sets the ring size.
+        if (val[0] == '/') {
+            ret = trace_dump(pctx, val);
+        }
+        else {
+            ret = sscanf(val, "%d", &ntrace);
+            ret = ((ret != 1) || (ntrace < 0) || (ntrace > HBA_TR_MXREC)) ?
+                  -1 : trace_size(pctx, ntrace);
+        }
+        if (ret != 0) {
+            ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
+            *plen = ret;
+            return;
+        }
+    }
+    else if ((cmd == EDGET) && (rscid == RSC_REGS)) {
+        // Each register prints as 'xx ' and the last space becomes the
+        // newline.  Refuse a read whose values would not all fit.
+        if ((pctx->rgcount == 0) || (((3 * pctx->rgcount) + 1) > *plen)) {
+            ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
+            *plen = ret;
+            return;
+        }
+        // One read of all of them.  More than HBA_MXBURST needs the
+        // extended command.
+        (void) memset(xpkt, 0, sizeof(xpkt));
+        if (pctx->rgcount <= HBA_MXBURST) {
+            xpkt[0] = HBA_READ_CMD | ((pctx->rgcount -1) << 4) | pctx->rgcore;
+            xpkt[1] = pctx->rgreg;
+            nsd = bus_send((void *) pctx, (4 + pctx->rgcount), xpkt);
+            pdata = &(xpkt[2]);
+            ret = nsd - 2;
+        }
+        else {
+            xpkt[0] = HBA_READ_CMD | HBA_EXT_CMD;
+            xpkt[1] = pctx->rgcore;
+            xpkt[2] = pctx->rgreg;
+            xpkt[3] = pctx->rgcount;
+            nsd = bus_send((void *) pctx, (8 + pctx->rgcount), xpkt);
+            pdata = &(xpkt[4]);
+            ret = nsd - 4;
+        }
+        if (ret != pctx->rgcount) {
+            ret = snprintf(buf, *plen, E_NORSP, pslot->rsc[rscid].name);
+            *plen = ret;
+            return;
+        }
+        for (i = 0; i < pctx->rgcount; i++) {
+            sprintf(&buf[3 * i], "%02x ", pdata[i]);
+        }
+        buf[(3 * i) - 1] = '\n';
+        *plen = 3 * i;
+    }
+    else if ((cmd == EDSET) && (rscid == RSC_REGS)) {
+        // Not our own core.  A read of its pending registers clears
+        // them and a read of the baud rate confirms a rate change.
+        ret = sscanf(val, "%d %d %d", &ncore, &nreg, &ncount);
+        if ((ret != 3) || (ncore <= HBA_SERIAL_FPGA_COREID) ||
+            (ncore >= (NCORE - 1)) ||
+            (nreg < 0) || (ncount < 1) || (ncount > HBA_MXBURST_EXT) ||
+            ((nreg + ncount) > 256)) {
+            ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
+            *plen = ret;
+            return;
+        }
+        pctx->rgcore = ncore;
+        pctx->rgreg = nreg;
+        pctx->rgcount = ncount;
+    }
+    else if ((cmd == EDSET) && (rscid == RSC_CACHE)) {
+        // Any value resets the counters and forgets the shadow
+        if (rtio_call(pctx, cache_reset, (void *) 0) != 0) {
+            ret = snprintf(buf, *plen, E_NORSP, pslot->rsc[rscid].name);
+            *plen = ret;
+            return;
+        }
+    }
     else if ((cmd == EDSET) && (rscid == RSC_PORT)) {
         // Val has the new port path.  Just copy it.
         (void) strncpy(pctx->port, val, PATH_MAX);
@@ -263,6 +1049,9 @@ static void usercmd(
             close(pctx->spfd);
             pctx->spfd = -1;
         }
+        // anything queued for the old port will never get a response
+        xfer_fail(pctx, HBAERROR_NOSEND);
+        shadow_invalidate(pctx, -1);
         // now open and register the new port
         ret = portconfig(pctx);
         if (ret < 0) {
@@ -278,12 +1067,7 @@ static void usercmd(
             *plen = ret;
             return;
         }
-        if ((nbaud != 1200) && (nbaud != 1800) && (nbaud != 2400) &&
-            (nbaud != 4800) && (nbaud != 9600) && (nbaud != 19200) &&
-            (nbaud != 38400) && (nbaud != 57600) && (nbaud != 115200) &&
-            (nbaud != 230400) && (nbaud != 460800) && (nbaud != 500000) &&
-            (nbaud != 576000) && (nbaud != 921600))
-        {
+        if ((nbaud < HBA_MNBAUD) || (nbaud > HBA_MXBAUD)) {
             ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
             *plen = ret;
             return;
@@ -293,28 +1077,31 @@ static void usercmd(
         pctx->baud = nbaud;
         portconfig(pctx);
     }
+    else if ((cmd == EDSET) && (rscid == RSC_INTRRP) && (val[0] == '/')) {
+        // the io_intr FIFO of an emulated FPGA
+        (void) strncpy(pctx->irpath, val, PATH_MAX - 1);
+        pctx->irpath[PATH_MAX - 1] = (char) 0;
+        if (gpioconfig(pctx) < 0) {       // config failed?
+            ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
+            *plen = ret;
+            return;
+        }
+    }
     else if ((cmd == EDSET) && (rscid == RSC_INTRRP)) {
         ret = sscanf(val, "%d", &intrpin);
-        if ((ret != 1) || (intrpin < 0) || (intrpin > 100)) {
+        if ((ret != 1) || (intrpin < 0) || (intrpin > HBA_MXINTRPIN)) {
             ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
             *plen = ret;
             return;
         }
         pctx->intrrp = intrpin;
-        // close and unregister the old port
-        if (pctx->irfd >= 0) {
-            del_fd(pctx->irfd);
-            close(pctx->irfd);
-            pctx->irfd = -1;
-        }
-        pctx->irfd = gpioconfig(pctx->intrrp);
-        if (pctx->irfd < 0) {       // config failed?
+        pctx->irpath[0] = (char) 0;
+        // close the old pin and open the new one
+        if (gpioconfig(pctx) < 0) {       // config failed?
             ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
             *plen = ret;
             return;
         }
-        // Add fd to exception list for select()
-        add_fd(pctx->irfd, ED_EXCEPT, do_interrupt, (void *) pctx);
     }
     else if ((cmd == EDSET) && (rscid == RSC_INTRRT)) {
         ret = sscanf(val, "%d", &intrrate);
@@ -345,7 +1132,7 @@ static void usercmd(
         pkt[2] = intrrt_ms;                     // new value
         pkt[3] = 0;                             // dummy for the ack
 
-        nsd = sendrecv_pkt(pslot->slot_id, 4, pkt);
+        nsd = bus_send((void *) pctx, 4, pkt);
         // We did a write so the sendrecv return value should be 1
         // and the returned byte should be an ACK
         if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
@@ -354,20 +1141,12 @@ static void usercmd(
             *plen = ret;
         }
 
-        // close and unregister the old port
-        if (pctx->irfd >= 0) {
-            del_fd(pctx->irfd);
-            close(pctx->irfd);
-            pctx->irfd = -1;
-        }
-        pctx->irfd = gpioconfig(pctx->intrrp);
-        if (pctx->irfd < 0) {       // config failed?
+        // close the old pin and open the new one
+        if (gpioconfig(pctx) < 0) {       // config failed?
             ret = snprintf(buf, *plen, E_BDVAL, pslot->rsc[rscid].name);
             *plen = ret;
             return;
         }
-        // Add fd to exception list for select()
-        add_fd(pctx->irfd, ED_EXCEPT, do_interrupt, (void *) pctx);
     }
     else if ((cmd == EDSET) && (rscid == RSC_RAWOUT)) {
         // User has given us a line of space separated 8-bit hex values.
@@ -382,8 +1161,11 @@ static void usercmd(
             if (pctx->outidx == MX_MSGLEN)      // full buffer ?
                 break;
         }
-        // Send data to serial port
+        // Send data to serial port.  It may change any register.
+        shadow_invalidate(pctx, -1);
         if (pctx->spfd >= 0) {
+            trace_add(pctx, HBA_TR_TX, HBA_TR_NOCORE, HBA_TR_RAW,
+                      pctx->rawoutc, pctx->outidx);
             ret = write(pctx->spfd, pctx->rawoutc, pctx->outidx);
             if (ret != pctx->outidx) {
                 // Error writing to serial port.  Ignore partial writes
@@ -413,58 +1195,97 @@ static void getevents(
     void     *cb_data)       // callback date (==*SERPORT)
 {
     SERPORT  *pctx;          // our context
-    SLOT     *pslot;         // This instance of the serial plug-in
-    RSC      *prsc;          // pointer to this slot's counts resource
+    SLOT     *pslot;         // our SLOT
+    uint8_t  *pnew;          // first of the newly read bytes
     int       nrd;           // number of bytes read
-    char      msg[MX_MSGLEN * 3 +1]; // text to send.  +1 for newline
-    int       slen;          // length of text to output
-    int       i;             // to walk the input buffer
 
 
     pctx = (SERPORT *) cb_data;
     pslot = pctx->pslot;
 
     // Read from the serial port and output the data if anyone is
-    // watching the rawin resource.  See if an interrupt is registered
-    // for the (implied) slot in the packet.  If there's a handler then
-    // forward the packet to the slot's interrupt handler.
+    // watching the rawin resource.  Then give the bytes to the
+    // transaction queue as the response to the oldest outstanding
+    // transaction.  New bytes are appended to rawinc since a completion
+    // callback may call back into here before the older bytes are used.
 
-    nrd = read(pctx->spfd, pctx->rawinc, MX_MSGLEN);
+    pnew = &(pctx->rawinc[pctx->inidx]);
+    nrd = read(pctx->spfd, pnew, (MX_MSGLEN - pctx->inidx));
 
     // shutdown manager conn on error or on zero bytes read */
     if ((nrd <= 0) && (errno != EAGAIN)) {
         close(pctx->spfd);
-        del_fd(pctx->spfd);
+        if (pctx->rtio == 0) {
+            del_fd(pctx->spfd);
+        }
         pctx->spfd = -1;
+        pctx->inidx = 0;
+        // nothing outstanding will get a response now
+        xfer_fail(pctx, HBAERROR_NORECV);
+        return;
+    }
+    if (nrd <= 0) {
         return;
     }
 
-    // Broadcast characters if any UI are monitoring it.
-    // '3' because each input byte prints as 'xx '.
-    prsc = &(pslot->rsc[RSC_RAWIN]);  // events resource
-    if (prsc->bkey != 0) {
-        for(i = 0 ; i < nrd ; i++) {
-            sprintf(&msg[i * 3],"%02x ", pctx->rawinc[i]);
+    // Broadcast characters if any UI are monitoring it.  The UI
+    // belongs to the event loop.
+    if (pslot->rsc[RSC_RAWIN].bkey != 0) {
+        if (pctx->rtio != 0) {
+            rtio_post(pctx, RT_RAWIN, nrd, pnew, 0, (void *) 0);
+        }
+        else {
+            rawin_bcst(pctx, pnew, nrd);
         }
-        sprintf(&msg[i * 3], "\n");
-        slen = (i * 3) + 1;
-        bcst_ui(msg, slen, &(prsc->bkey));
-        prompt(prsc->uilock);
     }
+
+    pctx->inidx += nrd;
+    xfer_rxbytes(pctx);
     return;
 }
 
 
+/***************************************************************************
+ * rawin_bcst(): - Send received bytes to the UIs monitoring rawin
+ ***************************************************************************/
+static void rawin_bcst(
+    SERPORT  *pctx,          // our context
+    uint8_t  *bytes,         // the received bytes
+    int       nrd)           // number of bytes
+{
+    SLOT     *pslot = pctx->pslot;  // our SLOT
+    RSC      *prsc;          // pointer to this slot's counts resource
+    char      msg[MX_MSGLEN * 3 +1]; // text to send.  +1 for newline
+    int       slen;          // length of text to output
+    int       i;             // to walk the input buffer
+
+    // '3' because each input byte prints as 'xx '.
+    prsc = &(pslot->rsc[RSC_RAWIN]);  // events resource
+    if (prsc->bkey == 0) {
+        return;
+    }
+    for(i = 0 ; i < nrd ; i++) {
+        sprintf(&msg[i * 3],"%02x ", bytes[i]);
+    }
+    sprintf(&msg[i * 3], "\n");
+    slen = (i * 3) + 1;
+    bcst_ui(msg, slen, &(prsc->bkey));
+    prompt(prsc->uilock);
+}
+
+
 /* Open and/or configure the serial port.  Open and config if
  * fd is -1.  Just config if fd is >= 0.  Sets pctx->spfd.
  * Return fd so errors can be handled in calling routine.
  */
 static int portconfig(SERPORT *pctx)
 {
-    struct termios tbuf;        // termios structure for port
-    speed_t baudrate;           // baudrate for cfsetospeed
+    struct termios2 tbuf;       // termios structure for port
     struct serial_struct serial; // for low latency
 
+    // The FPGA may have been reset or replaced while the port changed
+    shadow_invalidate(pctx, -1);
+
     if (pctx->spfd < 0) {
         pctx->spfd = open(pctx->port, (O_RDWR | O_NOCTTY | O_NONBLOCK), 0);
         if (pctx->spfd < 0) {
@@ -472,33 +1293,19 @@ static int portconfig(SERPORT *pctx)
         }
     }
 
-    // Get baudrate
-    switch(pctx->baud) {
-        case 1200 : baudrate = B1200; break;
-        case 1800 : baudrate = B1800; break;
-        case 2400 : baudrate = B2400; break;
-        case 4800 : baudrate = B4800; break;
-        case 9600 : baudrate = B9600; break;
-        case 19200 : baudrate = B19200; break;
-        case 38400 : baudrate = B38400; break;
-        case 57600 : baudrate = B57600; break;
-        case 115200 : baudrate = B115200; break;
-        case 230400 : baudrate = B230400; break;
-        case 460800 : baudrate = B460800; break;
-        case 500000 : baudrate = B500000; break;
-        case 576000 : baudrate = B576000; break;
-        case 921600 : baudrate = B921600; break;
-    }
-
-    // Port is open and spfd is valid.  Configure the port.
-    tbuf.c_cflag = CS8 | CREAD | baudrate | CLOCAL;
+    // Port is open and spfd is valid.  Configure the port.  BOTHER
+    // takes the baud rate as a number so any rate the UART can make
+    // is allowed.
+    (void) memset(&tbuf, 0, sizeof(tbuf));
+    tbuf.c_cflag = CS8 | CREAD | BOTHER | CLOCAL;
     tbuf.c_iflag = IGNBRK;
     tbuf.c_oflag = 0;
     tbuf.c_lflag = 0;
     tbuf.c_cc[VMIN] = 1;        /* character-by-character input */
     tbuf.c_cc[VTIME] = 0;       /* no delay waiting for characters */
-    int actions = TCSANOW;
-    if (tcsetattr(pctx->spfd, actions, &tbuf) < 0) {
+    tbuf.c_ispeed = pctx->baud;
+    tbuf.c_ospeed = pctx->baud;
+    if (ioctl(pctx->spfd, TCSETS2, &tbuf) < 0) {
         edlog(M_BADPORT, pctx->spfd, strerror(errno));
         close(pctx->spfd);
         pctx->spfd = -1;
@@ -516,50 +1323,191 @@ static int portconfig(SERPORT *pctx)
 }
 
 
-/* Open and configure the gpio port for interrupts.   Return opened
- * file descriptor on success and -1 on failure.
+/* port_setbaud() : Change the baud rate of an open serial port once
+ * what has been written is sent.  Returns 0 on success and -1 on
+ * error.
  */
-static int gpioconfig(int pin)
+static int port_setbaud(
+    int            fd,          // the serial port
+    int            baud)        // the new rate
 {
-    int           gpfd;         // the fd of the opened GPIO pin
-    int           sysfd;        // fd for /sys/class/gpio/....
-    char          pinname[MX_MSGLEN]; // pin number as an ascii string
-    int           pinlen;       // length of string in pinname
-    int           ret;          // generic system return value
+    struct termios2 tbuf;       // termios structure for port
+
+    if (ioctl(fd, TCGETS2, &tbuf) < 0) {
+        return(-1);
+    }
+    tbuf.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+    tbuf.c_cflag |= BOTHER;
+    tbuf.c_ispeed = baud;
+    tbuf.c_ospeed = baud;
+    if (ioctl(fd, TCSETSW2, &tbuf) < 0) {
+        return(-1);
+    }
+    return(0);
+}
+
+
+/* gpioconfig() : Close the interrupt pin if open and open
+ * pctx->intrrp with the first backend that can configure it, or the
+ * FIFO in pctx->irpath if set.  The pin is added to the select()
+ * list.  Return 0 on success and -1 on failure.
+ */
+static int gpioconfig(
+    SERPORT       *pctx)        // our local info
+{
+    int           i;
+
+    // close and unregister the old pin
+    if (pctx->irfd >= 0) {
+        del_fd(pctx->irfd);
+        close(pctx->irfd);
+        pctx->irfd = -1;
+    }
 
+    if (pctx->irpath[0]) {
+        pctx->irfd = gpiofifo_open(pctx->irpath);
+        if (pctx->irfd < 0) {
+            return(-1);
+        }
+        pctx->irbe = &gpiofifo;
+        add_fd(pctx->irfd, gpiofifo.fdflag, do_interrupt, (void *) pctx);
+        return(0);
+    }
 
     // simple sanity check on pin value
-    if ((pin < 0) || (pin > 1000)) {
+    if ((pctx->intrrp < 0) || (pctx->intrrp > HBA_MXINTRPIN)) {
        edlog("Invalid GPIO pin for interrupts");
        return(-1);
     }
-    pinlen = snprintf(pinname, MX_MSGLEN, "%d", pin);
 
-    // Open /sys/class/gpio/export and write the pin number to it
-    sysfd =open("/sys/class/gpio/export", (O_RDWR), 0);
-    if (sysfd < 0) {
-        edlog("Unable to open /sys/class/gpio/export.  Are you root?");
-        return(-1);
-    }
-    ret = write(sysfd, pinname, pinlen);
-    if (ret != pinlen) {
-        edlog("Warning: could not write pin name to /sys/class/gpio/export");
+    for (i = 0; i < (int) (sizeof(gpiobe) / sizeof(GPIOBE)); i++) {
+        pctx->irfd = (gpiobe[i].open) (pctx->intrrp);
+        if (pctx->irfd >= 0) {
+            pctx->irbe = &(gpiobe[i]);
+            add_fd(pctx->irfd, gpiobe[i].fdflag, do_interrupt, (void *) pctx);
+            return(0);
+        }
     }
-    close(sysfd);
-    usleep(100000);    // give the kernal a chance to set up gpio
+    return(-1);
+}
 
-    // Open edge for the GPIO pin and configure the port to be
-    // read ready on a rising edge
-    pinlen = snprintf(pinname, MX_MSGLEN, "/sys/class/gpio/gpio%d/edge", pin);
-    sysfd = open(pinname, (O_RDWR), 0);
-    if (sysfd < 0) {
-        edlog("Unable to open %s", pinname);
-        close(sysfd);
+
+#ifdef GPIO_V2_GET_LINE_IOCTL
+/* gpiocdev_open() : Request the pin as an input with rising edge
+ * events from the GPIO character device.  The kernel queues each edge
+ * with a timestamp so none are lost while we are busy.  Return the
+ * line file descriptor on success and -1 on failure.
+ */
+static int gpiocdev_open(int pin)
+{
+    int           chipfd;       // fd of the GPIO chip
+    struct gpio_v2_line_request req; // line request
+    int           ret;          // generic system return value
+
+    chipfd = open(HBA_GPIOCHIP, (O_RDONLY), 0);
+    if (chipfd < 0) {
         return(-1);
     }
-    ret = write(sysfd, "rising", 6);      // 6=strlen("rising")
-    if (ret != 6) {
-        edlog("Unable to configure %s", pinname);
+    (void) memset(&req, 0, sizeof(req));
+    req.offsets[0] = pin;
+    req.num_lines = 1;
+    req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING;
+    req.event_buffer_size = HBA_MXEDGE;
+    (void) strncpy(req.consumer, PLUGIN_NAME, GPIO_MAX_NAME_SIZE - 1);
+    ret = ioctl(chipfd, GPIO_V2_GET_LINE_IOCTL, &req);
+    close(chipfd);
+    if (ret < 0) {
+        edlog("Unable to get line %d of %s.  Trying sysfs", pin, HBA_GPIOCHIP);
+        return(-1);
+    }
+
+    // Reads must not block the daemon
+    (void) fcntl(req.fd, F_SETFL, O_NONBLOCK);
+    return(req.fd);
+}
+
+
+/* gpiocdev_edges() : Read all of the queued edge events in one read()
+ * and give their kernel timestamps in ts.  Return the number of edges,
+ * 0 if there are none or the pin is not high, and -1 on error.
+ */
+static int gpiocdev_edges(
+    int           fd,           // line fd from gpiocdev_open()
+    uint64_t     *ts,           // timestamp of each edge in ns
+    int           maxts)        // max number of timestamps
+{
+    struct gpio_v2_line_event ev[HBA_MXEDGE]; // the edge events
+    struct gpio_v2_line_values lv; // the pin value
+    int           nev;          // number of events read
+    int           ret;          // generic system return value
+    int           i;
+
+    ret = read(fd, ev, sizeof(ev));
+    if (ret < 0) {
+        return((errno == EAGAIN) ? 0 : -1);
+    }
+    nev = ret / sizeof(ev[0]);
+    nev = (nev < maxts) ? nev : maxts;
+    for (i = 0; i < nev; i++) {
+        ts[i] = ev[i].timestamp_ns;
+    }
+
+    // Noise on the interrupt line can trigger a rising edge.
+    // Verify that the interrupt pin really is high
+    lv.mask = 1;
+    lv.bits = 0;
+    if (ioctl(fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &lv) < 0) {
+        return(-1);
+    }
+    if ((lv.bits & 1) == 0) {
+        return(0);
+    }
+    return(nev);
+}
+#endif
+
+
+/* gpiosysfs_open() : Export the pin with the sysfs GPIO interface and
+ * configure it for rising edges.  sysfs numbers the pins globally so
+ * the line offset is moved up by the base of gpiochip0.  Return the
+ * opened value file descriptor on success and -1 on failure.
+ */
+static int gpiosysfs_open(int pin)
+{
+    int           gpfd;         // the fd of the opened GPIO pin
+    int           sysfd;        // fd for /sys/class/gpio/....
+    char          pinname[MX_MSGLEN]; // pin number as an ascii string
+    int           pinlen;       // length of string in pinname
+    int           ret;          // generic system return value
+
+    pin += gpiosysfs_base();
+    pinlen = snprintf(pinname, MX_MSGLEN, "%d", pin);
+
+    // Open /sys/class/gpio/export and write the pin number to it
+    sysfd =open("/sys/class/gpio/export", (O_RDWR), 0);
+    if (sysfd < 0) {
+        edlog("Unable to open /sys/class/gpio/export.  Are you root?");
+        return(-1);
+    }
+    ret = write(sysfd, pinname, pinlen);
+    if (ret != pinlen) {
+        edlog("Warning: could not write pin name to /sys/class/gpio/export");
+    }
+    close(sysfd);
+    usleep(100000);    // give the kernal a chance to set up gpio
+
+    // Open edge for the GPIO pin and configure the port to be
+    // read ready on a rising edge
+    pinlen = snprintf(pinname, MX_MSGLEN, "/sys/class/gpio/gpio%d/edge", pin);
+    sysfd = open(pinname, (O_RDWR), 0);
+    if (sysfd < 0) {
+        edlog("Unable to open %s", pinname);
+        close(sysfd);
+        return(-1);
+    }
+    ret = write(sysfd, "rising", 6);      // 6=strlen("rising")
+    if (ret != 6) {
+        edlog("Unable to configure %s", pinname);
         close(sysfd);
         return(-1);
     }
@@ -577,9 +1525,128 @@ static int gpioconfig(int pin)
 } 
 
 
+/* gpiosysfs_base() : Return the sysfs number of line 0 of gpiochip0.
+ * Kernels from 6.6 on number the chips from 512.  If the base can not
+ * be found the kernel is taken to be old enough to start gpiochip0 at
+ * 0.
+ */
+static int gpiosysfs_base(void)
+{
+    glob_t        gl;           // the chip's base file
+    FILE         *fp;           // the opened base file
+    int           base = 0;     // global number of line 0
+
+    (void) memset(&gl, 0, sizeof(gl));
+    (void) glob(HBA_GPIOBASE, 0, NULL, &gl);
+    (void) glob(HBA_GPIOPBASE, GLOB_APPEND, NULL, &gl);
+    if (gl.gl_pathc == 0) {
+        globfree(&gl);
+        return(0);
+    }
+    fp = fopen(gl.gl_pathv[0], "r");
+    if (fp != (FILE *) 0) {
+        if (fscanf(fp, "%d", &base) != 1) {
+            base = 0;
+        }
+        fclose(fp);
+    }
+    globfree(&gl);
+    return(base);
+}
+
+
+/* gpiosysfs_edges() : Read the pin value to clear the edge.  sysfs
+ * reports one edge at a time with no timestamp so the time of the
+ * read is used.  Return 1 if the pin is high, 0 if not, and -1 on
+ * error.
+ */
+static int gpiosysfs_edges(
+    int           fd,           // value fd from gpiosysfs_open()
+    uint64_t     *ts,           // timestamp of the edge in ns
+    int           maxts)        // max number of timestamps
+{
+    char          value[MX_MSGLEN]; // ASCII pin value
+    int           ret;          // generic system return value
+
+    (void) lseek(fd, (off_t) 0, SEEK_SET);
+    ret = read(fd, value, MX_MSGLEN);
+    if (ret <= 0) {
+        return(-1);
+    }
+
+    // Noise on the interrupt line can trigger a rising edge.
+    // Verify that the interrupt pin really is high
+    if ((value[0] != '1') || (maxts < 1)) {
+        return(0);
+    }
+    ts[0] = now_ns();
+    return(1);
+}
+
+
+/* gpiofifo_open() : Open the io_intr FIFO of hba_emu.  It is opened
+ * read-write so there is always a writer and we never see an end of
+ * file.  Return the fd on success and -1 on failure.
+ */
+static int gpiofifo_open(char *path)
+{
+    int           fd;           // the fd of the FIFO
+
+    fd = open(path, (O_RDWR | O_NONBLOCK), 0);
+    if (fd < 0) {
+        edlog("Unable to open interrupt FIFO %s", path);
+        return(-1);
+    }
+    return(fd);
+}
+
+
+/* gpiofifo_edges() : Read the FIFO.  A '1' is a rising edge and a '0'
+ * a falling edge.  The time of the read is used for each edge.
+ * Return the number of rising edges and -1 on error.
+ */
+static int gpiofifo_edges(
+    int           fd,           // fd from gpiofifo_open()
+    uint64_t     *ts,           // timestamp of each edge in ns
+    int           maxts)        // max number of timestamps
+{
+    char          lvl[HBA_MXEDGE * 2]; // levels written by hba_emu
+    int           nedge = 0;    // number of rising edges
+    int           ret;          // generic system return value
+    int           i;
+
+    ret = read(fd, lvl, sizeof(lvl));
+    if (ret < 0) {
+        return((errno == EAGAIN) ? 0 : -1);
+    }
+    for (i = 0; (i < ret) && (nedge < maxts); i++) {
+        if (lvl[i] == '1') {
+            ts[nedge++] = now_ns();
+        }
+    }
+    return(nedge);
+}
+
+
+/* now_ns() : Return the CLOCK_MONOTONIC time in ns.  This is the
+ * clock of the GPIO edge event timestamps.
+ */
+static uint64_t now_ns(void)
+{
+    struct timespec now;        // current time
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &now);
+    return(((uint64_t) now.tv_sec * 1000000000) + now.tv_nsec);
+}
+
+
 /* sendrecv_pkt() : Send a packet to the FPGA.  Wait for the
  * response.  Write packet receive one byte in response and read
  * packets receive two less than the number of bytes sent.
+ *     Extended packets (HBA_EXT_CMD) carry up to 255 data bytes and
+ * have a four byte header: cmd, core, reg, and length.  Extended
+ * reads receive four less than the number of bytes sent.  The buffer
+ * may then be up to HBA_MXPKT_EXT bytes.
  *     Input is the number of bytes to send and a pointer to a buffer
  * with the bytes to send.  The buffer does not need to be null terminated.
  *     On return the buffer is filled with the response bytes.
@@ -590,76 +1657,219 @@ static int gpioconfig(int pin)
  *     This routine is typically called from a driver plug-in to send
  * a read or write command to the FPGA.  It may be called from within
  * serial_fpga itself for initialization and to help process interrupts.
+ *     The packet goes through the same transaction queue as those from
+ * sendrecv_async().  We run the receive side of the queue ourselves
+ * until our packet completes so any transactions queued ahead of us
+ * complete, and have their callbacks invoked, before we return.
+ *     With the rtio I/O thread running this may also be called from
+ * other threads.  They wait for their own packet only.
+ *     bus_send() is the same for children that have our HBA_OPS.
  */
+typedef struct
+{
+    uint8_t      *buff;         // caller's buffer for the response
+    int           ret;          // response count or error code
+    atomic_int    done;         // set when the transaction completes
+    int           efd;          // eventfd of a waiting thread, or -1
+} SYNCXFER;
+
+static void sync_done(
+    void         *trans,        // our SYNCXFER
+    int           ret,          // response count or error code
+    uint8_t      *rsp)          // the response bytes
+{
+    SYNCXFER     *psync = (SYNCXFER *) trans;
+
+    if (ret > 0) {
+        (void) memcpy(psync->buff, rsp, ret);
+    }
+    psync->ret = ret;
+    // The waiter may be on another thread.  Release publishes ret and
+    // the response to it.
+    atomic_store_explicit(&(psync->done), 1, memory_order_release);
+}
+
 int sendrecv_pkt(
     int            parent,      // Slot number of parent,
     int            count,       // num bytes to send / receive
     uint8_t       *buff)        // pointer to first char to send
 {
     SERPORT      *pctx;         // our local info
-    SLOT         *pslot;        // our SLOT
-    int           sntcount1;    // return from first call to write()
-    int           sntcount2;    // return from second call to write()
-    int           expectrd;     // number of bytes expected in FPGA response
-    int           rdcount;      // return from read()
-    int           rdsofar = 0;  // number of characters we've read so far
-    fd_set        rdfs;         // read FDs for select()
-    struct timeval select_tv;   // timeout for select()
-    int           sret;         // select() return value
-    int           i;
 
-    pctx = (SERPORT *) Slots[parent].priv;
-    pslot = pctx->pslot;
-
-    if (strncmp(PLUGIN_NAME, pslot->name, strlen(PLUGIN_NAME)) != 0) {
-        edlog("Wanted %s in Slot %i.  Exiting...\n", PLUGIN_NAME, parent);
-        exit(1);
+    pctx = parent_ctx(parent);
+    if (pctx == (SERPORT *) 0) {
+        return(HBAERROR_NOSEND);
     }
+    return(bus_send((void *) pctx, count, buff));
+}
+
+static int bus_send(
+    void          *ctx,         // our local info
+    int            count,       // num bytes to send / receive
+    uint8_t       *buff)        // pointer to first char to send
+{
+    SERPORT      *pctx;         // our local info
+    SYNCXFER      sync;         // completion status of our packet
+    HBA_PKT       pkt;          // the packet for the I/O thread
+    void         *ptrans;       // sync_done()'s data for the I/O thread
 
-    // Sanity check. Valid count.  Non-null buffer.  Port open.
-    if ((count <= 0) || (buff == (uint8_t *) 0) || (pctx->spfd < 0)) {
+    pctx = (SERPORT *) ctx;
+
+    sync.buff = buff;
+    sync.ret = HBAERROR_NOSEND;
+    atomic_init(&(sync.done), 0);
+    sync.efd = -1;
+    if (pctx->rtio != 0) {
+        pkt.buff = buff;
+        pkt.count = count;
+        sync.efd = rtio_waitfd(pctx);
+        ptrans = (void *) &sync;
+        if (rtio_submit(pctx, RT_SUBMIT, 1, &pkt, sync_done, &ptrans) < 0) {
+            return(HBAERROR_NOSEND);
+        }
+        rtio_wait(pctx, &(sync.done), sync.efd);
+        return(sync.ret);
+    }
+    if (pthread_equal(pthread_self(), pctx->mainthr) == 0) {
+        return(HBAERROR_NOSEND);        // only the event loop without rtio
+    }
+    if (pctx->btimer != (void *) 0) {
+        return(HBAERROR_NOSEND);        // nothing is sent during a failed trial
+    }
+    if (xfer_submit(pctx, count, buff, sync_done, (void *) &sync) < 0) {
         return(HBAERROR_NOSEND);
     }
+    xfer_wait(pctx, &(sync.done));
 
-    // Print pkt if debug mode and running in foreground
-    if ((DebugMode != 0) && (ForegroundMode != 0)) {
-        printf(">> ");
-        for (i = 0; i < count; i++)
-            printf("%02x ", buff[i]);
-        printf("\n");
+    return(sync.ret);
+}
+
+
+/* sendrecv_batch() : Send a vector of packets to the FPGA in one
+ * write() and wait for all of the responses.  Each packet has the
+ * same format as for sendrecv_pkt() and on return each buffer holds
+ * its response and each 'ret' holds the response count or a negative
+ * error code.  This saves the syscalls and the turnaround gaps of a
+ * multi-step operation like disable, read, and restore.
+ *     Returns the number of packets that got a response or
+ * HBAERROR_NOSEND if the batch could not be queued.
+ */
+int sendrecv_batch(
+    int            parent,      // Slot number of parent,
+    int            npkt,        // number of packets in pkts
+    HBA_PKT       *pkts)        // the packets
+{
+    SERPORT      *pctx;         // our local info
+
+    pctx = parent_ctx(parent);
+    if (pctx == (SERPORT *) 0) {
+        return(HBAERROR_NOSEND);
     }
+    return(bus_batch((void *) pctx, npkt, pkts));
+}
 
-    // send data out the serial port 
-    sntcount1 = write(pctx->spfd, buff, count);
-    if (sntcount1 != count) {
-        if ((sntcount1 < 0) && (errno != EAGAIN) && (errno != EINTR)) {
-            edlog("error writing to serial port in serial_fpga");
+static int bus_batch(
+    void          *ctx,         // our local info
+    int            npkt,        // number of packets in pkts
+    HBA_PKT       *pkts)        // the packets
+{
+    SERPORT      *pctx;         // our local info
+    SYNCXFER      sync[HBA_MXBATCH]; // completion status of each packet
+    void         *ptrans[HBA_MXBATCH]; // sync_done()'s data for the I/O thread
+    XFER         *px;           // first transaction in the batch
+    int           efd;          // our eventfd if not the event loop
+    int           nok;          // number of packets with a response
+    int           i;
+
+    pctx = (SERPORT *) ctx;
+
+    // Sanity check.  The batch must fit in the queue.  The I/O thread
+    // holds it in the ring until it does.
+    if ((npkt <= 0) || (npkt > HBA_MXBATCH) || (pkts == (HBA_PKT *) 0)) {
+        return(HBAERROR_NOSEND);
+    }
+    if (pctx->rtio != 0) {
+        efd = rtio_waitfd(pctx);
+        for (i = 0; i < npkt; i++) {
+            sync[i].buff = pkts[i].buff;
+            sync[i].ret = HBAERROR_NOSEND;
+            atomic_init(&(sync[i].done), 0);
+            sync[i].efd = efd;
+            ptrans[i] = (void *) &(sync[i]);
+        }
+        if (rtio_submit(pctx, RT_BATCH, npkt, pkts, sync_done, ptrans) < 0) {
             return(HBAERROR_NOSEND);
         }
-
-        // Partial send or need to try again.  Pause then try again.
-        usleep(1000);
-        // sntcount1 is offset into xmit buffer.  No negative sntcount1
-        sntcount1 = (sntcount1 < 0) ? 0 : sntcount1;
-        sntcount2 = write(pctx->spfd, &buff[sntcount1], (count - sntcount1));
-        if (sntcount2 != (count - sntcount1)) {
-            // no retry on second failure
-            edlog("error writing to serial port in serial_fpga");
+        rtio_wait(pctx, &(sync[npkt - 1].done), efd);
+    }
+    else {
+        if ((npkt > (HBA_MXXFER - pctx->nxfer)) ||
+            (pthread_equal(pthread_self(), pctx->mainthr) == 0) ||
+            (pctx->btimer != (void *) 0)) {
             return(HBAERROR_NOSEND);
         }
+        // Queue all of the packets before sending any of them
+        px = &(pctx->xfer[(pctx->xhead + pctx->nxfer) % HBA_MXXFER]);
+        for (i = 0; i < npkt; i++) {
+            sync[i].buff = pkts[i].buff;
+            sync[i].ret = HBAERROR_NOSEND;
+            atomic_init(&(sync[i].done), 0);
+            sync[i].efd = -1;
+            if (xfer_queue(pctx, pkts[i].count, pkts[i].buff, sync_done,
+                           (void *) &(sync[i])) < 0) {
+                // Undo what we queued.  None of it has been sent.
+                while (i-- > 0) {
+                    pctx->nxfer--;
+                    shadow_done(pctx, &(pctx->xfer[(pctx->xhead + pctx->nxfer) %
+                                                   HBA_MXXFER]), 0);
+                }
+                return(HBAERROR_NOSEND);
+            }
+        }
+        px->nbatch = npkt;
+        xfer_send(pctx);
+        // Responses arrive in order so we are done when the last one is
+        xfer_wait(pctx, &(sync[npkt - 1].done));
     }
 
-    // Read characters from the serial port.  Use a select() loop
-    // so we can detect a timeout error.
-    // Expect response to have one byte for a write and two less than the
-    // write count for a read.
-    expectrd = (HBA_READ_CMD & buff[0]) ? (count -2) : 1 ;
+    nok = 0;
+    for (i = 0; i < npkt; i++) {
+        pkts[i].ret = sync[i].ret;
+        if (sync[i].ret > 0) {
+            nok++;
+        }
+    }
+    return(nok);
+}
+
 
-    // We loop as long as we are reading bytes within the timeout period.
+/* xfer_wait() : Run the receive side of the transaction queue until
+ * *pdone is set by a completion callback.
+ */
+static void xfer_wait(
+    SERPORT       *pctx,        // our local info
+    atomic_int    *pdone)       // set when the wait is over
+{
+    fd_set        rdfs;         // read FDs for select()
+    struct timeval select_tv;   // timeout for select()
+    int           sret;         // select() return value
+
+    // Read characters from the serial port.  Use a select() loop
+    // so we can detect a timeout error.  getevents() hands the bytes
+    // to the transaction queue which invokes the callbacks.
     // Bytes might dripple in especially on a slow link
-    while (1) {
+    while (atomic_load_explicit(pdone, memory_order_acquire) == 0) {
+        xfer_cached(pctx);
+        if (atomic_load_explicit(pdone, memory_order_acquire) != 0) {
+            break;
+        }
+        if (pctx->spfd < 0) {
+            // port closed without failing the queue?  Should not happen.
+            xfer_fail(pctx, HBAERROR_NORECV);
+            break;
+        }
         select_tv.tv_sec = 0;
-        select_tv.tv_usec = (useconds_t) 1000000;   // 0.1 seconds for a timeout
+        select_tv.tv_usec = (useconds_t) (xfer_tmo(pctx) * 1000);
         FD_ZERO(&rdfs);
         FD_SET(pctx->spfd, &rdfs);
         sret = select((pctx->spfd + 1), &rdfs, (fd_set *) 0, (fd_set *) 0, &select_tv);
@@ -671,141 +1881,2776 @@ int sendrecv_pkt(
             }
         }
         else if (sret == 0) {
-            // timeout waiting for the response
-            edlog("timeout reading from serial port in serial_fpga");
-            return(HBAERROR_NORECV);
+            // timeout waiting for the response to the oldest transaction
+            xfer_timeout((void *) 0, (void *) pctx);
         }
         else if ((pctx->spfd >= 0) && FD_ISSET(pctx->spfd, &rdfs)) {
-            // read bytes from serial port
-            rdcount = read(pctx->spfd, &(buff[rdsofar]), (expectrd - rdsofar));
-            if ((rdcount < 0) && (errno != EINTR)) {
-                edlog("error writing to serial port in serial_fpga");
-                return(HBAERROR_NORECV);
-            }
-            if (rdcount > 0) {
-                rdsofar += rdcount;
-                if (rdsofar == expectrd) {   // done?
-                    // Print pkt if debug mode and running in foreground
-                    if ((DebugMode != 0) && (ForegroundMode != 0)) {
-                        printf("<< ");
-                        for (i = 0; i < expectrd; i++)
-                            printf("%02x ", buff[i]);
-                        printf("\n");
-                    }
-                    return(expectrd);
-                }
-                // else more to read, drop back into select() to wait
-            }
+            getevents(pctx->spfd, (void *) pctx);
         }
     }
 }
 
 
-/* register_interrupt_handler() : Plug-in modules use this routine
- * to tell serial_fpga the address of the module's interrupt handler.
- * The plug-in passes in both the core ID, as well as the address of
- * the handler.  
+/* sendrecv_async() : Queue a packet for the FPGA and return without
+ * waiting for the response.  The packet format is the same as for
+ * sendrecv_pkt().  The packet is copied so the caller's buffer may be
+ * reused as soon as this returns.
+ *     When the response arrives, or the transaction fails, the callback
+ * is invoked as
+ *         done_cb(trans, ret, rsp)
+ * where ret is the number of response bytes in rsp or a negative error
+ * code as for sendrecv_pkt().  The callback is invoked from the event
+ * loop and may itself queue more packets.
+ *     Writes are held until the end of the event loop turn.  A write
+ * that continues the previous queued write to the same core (the next
+ * register up) is merged into it as one burst of up to HBA_MXBURST
+ * bytes.  Each caller still gets its own callback with the burst's ACK.
+ *     Returns 0 if the packet was queued and HBAERROR_NOSEND if the
+ * port is closed, the packet is malformed, or the queue is full.  The
+ * callback is not invoked if the packet was not queued.
+ *     With the rtio I/O thread running this may also be called from
+ * other threads.  The callback is still invoked from the event loop
+ * and a packet the I/O thread can not queue fails through it.
  */
-void register_interrupt_handler(
-    int           parent,       // Slot number of parent,
-    int           coreid,       // core ID.
-    void        (*handler)(),   // address of interrupt handler
-    void         *trans)        // transparently pass this to handler
+int sendrecv_async(
+    int            parent,      // Slot number of parent,
+    int            count,       // num bytes to send / receive
+    uint8_t       *buff,        // pointer to first char to send
+    void         (*done_cb)(),  // invoked when transaction completes
+    void          *trans)       // transparently pass this to done_cb
 {
     SERPORT      *pctx;         // our local info
-    SLOT         *pslot;        // our SLOT
-
-    pctx  = (SERPORT *) Slots[parent].priv;
-    pslot = pctx->pslot;
-    edlog("%s: Registering Interupt Handler at Slot %i for Core ID %i.", pslot->name, pslot->slot_id, coreid);
 
-    if (strncmp(PLUGIN_NAME, pslot->name, strlen(PLUGIN_NAME)) != 0) {
-        edlog("Wanted %s in Slot %i.  Exiting...\n", PLUGIN_NAME, parent);
-        exit(1);
+    pctx = parent_ctx(parent);
+    if (pctx == (SERPORT *) 0) {
+        return(HBAERROR_NOSEND);
     }
+    return(bus_async((void *) pctx, count, buff, done_cb, trans));
+}
 
-    // Sanity check the coreid and handler address
-    if ((coreid < 0) || (coreid >= NCORE) || (handler == 0)) {
-        edlog("Bad calling values to register_interrupt_handler()");
-        return;
-    }
+static int bus_async(
+    void          *ctx,         // our local info
+    int            count,       // num bytes to send / receive
+    uint8_t       *buff,        // pointer to first char to send
+    void         (*done_cb)(),  // invoked when transaction completes
+    void          *trans)       // transparently pass this to done_cb
+{
+    SERPORT      *pctx;         // our local info
+    HBA_PKT       pkt;          // the packet for the I/O thread
 
-    pctx->coreinfo[coreid].intr_hndlr = handler;
-    pctx->coreinfo[coreid].trans      = trans;
+    pctx = (SERPORT *) ctx;
+
+    if (done_cb == 0) {
+        return(HBAERROR_NOSEND);
+    }
+    if (pctx->rtio != 0) {
+        pkt.buff = buff;
+        pkt.count = count;
+        return(rtio_submit(pctx, (((buff != (uint8_t *) 0) &&
+                                   ((HBA_READ_CMD & buff[0]) == 0)) ?
+                                  RT_POST : RT_SUBMIT), 1, &pkt, done_cb,
+                           &trans));
+    }
+    if (pthread_equal(pthread_self(), pctx->mainthr) == 0) {
+        return(HBAERROR_NOSEND);        // only the event loop without rtio
+    }
+    if ((buff != (uint8_t *) 0) && ((HBA_READ_CMD & buff[0]) == 0)) {
+        return(xfer_post(pctx, count, buff, done_cb, trans));
+    }
+    return(xfer_submit(pctx, count, buff, done_cb, trans));
 }
 
 
-/***************************************************************************
- * do_interrupt(): - Handle an interrupt request.  Read the interrupt
- * pending registers in serial_fpga peripheral and invoke the appropriate
- * interrupt handlers if one is registered.  Log interrupts that do not
- * have a handler.
- ***************************************************************************/
-static void do_interrupt(
-    int       fd_in,         // FD with data to read,
-    void     *cb_data)       // callback date (==*SERPORT)
+/* xfer_post() : Queue a write without sending it, merging it into
+ * the previous queued write if that write has not been sent, is to
+ * the same core, ends at the register before this one, and has room.
+ * The flush timer sends whatever is queued at the end of this turn
+ * of the event loop.  Return 0 on success and HBAERROR_NOSEND if the
+ * packet can not be queued.
+ */
+static int xfer_post(
+    SERPORT       *pctx,        // our local info
+    int            count,       // num bytes to send / receive
+    uint8_t       *buff,        // pointer to first char to send
+    void         (*done_cb)(),  // invoked when transaction completes
+    void          *trans)       // transparently pass this to done_cb
 {
-    SERPORT  *pctx;          // our context
-    SLOT     *pslot;         // out SLOT
-    int       nrc;           // number of bytes recieved
-    int       intpending;    // a set bit means and interrupt is pending
-    int       ret;           // generic return value from a system call
-    int       i;             // to walk the cores
-    uint8_t   pkt[HBA_MXPKT];  
+    XFER         *px;           // the previous queued write
+    int           ndata;        // number of data bytes in the new write
+    int           tlen;         // number of data bytes in the previous write
 
-    pctx = (SERPORT *) cb_data;
-    pslot = pctx->pslot;
+    ndata = ((buff[0] >> 4) & 0x07) + 1;
 
-    // We need to read the GPIO value to clear the interrupt
-    (void) lseek(pctx->irfd, (off_t) 0, SEEK_SET);
-    ret = read(pctx->irfd, pkt, HBA_MXPKT);
-    if (ret <= 0) {
-        edlog("Error reading interrupt GPIO pin");
-        return;
+    // Merge if the new packet is well formed and the tail qualifies.
+    // A write of what the registers already hold is not merged so
+    // xfer_queue() can drop it.
+    if ((pctx->nxfer > pctx->nsent) && (count == (ndata + 3)) &&
+        (HBA_IS_EXT(buff[0]) == 0) &&
+        (shadow_same(pctx, buff[0], buff[1], ndata, &(buff[2])) == 0)) {
+        px = &(pctx->xfer[(pctx->xhead + pctx->nxfer - 1) % HBA_MXXFER]);
+        tlen = ((px->pkt[0] >> 4) & 0x07) + 1;
+        if ((px->canmerge == 1) && (px->ncb < HBA_MXBURST) &&
+            ((px->pkt[0] & 0x0f) == (buff[0] & 0x0f)) &&
+            ((px->pkt[1] + tlen) == buff[1]) &&
+            ((tlen + ndata) <= HBA_MXBURST)) {
+            (void) memcpy(&(px->pkt[2 + tlen]), &(buff[2]), ndata);
+            shadow_pend(pctx, buff[0], buff[1], ndata);
+            px->pkt[2 + tlen + ndata] = 0;        // dummy for the ack
+            px->pkt[0] = HBA_WRITE_CMD | ((tlen + ndata - 1) << 4) |
+                         (buff[0] & 0x0f);
+            px->cmd = px->pkt[0];
+            px->count += ndata;
+            px->done_cb[px->ncb] = done_cb;
+            px->trans[px->ncb] = trans;
+            px->ncb++;
+            return(0);
+        }
     }
 
-    // Noise on the interrupt line can trigger a rising edge.
-    // Verify that the interrupt pin really is high
-    if (pkt[0] != '1') {
+    if (xfer_queue(pctx, count, buff, done_cb, trans) < 0) {
+        return(HBAERROR_NOSEND);
+    }
+    px = &(pctx->xfer[(pctx->xhead + pctx->nxfer - 1) % HBA_MXXFER]);
+    px->canmerge = ((count == (ndata + 3)) && (HBA_IS_EXT(buff[0]) == 0) &&
+                    (px->cached == 0)) ? 1 : 0;
+
+    // The I/O thread sends at the end of each of its turns
+    if ((pctx->rtio == 0) && (pctx->ftimer == (void *) 0)) {
+        pctx->ftimer = add_timer(ED_ONESHOT, HBA_COALESCE_MS, xfer_flush,
+                                 (void *) pctx);
+    }
+    return(0);
+}
+
+
+/* xfer_flush() : Send the posted writes held by xfer_post() and
+ * complete the transactions answered from the register shadow.
+ */
+static void xfer_flush(
+    void          *timer,       // handle of the timer that expired
+    void          *pctx)        // our local info
+{
+    ((SERPORT *) pctx)->ftimer = (void *) 0;  // one-shot timers free themselves
+    xfer_send((SERPORT *) pctx);
+    xfer_cached((SERPORT *) pctx);
+}
+
+
+/* xfer_submit() : Add a transaction to the tail of the queue and
+ * send it if the link is free.  Return 0 on success and
+ * HBAERROR_NOSEND if the packet can not be queued.
+ */
+static int xfer_submit(
+    SERPORT       *pctx,        // our local info
+    int            count,       // num bytes to send / receive
+    uint8_t       *buff,        // pointer to first char to send
+    void         (*done_cb)(),  // invoked when transaction completes
+    void          *trans)       // transparently pass this to done_cb
+{
+    if (xfer_queue(pctx, count, buff, done_cb, trans) < 0) {
+        return(HBAERROR_NOSEND);
+    }
+    xfer_send(pctx);
+    return(0);
+}
+
+
+/* xfer_queue() : Add a transaction to the tail of the queue without
+ * sending it.  Return 0 on success and HBAERROR_NOSEND if the packet
+ * can not be queued.
+ */
+static int xfer_queue(
+    SERPORT       *pctx,        // our local info
+    int            count,       // num bytes to send / receive
+    uint8_t       *buff,        // pointer to first char to send
+    void         (*done_cb)(),  // invoked when transaction completes
+    void          *trans)       // transparently pass this to done_cb
+{
+    XFER         *px;           // the new transaction
+    int           hdr;          // number of header bytes in the packet
+
+    // Sanity check. Valid count.  Non-null buffer.  Port open.  Room.
+    if ((count <= 2) || (buff == (uint8_t *) 0) ||
+        (pctx->spfd < 0) || (pctx->nxfer == HBA_MXXFER)) {
+        return(HBAERROR_NOSEND);
+    }
+    if (HBA_IS_EXT(buff[0])) {
+        hdr = 4;                // cmd, core, reg, and length
+        if ((count <= hdr) || (count > HBA_MXPKT_EXT)) {
+            return(HBAERROR_NOSEND);
+        }
+        // The length byte has to match the packet size.  A read has
+        // a dummy for each echoed header byte and data byte.  A write
+        // has its data and a dummy for the ACK.
+        if (count != (((HBA_READ_CMD & buff[0]) ? (2 * hdr) : (hdr + 1)) + buff[3])) {
+            return(HBAERROR_NOSEND);
+        }
+    }
+    else {
+        hdr = 2;                // cmd and reg
+        if (count > HBA_MXPKT) {
+            return(HBAERROR_NOSEND);
+        }
+    }
+
+    px = &(pctx->xfer[(pctx->xhead + pctx->nxfer) % HBA_MXXFER]);
+    (void) memcpy(px->pkt, buff, count);
+    px->count = count;
+    // Expect response to have one byte for a write and the header size
+    // less than the write count for a read.
+    px->expectrd = (HBA_READ_CMD & buff[0]) ? (count - hdr) : 1 ;
+    px->rdsofar = 0;
+    px->txbytes = 0;
+    px->nbatch = 1;
+    px->canmerge = 0;
+    px->ncb = 1;
+    px->setmode = -1;
+    px->newbaud = 0;
+    px->cached = 0;
+    px->core = ((hdr == 4) ? buff[1] : buff[0]) & 0x0f;
+    px->cmd = buff[0];
+    px->done_cb[0] = done_cb;
+    px->trans[0] = trans;
+    shadow_check(pctx, px);
+    pctx->nxfer++;
+    return(0);
+}
+
+
+/* xfer_send() : Send queued transactions to the FPGA until there are
+ * 'window' transactions in flight.  The FPGA handles commands strictly
+ * in order and consumes each byte as it arrives, so the next command
+ * can follow the dummy bytes of the previous one on the wire.  This
+ * keeps the link busy instead of idling for a host round trip between
+ * transactions.  Responses are matched to transactions in order.
+ * The packets of a batch go out in one write() once the window has
+ * room for the first of them.  Each packet counts against the window
+ * so a batch can take the number in flight past it until the batch
+ * is answered.
+ *     In nodummy mode, and while telemetry or snapshot frames are sent, the
+ * FPGA does not consume bytes as they arrive.  It buffers them in a
+ * FIFO of HBA_SF_RXFIFO bytes so we keep no more than that in flight.
+ * A larger packet is sent only when nothing else is in flight.
+ *     Nothing is sent after a baud rate change until its ACK arrives
+ * and the port is at the new rate.
+ *     Transactions answered from the register shadow put nothing on
+ * the wire.  They complete from the event loop when they reach the
+ * head of the queue.
+ */
+static void xfer_send(
+    SERPORT       *pctx)        // our local info
+{
+    XFER         *px;           // the transaction to send
+    uint8_t       txbuf[HBA_MXBATCH * HBA_MXPKT_EXT]; // packets of a batch
+    int           txcount;      // number of bytes in txbuf
+    int           nbatch;       // number of packets in the batch
+    int           nodummy;      // nodummy mode after the batch
+    int           ntx[HBA_MXBATCH]; // number of bytes sent for each packet
+    int           i;
+
+    while ((pctx->nsent < pctx->nxfer) && (pctx->nsent < pctx->window) &&
+           (pctx->baudwait == 0)) {
+        px = &(pctx->xfer[(pctx->xhead + pctx->nsent) % HBA_MXXFER]);
+        nbatch = px->nbatch;
+        nodummy = pctx->txnodummy;
+        txcount = 0;
+        for (i = 0; i < nbatch; i++) {
+            px = &(pctx->xfer[(pctx->xhead + pctx->nsent + i) % HBA_MXXFER]);
+            ntx[i] = xfer_txcount(nodummy, px);
+            (void) memcpy(&(txbuf[txcount]), px->pkt, ntx[i]);
+            txcount += ntx[i];
+            // The FPGA changes mode when it handles this packet.  Send
+            // the packets after it in the new format.
+            if (px->setmode >= 0) {
+                nodummy = px->setmode;
+            }
+        }
+        // Nothing goes after a baud rate change until it is ACKed
+        for (i = 0; i < nbatch; i++) {
+            if (pctx->xfer[(pctx->xhead + pctx->nsent + i) % HBA_MXXFER].newbaud) {
+                pctx->baudwait = 1;
+            }
+        }
+        if ((pctx->nodummy || pctx->txnodummy || nodummy ||
+             (pctx->tmrate != 0) || pctx->snapshot) &&
+            (pctx->nsent > 0) &&
+            ((pctx->nsentb + txcount) > HBA_SF_RXFIFO)) {
+            break;              // wait for room in the FPGA FIFO
+        }
+        if ((txcount != 0) && (write_pkt(pctx, txbuf, txcount) != txcount)) {
+            // The link is in an unknown state.  Fail everything queued.
+            xfer_fail(pctx, HBAERROR_NOSEND);
+            return;
+        }
+        for (i = 0; i < nbatch; i++) {
+            px = &(pctx->xfer[(pctx->xhead + pctx->nsent + i) % HBA_MXXFER]);
+            px->txbytes = ntx[i];
+            if (ntx[i] != 0) {
+                trace_add(pctx, HBA_TR_TX, px->core, 0, px->pkt, ntx[i]);
+            }
+        }
+        pctx->txnodummy = nodummy;
+        pctx->nsent += nbatch;
+        pctx->nsentb += txcount;
+    }
+
+    // Complete cached transactions at the head from the event loop
+    if ((pctx->nsent > 0) && (pctx->xfer[pctx->xhead].cached) &&
+        (pctx->rtio == 0) && (pctx->ftimer == (void *) 0)) {
+        pctx->ftimer = add_timer(ED_ONESHOT, HBA_COALESCE_MS, xfer_flush,
+                                 (void *) pctx);
+    }
+
+    // Time the oldest outstanding transaction
+    if ((pctx->nsent > 0) && (pctx->rtio != 0) && (pctx->xdue == 0)) {
+        pctx->xdue = now_ns() + ((uint64_t) xfer_tmo(pctx) * 1000000);
+    }
+    else if ((pctx->nsent > 0) && (pctx->rtio == 0) &&
+             (pctx->xtimer == (void *) 0)) {
+        pctx->xtimer = add_timer(ED_ONESHOT, xfer_tmo(pctx), xfer_timeout,
+                                 (void *) pctx);
+    }
+}
+
+
+/* xfer_txcount() : Return the number of bytes of the packet to put
+ * on the wire.  With dummy byte clocking the FPGA sends one byte for
+ * each byte it receives so reads carry a dummy byte for each byte of
+ * response and writes a dummy for the ACK.  In nodummy mode the FPGA
+ * sends the response on its own and only the header, and for a write
+ * the data, are sent.  The response is the same in both modes.
+ * Nothing is sent for a transaction answered from the register shadow.
+ */
+static int xfer_txcount(
+    int            nodummy,     // ==1 if sending in nodummy mode
+    XFER         *px)           // the transaction to send
+{
+    if (px->cached) {
+        return(0);
+    }
+    if (nodummy == 0) {
+        return(px->count);
+    }
+    if (HBA_READ_CMD & px->pkt[0]) {
+        return(px->count - px->expectrd);
+    }
+    return(px->count - 1);
+}
+
+
+/* set_nodummy() : Turn nodummy mode on or off in the FPGA ctrl
+ * register.  The FPGA latches the mode at the start of each command
+ * so the write itself is in the old format and the packets after it
+ * are in the new one.  The host switches format as it sends the write
+ * which lets pipelined transactions follow it.  pctx->nodummy changes
+ * only when the write is ACKed.  Returns 0 on success and -1 on error.
+ */
+static int set_nodummy(
+    SERPORT       *pctx,        // our local info
+    int            nodummy)     // new mode
+{
+    SYNCXFER      sync;         // completion status of the write
+    XFER         *px;           // the write
+    uint8_t       pkt[HBA_MXPKT];
+
+    pkt[0] = HBA_WRITE_CMD | ((1 -1) << 4) | HBA_SERIAL_FPGA_COREID;
+    pkt[1] = HBA_SF_REG_CTRL;
+    pkt[2] = (nodummy) ? HBA_SF_CTRL_NODUMMY : 0;
+    pkt[3] = 0;                 // dummy for the ack
+    sync.buff = pkt;
+    sync.ret = HBAERROR_NOSEND;
+    atomic_init(&(sync.done), 0);
+    sync.efd = -1;
+    if (xfer_queue(pctx, 4, pkt, sync_done, (void *) &sync) < 0) {
+        return(-1);
+    }
+    px = &(pctx->xfer[(pctx->xhead + pctx->nxfer - 1) % HBA_MXXFER]);
+    px->setmode = nodummy;
+    xfer_send(pctx);
+    xfer_wait(pctx, &(sync.done));
+
+    // We did a write so the return value should be 1 and an ACK
+    if ((sync.ret != 1) || (pkt[0] != HBA_ACK)) {
+        return(-1);
+    }
+    return(0);
+}
+
+
+/* xfer_complete() : Remove the oldest transaction from the queue and
+ * invoke its callback.  ret is the response count or an error code.
+ */
+static void xfer_complete(
+    SERPORT       *pctx,        // our local info
+    int            ret)         // response count or error code
+{
+    XFER         *px;           // the completed transaction
+    uint8_t       rsp[HBA_MXPKT_EXT]; // copy of the response
+    void        (*done_cb[HBA_MXBURST])(); // completion callbacks
+    void         *trans[HBA_MXBURST];  // callbacks' transparent data
+    int           ncb;          // number of callbacks
+    int           i;
+
+    if (pctx->nxfer == 0) {
+        return;
+    }
+    px = &(pctx->xfer[pctx->xhead]);
+
+    // Print pkt if debug mode and running in foreground
+    if ((ret > 0) && (DebugMode != 0) && (ForegroundMode != 0)) {
+        printf("<< ");
+        for (i = 0; i < ret; i++)
+            printf("%02x ", px->pkt[i]);
+        printf("\n");
+    }
+    trace_add(pctx, HBA_TR_RX, px->core, (px->cached ? HBA_TR_CACHED :
+              ((px->txbytes == 0) ? HBA_TR_UNSENT : 0)), px->pkt, ret);
+
+    // Copy out what we need and pop the queue before invoking the
+    // callback since the callback may queue new transactions.
+    if (ret > 0) {
+        (void) memcpy(rsp, px->pkt, ret);
+    }
+
+    // An extended read echoes its length byte.  Do not use data from
+    // a response whose length does not match what was asked for.
+    if ((ret > 0) && (px->cached == 0) && HBA_IS_EXT(px->cmd) &&
+        ((px->cmd & HBA_READ_CMD) != 0) &&
+        ((ret < 4) || (rsp[3] != (ret - 4)))) {
+        ret = HBAERROR_NORECV;
+    }
+
+    // Mirror read data.  A write response is just the ACK.
+    if ((ret > 2) && ((rsp[0] & HBA_READ_CMD) != 0)) {
+        if (HBA_IS_EXT(rsp[0])) {
+            shm_update(pctx, rsp[1], rsp[2], (ret - 4), &(rsp[4]));
+            if (px->cached == 0) {
+                shadow_fill(pctx, rsp[1], rsp[2], (ret - 4), &(rsp[4]));
+            }
+        }
+        else {
+            shm_update(pctx, rsp[0], rsp[1], (ret - 2), &(rsp[2]));
+            if (px->cached == 0) {
+                shadow_fill(pctx, rsp[0], rsp[1], (ret - 2), &(rsp[2]));
+            }
+        }
+    }
+
+    // A write goes into the shadow once it is ACKed.  Without the ACK
+    // the core's registers are unknown.
+    shadow_done(pctx, px, ((ret == 1) && (rsp[0] == HBA_ACK)));
+    ncb = px->ncb;
+    for (i = 0; i < ncb; i++) {
+        done_cb[i] = px->done_cb[i];
+        trans[i] = px->trans[i];
+    }
+    pctx->xhead = (pctx->xhead + 1) % HBA_MXXFER;
+    pctx->nxfer--;
+    if (pctx->nsent > 0) {
+        pctx->nsent--;
+        pctx->nsentb -= px->txbytes;
+    }
+    if (pctx->xtimer != (void *) 0) {
+        del_timer(pctx->xtimer);
+        pctx->xtimer = (void *) 0;
+    }
+    pctx->xdue = 0;
+
+    // The FPGA is in the new mode once it ACKs the ctrl write.  Without
+    // the ACK keep the old mode and go back to sending in its format.
+    if ((px->setmode >= 0) && (ret == 1) && (rsp[0] == HBA_ACK)) {
+        pctx->nodummy = px->setmode;
+    }
+    else if (px->setmode >= 0) {
+        pctx->txnodummy = pctx->nodummy;
+    }
+
+    // The FPGA changes baud rate once it has sent the ACK.  Follow it.
+    if (px->newbaud != 0) {
+        pctx->baudwait = 0;
+        if ((ret == 1) && (rsp[0] == HBA_ACK) && (pctx->spfd >= 0) &&
+            (port_setbaud(pctx->spfd, px->newbaud) == 0)) {
+            pctx->baud = px->newbaud;
+        }
+    }
+
+    // Keep the link busy then tell the caller(s).  Callers hear from
+    // the event loop, not the I/O thread.  Requests left in the submit
+    // rings when the I/O thread stopped go in as the queue drains.
+    if ((pctx->rtio == 0) && (pctx->prt != (RTIO *) 0)) {
+        rtio_take(pctx);
+    }
+    xfer_send(pctx);
+    for (i = 0; i < ncb; i++) {
+        if (pctx->rtio != 0) {
+            rtio_done(pctx, done_cb[i], trans[i], ret, rsp);
+        }
+        else {
+            (done_cb[i]) (trans[i], ret, rsp);
+        }
+    }
+}
+
+
+/* xfer_rxbytes() : Use the bytes received from the FPGA (in rawinc)
+ * as the response to the oldest outstanding transaction.  The FPGA
+ * sends telemetry frames between responses so a frame sync byte where
+ * a response would start begins a frame.  Other bytes that arrive when
+ * no transaction is outstanding are unsolicited and are dropped (they
+ * are still shown on rawin).  Consumed bytes are removed from the front
+ * of rawinc.
+ */
+static void xfer_rxbytes(
+    SERPORT       *pctx)        // our local info
+{
+    XFER         *px;           // oldest outstanding transaction
+    uint8_t      *buff = pctx->rawinc; // received bytes
+    int           ncp;          // number of bytes to use
+
+    while (pctx->inidx > 0) {
+        xfer_cached(pctx);      // cached responses come first
+        if ((buff[0] == HBA_SF_TM_SYNC) && ((pctx->nsent == 0) ||
+            (pctx->xfer[pctx->xhead].rdsofar == 0))) {
+            if (tm_rxframe(pctx, buff, pctx->inidx) == 0) {
+                break;          // wait for the rest of the frame
+            }
+            continue;
+        }
+        if (pctx->nsent == 0) {
+            // Unsolicited.  Drop it.
+            pctx->inidx--;
+            (void) memmove(buff, &(buff[1]), pctx->inidx);
+            continue;
+        }
+        px = &(pctx->xfer[pctx->xhead]);
+        ncp = px->expectrd - px->rdsofar;
+        ncp = (ncp < pctx->inidx) ? ncp : pctx->inidx;
+        (void) memcpy(&(px->pkt[px->rdsofar]), buff, ncp);
+        px->rdsofar += ncp;
+        pctx->inidx -= ncp;
+        (void) memmove(buff, &(buff[ncp]), pctx->inidx);
+        if (px->rdsofar == px->expectrd) {
+            // done.  The callback may read more bytes into buff.
+            xfer_complete(pctx, px->expectrd);
+        }
+    }
+    xfer_cached(pctx);
+}
+
+
+/* tm_rxframe() : Handle the telemetry frame at the start of buff.
+ * The frame is the sync byte, the number of bytes that follow, and
+ * for each pair a {count, core} byte, the first register, and count
+ * register values.  An interrupt snapshot frame starts with a pair for
+ * the two pending registers of core 0 and has only the pairs of
+ * interrupting cores.  The registers are mirrored here and the frame
+ * goes to tm_dispatch() for the handlers.
+ * Returns the number of bytes removed from the front of rawinc, or
+ * zero if the frame is not all here yet.
+ */
+static int tm_rxframe(
+    SERPORT       *pctx,        // our local info
+    uint8_t      *buff,         // received bytes, starting with the sync
+    int            count)       // number of bytes in buff
+{
+    uint8_t       frame[2 + HBA_SF_TM_MXLEN]; // copy of the frame
+    int           flen;         // number of bytes in the frame
+    int           core;         // core of a pair
+    int           nreg;         // number of registers in a pair
+    int           i;
+
+    if (count < 2) {
+        return(0);
+    }
+    if (buff[1] > HBA_SF_TM_MXLEN) {
+        // Not a frame we could have asked for.  Drop the sync byte.
+        flen = 1;
+    }
+    else {
+        flen = 2 + buff[1];
+        if (count < flen) {
+            return(0);
+        }
+    }
+
+    // Remove the frame from rawinc before invoking the handlers since
+    // a handler may read more bytes into rawinc.
+    (void) memcpy(frame, buff, flen);
+    trace_add(pctx, HBA_TR_FRAME, HBA_TR_NOCORE, 0, frame, flen);
+    pctx->inidx -= flen;
+    (void) memmove(buff, &(buff[flen]), pctx->inidx);
+
+    i = 2;
+    if ((flen >= 6) && (frame[2] == HBA_SF_SNAP_PENDCC) &&
+        (frame[3] == HBA_SF_REG_INTR0)) {
+        shm_update(pctx, HBA_SERIAL_FPGA_COREID, frame[3], 2, &(frame[4]));
+        i = 6;
+    }
+    while ((i + 2) <= flen) {
+        core = frame[i] & 0x0f;
+        nreg = frame[i] >> 4;
+        if ((i + 2 + nreg) > flen) {
+            break;              // truncated pair
+        }
+        shm_update(pctx, core, frame[i + 1], nreg, &(frame[i + 2]));
+        shadow_fill(pctx, core, frame[i + 1], nreg, &(frame[i + 2]));
+        i += 2 + nreg;
+    }
+
+    // The handlers belong to the event loop
+    if (pctx->rtio != 0) {
+        rtio_post(pctx, RT_FRAME, flen, frame, 0, (void *) 0);
+    }
+    else {
+        tm_dispatch(pctx, frame, flen);
+    }
+    return(flen);
+}
+
+
+/* tm_dispatch() : Give each pair of a telemetry frame to the telemetry
+ * handler of its core as
+ *         tm_hndlr(trans, reg, count, data)
+ * Pending cores of an interrupt snapshot without a pair get their
+ * interrupt handler.
+ */
+static void tm_dispatch(
+    SERPORT       *pctx,        // our local info
+    uint8_t      *frame,        // the frame, starting with the sync
+    int            flen)        // number of bytes in the frame
+{
+    int           core;         // core of a pair
+    int           nreg;         // number of registers in a pair
+    int           snap;         // ==1 if an interrupt snapshot
+    int           intpending;   // pending interrupts in a snapshot
+    int           handled;      // cores given their registers
+    uint64_t      start;        // time a snapshot handler was invoked
+    int           i;
+
+    i = 2;
+    snap = 0;
+    intpending = 0;
+    handled = 0;
+    if ((flen >= 6) && (frame[2] == HBA_SF_SNAP_PENDCC) &&
+        (frame[3] == HBA_SF_REG_INTR0)) {
+        snap = 1;
+        intpending = frame[4] | (frame[5] << 8);
+        i = 6;
+    }
+    while ((i + 2) <= flen) {
+        core = frame[i] & 0x0f;
+        nreg = frame[i] >> 4;
+        if ((i + 2 + nreg) > flen) {
+            break;              // truncated pair
+        }
+        if (pctx->coreinfo[core].tm_hndlr != 0) {
+            start = now_ns();
+            (pctx->coreinfo[core].tm_hndlr) (pctx->coreinfo[core].tm_trans,
+                                             frame[i + 1], nreg, &(frame[i + 2]));
+            if (snap && ((handled & (1 << core)) == 0)) {
+                // No GPIO edge so there is no latency to record
+                pctx->coreinfo[core].nintr++;
+                intr_stat(&(pctx->coreinfo[core]), 0, start, now_ns());
+            }
+            handled |= (1 << core);
+        }
+        i += 2 + nreg;
+    }
+    if (snap) {
+        intr_dispatch(pctx, intpending, handled, 0);
+    }
+}
+
+
+/* set_telemetry() : Configure the telemetry frames.  The value is the
+ * frame period in ms (0 to turn telemetry off) followed by up to
+ * HBA_SF_TM_MXPAIR core:reg:count triples giving the registers to send.
+ * The pairs are also used by interrupt snapshots so they are kept
+ * when the period is 0.  Returns 0 on success, 1 on a bad value, and
+ * HBAERROR_NOSEND if the FPGA did not ACK the new configuration.
+ */
+static int set_telemetry(
+    SERPORT       *pctx,        // our local info
+    char          *val)         // the new configuration
+{
+    char         *ptok;         // a token in val
+    int           rate;         // new frame period in ms
+    int           npair;        // new number of pairs
+    int           core, reg, count; // a new pair
+    uint8_t       cc[HBA_SF_TM_MXPAIR];  // {count, core} of each pair
+    uint8_t       regs[HBA_SF_TM_MXPAIR]; // first register of each pair
+    int           nsd;          // number of bytes sent to FPGA
+    int           i;
+    uint8_t       pkt[HBA_MXPKT];
+
+    ptok = strtok(val, " ");
+    if ((ptok == (char *) 0) || (sscanf(ptok, "%d", &rate) != 1) ||
+        (rate < 0) || (rate > 255)) {
+        return(1);
+    }
+    npair = 0;
+    while ((ptok = strtok((char *) 0, " ")) != (char *) 0) {
+        if ((npair == HBA_SF_TM_MXPAIR) ||
+            (sscanf(ptok, "%d:%d:%d", &core, &reg, &count) != 3) ||
+            (core <= HBA_SERIAL_FPGA_COREID) || (core >= NCORE) ||
+            (reg < 0) || (reg > 255) ||
+            (count < 1) || (count > HBA_SF_TM_MXCOUNT)) {
+            return(1);
+        }
+        cc[npair] = (uint8_t) ((count << 4) | core);
+        regs[npair] = (uint8_t) reg;
+        npair++;
+    }
+
+    // Write the pairs then the rate and number of pairs
+    if (npair > 0) {
+        pkt[0] = HBA_WRITE_CMD | (((2 * npair) -1) << 4) | HBA_SERIAL_FPGA_COREID;
+        pkt[1] = HBA_SF_REG_TM_PAIR0;
+        for (i = 0; i < npair; i++) {
+            pkt[2 + (2 * i)] = cc[i];
+            pkt[3 + (2 * i)] = regs[i];
+        }
+        pkt[2 + (2 * npair)] = 0;           // dummy for the ack
+        nsd = bus_send((void *) pctx, (3 + (2 * npair)), pkt);
+        if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
+            return(HBAERROR_NOSEND);
+        }
+    }
+    pkt[0] = HBA_WRITE_CMD | ((2 -1) << 4) | HBA_SERIAL_FPGA_COREID;
+    pkt[1] = HBA_SF_REG_TM_RATE;
+    pkt[2] = rate;
+    pkt[3] = npair;
+    pkt[4] = 0;                             // dummy for the ack
+    nsd = bus_send((void *) pctx, 5, pkt);
+    if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
+        return(HBAERROR_NOSEND);
+    }
+
+    if (rtio_set(pctx, &(pctx->tmrate), rate) != 0) {
+        return(HBAERROR_NOSEND);
+    }
+    pctx->tmnpair = npair;
+    for (i = 0; i < npair; i++) {
+        pctx->tmcore[i] = cc[i] & 0x0f;
+        pctx->tmreg[i] = regs[i];
+        pctx->tmcount[i] = cc[i] >> 4;
+    }
+    return(0);
+}
+
+
+/* set_snapshot() : Turn interrupt snapshot frames on or off.  With
+ * snapshots on the FPGA sends a frame with the pending interrupts and
+ * the telemetry pairs of the interrupting cores in place of raising
+ * the interrupt pin.  Returns 0 on success or HBAERROR_NOSEND if the
+ * FPGA did not ACK the new mode.
+ */
+static int set_snapshot(
+    SERPORT       *pctx,        // our local info
+    int            snapshot)    // new mode
+{
+    int           nsd;          // number of bytes sent to FPGA
+    uint8_t       pkt[HBA_MXPKT];
+
+    pkt[0] = HBA_WRITE_CMD | ((1 -1) << 4) | HBA_SERIAL_FPGA_COREID;
+    pkt[1] = HBA_SF_REG_SNAP;
+    pkt[2] = (snapshot) ? HBA_SF_SNAP_ENABLE : 0;
+    pkt[3] = 0;                             // dummy for the ack
+    nsd = bus_send((void *) pctx, 4, pkt);
+    if ((nsd != 1) || (pkt[0] != HBA_ACK)) {
+        return(HBAERROR_NOSEND);
+    }
+    if (rtio_set(pctx, &(pctx->snapshot), snapshot) != 0) {
+        return(HBAERROR_NOSEND);
+    }
+    return(0);
+}
+
+
+/* baud_switch() : Move the FPGA and the serial port to a new baud
+ * rate.  The new rate is written to the FPGA and both sides switch on
+ * the ACK.  A few reads check the link at the new rate and the last
+ * read confirms it to the FPGA.  If the check fails the FPGA goes
+ * back to the old rate on its own and so do we.  Returns 0 if the
+ * link is at the new rate, 1 if the new rate was not ACKed at the
+ * port's rate, HBA_BAUD_PENDING if the check failed, and
+ * HBAERROR_NORECV if the FPGA does not respond.  After a failed check
+ * nothing is sent until baud_trialend() runs from a timer, once the
+ * FPGA has given up on the new rate.
+ */
+static int baud_switch(
+    SERPORT       *pctx,        // our local info
+    int            nbaud)       // the new rate
+{
+    SYNCXFER      sync;         // completion status of the write
+    XFER         *px;           // the write
+    int           obaud;        // the old rate
+    int           i;
+    uint8_t       pkt[HBA_MXPKT];
+
+    // Writes around the switch may be garbled.  Start the shadow over.
+    shadow_invalidate(pctx, -1);
+    obaud = pctx->baud;
+    pkt[0] = HBA_WRITE_CMD | ((4 -1) << 4) | HBA_SERIAL_FPGA_COREID;
+    pkt[1] = HBA_SF_REG_BAUD;
+    pkt[2] = nbaud & 0xff;
+    pkt[3] = (nbaud >> 8) & 0xff;
+    pkt[4] = (nbaud >> 16) & 0xff;
+    pkt[5] = (nbaud >> 24) & 0xff;
+    pkt[6] = 0;                 // dummy for the ack
+    sync.buff = pkt;
+    sync.ret = HBAERROR_NOSEND;
+    atomic_init(&(sync.done), 0);
+    sync.efd = -1;
+    if (xfer_queue(pctx, 7, pkt, sync_done, (void *) &sync) < 0) {
+        return(HBAERROR_NORECV);
+    }
+    px = &(pctx->xfer[(pctx->xhead + pctx->nxfer - 1) % HBA_MXXFER]);
+    px->newbaud = nbaud;
+    xfer_send(pctx);
+    xfer_wait(pctx, &(sync.done));
+    if ((sync.ret != 1) || (pkt[0] != HBA_ACK)) {
+        return(HBAERROR_NORECV); // not ACKed so nothing changed
+    }
+    if (pctx->baud != nbaud) {
+        return(1);              // the port can not do the new rate
+    }
+
+    // Check the link then read reg19 to keep the rate
+    for (i = 0; i < HBA_BAUD_NCHECK; i++) {
+        if (baud_check(pctx, nbaud, 3) != 0) {
+            break;
+        }
+    }
+    if ((i == HBA_BAUD_NCHECK) && (baud_check(pctx, nbaud, 4) == 0)) {
+        return(0);
+    }
+
+    // Hold the queue while the FPGA gives up on the new rate.  The
+    // event loop keeps running in the meantime.
+    edlog("serial_fpga: %d baud failed, back to %d", nbaud, obaud);
+    (void) port_setbaud(pctx->spfd, obaud);
+    pctx->baud = obaud;
+    pctx->baudwait = 1;
+    pctx->bnold = obaud;
+    pctx->bnnew = nbaud;
+    pctx->btimer = add_timer(ED_ONESHOT, (2 * HBA_SF_BAUD_TRIAL_MS),
+                             baud_trialend, (void *) pctx);
+    return(HBA_BAUD_PENDING);
+}
+
+
+/* baud_trialend() : The FPGA has given up on a failed rate.  Drop
+ * what was received in the meantime, check the link at the old rate,
+ * and end the negotiation.
+ */
+static void baud_trialend(
+    void          *timer,       // the timer that fired
+    void          *cb_data)     // our local info (==*SERPORT)
+{
+    SERPORT      *pctx = (SERPORT *) cb_data;
+    int           ret;          // how the negotiation ended
+
+    pctx->btimer = (void *) 0;    // one-shot timers free themselves
+    pctx->baudwait = 0;
+    (void) ioctl(pctx->spfd, TCFLSH, TCIOFLUSH);
+    pctx->inidx = 0;
+    ret = 0;
+    if (baud_check(pctx, pctx->bnnew, 3) != 0) {
+        // The confirming read might have arrived with a bad response.
+        (void) port_setbaud(pctx->spfd, pctx->bnnew);
+        pctx->baud = pctx->bnnew;
+        if (baud_check(pctx, pctx->bnnew, 3) != 0) {
+            edlog("serial_fpga: no response at %d or %d baud", pctx->bnold,
+                  pctx->bnnew);
+            (void) port_setbaud(pctx->spfd, pctx->bnold);
+            pctx->baud = pctx->bnold;
+            ret = HBAERROR_NORECV;
+        }
+        // else stuck at a rate that is not clean
+    }
+    baud_done(pctx, ret);
+}
+
+
+/* baud_done() : End a maxbaud negotiation that waited out a failed
+ * rate.  maxbaud is kept only if the link still works.  The UI that
+ * set it gets its answer and the I/O thread is started again if it
+ * was stopped for the negotiation.
+ */
+static void baud_done(
+    SERPORT       *pctx,        // our local info
+    int            ret)         // 0 if the link works or an error code
+{
+    SLOT         *pslot = (SLOT *) pctx->pslot; // our SLOT
+    RSC          *prsc;         // the maxbaud resource
+    char          msg[MX_MSGLEN]; // error text for the UI
+    int           slen;         // length of msg
+
+    if (ret == 0) {
+        pctx->maxbaud = pctx->bnmax;
+    }
+    pctx->bnmax = 0;
+    prsc = &(pslot->rsc[RSC_MAXBAUD]);
+    if (prsc->uilock != -1) {
+        if (ret != 0) {
+            slen = snprintf(msg, MX_MSGLEN, E_NORSP, prsc->name);
+            send_ui(msg, slen, prsc->uilock);
+        }
+        prompt(prsc->uilock);
+        prsc->uilock = -1;
+    }
+    xfer_send(pctx);            // send what was held
+    if (pctx->bnrtio != 0) {
+        pctx->bnrtio = 0;
+        if (rtio_start(pctx, pctx->prt->cpu, pctx->prt->prio) != 0) {
+            edlog("%s: unable to restart the I/O thread", PLUGIN_NAME);
+        }
+    }
+}
+
+
+/* baud_check() : Read nreg of the FPGA baud rate registers and
+ * compare them to rate.  Reading all four confirms a new rate.
+ * Returns 0 if they match and -1 if not.
+ */
+static int baud_check(
+    SERPORT       *pctx,        // our local info
+    int            rate,        // the rate last written to the FPGA
+    int            nreg)        // number of registers to read (1 to 4)
+{
+    int           nsd;          // number of bytes received
+    int           i;
+    uint8_t       pkt[HBA_MXPKT];
+
+    (void) memset(pkt, 0, sizeof(pkt));
+    pkt[0] = HBA_READ_CMD | ((nreg -1) << 4) | HBA_SERIAL_FPGA_COREID;
+    pkt[1] = HBA_SF_REG_BAUD;
+    nsd = bus_send((void *) pctx, (4 + nreg), pkt);
+    if ((nsd != (2 + nreg)) || (pkt[0] != (HBA_READ_CMD | ((nreg -1) << 4) |
+        HBA_SERIAL_FPGA_COREID)) || (pkt[1] != HBA_SF_REG_BAUD)) {
+        return(-1);
+    }
+    for (i = 0; i < nreg; i++) {
+        if (pkt[2 + i] != ((rate >> (8 * i)) & 0xff)) {
+            return(-1);
+        }
+    }
+    return(0);
+}
+
+
+    // Baud rates tried on the way up to maxbaud
+static const int baudsteps[] = { 230400, 460800, 921600, 1000000,
+      1500000, 2000000, 3000000, 4000000, 6000000, 8000000, 12000000 };
+
+/* baud_negotiate() : Step the link up through the common baud rates
+ * to maxbaud, stopping at the first that fails the check.  A maxbaud
+ * below the present rate is switched to directly.  Returns 0 if the
+ * link works at the end, HBAERROR_NORECV if the FPGA stopped
+ * responding, and HBA_BAUD_PENDING if a rate failed and
+ * baud_trialend() will end the negotiation.
+ */
+static int baud_negotiate(
+    SERPORT       *pctx,        // our local info
+    int            maxbaud)     // highest rate to try
+{
+    int           ret;          // baud_switch() return value
+    int           i;
+
+    if (pctx->spfd < 0) {
+        return(HBAERROR_NORECV);
+    }
+    if (maxbaud < pctx->baud) {
+        ret = baud_switch(pctx, maxbaud);
+        return((ret == 1) ? 0 : ret);
+    }
+
+    for (i = 0; i < (int) (sizeof(baudsteps) / sizeof(int)); i++) {
+        if ((baudsteps[i] <= pctx->baud) || (baudsteps[i] > maxbaud)) {
+            continue;
+        }
+        ret = baud_switch(pctx, baudsteps[i]);
+        if (ret != 0) {
+            return((ret == 1) ? 0 : ret);
+        }
+    }
+    if (pctx->baud < maxbaud) {
+        // maxbaud is not one of the steps
+        ret = baud_switch(pctx, maxbaud);
+        return((ret == 1) ? 0 : ret);
+    }
+    return(0);
+}
+
+
+/* shm_setup() : Create and map the shared memory register mirror.
+ * Returns the mirror or 0 if it could not be set up.
+ */
+static HBA_SHM *shm_setup(void)
+{
+    HBA_SHM      *pshm;         // the mapped mirror
+    int           shmfd;        // fd of the shared memory object
+
+    shmfd = shm_open(HBA_SHM_NAME, (O_CREAT | O_RDWR), 0644);
+    if (shmfd < 0) {
+        edlog("Unable to open shared memory %s", HBA_SHM_NAME);
+        return((HBA_SHM *) 0);
+    }
+    if (ftruncate(shmfd, sizeof(HBA_SHM)) < 0) {
+        edlog("Unable to size shared memory %s", HBA_SHM_NAME);
+        close(shmfd);
+        return((HBA_SHM *) 0);
+    }
+    pshm = mmap((void *) 0, sizeof(HBA_SHM), (PROT_READ | PROT_WRITE),
+                MAP_SHARED, shmfd, 0);
+    close(shmfd);
+    if (pshm == MAP_FAILED) {
+        edlog("Unable to map shared memory %s", HBA_SHM_NAME);
+        return((HBA_SHM *) 0);
+    }
+    (void) memset(pshm, 0, sizeof(HBA_SHM));
+    __atomic_store_n(&(pshm->magic), HBA_SHM_MAGIC, __ATOMIC_RELEASE);
+    return(pshm);
+}
+
+
+/* shm_update() : Copy register values into the shared memory mirror.
+ * The core's sequence count is odd during the copy so readers can
+ * tell they raced with it and retry.
+ */
+static void shm_update(
+    SERPORT       *pctx,        // our local info
+    int            core,        // core of the registers
+    int            reg,         // first register
+    int            count,       // number of registers
+    uint8_t       *data)        // the register values
+{
+    HBA_SHM      *pshm;         // the mirror
+    uint32_t      seq;          // core's sequence count
+    int           i;
+
+    pshm = pctx->pshm;
+    if (pshm == (HBA_SHM *) 0) {
+        return;
+    }
+    core = core & 0x0f;
+    seq = pshm->seq[core];
+    __atomic_store_n(&(pshm->seq[core]), (seq + 1), __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (i = 0; i < count; i++) {
+        __atomic_store_n(&(pshm->reg[core][(reg + i) % HBA_SHM_NREG]),
+                         data[i], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&(pshm->seq[core]), (seq + 2), __ATOMIC_RELEASE);
+}
+
+
+/* shadow_check() : Answer a newly queued transaction from the register
+ * shadow if we can.  A read of non-volatile registers that are all in
+ * the shadow gets the echoed header and the shadow values as its
+ * response.  A write of the values the non-volatile registers already
+ * hold gets an ACK.  Either way the transaction is marked as cached so
+ * it is never sent to the FPGA.  Other writes are pending until their
+ * ACK puts them in the shadow and registers with a pending write are
+ * not answered from it.
+ */
+static void shadow_check(
+    SERPORT       *pctx,        // our local info
+    XFER         *px)           // the new transaction
+{
+    int           core;         // core of the registers
+    int           reg;          // first register
+    int           ndata;        // number of registers
+    int           hdr;          // number of header bytes
+    int           nnv;          // number of non-volatile registers
+    int           i;
+
+    if (HBA_IS_EXT(px->pkt[0])) {
+        core = px->pkt[1] & 0x0f;
+        reg = px->pkt[2];
+        ndata = px->pkt[3];
+        hdr = 4;
+    }
+    else {
+        core = px->pkt[0] & 0x0f;
+        reg = px->pkt[1];
+        ndata = ((px->pkt[0] >> 4) & 0x07) + 1;
+        hdr = 2;
+    }
+
+    if ((px->pkt[0] & HBA_READ_CMD) == 0) {
+        if (px->count != (hdr + ndata + 1)) {
+            return;             // malformed.  Let the FPGA sort it out.
+        }
+        if (shadow_same(pctx, core, reg, ndata, &(px->pkt[hdr]))) {
+            px->pkt[0] = HBA_ACK;
+            px->cached = 1;
+            pctx->shskips++;
+            return;
+        }
+        shadow_pend(pctx, core, reg, ndata);
+        return;
+    }
+
+    if (px->expectrd != (hdr + ndata)) {
+        return;
+    }
+    nnv = 0;
+    for (i = 0; i < ndata; i++) {
+        if (pctx->shflags[core][(reg + i) % HBA_SHM_NREG] & HBA_SH_NONVOL) {
+            nnv++;
+        }
+    }
+    if ((ndata == 0) || (nnv != ndata)) {
+        return;                 // a volatile register has to be read
+    }
+    for (i = 0; i < ndata; i++) {
+        if (((pctx->shflags[core][(reg + i) % HBA_SHM_NREG] & HBA_SH_VALID) == 0) ||
+            (pctx->shpend[core][(reg + i) % HBA_SHM_NREG] != 0)) {
+            pctx->shmisses++;
+            return;
+        }
+    }
+    for (i = 0; i < ndata; i++) {
+        px->pkt[hdr + i] = pctx->shadow[core][(reg + i) % HBA_SHM_NREG];
+    }
+    px->cached = 1;
+    pctx->shhits++;
+}
+
+
+/* shadow_same() : Return 1 if the registers are all non-volatile, have
+ * no write pending, and the shadow says they already hold data.
+ * Return 0 otherwise.
+ */
+static int shadow_same(
+    SERPORT       *pctx,        // our local info
+    int            core,        // core of the registers
+    int            reg,         // first register
+    int            count,       // number of registers
+    uint8_t       *data)        // the values to compare
+{
+    int           r;            // a register
+    int           i;
+
+    core = core & 0x0f;
+    for (i = 0; i < count; i++) {
+        r = (reg + i) % HBA_SHM_NREG;
+        if ((pctx->shflags[core][r] != (HBA_SH_NONVOL | HBA_SH_VALID)) ||
+            (pctx->shpend[core][r] != 0) || (pctx->shadow[core][r] != data[i])) {
+            return(0);
+        }
+    }
+    return((count > 0) ? 1 : 0);
+}
+
+
+/* shadow_pend() : Note a queued write to non-volatile registers.
+ */
+static void shadow_pend(
+    SERPORT       *pctx,        // our local info
+    int            core,        // core of the registers
+    int            reg,         // first register
+    int            count)       // number of registers
+{
+    int           r;            // a register
+    int           i;
+
+    core = core & 0x0f;
+    for (i = 0; i < count; i++) {
+        r = (reg + i) % HBA_SHM_NREG;
+        if (pctx->shflags[core][r] & HBA_SH_NONVOL) {
+            pctx->shpend[core][r]++;
+        }
+    }
+}
+
+
+/* shadow_done() : A write noted by shadow_pend() has completed.  On an
+ * ACK record the values written to non-volatile registers.  On anything
+ * else forget the shadow of the core since the write may or may not
+ * have reached it.  Reads and cached writes are ignored.
+ */
+static void shadow_done(
+    SERPORT       *pctx,        // our local info
+    XFER          *px,          // the completed write
+    int            ack)         // ==1 if the FPGA ACKed it
+{
+    int           reg;          // first register
+    int           count;        // number of registers
+    int           hdr;          // number of header bytes
+    int           r;            // a register
+    int           i;
+
+    if (px->cached || (px->cmd & HBA_READ_CMD)) {
+        return;
+    }
+    // The ACK overwrote pkt[0].  The rest of the packet is intact.
+    if (HBA_IS_EXT(px->cmd)) {
+        reg = px->pkt[2];
+        count = px->pkt[3];
+        hdr = 4;
+    }
+    else {
+        reg = px->pkt[1];
+        count = ((px->cmd >> 4) & 0x07) + 1;
+        hdr = 2;
+    }
+    for (i = 0; i < count; i++) {
+        r = (reg + i) % HBA_SHM_NREG;
+        if ((pctx->shflags[px->core][r] & HBA_SH_NONVOL) == 0) {
+            continue;
+        }
+        if (pctx->shpend[px->core][r] != 0) {
+            pctx->shpend[px->core][r]--;
+        }
+        if (ack) {
+            pctx->shadow[px->core][r] = px->pkt[hdr + i];
+            pctx->shflags[px->core][r] |= HBA_SH_VALID;
+        }
+    }
+    if (ack == 0) {
+        shadow_invalidate(pctx, px->core);
+    }
+}
+
+
+/* shadow_fill() : Record values read from non-volatile registers that
+ * are not yet in the shadow.  Registers already in the shadow are left
+ * alone since a write queued after the read has the newer value.
+ */
+static void shadow_fill(
+    SERPORT       *pctx,        // our local info
+    int            core,        // core of the registers
+    int            reg,         // first register
+    int            count,       // number of registers
+    uint8_t       *data)        // the values read
+{
+    int           r;            // a register
+    int           i;
+
+    core = core & 0x0f;
+    for (i = 0; i < count; i++) {
+        r = (reg + i) % HBA_SHM_NREG;
+        if (pctx->shflags[core][r] == HBA_SH_NONVOL) {
+            pctx->shadow[core][r] = data[i];
+            pctx->shflags[core][r] |= HBA_SH_VALID;
+        }
+    }
+}
+
+
+/* shadow_invalidate() : Forget the shadow of a core, or of all cores
+ * if core is -1.  The registers stay non-volatile.
+ */
+static void shadow_invalidate(
+    SERPORT       *pctx,        // our local info
+    int            core)        // core to forget or -1
+{
+    int           c;            // a core
+    int           r;            // a register
+
+    for (c = 0; c < NCORE; c++) {
+        if ((core >= 0) && (c != core)) {
+            continue;
+        }
+        for (r = 0; r < HBA_SHM_NREG; r++) {
+            pctx->shflags[c][r] &= ~HBA_SH_VALID;
+        }
+    }
+}
+
+
+/* xfer_cached() : Complete the sent transactions at the head of the
+ * queue that were answered from the register shadow.  They complete
+ * in order with the rest so callers see responses in the order they
+ * queued them.
+ */
+static void xfer_cached(
+    SERPORT       *pctx)        // our local info
+{
+    XFER         *px;           // oldest outstanding transaction
+
+    while (pctx->nsent > 0) {
+        px = &(pctx->xfer[pctx->xhead]);
+        if (px->cached == 0) {
+            break;
+        }
+        xfer_complete(pctx, px->expectrd);
+    }
+}
+
+
+/* xfer_fail() : Complete every queued transaction with an error.
+ */
+static void xfer_fail(
+    SERPORT       *pctx,        // our local info
+    int            err)         // error code to give callbacks
+{
+    int           nfail;        // number of transactions to fail
+
+    // Only fail what is queued now.  Callbacks may queue more.
+    nfail = pctx->nxfer;
+    pctx->nsent = nfail;        // do not send what we are failing
+    while ((nfail-- > 0) && (pctx->nxfer > 0)) {
+        xfer_complete(pctx, err);
+    }
+}
+
+
+/* xfer_timeout() : The oldest outstanding transaction did not get
+ * a response in time.  Resync the link, fail the transaction, and
+ * anything sent after it since their responses can no longer be
+ * matched, and move on to the next one.
+ */
+static void xfer_timeout(
+    void          *timer,       // the timer that fired (or null)
+    void          *cb_data)     // our local info (==*SERPORT)
+{
+    SERPORT      *pctx = (SERPORT *) cb_data;
+    int           nfail;        // number of transactions to fail
+
+    if (timer != (void *) 0) {
+        pctx->xtimer = (void *) 0;    // one-shot timers free themselves
+    }
+    if (pctx->nsent == 0) {
+        return;
+    }
+    edlog("timeout reading from serial port in serial_fpga");
+    link_resync(pctx);
+    nfail = pctx->nsent;
+    while ((nfail-- > 0) && (pctx->nsent > 0)) {
+        xfer_complete(pctx, HBAERROR_NORECV);
+    }
+}
+
+
+/* xfer_tmo() : Return the time in ms to wait for the response to the
+ * oldest outstanding transaction.  This is the time to put the bytes
+ * ahead of it and its response on the wire at the current baud rate,
+ * plus a telemetry or snapshot frame after each transaction, plus
+ * some slack.  At 115200 baud a short read times out in a few ms.
+ */
+static int xfer_tmo(
+    SERPORT       *pctx)        // our local info
+{
+    int           nbyte;        // bytes that may be on the wire first
+
+    nbyte = pctx->nsentb + pctx->xfer[pctx->xhead].expectrd;
+    if ((pctx->tmrate != 0) || pctx->snapshot) {
+        nbyte += pctx->nsent * (HBA_SF_TM_MXLEN + 2);
+    }
+    // 10 bit times per byte
+    return(((nbyte * 10 * 1000) + pctx->baud - 1) / pctx->baud +
+           HBA_XFER_SLACK_MS);
+}
+
+
+/* link_resync() : Put the FPGA and the host back in step after a
+ * lost or misframed packet.  A break longer than any character drops
+ * the command the FPGA is parsing and whatever it has buffered, and
+ * keeps the FPGA quiet until the break ends.  Anything it sent before
+ * then is dropped here.
+ */
+static void link_resync(
+    SERPORT       *pctx)        // our local info
+{
+    useconds_t    brkus;        // length of the break in us
+
+    pctx->inidx = 0;                 // partial responses are garbage
+    shadow_invalidate(pctx, -1);     // and writes may have been lost
+    if (pctx->spfd < 0) {
+        return;
+    }
+    brkus = (useconds_t) (((HBA_BREAK_BITS * 1000000LL) + pctx->baud - 1) /
+                          pctx->baud);
+    trace_add(pctx, HBA_TR_BREAK, HBA_TR_NOCORE, 0, (uint8_t *) 0, 0);
+    (void) ioctl(pctx->spfd, TCSBRK, 1);      // drain the output
+    (void) ioctl(pctx->spfd, TIOCSBRK);
+    usleep(brkus);
+    (void) ioctl(pctx->spfd, TCFLSH, TCIFLUSH);
+    (void) ioctl(pctx->spfd, TIOCCBRK);
+}
+
+
+/* write_pkt() : Write a packet to the serial port retrying once on
+ * a partial write.  Returns the number of bytes written.
+ */
+static int write_pkt(
+    SERPORT       *pctx,        // our local info
+    uint8_t       *buff,        // bytes to send
+    int            count)       // number of bytes to send
+{
+    int           sntcount1;    // return from first call to write()
+    int           sntcount2;    // return from second call to write()
+    int           i;
+
+    // Print pkt if debug mode and running in foreground
+    if ((DebugMode != 0) && (ForegroundMode != 0)) {
+        printf(">> ");
+        for (i = 0; i < count; i++)
+            printf("%02x ", buff[i]);
+        printf("\n");
+    }
+
+    // send data out the serial port 
+    sntcount1 = write(pctx->spfd, buff, count);
+    if (sntcount1 != count) {
+        if ((sntcount1 < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+            edlog("error writing to serial port in serial_fpga");
+            return(HBAERROR_NOSEND);
+        }
+
+        // Partial send or need to try again.  Pause then try again.
+        usleep(1000);
+        // sntcount1 is offset into xmit buffer.  No negative sntcount1
+        sntcount1 = (sntcount1 < 0) ? 0 : sntcount1;
+        sntcount2 = write(pctx->spfd, &buff[sntcount1], (count - sntcount1));
+        if (sntcount2 != (count - sntcount1)) {
+            // no retry on second failure
+            edlog("error writing to serial port in serial_fpga");
+            return(HBAERROR_NOSEND);
+        }
+    }
+    return(count);
+}
+
+
+/* register_interrupt_handler() : Plug-in modules use this routine
+ * to tell serial_fpga the address of the module's interrupt handler.
+ * The plug-in passes in both the core ID, as well as the address of
+ * the handler.  
+ */
+void register_interrupt_handler(
+    int           parent,       // Slot number of parent,
+    int           coreid,       // core ID.
+    void        (*handler)(),   // address of interrupt handler
+    void         *trans)        // transparently pass this to handler
+{
+    SERPORT      *pctx;         // our local info
+
+    pctx = parent_ctx(parent);
+    if (pctx == (SERPORT *) 0) {
+        return;
+    }
+    bus_intr((void *) pctx, coreid, handler, trans);
+}
+
+static void bus_intr(
+    void         *ctx,          // our local info
+    int           coreid,       // core ID.
+    void        (*handler)(),   // address of interrupt handler
+    void         *trans)        // transparently pass this to handler
+{
+    SERPORT      *pctx;         // our local info
+    SLOT         *pslot;        // our SLOT
+
+    pctx  = (SERPORT *) ctx;
+    pslot = pctx->pslot;
+    edlog("%s: Registering Interupt Handler at Slot %i for Core ID %i.", pslot->name, pslot->slot_id, coreid);
+
+    // Sanity check the coreid and handler address
+    if ((coreid < 0) || (coreid >= NCORE) || (handler == 0)) {
+        edlog("Bad calling values to register_interrupt_handler()");
+        return;
+    }
+
+    pctx->coreinfo[coreid].intr_hndlr = handler;
+    pctx->coreinfo[coreid].trans      = trans;
+}
+
+
+/* register_telemetry_handler() : Plug-in modules use this routine
+ * to receive their registers from the telemetry frames.  The handler
+ * is invoked as handler(trans, reg, count, data) with the first
+ * register, the number of registers, and their values for each pair
+ * in a frame that is for the core.
+ */
+void register_telemetry_handler(
+    int           parent,       // Slot number of parent,
+    int           coreid,       // core ID.
+    void        (*handler)(),   // address of telemetry handler
+    void         *trans)        // transparently pass this to handler
+{
+    SERPORT      *pctx;         // our local info
+
+    pctx = parent_ctx(parent);
+    if (pctx == (SERPORT *) 0) {
+        return;
+    }
+    bus_telemetry((void *) pctx, coreid, handler, trans);
+}
+
+static void bus_telemetry(
+    void         *ctx,          // our local info
+    int           coreid,       // core ID.
+    void        (*handler)(),   // address of telemetry handler
+    void         *trans)        // transparently pass this to handler
+{
+    SERPORT      *pctx;         // our local info
+
+    pctx  = (SERPORT *) ctx;
+
+    // Sanity check the coreid and handler address
+    if ((coreid < 0) || (coreid >= NCORE) || (handler == 0)) {
+        edlog("Bad calling values to register_telemetry_handler()");
+        return;
+    }
+
+    pctx->coreinfo[coreid].tm_hndlr = handler;
+    pctx->coreinfo[coreid].tm_trans = trans;
+}
+
+
+/* register_nonvolatile() : Plug-in modules use this routine to mark
+ * registers that only change when the host writes them.  Reads of
+ * these registers are answered from the register shadow once their
+ * value is known, and writes of the value they already hold are not
+ * sent.  All registers are volatile until marked.
+ */
+void register_nonvolatile(
+    int           parent,       // Slot number of parent,
+    int           coreid,       // core ID.
+    int           reg,          // first register
+    int           count)        // number of registers
+{
+    SERPORT      *pctx;         // our local info
+
+    pctx = parent_ctx(parent);
+    if (pctx == (SERPORT *) 0) {
+        return;
+    }
+    bus_nonvolatile((void *) pctx, coreid, reg, count);
+}
+
+static void bus_nonvolatile(
+    void         *ctx,          // our local info
+    int           coreid,       // core ID.
+    int           reg,          // first register
+    int           count)        // number of registers
+{
+    SERPORT      *pctx;         // our local info
+    int           rtrun;        // ==1 if the I/O thread was running
+    int           i;
+
+    pctx  = (SERPORT *) ctx;
+
+    // Sanity check the coreid and register range
+    if ((coreid < 0) || (coreid >= NCORE) || (reg < 0) || (count <= 0) ||
+        ((reg + count) > HBA_SHM_NREG)) {
+        edlog("Bad calling values to register_nonvolatile()");
+        return;
+    }
+
+    // The shadow belongs to the I/O thread while it runs
+    rtrun = pctx->rtio;
+    rtio_stop(pctx);
+    for (i = 0; i < count; i++) {
+        pctx->shflags[coreid][reg + i] = HBA_SH_NONVOL;
+    }
+    if ((rtrun != 0) && (rtio_start(pctx, pctx->prt->cpu, pctx->prt->prio) != 0)) {
+        edlog("%s: unable to restart the I/O thread", PLUGIN_NAME);
+    }
+}
+
+
+/* bus_stats() : Fill in the link and shadow counters and the
+ * interrupt counts of a core.  Called from the event loop.  While the
+ * I/O thread runs the link and shadow counts are copied by that
+ * thread.  Returns 0 on success or -1 if the core ID is out of range
+ * or the copy could not be made.
+ */
+static int bus_stats(
+    void         *ctx,          // our local info
+    int           coreid,       // core ID.
+    HBA_STATS    *pstats)       // the counters on return
+{
+    SERPORT      *pctx;         // our local info
+    SFSTATS       st;           // snapshot of the counters
+
+    pctx  = (SERPORT *) ctx;
+
+    if ((coreid < 0) || (coreid >= NCORE) || (pstats == (HBA_STATS *) 0)) {
+        return(-1);
+    }
+    if (rtio_call(pctx, stats_snap, (void *) &st) != 0) {
+        return(-1);
+    }
+    intr_snap(pctx, &st);
+    pstats->baud = st.baud;
+    pstats->nqueued = st.nqueued;
+    pstats->nintr = st.nintr[coreid];
+    pstats->nunhandled = st.nunhandled[coreid];
+    pstats->shhits = st.shhits;
+    pstats->shmisses = st.shmisses;
+    pstats->shskips = st.shskips;
+    return(0);
+}
+
+
+/* intr_reset() : Clear the interrupt counts and histograms.  Run in
+ * the event loop, where the handlers update them.
+ */
+static void intr_reset(
+    SERPORT      *pctx)         // our local info
+{
+    int           i;
+
+    for (i = 0; i < NCORE; i++) {
+        pctx->coreinfo[i].nintr = 0;
+        pctx->coreinfo[i].nunhandled = 0;
+        (void) memset(pctx->coreinfo[i].lathist, 0,
+                      sizeof(pctx->coreinfo[i].lathist));
+        (void) memset(pctx->coreinfo[i].exechist, 0,
+                      sizeof(pctx->coreinfo[i].exechist));
+    }
+}
+
+
+/* cache_reset() : Clear the shadow counters and forget the shadow.
+ * Run by rtio_call().
+ */
+static void cache_reset(
+    SERPORT      *pctx,         // our local info
+    void         *arg)          // unused
+{
+    pctx->shhits = 0;
+    pctx->shmisses = 0;
+    pctx->shskips = 0;
+    shadow_invalidate(pctx, -1);
+}
+
+
+/* stats_snap() : Copy the link, shadow, and trace counters into the
+ * SFSTATS at arg.  Run by rtio_call() on the thread that updates them.
+ */
+static void stats_snap(
+    SERPORT      *pctx,         // our local info
+    void         *arg)          // the SFSTATS to fill
+{
+    SFSTATS      *pst = (SFSTATS *) arg;
+
+    pst->baud = pctx->baud;
+    pst->nqueued = pctx->nxfer;
+    pst->shhits = pctx->shhits;
+    pst->shmisses = pctx->shmisses;
+    pst->shskips = pctx->shskips;
+    pst->trsize = pctx->trsize;
+    pst->trcount = pctx->trcount;
+}
+
+
+/* intr_snap() : Copy the interrupt counts and histograms into pst.
+ * Run in the event loop, where the handlers update them.
+ */
+static void intr_snap(
+    SERPORT      *pctx,         // our local info
+    SFSTATS      *pst)          // the SFSTATS to fill
+{
+    int           i;
+
+    for (i = 0; i < NCORE; i++) {
+        pst->nintr[i] = pctx->coreinfo[i].nintr;
+        pst->nunhandled[i] = pctx->coreinfo[i].nunhandled;
+        (void) memcpy(pst->lathist[i], pctx->coreinfo[i].lathist,
+                      sizeof(pst->lathist[i]));
+        (void) memcpy(pst->exechist[i], pctx->coreinfo[i].exechist,
+                      sizeof(pst->exechist[i]));
+    }
+}
+
+
+/* hba_get_ops() : Give a child plug-in our bus operations.  The
+ * child does this once, through hba_ops() in hba.h, and then calls
+ * the operations with ops->ctx directly.  The slot is checked here
+ * instead of on every packet.  Returns 0 if the slot is not ours.
+ */
+HBA_OPS *hba_get_ops(
+    int           parent)       // Slot number of parent,
+{
+    if ((parent < 0) || (parent >= MX_PLUGIN) || (Slots[parent].name == 0) ||
+        (strncmp(PLUGIN_NAME, Slots[parent].name, strlen(PLUGIN_NAME)) != 0) ||
+        (Slots[parent].priv == (void *) 0)) {
+        return((HBA_OPS *) 0);
+    }
+    return(&(((SERPORT *) Slots[parent].priv)->ops));
+}
+
+
+/* parent_ctx() : Check that a slot passed to one of our exported
+ * routines is ours and return its context.  Plug-ins that call the
+ * routines by name get the check on every call, as they always have.
+ * Returns null, and logs it, if the slot is not a serial_fpga.
+ */
+static SERPORT *parent_ctx(
+    int           parent)       // Slot number of parent,
+{
+    if ((parent < 0) || (parent >= MX_PLUGIN) || (Slots[parent].name == 0) ||
+        (strncmp(PLUGIN_NAME, Slots[parent].name, strlen(PLUGIN_NAME)) != 0) ||
+        (Slots[parent].priv == (void *) 0)) {
+        edlog("Wanted %s in Slot %i", PLUGIN_NAME, parent);
+        return((SERPORT *) 0);
+    }
+    return((SERPORT *) Slots[parent].priv);
+}
+
+
+/***************************************************************************
+ * do_interrupt(): - Handle an interrupt request.  Read the interrupt
+ * pending registers in serial_fpga peripheral and invoke the appropriate
+ * interrupt handlers if one is registered.  Log interrupts that do not
+ * have a handler.
+ ***************************************************************************/
+static void do_interrupt(
+    int       fd_in,         // FD with data to read,
+    void     *cb_data)       // callback date (==*SERPORT)
+{
+    SERPORT  *pctx;          // our context
+    int       nedge;         // number of rising edges on the pin
+    uint64_t  ts[HBA_MXEDGE]; // kernel time of each edge in ns
+    IRQEDGE  *pir;           // the edge given to intr_pending()
+    uint8_t   pkt[HBA_MXPKT];  
+
+    pctx = (SERPORT *) cb_data;
+
+    // We need to read the GPIO edges to clear the interrupt
+    nedge = (pctx->irbe->edges) (pctx->irfd, ts, HBA_MXEDGE);
+    if (nedge < 0) {
+        edlog("Error reading interrupt GPIO pin");
+        return;
+    }
+    if (nedge == 0) {
+        return;                 // noise or nothing queued
+    }
+
+    // Edges queued while we were busy are all served by one read of
+    // the pending registers.  Keep the time of the first.  If every
+    // slot still waits on its read this edge goes untimed.
+    pir = &(pctx->irq[pctx->irnext]);
+    if (atomic_load(&(pir->busy)) != 0) {
+        pir = &(pctx->irnone);
+    }
+    else {
+        pctx->irnext = (pctx->irnext + 1) % HBA_MXIRQ;
+        pir->ts = ts[0];
+        atomic_store(&(pir->busy), 1);
+    }
+
+    // Read the two interrupt registers in serial_fpga.  The handlers
+    // are invoked from intr_pending() when the response arrives.
+    //  (2-1) is # byte to read -1
+    pkt[0] = HBA_READ_CMD | ((2 -1) << 4) | HBA_SERIAL_FPGA_COREID;
+    pkt[1] = HBA_SF_REG_INTR0;
+    pkt[2] = 0;                     // dummy byte
+    pkt[3] = 0;                     // dummy byte
+    pkt[4] = 0;                     // dummy byte
+    pkt[5] = 0;                     // dummy byte
+    if (xfer_submit(pctx, 6, pkt, intr_pending, (void *) pir) < 0) {
+        atomic_store(&(pir->busy), 0);
+        edlog("Error reading interrupt pending register from FPGA");
+    }
+}
+
+
+/***************************************************************************
+ * intr_pending(): - Completion callback for the read of the interrupt
+ * pending registers.  Invoke the handler of each core with an interrupt
+ * pending.
+ ***************************************************************************/
+static void intr_pending(
+    void     *cb_data,       // callback date (==*IRQEDGE)
+    int       nrc,           // number of bytes recieved
+    uint8_t  *pkt)           // echoed header and the two registers
+{
+    IRQEDGE  *pir;           // the edge that started the read
+    SERPORT  *pctx;          // our context
+    uint64_t  edgets;        // time of the edge in ns
+    int       intpending;    // a set bit means and interrupt is pending
+
+    pir = (IRQEDGE *) cb_data;
+    pctx = (SERPORT *) pir->pctx;
+    edgets = pir->ts;
+    atomic_store(&(pir->busy), 0);
+
+    // We sent header + two bytes so the sendrecv return value should be 4
+    if (nrc != 4) {
+        // error reading value from GPIO port
+        edlog("Error reading interrupt pending register from FPGA");
+        return;
+    }
+    intpending = pkt[2] | (pkt[3] << 8);
+
+    // Sanity check
+    if (intpending == 0) {
+        edlog("Interrupt but no bits set in pending registers");
+        return;
+    }
+
+    intr_dispatch(pctx, intpending, 0, edgets);
+}
+
+
+/***************************************************************************
+ * intr_dispatch(): - Invoke the interrupt handler of each core with an
+ * interrupt pending.  Cores in 'handled' already got their registers
+ * from a snapshot frame and are skipped.
+ ***************************************************************************/
+static void intr_dispatch(
+    SERPORT  *pctx,          // our context
+    int       intpending,    // a set bit means and interrupt is pending
+    int       handled,       // a set bit means the core was given its data
+    uint64_t  edgets)        // time of the GPIO edge in ns, 0 if none
+{
+    COREINFO *pci;           // info for the interrupting core
+    uint64_t  start;         // time the handler was invoked
+    int       i;             // to walk the cores
+
+    // walk the pending interrupts invoking the handlers.  No need to check
+    // at zero since that's us.
+    for (i = 1;  i < NCORE; i++) {
+        intpending = intpending >> 1;
+        handled = handled >> 1;
+        if (((intpending & 0x01) == 1) && ((handled & 0x01) == 0)) {
+            // interrupt is pending on this core.  Invoke its handler
+            pci = &(pctx->coreinfo[i]);
+            pci->nintr++;
+            if (pci->intr_hndlr == 0) {
+                pci->nunhandled++;
+                edlog("Received unhandled interrupt in core %d", i);
+                continue;
+            }
+            // invoke handler
+            start = now_ns();
+            (pci->intr_hndlr) (pci->trans);
+            intr_stat(pci, edgets, start, now_ns());
+        }
+    }
+}
+
+
+/***************************************************************************
+ * intr_stat(): - Add an interrupt to the latency and execution time
+ * histograms of its core.  The plug-ins' handlers queue their register
+ * reads with send_async() and return, so the execution time is the
+ * handler's own work.  The callback that gets the registers is not
+ * counted.
+ ***************************************************************************/
+static void intr_stat(
+    COREINFO *pci,           // the core's info
+    uint64_t  edgets,        // time of the GPIO edge in ns, 0 if none
+    uint64_t  start,         // time the handler was invoked
+    uint64_t  end)           // time the handler returned
+{
+    uint64_t  us;            // a time in us
+    int       bkt;           // histogram bucket
+
+    if ((edgets != 0) && (start >= edgets)) {
+        us = (start - edgets) / 1000;
+        for (bkt = 0; (us > 1) && (bkt < (HBA_NSTATBKT - 1)); bkt++) {
+            us = us >> 1;
+        }
+        pci->lathist[bkt]++;
+    }
+    us = (end - start) / 1000;
+    for (bkt = 0; (us > 1) && (bkt < (HBA_NSTATBKT - 1)); bkt++) {
+        us = us >> 1;
+    }
+    pci->exechist[bkt]++;
+}
+
+
+/***************************************************************************
+ * intr_stats(): - Print the interrupt statistics of each core that has
+ * had an interrupt.  Each line is the core, the number of interrupts,
+ * the number with no handler, and the latency and execution time
+ * histograms.  Returns the number of characters put in buf or -1 if
+ * the statistics do not fit.
+ ***************************************************************************/
+static int intr_stats(
+    SFSTATS  *pst,           // snapshot of the counters
+    char     *buf,           // where to print the statistics
+    int       len)           // size of buf
+{
+    int       ret;           // number of chars in buf
+    int       i, j;
+
+    // snprintf() returns what it would have printed so ret reaches
+    // len as soon as anything is cut off.
+    ret = 0;
+    for (i = 1; i < NCORE; i++) {
+        if (pst->nintr[i] == 0) {
+            continue;
+        }
+        ret += snprintf(&(buf[ret]), (len - ret), "%d %u %u lat",
+                        i, pst->nintr[i], pst->nunhandled[i]);
+        for (j = 0; (j < HBA_NSTATBKT) && (ret < len); j++) {
+            ret += snprintf(&(buf[ret]), (len - ret), " %u", pst->lathist[i][j]);
+        }
+        if (ret < len) {
+            ret += snprintf(&(buf[ret]), (len - ret), " exec");
+        }
+        for (j = 0; (j < HBA_NSTATBKT) && (ret < len); j++) {
+            ret += snprintf(&(buf[ret]), (len - ret), " %u", pst->exechist[i][j]);
+        }
+        if (ret < len) {
+            ret += snprintf(&(buf[ret]), (len - ret), "\n");
+        }
+        if (ret >= len) {
+            return(-1);
+        }
+    }
+    return(ret);
+}
+
+
+/***************************************************************************
+ * trace_add(): - Record a packet, response, or frame in the trace ring.
+ * A negative len is the error code of a failed transaction.  This is
+ * on the hot path so there is no formatting here, just a copy.
+ ***************************************************************************/
+static void trace_add(
+    SERPORT  *pctx,          // our context
+    int       type,          // HBA_TR_TX, _RX, _FRAME, or _BREAK
+    int       core,          // core of the transaction, or HBA_TR_NOCORE
+    int       flags,         // HBA_TR_xxx flags
+    uint8_t  *data,          // the bytes
+    int       len)           // number of bytes, or an error code
+{
+    HBA_TRREC *prec;         // the record to fill
+
+    if (pctx->trace == (HBA_TRREC *) 0) {
         return;
     }
+    prec = &(pctx->trace[pctx->trcount & (pctx->trsize - 1)]);
+    prec->ts = now_ns();
+    prec->type = type;
+    prec->core = core;
+    prec->flags = flags;
+    prec->err = (len < 0) ? len : 0;
+    prec->len = (len < 0) ? 0 : len;
+    if (len > 0) {
+        (void) memcpy(prec->data, data, ((len < HBA_TR_DATA) ? len : HBA_TR_DATA));
+    }
+    pctx->trcount++;
+}
+
+
+/***************************************************************************
+ * trace_size(): - Set up a trace ring with room for at least nrec
+ * records, or turn tracing off if nrec is zero.  The old records are
+ * dropped.  Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int trace_size(
+    SERPORT  *pctx,          // our context
+    int       nrec)          // minimum number of records
+{
+    HBA_TRREC *ptrace;       // the new ring
+    unsigned int nsize;      // nrec rounded up to a power of two
+
+    ptrace = (HBA_TRREC *) 0;
+    nsize = 0;
+    if (nrec > 0) {
+        nsize = 1;
+        while (nsize < (unsigned int) nrec) {
+            nsize <<= 1;
+        }
+        ptrace = (HBA_TRREC *) calloc(nsize, sizeof(HBA_TRREC));
+        if (ptrace == (HBA_TRREC *) 0) {
+            return(-1);
+        }
+    }
+    free(pctx->trace);
+    pctx->trace = ptrace;
+    pctx->trsize = nsize;
+    pctx->trcount = 0;
+    return(0);
+}
 
-    // Read the two interrupt registers in serial_fpga
-    //  (2-1) is # byte to read -1
-    pkt[0] = HBA_READ_CMD | ((2 -1) << 4) | HBA_SERIAL_FPGA_COREID;
-    pkt[1] = HBA_SF_REG_INTR0;
-    pkt[2] = 0;                     // dummy byte
-    pkt[3] = 0;                     // dummy byte
-    pkt[4] = 0;                     // dummy byte
-    pkt[5] = 0;                     // dummy byte
-    nrc = sendrecv_pkt(pslot->slot_id, 6, pkt);
-    // We sent header + two bytes so the sendrecv return value should be 4
-    if (nrc != 4) {
-        // error reading value from GPIO port
-        edlog("Error reading interrupt pending register from FPGA");
-        return;
+
+/***************************************************************************
+ * trace_dump(): - Write the trace ring to a capture file.  The file
+ * is an HBA_TRHDR and then the records, oldest first.  The ring is
+ * left as it is.  Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int trace_dump(
+    SERPORT  *pctx,          // our context
+    char     *path)          // full path of the capture file
+{
+    HBA_TRHDR hdr;           // the capture file header
+    uint64_t  first;         // number of the oldest record in the ring
+    unsigned int idx;        // index of the oldest record in the ring
+    unsigned int nhead;      // records from idx to the end of the ring
+    int       fd;
+    int       ret;
+
+    if (pctx->trace == (HBA_TRREC *) 0) {
+        return(-1);
+    }
+    hdr.magic = HBA_TR_MAGIC;
+    hdr.version = HBA_TR_VERSION;
+    hdr.recsize = sizeof(HBA_TRREC);
+    hdr.nrec = (pctx->trcount < pctx->trsize) ? pctx->trcount : pctx->trsize;
+    hdr.baud = pctx->baud;
+    hdr.total = pctx->trcount;
+    first = pctx->trcount - hdr.nrec;
+    idx = first & (pctx->trsize - 1);
+    nhead = pctx->trsize - idx;
+    if (nhead > hdr.nrec) {
+        nhead = hdr.nrec;
     }
-    intpending = pkt[2] | (pkt[3] << 8);
 
-    // Sanity check
-    if (intpending == 0) {
-        edlog("Interrupt but no bits set in pending registers");
+    fd = open(path, (O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC), 0644);
+    if (fd < 0) {
+        edlog("%s: unable to open trace file %s", PLUGIN_NAME, path);
+        return(-1);
+    }
+    ret = 0;
+    if ((write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) ||
+        (write(fd, &(pctx->trace[idx]), (nhead * sizeof(HBA_TRREC))) !=
+         (ssize_t) (nhead * sizeof(HBA_TRREC))) ||
+        (write(fd, pctx->trace, ((hdr.nrec - nhead) * sizeof(HBA_TRREC))) !=
+         (ssize_t) ((hdr.nrec - nhead) * sizeof(HBA_TRREC)))) {
+        edlog("%s: unable to write trace file %s", PLUGIN_NAME, path);
+        ret = -1;
+    }
+    close(fd);
+    return(ret);
+}
+
+
+/***************************************************************************
+ * rtio_start(): - Start the real-time I/O thread.  It takes over the
+ * serial port, the interrupt pin, and the transaction queue from the
+ * event loop.  The thread is pinned to cpu unless it is -1 and runs
+ * SCHED_FIFO at prio unless prio is 0.  Without the privilege for
+ * SCHED_FIFO it runs SCHED_OTHER.  Returns 0 on success and -1 on
+ * error.
+ ***************************************************************************/
+static int rtio_start(
+    SERPORT  *pctx,          // our context
+    int       cpu,           // CPU to pin the thread to, or -1
+    int       prio)          // SCHED_FIFO priority, or 0
+{
+    RTIO     *prt;           // the I/O thread
+    pthread_attr_t attr;     // thread attributes
+    struct sched_param sp;   // thread priority
+    cpu_set_t cpus;          // CPU the thread is pinned to
+    int       ret;
+    int       i;
+
+    if (pctx->rtio != 0) {
+        return(0);
+    }
+
+    // The rings are kept once allocated so threads keep their ring
+    // across a restart
+    prt = pctx->prt;
+    if (prt == (RTIO *) 0) {
+        prt = (RTIO *) calloc(1, sizeof(RTIO));
+        if (prt == (RTIO *) 0) {
+            return(-1);
+        }
+        for (i = 0; i < HBA_RT_NSUBMIT; i++) {
+            prt->submit[i].nmsg = HBA_RT_NMSG;
+            prt->submit[i].msg = (RTMSG *) calloc(HBA_RT_NMSG, sizeof(RTMSG));
+        }
+        prt->done.nmsg = HBA_RT_NDONE;
+        prt->done.msg = (RTMSG *) calloc(HBA_RT_NDONE, sizeof(RTMSG));
+        prt->wakefd = eventfd(0, (EFD_NONBLOCK | EFD_CLOEXEC));
+        prt->donefd = eventfd(0, (EFD_NONBLOCK | EFD_CLOEXEC));
+        (void) pthread_mutex_init(&(prt->dlock), (pthread_mutexattr_t *) 0);
+        (void) pthread_cond_init(&(prt->dcond), (pthread_condattr_t *) 0);
+        atomic_store(&(prt->used[0]), 1);   // the event loop's ring
+        for (i = 0; i < HBA_RT_NSUBMIT; i++) {
+            if (prt->submit[i].msg == (RTMSG *) 0) {
+                break;
+            }
+        }
+        if ((i < HBA_RT_NSUBMIT) || (prt->done.msg == (RTMSG *) 0) ||
+            (prt->wakefd < 0) || (prt->donefd < 0)) {
+            edlog("%s: unable to allocate the I/O thread", PLUGIN_NAME);
+            return(-1);         // (not freed.  We are out of memory or fds.)
+        }
+        pctx->prt = prt;
+    }
+    prt->cpu = cpu;
+    prt->prio = prio;
+    prt->nwake = 0;
+    atomic_store(&(prt->stop), 0);
+
+    // Hand the fds and the queue to the thread.  Its timeout replaces
+    // the event loop's timers.
+    if (pctx->spfd >= 0) {
+        del_fd(pctx->spfd);
+    }
+    if (pctx->irfd >= 0) {
+        del_fd(pctx->irfd);
+    }
+    if (pctx->xtimer != (void *) 0) {
+        del_timer(pctx->xtimer);
+        pctx->xtimer = (void *) 0;
+    }
+    if (pctx->ftimer != (void *) 0) {
+        del_timer(pctx->ftimer);
+        pctx->ftimer = (void *) 0;
+    }
+    pctx->xdue = 0;
+    pctx->rtio = 1;
+
+    ret = pthread_attr_init(&attr);
+    if ((ret == 0) && (cpu >= 0)) {
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        ret = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+    if ((ret == 0) && (prio > 0)) {
+        sp.sched_priority = prio;
+        (void) pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        (void) pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        (void) pthread_attr_setschedparam(&attr, &sp);
+    }
+    if (ret == 0) {
+        ret = pthread_create(&(prt->thread), &attr, rtio_run, (void *) pctx);
+        if ((ret == EPERM) && (prio > 0)) {
+            edlog("%s: no permission for SCHED_FIFO, using SCHED_OTHER",
+                  PLUGIN_NAME);
+            (void) pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+            ret = pthread_create(&(prt->thread), &attr, rtio_run, (void *) pctx);
+        }
+    }
+    (void) pthread_attr_destroy(&attr);
+    if (ret != 0) {
+        edlog("%s: unable to start the I/O thread: %s", PLUGIN_NAME,
+              strerror(ret));
+        pctx->rtio = 0;
+        rtio_fds(pctx);
+        xfer_send(pctx);
+        return(-1);
+    }
+    add_fd(prt->donefd, ED_READ, rtio_events, (void *) pctx);
+    return(0);
+}
+
+
+/***************************************************************************
+ * rtio_stop(): - Stop the I/O thread and give the serial port, the
+ * interrupt pin, and the transaction queue back to the event loop.
+ * Transactions in flight stay in the queue.
+ ***************************************************************************/
+static void rtio_stop(
+    SERPORT  *pctx)          // our context
+{
+    RTIO     *prt = pctx->prt;
+    uint64_t  one = 1;       // eventfd increment
+
+    if (pctx->rtio == 0) {
         return;
     }
+    atomic_store(&(prt->stop), 1);
+    (void) write(prt->wakefd, &one, sizeof(one));
+    // The thread may be waiting for room on the done ring.  It spills
+    // into prt->spill once it sees stop.
+    (void) pthread_mutex_lock(&(prt->dlock));
+    (void) pthread_cond_signal(&(prt->dcond));
+    (void) pthread_mutex_unlock(&(prt->dlock));
+    (void) pthread_join(prt->thread, (void **) 0);
+    del_fd(prt->donefd);
+    pctx->rtio = 0;
+    pctx->xdue = 0;
+    rtio_fds(pctx);
 
-    // walk the pending interrupts invoking the handlers.  No need to check
-    // at zero since that's us.
-    for (i = 1;  i < NCORE; i++) {
-        intpending = intpending >> 1;
-        if ((intpending & 0x01) == 1) {
-            // interrupt is pending on this core.  Invoke its handler
-            if (pctx->coreinfo[i].intr_hndlr == 0) {
-                edlog("Received unhandled interrupt in core %d", i);
+    // Run what the thread finished, then queue what came in as it
+    // stopped, and restart the event loop's timers
+    rtio_drain(pctx);
+    rtio_take(pctx);
+    xfer_send(pctx);
+    xfer_cached(pctx);
+}
+
+
+/***************************************************************************
+ * rtio_fds(): - Give the serial port and the interrupt pin back to the
+ * event loop.
+ ***************************************************************************/
+static void rtio_fds(
+    SERPORT  *pctx)          // our context
+{
+    if (pctx->spfd >= 0) {
+        add_fd(pctx->spfd, ED_READ, getevents, (void *) pctx);
+    }
+    if (pctx->irfd >= 0) {
+        add_fd(pctx->irfd, pctx->irbe->fdflag, do_interrupt, (void *) pctx);
+    }
+}
+
+
+/***************************************************************************
+ * rtio_run(): - The I/O thread.  Each turn takes the requests from the
+ * submit rings, sends what the window allows, and waits for the serial
+ * port, the interrupt pin, a new request, or the oldest transaction's
+ * timeout.  Callbacks go to the event loop on the done ring.
+ ***************************************************************************/
+static void *rtio_run(
+    void     *cb_data)       // our context (==*SERPORT)
+{
+    SERPORT  *pctx = (SERPORT *) cb_data;
+    RTIO     *prt = pctx->prt;
+    struct pollfd pfd[3];    // wake eventfd, serial port, interrupt pin
+    int       npfd;          // number of fds in pfd
+    int       spidx;         // index of the serial port in pfd, or -1
+    int       iridx;         // index of the interrupt pin in pfd, or -1
+    struct timespec tmo;     // time to the oldest transaction's timeout
+    uint64_t  now;           // current time in ns
+    uint64_t  cnt;           // eventfd counter
+    uint64_t  one = 1;       // eventfd increment
+
+    while (1) {
+        rtio_take(pctx);
+        xfer_send(pctx);
+        xfer_cached(pctx);
+        if (prt->nwake != 0) {
+            prt->nwake = 0;
+            (void) write(prt->donefd, &one, sizeof(one));
+        }
+        if (atomic_load(&(prt->stop)) != 0) {
+            break;
+        }
+
+        npfd = 0;
+        pfd[npfd].fd = prt->wakefd;
+        pfd[npfd].events = POLLIN;
+        npfd++;
+        spidx = -1;
+        if (pctx->spfd >= 0) {
+            spidx = npfd;
+            pfd[npfd].fd = pctx->spfd;
+            pfd[npfd].events = POLLIN;
+            npfd++;
+        }
+        iridx = -1;
+        if (pctx->irfd >= 0) {
+            iridx = npfd;
+            pfd[npfd].fd = pctx->irfd;
+            pfd[npfd].events = (pctx->irbe->fdflag == ED_EXCEPT) ? POLLPRI : POLLIN;
+            npfd++;
+        }
+        now = now_ns();
+        tmo.tv_sec = 0;
+        tmo.tv_nsec = 0;
+        if (pctx->xdue > now) {
+            tmo.tv_sec = (pctx->xdue - now) / 1000000000;
+            tmo.tv_nsec = (pctx->xdue - now) % 1000000000;
+        }
+        if ((ppoll(pfd, npfd, ((pctx->xdue != 0) ? &tmo : (struct timespec *) 0),
+                   (sigset_t *) 0) < 0) && (errno != EINTR)) {
+            edlog("%s: I/O thread poll failed", PLUGIN_NAME);
+            break;
+        }
+
+        if (pfd[0].revents != 0) {
+            (void) read(prt->wakefd, &cnt, sizeof(cnt));
+        }
+        if ((spidx >= 0) && (pfd[spidx].revents != 0) && (pctx->spfd >= 0)) {
+            getevents(pctx->spfd, (void *) pctx);
+        }
+        if ((iridx >= 0) && (pfd[iridx].revents != 0) && (pctx->irfd >= 0)) {
+            do_interrupt(pctx->irfd, (void *) pctx);
+        }
+        if ((pctx->xdue != 0) && (now_ns() >= pctx->xdue)) {
+            pctx->xdue = 0;
+            xfer_timeout((void *) 0, (void *) pctx);
+        }
+    }
+    return((void *) 0);
+}
+
+
+/***************************************************************************
+ * rtio_take(): - Move the requests in the submit rings to the
+ * transaction queue.  A request stays in its ring until the queue has
+ * room for it.  Requests that can not be queued fail through their
+ * callback.
+ ***************************************************************************/
+static void rtio_take(
+    SERPORT  *pctx)          // our context
+{
+    RTRING   *pr;            // a submit ring
+    RTMSG    *pm;            // a request
+    XFER     *px;            // first transaction of a batch
+    unsigned int tail;       // the ring's tail
+    int       nmsg;          // number of messages in the request
+    void     *fnarg;         // argument of an RT_CALL function
+    int       ret;
+    int       i, j;
+
+    for (i = 0; i < HBA_RT_NSUBMIT; i++) {
+        pr = &(pctx->prt->submit[i]);
+        while (1) {
+            tail = atomic_load_explicit(&(pr->tail), memory_order_relaxed);
+            if (atomic_load_explicit(&(pr->head), memory_order_acquire) == tail) {
+                break;
+            }
+            pm = &(pr->msg[tail % pr->nmsg]);
+            nmsg = pm->nbatch;
+            if (pm->op == RT_CALL) {
+                (void) memcpy(&fnarg, pm->pkt, sizeof(fnarg));
+                ((void (*)(SERPORT *, void *)) pm->done_cb) (pctx, fnarg);
+                rtio_done(pctx, sync_done, pm->trans, 0, (uint8_t *) 0);
+                atomic_store_explicit(&(pr->tail), (tail + 1), memory_order_release);
                 continue;
             }
-            // invoke handler
-            (pctx->coreinfo[i].intr_hndlr) (pctx->coreinfo[i].trans);
+            if ((HBA_MXXFER - pctx->nxfer) < nmsg) {
+                break;
+            }
+            if (pm->op == RT_POST) {
+                ret = xfer_post(pctx, pm->count, pm->pkt, pm->done_cb, pm->trans);
+            }
+            else {
+                px = &(pctx->xfer[(pctx->xhead + pctx->nxfer) % HBA_MXXFER]);
+                ret = 0;
+                for (j = 0; (j < nmsg) && (ret == 0); j++) {
+                    pm = &(pr->msg[(tail + j) % pr->nmsg]);
+                    ret = xfer_queue(pctx, pm->count, pm->pkt, pm->done_cb,
+                                     pm->trans);
+                }
+                if (ret == 0) {
+                    px->nbatch = nmsg;
+                }
+                else {
+                    // None of it has been sent.  Undo what was queued.
+                    while (--j > 0) {
+                        pctx->nxfer--;
+                        shadow_done(pctx, &(pctx->xfer[(pctx->xhead +
+                                    pctx->nxfer) % HBA_MXXFER]), 0);
+                    }
+                }
+            }
+            if (ret != 0) {
+                for (j = 0; j < nmsg; j++) {
+                    pm = &(pr->msg[(tail + j) % pr->nmsg]);
+                    rtio_done(pctx, pm->done_cb, pm->trans, HBAERROR_NOSEND,
+                              (uint8_t *) 0);
+                }
+            }
+            atomic_store_explicit(&(pr->tail), (tail + nmsg), memory_order_release);
+        }
+    }
+}
+
+
+/***************************************************************************
+ * rtio_ring(): - Return the calling thread's submit ring.  The event
+ * loop has ring 0 and other threads each get one of the rest the first
+ * time they submit.  Returns 0 if they are all taken.
+ ***************************************************************************/
+static RTRING *rtio_ring(
+    SERPORT  *pctx)          // our context
+{
+    static __thread RTIO *myprt = (RTIO *) 0; // I/O thread of myring
+    static __thread int myring;  // this thread's ring
+    RTIO     *prt = pctx->prt;
+    int       unused;        // expected value of a free ring's used flag
+    int       i;
+
+    if (pthread_equal(pthread_self(), pctx->mainthr) != 0) {
+        return(&(prt->submit[0]));
+    }
+    if (myprt != prt) {
+        for (i = 1; i < HBA_RT_NSUBMIT; i++) {
+            unused = 0;
+            if (atomic_compare_exchange_strong(&(prt->used[i]), &unused, 1)) {
+                break;
+            }
+        }
+        if (i == HBA_RT_NSUBMIT) {
+            return((RTRING *) 0);
+        }
+        myprt = prt;
+        myring = i;
+    }
+    return(&(prt->submit[myring]));
+}
+
+
+/***************************************************************************
+ * rtio_submit(): - Give a packet, or the packets of a batch, to the I/O
+ * thread.  The packets are copied into the caller's submit ring.
+ * Returns 0 if they were queued and HBAERROR_NOSEND if a packet is
+ * malformed or the ring is full.
+ ***************************************************************************/
+static int rtio_submit(
+    SERPORT  *pctx,          // our context
+    int       op,            // RT_SUBMIT, RT_POST, or RT_BATCH
+    int       npkt,          // number of packets
+    HBA_PKT  *pkts,          // the packets
+    void    (*done_cb)(),    // invoked when each transaction completes
+    void    **trans)         // transparently pass trans[i] to done_cb
+{
+    RTRING   *pr;            // our submit ring
+    RTMSG    *pm;            // a slot in the ring
+    unsigned int head;       // the ring's head
+    uint64_t  one = 1;       // eventfd increment
+    int       i;
+
+    pr = rtio_ring(pctx);
+    if (pr == (RTRING *) 0) {
+        return(HBAERROR_NOSEND);
+    }
+    head = atomic_load_explicit(&(pr->head), memory_order_relaxed);
+    if ((pr->nmsg - (head - atomic_load_explicit(&(pr->tail),
+                                                 memory_order_acquire))) <
+        (unsigned int) npkt) {
+        return(HBAERROR_NOSEND);
+    }
+    for (i = 0; i < npkt; i++) {
+        if ((pkts[i].buff == (uint8_t *) 0) || (pkts[i].count <= 2) ||
+            (pkts[i].count > HBA_MXPKT_EXT)) {
+            return(HBAERROR_NOSEND);
+        }
+        pm = &(pr->msg[(head + i) % pr->nmsg]);
+        pm->op = op;
+        pm->count = pkts[i].count;
+        pm->nbatch = (i == 0) ? npkt : 0;
+        pm->done_cb = done_cb;
+        pm->trans = trans[i];
+        (void) memcpy(pm->pkt, pkts[i].buff, pkts[i].count);
+    }
+    atomic_store_explicit(&(pr->head), (head + npkt), memory_order_release);
+    (void) write(pctx->prt->wakefd, &one, sizeof(one));
+    return(0);
+}
+
+
+/***************************************************************************
+ * rtio_call(): - Run fn(pctx, arg) on the thread that owns the queue and
+ * the counters and wait for it.  That is the I/O thread while it runs
+ * and the caller otherwise.  Returns 0 once fn has run and
+ * HBAERROR_NOSEND if it could not be handed to the I/O thread.
+ ***************************************************************************/
+static int rtio_call(
+    SERPORT  *pctx,          // our context
+    void    (*fn)(SERPORT *, void *),  // the function to run
+    void     *arg)           // its argument
+{
+    SYNCXFER  sync;          // completion status of the call
+    RTRING   *pr;            // our submit ring
+    RTMSG    *pm;            // the slot in the ring
+    unsigned int head;       // the ring's head
+    uint64_t  one = 1;       // eventfd increment
+
+    if ((pctx->rtio == 0) ||
+        (pthread_equal(pthread_self(), pctx->prt->thread) != 0)) {
+        (fn) (pctx, arg);
+        return(0);
+    }
+    pr = rtio_ring(pctx);
+    if (pr == (RTRING *) 0) {
+        return(HBAERROR_NOSEND);
+    }
+    head = atomic_load_explicit(&(pr->head), memory_order_relaxed);
+    if ((head - atomic_load_explicit(&(pr->tail), memory_order_acquire)) ==
+        pr->nmsg) {
+        return(HBAERROR_NOSEND);
+    }
+    sync.buff = (uint8_t *) 0;
+    sync.ret = HBAERROR_NOSEND;
+    atomic_init(&(sync.done), 0);
+    sync.efd = rtio_waitfd(pctx);
+    pm = &(pr->msg[head % pr->nmsg]);
+    pm->op = RT_CALL;
+    pm->count = sizeof(arg);
+    pm->nbatch = 1;
+    pm->done_cb = (void (*)()) fn;
+    pm->trans = (void *) &sync;
+    (void) memcpy(pm->pkt, &arg, sizeof(arg));
+    atomic_store_explicit(&(pr->head), (head + 1), memory_order_release);
+    (void) write(pctx->prt->wakefd, &one, sizeof(one));
+    rtio_wait(pctx, &(sync.done), sync.efd);
+    return(0);
+}
+
+
+/***************************************************************************
+ * rtio_set(): - Set an int the I/O thread reads, like the window or the
+ * telemetry rate, from the thread that owns it.  Returns 0 on success
+ * or HBAERROR_NOSEND.
+ ***************************************************************************/
+typedef struct
+{
+    int      *pvar;          // the variable to set
+    int       val;           // its new value
+} RTSET;
+
+static void rtio_setvar(
+    SERPORT  *pctx,          // our context
+    void     *arg)           // the RTSET
+{
+    *(((RTSET *) arg)->pvar) = ((RTSET *) arg)->val;
+    xfer_send(pctx);         // a larger window may send more
+}
+
+static int rtio_set(
+    SERPORT  *pctx,          // our context
+    int      *pvar,          // the variable to set
+    int       val)           // its new value
+{
+    RTSET     set;           // what to set
+
+    set.pvar = pvar;
+    set.val = val;
+    return(rtio_call(pctx, rtio_setvar, (void *) &set));
+}
+
+
+/***************************************************************************
+ * rtio_waitfd(): - Return the eventfd the calling thread waits on for
+ * its sendrecv_pkt() and sendrecv_batch() responses, or -1 for the
+ * event loop, which waits on the done ring.
+ ***************************************************************************/
+static int rtio_waitfd(
+    SERPORT  *pctx)          // our context
+{
+    static __thread int waitfd = -1;  // this thread's eventfd
+
+    if (pthread_equal(pthread_self(), pctx->mainthr) != 0) {
+        return(-1);
+    }
+    if (waitfd < 0) {
+        waitfd = eventfd(0, EFD_CLOEXEC);
+    }
+    return(waitfd);
+}
+
+
+/***************************************************************************
+ * rtio_wait(): - Wait for *pdone.  The event loop runs the callbacks
+ * on the done ring while it waits so those ahead of it complete first.
+ * Other threads sleep on their eventfd.
+ ***************************************************************************/
+static void rtio_wait(
+    SERPORT  *pctx,          // our context
+    atomic_int *pdone,       // set when the wait is over
+    int       efd)           // our eventfd, or -1 for the event loop
+{
+    struct pollfd pfd;       // the done ring's eventfd
+    uint64_t  cnt;           // eventfd counter
+
+    // Acquire pairs with the release in sync_done() so the response
+    // is seen once done is.
+    while (atomic_load_explicit(pdone, memory_order_acquire) == 0) {
+        if (efd >= 0) {
+            (void) read(efd, &cnt, sizeof(cnt));
+            continue;
+        }
+        pfd.fd = pctx->prt->donefd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, -1) > 0) {
+            (void) read(pctx->prt->donefd, &cnt, sizeof(cnt));
+        }
+        rtio_drain(pctx);
+    }
+}
+
+
+/***************************************************************************
+ * rtio_done(): - Complete a transaction from the I/O thread.  The
+ * callback is run by the event loop except for a thread waiting in
+ * sendrecv_pkt() or sendrecv_batch(), which is woken directly.
+ ***************************************************************************/
+static void rtio_done(
+    SERPORT  *pctx,          // our context
+    void    (*done_cb)(),    // the completion callback
+    void     *trans,         // transparently pass this to done_cb
+    int       ret,           // response count or error code
+    uint8_t  *rsp)           // the response
+{
+    uint64_t  one = 1;       // eventfd increment
+    int       efd;           // the waiting thread's eventfd
+
+    if (pctx->rtio == 0) {
+        (done_cb) (trans, ret, rsp);
+        return;
+    }
+    if ((done_cb == sync_done) && (((SYNCXFER *) trans)->efd >= 0)) {
+        // The waiter may return as soon as done is set
+        efd = ((SYNCXFER *) trans)->efd;
+        sync_done(trans, ret, rsp);
+        (void) write(efd, &one, sizeof(one));
+        return;
+    }
+    rtio_post(pctx, RT_DONE, ret, rsp, done_cb, trans);
+}
+
+
+/***************************************************************************
+ * rtio_post(): - Put a completion, frame, or received bytes on the done
+ * ring for the event loop.  The event loop is woken at the end of the
+ * I/O thread's turn.  If the ring is full the I/O thread sleeps until
+ * the event loop makes room.  If the event loop is stopping the thread
+ * instead the message goes on the spill list, which the event loop
+ * runs after the thread exits.
+ ***************************************************************************/
+static void rtio_post(
+    SERPORT  *pctx,          // our context
+    int       op,            // RT_DONE, RT_FRAME, or RT_RAWIN
+    int       count,         // response count, or bytes in data
+    uint8_t  *data,          // the response, frame, or bytes
+    void    (*done_cb)(),    // the completion callback
+    void     *trans)         // transparently pass this to done_cb
+{
+    RTIO     *prt = pctx->prt;
+    RTRING   *pr = &(prt->done);
+    RTMSG    *pm;            // the slot in the ring
+    unsigned int head;       // the ring's head
+    uint64_t  one = 1;       // eventfd increment
+
+    head = atomic_load_explicit(&(pr->head), memory_order_relaxed);
+    if ((prt->nspill == 0) &&
+        ((head - atomic_load_explicit(&(pr->tail), memory_order_acquire)) ==
+         pr->nmsg)) {
+        // dfull and tail are sequentially consistent so either we see
+        // the event loop's new tail or it sees dfull and signals us.
+        (void) write(prt->donefd, &one, sizeof(one));
+        (void) pthread_mutex_lock(&(prt->dlock));
+        atomic_store(&(prt->dfull), 1);
+        while (((head - atomic_load(&(pr->tail))) == pr->nmsg) &&
+               (atomic_load(&(prt->stop)) == 0)) {
+            (void) pthread_cond_wait(&(prt->dcond), &(prt->dlock));
+        }
+        atomic_store(&(prt->dfull), 0);
+        (void) pthread_mutex_unlock(&(prt->dlock));
+        // The FPGA was not the one waiting.  Time the oldest
+        // transaction again from now.
+        pctx->xdue = 0;
+    }
+    if ((prt->nspill != 0) ||
+        ((head - atomic_load_explicit(&(pr->tail), memory_order_acquire)) ==
+         pr->nmsg)) {
+        if (prt->nspill == prt->mxspill) {
+            pm = (RTMSG *) realloc(prt->spill, ((prt->mxspill + HBA_RT_NDONE) *
+                                                sizeof(RTMSG)));
+            if (pm == (RTMSG *) 0) {
+                edlog("%s: lost an I/O thread message on stop", PLUGIN_NAME);
+                return;
+            }
+            prt->spill = pm;
+            prt->mxspill += HBA_RT_NDONE;
+        }
+        pm = &(prt->spill[prt->nspill]);
+        prt->nspill++;
+        pm->op = op;
+        pm->count = count;
+        pm->nbatch = 0;
+        pm->done_cb = done_cb;
+        pm->trans = trans;
+        if (count > 0) {
+            (void) memcpy(pm->pkt, data, count);
+        }
+        return;
+    }
+    pm = &(pr->msg[head % pr->nmsg]);
+    pm->op = op;
+    pm->count = count;
+    pm->nbatch = 0;
+    pm->done_cb = done_cb;
+    pm->trans = trans;
+    if (count > 0) {
+        (void) memcpy(pm->pkt, data, count);
+    }
+    atomic_store_explicit(&(pr->head), (head + 1), memory_order_release);
+    prt->nwake++;
+}
+
+
+/***************************************************************************
+ * rtio_events(): - The I/O thread has put callbacks on the done ring
+ ***************************************************************************/
+static void rtio_events(
+    int       fd_in,         // the done ring's eventfd
+    void     *cb_data)       // our context (==*SERPORT)
+{
+    SERPORT  *pctx = (SERPORT *) cb_data;
+    uint64_t  cnt;           // eventfd counter
+
+    (void) read(fd_in, &cnt, sizeof(cnt));
+    rtio_drain(pctx);
+}
+
+
+/***************************************************************************
+ * rtio_drain(): - Run the callbacks, telemetry handlers, and rawin
+ * broadcasts on the done ring in the order the I/O thread put them
+ * there.  Each is taken off the ring first since a callback may wait
+ * for more.  Once the thread has stopped the spill list follows the
+ * ring.
+ ***************************************************************************/
+static void rtio_drain(
+    SERPORT  *pctx)          // our context
+{
+    RTRING   *pr = &(pctx->prt->done);
+    RTMSG    *pm;            // the slot in the ring
+    RTMSG     msg;           // copy of the slot
+    unsigned int tail;       // the ring's tail
+
+    while (1) {
+        tail = atomic_load_explicit(&(pr->tail), memory_order_relaxed);
+        if (atomic_load_explicit(&(pr->head), memory_order_acquire) == tail) {
+            break;
         }
+        pm = &(pr->msg[tail % pr->nmsg]);
+        msg.op = pm->op;
+        msg.count = pm->count;
+        msg.done_cb = pm->done_cb;
+        msg.trans = pm->trans;
+        if (msg.count > 0) {
+            (void) memcpy(msg.pkt, pm->pkt, msg.count);
+        }
+        atomic_store(&(pr->tail), (tail + 1));
+        rtio_room(pctx->prt);
+        rtio_msg(pctx, &msg);
+    }
+    while ((pctx->rtio == 0) && (pctx->prt->nspill != 0)) {
+        msg = pctx->prt->spill[0];
+        pctx->prt->nspill--;
+        (void) memmove(pctx->prt->spill, &(pctx->prt->spill[1]),
+                       (pctx->prt->nspill * sizeof(RTMSG)));
+        rtio_msg(pctx, &msg);
+    }
+}
+
+
+/***************************************************************************
+ * rtio_msg(): - Run a callback, telemetry handler, or rawin broadcast
+ * taken off the done ring.
+ ***************************************************************************/
+static void rtio_msg(
+    SERPORT  *pctx,          // our context
+    RTMSG    *pm)            // the message
+{
+    if (pm->op == RT_DONE) {
+        (pm->done_cb) (pm->trans, pm->count, pm->pkt);
+    }
+    else if (pm->op == RT_FRAME) {
+        tm_dispatch(pctx, pm->pkt, pm->count);
+    }
+    else if (pm->op == RT_RAWIN) {
+        rawin_bcst(pctx, pm->pkt, pm->count);
+    }
+}
+
+
+/***************************************************************************
+ * rtio_room(): - Wake the I/O thread if it is waiting for room on the
+ * done ring.  Called after the tail moves.
+ ***************************************************************************/
+static void rtio_room(
+    RTIO     *prt)           // the I/O thread
+{
+    if (atomic_load(&(prt->dfull)) != 0) {
+        (void) pthread_mutex_lock(&(prt->dlock));
+        (void) pthread_cond_signal(&(prt->dcond));
+        (void) pthread_mutex_unlock(&(prt->dlock));
     }
 }
 
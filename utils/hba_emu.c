@@ -0,0 +1,912 @@
+/* hba_emu.c  :  A software model of the FPGA on a pseudo-terminal.
+ * It speaks the serial_fpga protocol so the plug-ins, hbaserver, and
+ * the apps can be run and tested without the board.
+ *
+ * The model has:
+ *   serial_fpga : dummy and nodummy modes, the extended command, the
+ *                 interrupt pending and rate registers, telemetry and
+ *                 snapshot frames, baud rate changes with the 100 ms
+ *                 confirm, and resync on a break
+ *   hba_basicio : leds, buttons, and the button change interrupt
+ *   hba_qtr     : two sensors with the period and threshold interrupts
+ *   hba_motor   : two motors whose duty cycle turns the encoders,
+ *                 and the reg0[7] hold of the mode until reg2
+ *   hba_sonar   : two sonars sampled every 100 ms
+ *   hba_quad    : two encoders, speed, period, reset, the latches
+ *                 on a read of reg1 and reg8, and the sample FIFO
+ *   hba_gpio    : four pins with pin 2 looped back to pin 0 and pin 3
+ *                 looped back to pin 1, as hba_bench expects
+ *
+ * Each byte takes the time it would at the link's baud rate.  Bytes
+ * are garbled while the host's rate does not match the link's rate or
+ * the link is above the -m rate.  The host's tcflush() of its input at
+ * the end of a break is seen through the pty's packet mode and resyncs
+ * the model the way a break resyncs the FPGA.
+ *
+ * io_intr is a FIFO.  A '1' is written to it when the line goes high
+ * and a '0' when it goes low.  Point serial_fpga at it with:
+ *   hbaset serial_fpga port /tmp/hba_fpga
+ *   hbaset serial_fpga intrr_pin /tmp/hba_intr
+ *
+ * Lines on stdin set what the sensors see and peek and poke registers:
+ *   b val          set the buttons
+ *   q val0 val1    set what the two QTR sensors read
+ *   s val0 val1    set the distance the two sonars read
+ *   g val          set the levels of gpio input pins not looped back
+ *   r core reg     print a register
+ *   w core reg val write a register
+ *   i core         raise the interrupt of a core
+ *   x              print the command, frame, and break counts
+ * Values are decimal or 0x hex.
+ *
+ * Usage: hba_emu [-b baud] [-m maxbaud] [-l link] [-i fifo] [-N] [-f] [-v]
+ *   -b : starting baud rate (115200)
+ *   -m : highest rate that works.  Above it bytes are garbled (none)
+ *   -l : symlink to make to the pty (/tmp/hba_fpga)
+ *   -i : path of the interrupt FIFO (/tmp/hba_intr)
+ *   -N : NACK writes to cores the model does not have.  The FPGA
+ *        ACKs all writes.  This is to test the host's NACK handling.
+ *   -f : do not wait the byte time of each byte
+ *   -v : print each command
+ *
+ * Build with: gcc -O2 -o hba_emu hba_emu.c -lpthread
+ */
+
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <asm/termbits.h>        // termios2 for any baud rate
+
+        // Bus size
+#define NCORE        (16)
+#define NREG         (256)
+        // Core numbers.  These match hba.h
+#define CORE_SERIAL  (0)
+#define CORE_BASICIO (1)
+#define CORE_QTR     (2)
+#define CORE_MOTOR   (3)
+#define CORE_SONAR   (4)
+#define CORE_QUAD    (5)
+#define CORE_GPIO    (6)
+#define NMODEL       (7)        // cores 0 to 6 are modeled
+        // serial_fpga registers and characters
+#define SF_INTR0     (0)
+#define SF_INTR1     (1)
+#define SF_RATE      (2)
+#define SF_CTRL      (3)
+#define SF_TM_RATE   (4)
+#define SF_TM_NPAIRS (5)
+#define SF_SNAP      (6)
+#define SF_TM_PAIR0  (8)
+#define SF_BAUD0     (16)
+#define SF_BAUD3     (19)
+#define SF_CTRL_NODUMMY (0x01)
+#define SF_SNAP_ENABLE  (0x01)
+#define EXT_CMD      (0x7F)
+#define ACK_CHAR     (0xAC)
+#define NACK_CHAR    (0x56)
+#define TM_SYNC      (0x5A)
+#define TM_MXPAIR    (4)
+#define TM_MXCOUNT   (8)
+#define SNAP_PENDCC  (0x20)
+#define BAUD_TRIAL_MS (100)
+        // Return values of rb() other than a char
+#define RB_NONE      (-1)       // no char within the timeout
+#define RB_ABORT     (-2)       // break or baud revert, drop the command
+        // Defaults
+#define DEF_BAUD     (115200)
+#define DEF_LINK     "/tmp/hba_fpga"
+#define DEF_FIFO     "/tmp/hba_intr"
+        // Encoder counts per second at a duty cycle of 100
+#define ENC_RATE     (1000)
+#define QUAD_CLK     (50000000) // hba_clk counted by the quad periods
+#define QUAD_PMAX    (0xffffff) // period of a stopped encoder
+#define QFIFO_DEPTH  (128)      // samples in the quad sample FIFO
+#define QFIFO_LEN    (6)        // bytes in a sample
+        // Sonar sample period in ms
+#define SONAR_MS     (100)
+#define MXLINE       (200)
+
+static uint8_t  Regs[NCORE][NREG];
+static pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+static int      Mfd = -1;       // pty master
+static int      Irfd = -1;      // io_intr FIFO
+static int      Verbose = 0;
+static int      Pace = 1;       // ==1 to wait the byte time of each byte
+static int      Nack = 0;       // ==1 to NACK writes to unmodeled cores
+static uint32_t Baud = DEF_BAUD;   // rate of the link
+static uint32_t Baudprev;       // rate to go back to if not confirmed
+static uint32_t Maxbaud = 0;    // highest rate that works (0=any)
+static int      Trial = 0;      // ==1 while waiting for a rate confirm
+static uint64_t Trialns;        // when the trial started
+static uint64_t Rxnext, Txnext; // when the uart is done with a byte
+static uint8_t  Inbuf[4096];    // chars read from the pty
+static int      Inidx, Inlen;
+static int      Ioint = 0;      // level of io_intr
+static int      Snapdue = 0;    // ==1 to send a snapshot frame
+static int      Tmdue = 0;      // ==1 to send a telemetry frame
+static long     Ncmd, Nframe, Nbreak;
+
+    // What the sensors see, and the peripherals' internal state
+static uint8_t  Buttons;
+static uint8_t  Qtrsee[2] = { 40, 40 };
+static uint8_t  Sonsee[2] = { 100, 100 };
+static uint8_t  Gpioin = 0x0f;  // levels of inputs not looped back
+static uint8_t  Gpioout;        // levels driven on output pins
+static int32_t  Enc[2];         // encoder counts
+static int      Encacc[2];      // fractional counts
+static int32_t  Spdbase[2];     // counts at the start of a speed period
+static uint8_t  Qlive[15];      // quad reg1 to reg14 before the latches
+static uint8_t  Mact[3];        // motor reg0 to reg2 driving the motors
+static int      Mhold;          // ==1 while reg0 waits for reg2
+static uint8_t  Qfifo[QFIFO_DEPTH][QFIFO_LEN];  // quad sample FIFO
+static int      Qhead, Qcount;  // oldest sample and number of samples
+static int      Qbyte;          // next byte of the oldest sample
+static int      Qmark;          // ==1 while at or above the watermark
+static int      Qtrside[2];     // side of the threshold of each QTR
+
+
+/* now_ns() : Return the CLOCK_MONOTONIC time in ns */
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+
+/* sleep_until() : Sleep to a CLOCK_MONOTONIC time in ns */
+static void sleep_until(uint64_t t)
+{
+    struct timespec ts;
+
+    ts.tv_sec = t / 1000000000ULL;
+    ts.tv_nsec = t % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+
+/* linebad() : Return 1 if chars are garbled at the current rates.
+ * The pty master has the termios of the host's side.  UARTs work
+ * with rates up to about 2% apart.
+ */
+static int linebad(void)
+{
+    struct termios2 t;
+    int64_t  diff;
+
+    if ((Maxbaud != 0) && (Baud > Maxbaud))
+        return(1);
+    if (ioctl(Mfd, TCGETS2, &t) < 0)
+        return(0);
+    diff = (int64_t) t.c_ospeed - (int64_t) Baud;
+    if (diff < 0)
+        diff = -diff;
+    return((diff * 50) > Baud);
+}
+
+
+/* set_intr() : Drive io_intr.  Lock must be held. */
+static void set_intr(int level)
+{
+    if (level == Ioint)
+        return;
+    Ioint = level;
+    if (Irfd >= 0)
+        (void) write(Irfd, level ? "1" : "0", 1);
+}
+
+
+/* intr() : Set the interrupt pending bit of a core.  Lock must be held. */
+static void intr(int core)
+{
+    if (core < 8)
+        Regs[CORE_SERIAL][SF_INTR0] |= (1 << core);
+    else
+        Regs[CORE_SERIAL][SF_INTR1] |= (1 << (core - 8));
+}
+
+
+/* gpio_update() : Compute the pin levels and raise an interrupt if an
+ * enabled input pin changed.  Lock must be held.
+ */
+static void gpio_update(void)
+{
+    uint8_t  dir = Regs[CORE_GPIO][0] & 0x0f;
+    uint8_t  in = Gpioin;
+    uint8_t  pins;
+    uint8_t  old = Regs[CORE_GPIO][1];
+
+    // pin 2 drives pin 0 and pin 3 drives pin 1 when they are outputs
+    if (dir & 0x04)
+        in = (in & ~0x01) | ((Gpioout >> 2) & 0x01);
+    if (dir & 0x08)
+        in = (in & ~0x02) | ((Gpioout >> 2) & 0x02);
+    pins = ((Gpioout & dir) | (in & ~dir)) & 0x0f;
+    Regs[CORE_GPIO][1] = pins;
+    if ((old ^ pins) & ~dir & Regs[CORE_GPIO][2] & 0x0f)
+        intr(CORE_GPIO);
+}
+
+
+/* rdreg() : Read a register as the bus would.  The interrupt pending
+ * registers clear on read and a read of reg19 confirms a new rate.
+ * A read of quad reg1 latches the counts and speeds and a read of
+ * reg8 the periods.  Lock must be held.
+ */
+static uint8_t rdreg(int core, int reg)
+{
+    uint8_t  val;
+
+    if (core >= NMODEL)
+        return(0);
+    val = Regs[core][reg];
+    if ((core == CORE_SERIAL) && ((reg == SF_INTR0) || (reg == SF_INTR1))) {
+        Regs[core][reg] = 0;
+        if (Ioint && ((Regs[core][SF_INTR0] | Regs[core][SF_INTR1]) == 0))
+            set_intr(0);
+    }
+    if ((core == CORE_SERIAL) && (reg == SF_BAUD3))
+        Trial = 0;
+    if ((core == CORE_QUAD) && (reg == 1)) {
+        memcpy(&Regs[core][1], &Qlive[1], 6);
+        val = Regs[core][1];
+    }
+    if ((core == CORE_QUAD) && (reg == 8)) {
+        memcpy(&Regs[core][8], &Qlive[8], 7);
+        val = Regs[core][8];
+    }
+    if ((core == CORE_QUAD) && (reg == 16))
+        val = Qcount;
+    if ((core == CORE_QUAD) && (reg >= 32)) {
+        val = 0;
+        if (Qcount > 0) {
+            val = Qfifo[Qhead][Qbyte];
+            if (++Qbyte == QFIFO_LEN) {
+                Qbyte = 0;
+                Qhead = (Qhead + 1) % QFIFO_DEPTH;
+                Qcount--;
+            }
+        }
+    }
+    return(val);
+}
+
+
+/* wrreg() : Write a register and do what the core does with it.
+ * Registers that are inputs to the bus are not written.  Lock must
+ * be held.
+ */
+static void wrreg(int core, int reg, uint8_t val)
+{
+    if (core >= NMODEL)
+        return;
+    switch (core) {
+        case CORE_SERIAL:
+            if ((reg == SF_INTR0) || (reg == SF_INTR1))
+                return;
+            break;
+        case CORE_BASICIO:
+            if (reg == 1)
+                return;
+            if ((reg == 0) && Verbose)
+                printf("leds 0x%02x\n", val);
+            break;
+        case CORE_QTR:
+            if ((reg == 1) || (reg == 2))
+                return;
+            break;
+        case CORE_MOTOR:
+            // A write of reg0 with the hold bit waits for reg2 so a
+            // burst changes the mode and both powers together
+            Regs[core][reg] = val;
+            if (reg == 0)
+                Mhold = (val & 0x80) != 0;
+            else if (reg == 2)
+                Mhold = 0;
+            if (!Mhold)
+                memcpy(Mact, Regs[core], 3);
+            return;
+        case CORE_SONAR:
+            if ((reg == 1) || (reg == 2))
+                return;
+            break;
+        case CORE_QUAD:
+            if (((reg >= 1) && (reg <= 6)) || ((reg >= 8) && (reg <= 14)) ||
+                (reg == 16) || (reg >= 32))
+                return;
+            if (reg == 18)
+                val = 0;
+            if ((reg == 0) && (val & 0x08) && !(Regs[core][0] & 0x08)) {
+                Enc[0] = Enc[1] = 0;
+                Spdbase[0] = Spdbase[1] = 0;
+                memset(&Qlive[1], 0, 4);
+            }
+            break;
+        case CORE_GPIO:
+            if (reg == 1) {
+                Gpioout = val & 0x0f;
+                gpio_update();
+                return;
+            }
+            Regs[core][reg] = val;
+            gpio_update();
+            return;
+    }
+    Regs[core][reg] = val;
+}
+
+
+/* rb() : Get a char from the host.  Wait up to tmo ms, or forever
+ * if tmo is negative.  Return the char, RB_NONE on a timeout, or
+ * RB_ABORT if the host sent a break or an unconfirmed rate change
+ * ran out.  Either abort drops the received chars.
+ */
+static int rb(int tmo)
+{
+    struct pollfd pfd;
+    uint8_t  c;
+    uint64_t start = now_ns();
+    uint64_t bytens;
+    int      ret;
+
+    while (Inidx >= Inlen) {
+        pthread_mutex_lock(&Lock);
+        if (Trial && ((now_ns() - Trialns) > (BAUD_TRIAL_MS * 1000000ULL))) {
+            if (Verbose)
+                printf("no confirm of %u, back to %u\n", Baud, Baudprev);
+            Baud = Baudprev;
+            Trial = 0;
+            pthread_mutex_unlock(&Lock);
+            Inidx = Inlen = 0;
+            return(RB_ABORT);
+        }
+        pthread_mutex_unlock(&Lock);
+        if ((tmo >= 0) && ((now_ns() - start) >= (tmo * 1000000ULL)))
+            return(RB_NONE);
+
+        pfd.fd = Mfd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 1) <= 0)
+            continue;
+        ret = read(Mfd, Inbuf, sizeof(Inbuf));
+        if (ret <= 0) {
+            usleep(1000);          // host closed the pty
+            continue;
+        }
+        // In packet mode the first byte is 0 for data or has the
+        // flags of a flush of the host side
+        if (Inbuf[0] != TIOCPKT_DATA) {
+            if (Inbuf[0] & TIOCPKT_FLUSHREAD) {
+                Nbreak++;
+                if (Verbose)
+                    printf("break\n");
+                Inidx = Inlen = 0;
+                return(RB_ABORT);
+            }
+            continue;
+        }
+        Inidx = 1;
+        Inlen = ret;
+        if (Rxnext < now_ns())
+            Rxnext = now_ns();
+    }
+    c = Inbuf[Inidx++];
+
+    // The char is not in the FPGA until the uart has all of it
+    if (Pace) {
+        bytens = 10000000000ULL / Baud;
+        Rxnext += bytens;
+        sleep_until(Rxnext);
+    }
+    if (linebad())
+        c ^= 0x55;
+    return(c);
+}
+
+
+/* wb() : Send a char to the host.  Chars the host is not reading are
+ * dropped the way they would be on the wire.
+ */
+static void wb(uint8_t c)
+{
+    uint64_t now;
+
+    if (Pace) {
+        now = now_ns();
+        if (Txnext < now)
+            Txnext = now;
+        Txnext += 10000000000ULL / Baud;
+        sleep_until(Txnext);
+    }
+    if (linebad())
+        c ^= 0x33;
+    (void) write(Mfd, &c, 1);
+}
+
+
+/* send_frame() : Send a telemetry frame, or a snapshot frame of the
+ * pending registers and the pairs of the interrupting cores.
+ */
+static void send_frame(int snap)
+{
+    uint8_t  frame[2 + 4 + (TM_MXPAIR * (2 + TM_MXCOUNT))];
+    int      len = 2;
+    int      npairs;
+    int      pend = 0xffff;
+    int      cc, core, count, reg;
+    int      i, j;
+
+    pthread_mutex_lock(&Lock);
+    npairs = Regs[CORE_SERIAL][SF_TM_NPAIRS];
+    npairs = (npairs > TM_MXPAIR) ? TM_MXPAIR : npairs;
+    if (snap) {
+        frame[len++] = SNAP_PENDCC;
+        frame[len++] = SF_INTR0;
+        frame[len++] = rdreg(CORE_SERIAL, SF_INTR0);
+        frame[len++] = rdreg(CORE_SERIAL, SF_INTR1);
+        pend = frame[4] | (frame[5] << 8);
+        Snapdue = 0;
+    }
+    else
+        Tmdue = 0;
+    for (i = 0; i < npairs; i++) {
+        cc = Regs[CORE_SERIAL][SF_TM_PAIR0 + (2 * i)];
+        reg = Regs[CORE_SERIAL][SF_TM_PAIR0 + (2 * i) + 1];
+        core = cc & 0x0f;
+        count = cc >> 4;
+        count = (count > TM_MXCOUNT) ? TM_MXCOUNT : count;
+        // A pair with a count of 0 still sends its header
+        if ((pend & (1 << core)) == 0)
+            continue;
+        frame[len++] = (count << 4) | core;
+        frame[len++] = reg;
+        for (j = 0; j < count; j++)
+            frame[len++] = rdreg(core, (reg + j) & 0xff);
+    }
+    pthread_mutex_unlock(&Lock);
+    frame[0] = TM_SYNC;
+    frame[1] = len - 2;
+    for (i = 0; i < len; i++)
+        wb(frame[i]);
+    Nframe++;
+}
+
+
+/* do_command() : Carry out one command from the host.  The nodummy
+ * bit is latched at the start of the command.  Returns at once on
+ * an abort.
+ */
+static void do_command(int cmd)
+{
+    int      nodummy;
+    int      ext = ((cmd & 0x7f) == EXT_CMD);
+    int      core, reg, len;
+    int      hdr[4], nhdr = 0;
+    int      baudwr = 0;
+    int      c, i;
+    uint8_t  val;
+
+    pthread_mutex_lock(&Lock);
+    nodummy = Regs[CORE_SERIAL][SF_CTRL] & SF_CTRL_NODUMMY;
+    pthread_mutex_unlock(&Lock);
+
+    hdr[nhdr++] = cmd;
+    for (i = 0; i < (ext ? 3 : 1); i++) {
+        if ((c = rb(-1)) < 0)
+            return;
+        hdr[nhdr++] = c;
+    }
+    if (ext) {
+        core = hdr[1] & 0x0f;
+        reg = hdr[2];
+        len = hdr[3];
+    }
+    else {
+        core = cmd & 0x0f;
+        reg = hdr[1];
+        len = ((cmd >> 4) & 0x07) + 1;
+    }
+    Ncmd++;
+    if (Verbose)
+        printf("%s core %d reg %d len %d\n", (cmd & 0x80) ? "read" : "write",
+               core, reg, len);
+
+    if (cmd & 0x80) {
+        // echo the header then send the registers
+        for (i = 0; i < nhdr; i++) {
+            wb(hdr[i]);
+            if (!nodummy && (rb(-1) < 0))
+                return;
+        }
+        for (i = 0; i < len; i++) {
+            pthread_mutex_lock(&Lock);
+            val = rdreg(core, (reg + i) & 0xff);
+            pthread_mutex_unlock(&Lock);
+            wb(val);
+            if (!nodummy && (rb(-1) < 0))
+                return;
+        }
+        return;
+    }
+
+    for (i = 0; i < len; i++) {
+        if ((c = rb(-1)) < 0)
+            return;
+        pthread_mutex_lock(&Lock);
+        wrreg(core, (reg + i) & 0xff, c);
+        pthread_mutex_unlock(&Lock);
+        if ((core == CORE_SERIAL) && (((reg + i) & 0xff) == SF_BAUD3))
+            baudwr = 1;
+    }
+    wb((Nack && (core >= NMODEL)) ? NACK_CHAR : ACK_CHAR);
+    if (!nodummy && (rb(-1) < 0))
+        return;
+
+    // The new rate is used once the ACK is out
+    if (baudwr) {
+        uint32_t nbaud;
+
+        pthread_mutex_lock(&Lock);
+        nbaud = Regs[CORE_SERIAL][SF_BAUD0] |
+                (Regs[CORE_SERIAL][SF_BAUD0 + 1] << 8) |
+                (Regs[CORE_SERIAL][SF_BAUD0 + 2] << 16) |
+                ((uint32_t) Regs[CORE_SERIAL][SF_BAUD3] << 24);
+        if (nbaud != 0) {
+            if (Pace)
+                sleep_until(Txnext);
+            Baudprev = Baud;
+            Baud = nbaud;
+            Trial = 1;
+            Trialns = now_ns();
+            if (Verbose)
+                printf("baud %u\n", Baud);
+        }
+        pthread_mutex_unlock(&Lock);
+    }
+}
+
+
+/* serial_loop() : The serial_fpga bridge.  Frames go out only between
+ * commands and only when no char from the host is waiting.
+ */
+static void *serial_loop(void *arg)
+{
+    int      c;
+    int      snap, tm;
+
+    (void) arg;
+    for (;;) {
+        pthread_mutex_lock(&Lock);
+        snap = Snapdue;
+        tm = Tmdue;
+        pthread_mutex_unlock(&Lock);
+        if ((snap || tm) && (Inidx >= Inlen)) {
+            send_frame(snap);
+            continue;
+        }
+        c = rb(1);
+        if (c >= 0)
+            do_command(c);
+    }
+    return((void *) 0);
+}
+
+
+/* tick() : Advance the peripherals and the interrupt logic by 1 ms.
+ * Lock must be held.
+ */
+static void tick(uint64_t ms)
+{
+    static int intrms, tmms;
+    uint8_t  mode = Mact[0];
+    uint8_t  qctrl = Regs[CORE_QTR][0];
+    uint8_t  rate;
+    int      period;
+    int      side, changed;
+    int      pend;
+    int      i, en;
+
+    // basicio: a change of the buttons
+    if ((Buttons != Regs[CORE_BASICIO][1])) {
+        Regs[CORE_BASICIO][1] = Buttons;
+        if (Regs[CORE_BASICIO][2] & 0x01)
+            intr(CORE_BASICIO);
+    }
+
+    // motor and quad: an active motor turns its encoder
+    changed = 0;
+    for (i = 0; i < 2; i++) {
+        int      duty = Mact[1 + i];
+
+        duty = (duty > 100) ? 100 : duty;
+        if (!(mode & (1 << i)) || (mode & (0x10 << i)))
+            duty = 0;
+        Encacc[i] += duty * ENC_RATE;
+        if (Regs[CORE_QUAD][0] & (1 << i)) {
+            // duty * ENC_RATE / 100 ticks per second
+            uint32_t p = (duty == 0) ? QUAD_PMAX :
+                         (uint32_t) ((QUAD_CLK * 100ULL) / (duty * ENC_RATE));
+
+            Qlive[8 + (3 * i)] = p & 0xff;
+            Qlive[9 + (3 * i)] = (p >> 8) & 0xff;
+            Qlive[10 + (3 * i)] = (p >> 16) & 0xff;
+            if (mode & (0x04 << i))
+                Qlive[14] |= (1 << i);
+            else if (duty != 0)
+                Qlive[14] &= ~(1 << i);
+        }
+        while (Encacc[i] >= 100000) {
+            Encacc[i] -= 100000;
+            Enc[i] += (mode & (0x04 << i)) ? -1 : 1;
+            changed = 1;
+            if (Regs[CORE_QUAD][0] & (1 << i)) {
+                Qlive[1 + (2 * i)] = Enc[i] & 0xff;
+                Qlive[2 + (2 * i)] = (Enc[i] >> 8) & 0xff;
+            }
+        }
+    }
+    if (changed && (Regs[CORE_QUAD][0] & 0x04))
+        intr(CORE_QUAD);
+    rate = Regs[CORE_QUAD][7];
+    if ((rate != 0) && ((ms % rate) == 0)) {
+        // The speed is signed and wraps at 8 bits like the RTL counter
+        for (i = 0; i < 2; i++) {
+            Qlive[5 + i] = (Enc[i] - Spdbase[i]) & 0xff;
+            Spdbase[i] = Enc[i];
+        }
+    }
+
+    // quad: a FIFO sample every reg15 ms, interrupt at the watermark
+    rate = Regs[CORE_QUAD][15];
+    if ((rate != 0) && ((ms % rate) == 0)) {
+        if (Qcount == QFIFO_DEPTH) {
+            if (Regs[CORE_QUAD][18] != 0xff)
+                Regs[CORE_QUAD][18]++;
+        }
+        else {
+            uint8_t *smp = Qfifo[(Qhead + Qcount) % QFIFO_DEPTH];
+
+            smp[0] = ms & 0xff;
+            smp[1] = (ms >> 8) & 0xff;
+            for (i = 0; i < 2; i++) {
+                smp[2 + (2 * i)] = Enc[i] & 0xff;
+                smp[3 + (2 * i)] = (Enc[i] >> 8) & 0xff;
+            }
+            Qcount++;
+        }
+    }
+    en = (Regs[CORE_QUAD][17] != 0) && (Qcount >= Regs[CORE_QUAD][17]);
+    if (en && !Qmark)
+        intr(CORE_QUAD);
+    Qmark = en;
+
+    // qtr: a sample every period, interrupt on each or on a crossing
+    period = (Regs[CORE_QTR][3] + 1) * 50;
+    if ((qctrl & 0x01) && ((ms % period) == 0)) {
+        Regs[CORE_QTR][1] = Qtrsee[0];
+        Regs[CORE_QTR][2] = Qtrsee[1];
+        side = 0;
+        for (i = 0; i < 2; i++) {
+            int s = (Qtrsee[i] > Regs[CORE_QTR][4]);
+
+            side |= (s != Qtrside[i]);
+            Qtrside[i] = s;
+        }
+        if ((qctrl & 0x02) && (!(qctrl & 0x04) || side))
+            intr(CORE_QTR);
+        if ((qctrl & 0x0c) == 0x0c && ((Qtrsee[0] == 0xff) || (Qtrsee[1] == 0xff))) {
+            Regs[CORE_MOTOR][0] &= ~0x03;     // estop brakes the motors
+            if (!Mhold)
+                Mact[0] = Regs[CORE_MOTOR][0];
+        }
+    }
+
+    // sonar: enabled sonars are sampled every SONAR_MS
+    if ((Regs[CORE_SONAR][0] & 0x03) && ((ms % SONAR_MS) == 0)) {
+        for (i = 0; i < 2; i++) {
+            if (Regs[CORE_SONAR][0] & (1 << i))
+                Regs[CORE_SONAR][1 + i] = Sonsee[i];
+        }
+        intr(CORE_SONAR);
+    }
+
+    gpio_update();
+
+    // serial_fpga: io_intr is checked every rate ms and frames are due
+    // every telemetry rate ms
+    en = 0;
+    if (++intrms >= Regs[CORE_SERIAL][SF_RATE]) {
+        intrms = 0;
+        en = 1;
+    }
+    pend = Regs[CORE_SERIAL][SF_INTR0] | Regs[CORE_SERIAL][SF_INTR1];
+    if (Regs[CORE_SERIAL][SF_SNAP] & SF_SNAP_ENABLE) {
+        set_intr(0);
+        if (en && pend)
+            Snapdue = 1;
+    }
+    else {
+        Snapdue = 0;
+        if (Ioint || en)
+            set_intr(pend != 0);
+    }
+    if ((Regs[CORE_SERIAL][SF_TM_RATE] == 0) ||
+        (Regs[CORE_SERIAL][SF_TM_NPAIRS] == 0)) {
+        tmms = 0;
+        Tmdue = 0;
+    }
+    else if (++tmms >= Regs[CORE_SERIAL][SF_TM_RATE]) {
+        tmms = 0;
+        Tmdue = 1;
+    }
+}
+
+
+/* sim_loop() : Run tick() once a ms */
+static void *sim_loop(void *arg)
+{
+    uint64_t next = now_ns();
+    uint64_t ms = 0;
+
+    (void) arg;
+    for (;;) {
+        next += 1000000;
+        sleep_until(next);
+        pthread_mutex_lock(&Lock);
+        tick(++ms);
+        pthread_mutex_unlock(&Lock);
+    }
+    return((void *) 0);
+}
+
+
+/* console() : Carry out the commands on stdin */
+static void console(void)
+{
+    char     line[MXLINE];
+    char     cmd;
+    unsigned a, b, c;
+    int      n;
+
+    while (fgets(line, MXLINE, stdin) != NULL) {
+        n = sscanf(line, " %c %i %i %i", &cmd, &a, &b, &c);
+        if (n < 1)
+            continue;
+        pthread_mutex_lock(&Lock);
+        if ((cmd == 'b') && (n == 2))
+            Buttons = a;
+        else if ((cmd == 'q') && (n == 3)) {
+            Qtrsee[0] = a;
+            Qtrsee[1] = b;
+        }
+        else if ((cmd == 's') && (n == 3)) {
+            Sonsee[0] = a;
+            Sonsee[1] = b;
+        }
+        else if ((cmd == 'g') && (n == 2))
+            Gpioin = a & 0x0f;
+        else if ((cmd == 'r') && (n == 3) && (a < NCORE) && (b < NREG))
+            printf("core %u reg %u = 0x%02x\n", a, b, Regs[a][b]);
+        else if ((cmd == 'w') && (n == 4) && (a < NCORE) && (b < NREG))
+            wrreg(a, b, c);
+        else if ((cmd == 'i') && (n == 2) && (a < NCORE))
+            intr(a);
+        else if (cmd == 'x')
+            printf("%ld commands, %ld frames, %ld breaks at %u baud\n",
+                   Ncmd, Nframe, Nbreak, Baud);
+        else
+            printf("?\n");
+        pthread_mutex_unlock(&Lock);
+        fflush(stdout);
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    char    *link = DEF_LINK;
+    char    *fifo = DEF_FIFO;
+    struct termios2 t;
+    pthread_t thr;
+    char    *pts;
+    int      sfd;
+    int      one = 1;
+    int      opt;
+
+    while ((opt = getopt(argc, argv, "b:m:l:i:Nfv")) != -1) {
+        switch (opt) {
+            case 'b':
+                Baud = strtoul(optarg, NULL, 0);
+                break;
+            case 'm':
+                Maxbaud = strtoul(optarg, NULL, 0);
+                break;
+            case 'l':
+                link = optarg;
+                break;
+            case 'i':
+                fifo = optarg;
+                break;
+            case 'N':
+                Nack = 1;
+                break;
+            case 'f':
+                Pace = 0;
+                break;
+            case 'v':
+                Verbose = 1;
+                break;
+            default:
+                printf("Usage: %s [-b baud] [-m maxbaud] [-l link] [-i fifo] [-N] [-f] [-v]\n",
+                       argv[0]);
+                exit(1);
+        }
+    }
+    if (Baud == 0) {
+        printf("Invalid baud rate\n");
+        exit(1);
+    }
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    // The pty in packet mode so the host's flush shows up
+    Mfd = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((Mfd < 0) || (grantpt(Mfd) < 0) || (unlockpt(Mfd) < 0) ||
+        (ioctl(Mfd, TIOCPKT, &one) < 0)) {
+        perror("pty");
+        exit(1);
+    }
+    pts = ptsname(Mfd);
+
+    // Keep the slave open so the master never sees a hangup, and make
+    // it raw at the starting rate until the host configures it
+    sfd = open(pts, O_RDWR | O_NOCTTY);
+    if ((sfd < 0) || (ioctl(sfd, TCGETS2, &t) < 0)) {
+        perror(pts);
+        exit(1);
+    }
+    t.c_iflag = 0;
+    t.c_oflag = 0;
+    t.c_lflag = 0;
+    t.c_cflag = CS8 | CREAD | CLOCAL | BOTHER;
+    t.c_ispeed = Baud;
+    t.c_ospeed = Baud;
+    t.c_cc[VMIN] = 1;
+    t.c_cc[VTIME] = 0;
+    (void) ioctl(sfd, TCSETS2, &t);
+    (void) fcntl(Mfd, F_SETFL, O_NONBLOCK);
+
+    (void) unlink(link);
+    if (symlink(pts, link) < 0)
+        perror(link);
+
+    // Opened read-write so the open does not wait for a reader
+    if ((mkfifo(fifo, 0666) < 0) && (errno != EEXIST))
+        perror(fifo);
+    Irfd = open(fifo, O_RDWR | O_NONBLOCK);
+    if (Irfd < 0)
+        perror(fifo);
+
+    printf("FPGA on %s (%s) at %u baud, io_intr on %s\n", link, pts, Baud, fifo);
+
+    pthread_create(&thr, NULL, sim_loop, NULL);
+    pthread_create(&thr, NULL, serial_loop, NULL);
+    console();
+
+    // stdin closed.  Keep running until killed.
+    for (;;)
+        pause();
+}
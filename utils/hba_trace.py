@@ -0,0 +1,140 @@
+#!/usr/bin/python3
+
+# Print a packet trace capture file written by serial_fpga.
+# Each record is shown with its time from the start of the capture and
+# from the record before it.  Responses show the time since their
+# packet was sent.  Gaps between records longer than gap_ms are marked.
+# A summary of the latency of each core and the longest gaps follows.
+#
+# The file layout is in common/include/hba_trace.h.
+
+import struct
+import sys
+
+HBA_TR_MAGIC = 0x54414248
+HBA_TR_VERSION = 1
+HDR_FMT = "<IHHIIQ"
+REC_FMT = "<QHBBBb50s"
+
+HBA_TR_TX = 1
+HBA_TR_RX = 2
+HBA_TR_FRAME = 3
+HBA_TR_BREAK = 4
+
+HBA_TR_CACHED = 0x01
+HBA_TR_UNSENT = 0x02
+HBA_TR_RAW = 0x04
+HBA_TR_NOCORE = 0xff
+
+ERRORS = { -1: "NOSEND", -2: "NORECV" }
+NGAPS = 5
+
+# check the number of arguments
+if len(sys.argv) < 2 or len(sys.argv) > 3:
+	print("Usage: hba_trace.py capture_file [gap_ms]")
+	sys.exit(1)
+
+gap_ns = 1000000
+if len(sys.argv) == 3:
+	gap_ns = int(float(sys.argv[2]) * 1000000)
+
+with open(sys.argv[1], mode="rb") as fp:
+	data = fp.read()
+
+hdrlen = struct.calcsize(HDR_FMT)
+if len(data) < hdrlen:
+	print("Not a trace capture file")
+	sys.exit(1)
+magic, version, recsize, nrec, baud, total = struct.unpack_from(HDR_FMT, data)
+if magic != HBA_TR_MAGIC or version != HBA_TR_VERSION or \
+   recsize != struct.calcsize(REC_FMT):
+	print("Not a version %d trace capture file" % HBA_TR_VERSION)
+	sys.exit(1)
+nrec = min(nrec, (len(data) - hdrlen) // recsize)
+
+print("%d records of %d at %d baud" % (nrec, total, baud))
+if total > nrec:
+	print("(%d older records were overwritten)" % (total - nrec))
+
+
+def hexbytes(buf, n):
+	text = " ".join("%02x" % b for b in buf[:min(n, len(buf))])
+	if n > len(buf):
+		text += " ..."
+	return text
+
+
+def corename(core):
+	if core == HBA_TR_NOCORE:
+		return "  "
+	return "%2d" % core
+
+
+pending = []        # send times of packets waiting for a response
+lat = {}            # core -> list of response times in ns
+gaps = []           # (gap in ns, time of the record after the gap)
+nerr = 0
+nbreak = 0
+nframe = 0
+ncached = 0
+t0 = None
+tprev = None
+
+for i in range(nrec):
+	ts, rlen, rtype, core, flags, err, buf = \
+		struct.unpack_from(REC_FMT, data, hdrlen + (i * recsize))
+	if t0 is None:
+		t0 = ts
+		tprev = ts
+	dt = ts - tprev
+	if i > 0 and dt > gap_ns:
+		print("---- gap of %.3f ms ----" % (dt / 1e6))
+		gaps.append((dt, ts - t0))
+	line = "%12.6f +%9.6f " % ((ts - t0) / 1e9, dt / 1e9)
+	tprev = ts
+
+	if rtype == HBA_TR_TX:
+		if flags & HBA_TR_RAW:
+			line += "RAW   %s  %s" % (corename(core), hexbytes(buf, rlen))
+		else:
+			pending.append(ts)
+			line += "TX    %s  %s" % (corename(core), hexbytes(buf, rlen))
+	elif rtype == HBA_TR_RX:
+		tsent = None
+		if (flags & (HBA_TR_CACHED | HBA_TR_UNSENT)) == 0 and pending:
+			tsent = pending.pop(0)
+		if err != 0:
+			nerr += 1
+			line += "ERR   %s  %s" % (corename(core), ERRORS.get(err, str(err)))
+		elif flags & HBA_TR_CACHED:
+			ncached += 1
+			line += "SHDW  %s  %s" % (corename(core), hexbytes(buf, rlen))
+		else:
+			line += "RX    %s  %s" % (corename(core), hexbytes(buf, rlen))
+		if tsent is not None:
+			line += "   (%.3f ms)" % ((ts - tsent) / 1e6)
+			if err == 0:
+				lat.setdefault(core, []).append(ts - tsent)
+	elif rtype == HBA_TR_FRAME:
+		nframe += 1
+		line += "FRAME     %s" % hexbytes(buf, rlen)
+	elif rtype == HBA_TR_BREAK:
+		nbreak += 1
+		pending = []
+		line += "BREAK"
+	else:
+		line += "type %d?" % rtype
+	print(line)
+
+print("")
+print("core  count   min ms   avg ms   max ms")
+for core in sorted(lat):
+	l = lat[core]
+	print("%4d %6d %8.3f %8.3f %8.3f" % (core, len(l), min(l) / 1e6,
+	      (sum(l) / len(l)) / 1e6, max(l) / 1e6))
+print("errors %d  breaks %d  frames %d  from shadow %d" %
+      (nerr, nbreak, nframe, ncached))
+if gaps:
+	print("longest gaps:")
+	for dt, t in sorted(gaps, reverse=True)[:NGAPS]:
+		print("  %.3f ms before %.6f" % (dt / 1e6, t / 1e9))